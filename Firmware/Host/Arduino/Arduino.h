@@ -0,0 +1,268 @@
+/****************************************************************************
+
+  Header file for the host Arduino core
+  The parts of the Teensy 3.2 core the sketches use, to build them on a PC
+
+  Every call runs on the current host::Device (see HostBoard.h) and
+  takes the CPU time the Teensy call takes, so millis(), micros() and
+  the cycle counter follow the virtual clock of that device. Code
+  between core calls takes no time.
+  All the state lives in HostBoard.cpp, not in this header: the
+  sketches are linked several times under their own symbol prefixes
+  and must all share one core.
+
+ ****************************************************************************/
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <type_traits>
+
+#define F_CPU           96000000
+#define TEENSYDUINO     144
+
+typedef uint8_t  byte;
+typedef bool     boolean;
+typedef uint16_t word;
+
+#define HIGH            1
+#define LOW             0
+#define INPUT           0
+#define OUTPUT          1
+#define INPUT_PULLUP    2
+#define INPUT_PULLDOWN  3
+#define FALLING         2
+#define RISING          3
+#define CHANGE          4
+
+#define DEC             10
+#define HEX             16
+#define OCT             8
+#define BIN             2
+
+// Teensy 3.2 pin numbers, 0-33 are digital with interrupts
+#define NUM_DIGITAL_PINS  34
+#define HOST_NUM_PINS     41
+#define LED_BUILTIN       13
+#define A0   14
+#define A1   15
+#define A2   16
+#define A3   17
+#define A4   18
+#define A5   19
+#define A6   20
+#define A7   21
+#define A8   22
+#define A9   23
+#define A10  34
+#define A11  35
+#define A12  36
+#define A13  37
+#define A14  40
+
+#define PROGMEM
+#define F(string)               (string)
+#define pgm_read_byte(addr)     (*(const uint8_t *)(addr))
+#define pgm_read_word(addr)     (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr)    (*(const uint32_t *)(addr))
+
+#define constrain(amt, low, high) \
+  ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define radians(deg)            ((deg) * 0.017453292519943295)
+#define degrees(rad)            ((rad) * 57.29577951308232)
+#define sq(x)                   ((x) * (x))
+#define bitRead(value, bit)     (((value) >> (bit)) & 0x01)
+#define bit(b)                  (1UL << (b))
+
+template <class A, class B>
+inline typename std::common_type<A, B>::type min( A a, B b ) { return (b < a) ? b : a; }
+template <class A, class B>
+inline typename std::common_type<A, B>::type max( A a, B b ) { return (a < b) ? b : a; }
+
+/*------------------------------- Time ------------------------------------*/
+uint32_t millis( void );
+uint32_t micros( void );
+void delay( uint32_t ms );
+void delayMicroseconds( uint32_t us );
+void yield( void );
+
+/*------------------------------- Pins ------------------------------------*/
+void pinMode( uint8_t pin, uint8_t mode );
+void digitalWrite( uint8_t pin, uint8_t value );
+int digitalRead( uint8_t pin );
+int analogRead( uint8_t pin );
+void analogWrite( uint8_t pin, int value );
+void analogWriteResolution( uint32_t bits );
+void analogReadResolution( unsigned int bits );
+
+/*---------------------------- Interrupts ---------------------------------*/
+#define digitalPinToInterrupt(pin)  (pin)
+void attachInterrupt( uint8_t pin, void (*function)(void), int mode );
+void detachInterrupt( uint8_t pin );
+void noInterrupts( void );
+void interrupts( void );
+#define __disable_irq()         noInterrupts()
+#define __enable_irq()          interrupts()
+
+// Cycle counter, runs at F_CPU on the device's clock
+namespace host { uint32_t CycleCount( void ); }
+extern volatile uint32_t ARM_DEMCR;
+extern volatile uint32_t ARM_DWT_CTRL;
+#define ARM_DEMCR_TRCENA        (1 << 24)
+#define ARM_DWT_CTRL_CYCCNTENA  (1 << 0)
+#define ARM_DWT_CYCCNT          (host::CycleCount())
+
+// Direct pin reads for the Encoder library (utility/direct_pin_read.h):
+// the "register" is the pin level of the current device
+#define direct_pin_read_h_
+namespace host { volatile uint8_t *PinRegister( uint8_t pin ); }
+#define IO_REG_TYPE                 uint8_t
+#define PIN_TO_BASEREG(pin)         (host::PinRegister(pin))
+#define PIN_TO_BITMASK(pin)         (1)
+#define DIRECT_PIN_READ(base, mask) (((*(base)) & (mask)) ? 1 : 0)
+#define CORE_NUM_INTERRUPT  NUM_DIGITAL_PINS
+#define CORE_INT0_PIN   0
+#define CORE_INT1_PIN   1
+#define CORE_INT2_PIN   2
+#define CORE_INT3_PIN   3
+#define CORE_INT4_PIN   4
+#define CORE_INT5_PIN   5
+#define CORE_INT6_PIN   6
+#define CORE_INT7_PIN   7
+#define CORE_INT8_PIN   8
+#define CORE_INT9_PIN   9
+#define CORE_INT10_PIN  10
+#define CORE_INT11_PIN  11
+#define CORE_INT12_PIN  12
+#define CORE_INT13_PIN  13
+#define CORE_INT14_PIN  14
+#define CORE_INT15_PIN  15
+#define CORE_INT16_PIN  16
+#define CORE_INT17_PIN  17
+#define CORE_INT18_PIN  18
+#define CORE_INT19_PIN  19
+#define CORE_INT20_PIN  20
+#define CORE_INT21_PIN  21
+#define CORE_INT22_PIN  22
+#define CORE_INT23_PIN  23
+#define CORE_INT24_PIN  24
+#define CORE_INT25_PIN  25
+#define CORE_INT26_PIN  26
+#define CORE_INT27_PIN  27
+#define CORE_INT28_PIN  28
+#define CORE_INT29_PIN  29
+#define CORE_INT30_PIN  30
+#define CORE_INT31_PIN  31
+#define CORE_INT32_PIN  32
+#define CORE_INT33_PIN  33
+
+/*------------------------------ Strings ----------------------------------*/
+class String
+{
+  public:
+    String( const char *s = "" ) : str(s) {}
+    String( const std::string &s ) : str(s) {}
+    explicit String( int value, unsigned char base = DEC );
+    const char *c_str( void ) const { return str.c_str(); }
+    unsigned int length( void ) const { return str.length(); }
+    String &operator+=( const String &s ) { str += s.str; return *this; }
+    String &operator+=( const char *s ) { str += s; return *this; }
+    String &operator+=( char c ) { str += c; return *this; }
+    bool operator==( const String &s ) const { return str == s.str; }
+    bool operator==( const char *s ) const { return str == s; }
+    char operator[]( unsigned int i ) const { return str[i]; }
+    int toInt( void ) const { return atoi( str.c_str() ); }
+
+  private:
+    std::string str;
+};
+
+inline String operator+( String a, const String &b ) { a += b; return a; }
+
+/*------------------------------- Serial ----------------------------------*/
+class Print
+{
+  public:
+    virtual ~Print();
+    virtual size_t write( uint8_t b ) = 0;
+    virtual size_t write( const uint8_t *buffer, size_t size );
+    size_t write( const char *s ) { return write( (const uint8_t *)s, strlen(s) ); }
+    size_t write( const char *buffer, size_t size ) { return write( (const uint8_t *)buffer, size ); }
+
+    size_t print( const char *s ) { return write( s ); }
+    size_t print( const String &s ) { return write( s.c_str() ); }
+    size_t print( char c ) { return write( (uint8_t)c ); }
+    size_t print( unsigned char n, int base = DEC ) { return printNumber( n, base ); }
+    size_t print( int n, int base = DEC ) { return printSigned( n, base ); }
+    size_t print( unsigned int n, int base = DEC ) { return printNumber( n, base ); }
+    size_t print( long n, int base = DEC ) { return printSigned( n, base ); }
+    size_t print( unsigned long n, int base = DEC ) { return printNumber( n, base ); }
+    size_t print( double n, int digits = 2 );
+
+    size_t println( void ) { return write( "\r\n" ); }
+    template <class T>
+    size_t println( const T &value ) { return print( value ) + println(); }
+    template <class T>
+    size_t println( const T &value, int format ) { return print( value, format ) + println(); }
+
+    int printf( const char *format, ... );
+
+  private:
+    size_t printSigned( long n, int base );
+    size_t printNumber( unsigned long n, int base );
+};
+
+class Stream : public Print
+{
+  public:
+    Stream() : timeout(1000) {}
+    virtual int available( void ) = 0;
+    virtual int read( void ) = 0;
+    virtual int peek( void ) = 0;
+    void setTimeout( unsigned long ms ) { timeout = ms; }
+    size_t readBytes( char *buffer, size_t length );
+    size_t readBytes( uint8_t *buffer, size_t length ) { return readBytes( (char *)buffer, length ); }
+
+  private:
+    unsigned long timeout;  // [ms]
+};
+
+// The USB serial (port 0, Serial) and the UARTs (Serial1-3) of the
+// current device
+class HardwareSerial : public Stream
+{
+  public:
+    explicit HardwareSerial( int port ) : port(port) {}
+    void begin( uint32_t baud, uint32_t format = 0 );
+    void end( void );
+    int available( void );
+    int read( void );
+    int peek( void );
+    void flush( void );
+    void clear( void );
+    size_t write( uint8_t b );
+    size_t write( const uint8_t *buffer, size_t size );
+    using Print::write;
+    int availableForWrite( void );
+    void addMemoryForWrite( void *buffer, size_t length );
+    void addMemoryForRead( void *buffer, size_t length );
+    void transmitterEnable( uint8_t pin );
+    operator bool() { return true; }
+
+  private:
+    int port;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
+extern HardwareSerial Serial3;
+
+#endif
@@ -0,0 +1,27 @@
+/****************************************************************************
+
+  Header file for the host EEPROM
+  The 2 KB EEPROM of the current host::Device, blank (0xFF) except
+  byte 0, the ID the device was created with
+
+ ****************************************************************************/
+
+#ifndef HOST_EEPROM_H
+#define HOST_EEPROM_H
+
+#include "Arduino.h"
+
+#define E2END 0x7FF   // last EEPROM address
+
+class EEPROMClass
+{
+  public:
+    uint8_t read( int address );
+    void write( int address, uint8_t value );
+    void update( int address, uint8_t value ) { write( address, value ); }
+    uint16_t length( void ) { return E2END + 1; }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
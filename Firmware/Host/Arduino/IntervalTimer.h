@@ -0,0 +1,31 @@
+/****************************************************************************
+
+  Header file for the host IntervalTimer
+  Periodic interrupt of the current host::Device, on its virtual clock.
+  Like the 4 PIT timers of the Teensy 3.2, begin() fails once 4 run.
+
+ ****************************************************************************/
+
+#ifndef HOST_INTERVAL_TIMER_H
+#define HOST_INTERVAL_TIMER_H
+
+#include "Arduino.h"
+
+class IntervalTimer
+{
+  public:
+    IntervalTimer() : timer(-1) {}
+    bool begin( void (*function)(void), unsigned long microseconds );
+    bool begin( void (*function)(void), int microseconds ) {
+      return begin( function, (unsigned long)microseconds );
+    }
+    bool begin( void (*function)(void), float microseconds );
+    void update( unsigned long microseconds );
+    void end( void );
+    void priority( uint8_t n ) { (void)n; }
+
+  private:
+    int timer;    // timer of the device, -1 while stopped
+};
+
+#endif
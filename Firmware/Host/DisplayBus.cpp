@@ -0,0 +1,316 @@
+/****************************************************************************
+ Module
+   DisplayBus.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   The master and its slaves on virtual RS485 lines, see DisplayBus.h
+
+ Notes
+   The bus of a slave is worked out as the master's
+   SetDisplayGeometry() does for the default 12x24 display with the
+   rows split evenly.
+****************************************************************************/
+
+#include <algorithm>
+#include <math.h>
+#include <string>
+#include "DisplayBus.h"
+#include "ShapeConstants.h"
+#include "RS485_protocol.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define POLL_PERIOD     (10 * host::MS)     // how often Boot() looks
+#define MASTER_DONE     "Initialized shape display Master"
+#define SLAVE_DONE      "------"            // end of the banner the slave's setup() prints
+#define DATA_CMD        127                 // Unity's position frame, Master-Unity.ino
+#define STATUS_CMD      123                 // Unity's status request
+#define STATUS_REPLY_TIME (5 * host::MS)    // the cmd on USB and the table back
+#define DISPLAY_ROWS    12
+#define SLAVES_PER_ROW  4
+#define LINK_SWITCH     (5 * host::MS)      // time the slaves get to take SET_BAUD
+
+DisplayBusParams DefaultDisplayBus( void ) {
+  DisplayBusParams params;
+  params.slaves = 48;
+  params.linkRate = 0;
+  params.bitErrorRate = 0;
+  params.plants = false;
+  // the config globals are constants until a master boots
+  Master( hostMasterImage ).getConfig( &params.config );
+  return params;
+}
+
+DisplayBus::DisplayBus( const DisplayBusParams &p )
+  : params(p), master(hostMasterImage, 0), hooks(Master(hostMasterImage)), unitySeq(0)
+{
+  params.config.rs485Buses = std::max( 1, std::min( 3, params.config.rs485Buses ) );
+  params.slaves = std::min( params.slaves, hostNumSlaveImages );
+  applied.resize( params.slaves );
+  lastTarget.resize( params.slaves, 0 );
+  nextFrame.resize( params.slaves, 0 );
+  master.keepTx = true;
+  master.onBoot = [this]( host::Device & ) {
+    hooks.setConfig( &params.config );
+  };
+  for ( int b = 0; b < 3; b++ ) {
+    lines[b] = new host::Line( b + 1 );
+    lines[b]->bitErrorRate = params.bitErrorRate;
+    master.Connect( b + 1, *lines[b], false );
+  }
+
+  for ( int i = 0; i < params.slaves; i++ ) {
+    host::Device *device;
+    if ( params.plants ) {
+      boards.push_back( new SlaveBoard( hostSlaveImages[i], i, 0, DefaultPinPlant() ) );
+      device = &boards.back()->device;
+    } else {
+      device = new host::Device( hostSlaveImages[i], i );
+    }
+    // the slaves' receivers are always on
+    device->Connect( 1, *lines[Bus(i)], true );
+    device->keepTx = true;
+    device->onTimer = [this, i]( host::Device &d, int ) {
+      Record( i, d.Now() );
+    };
+    slaves.push_back( device );
+  }
+}
+
+DisplayBus::~DisplayBus() {
+  if ( boards.empty() ) {
+    for ( size_t i = 0; i < slaves.size(); i++ ) {
+      delete slaves[i];
+    }
+  }
+  for ( size_t i = 0; i < boards.size(); i++ ) {
+    delete boards[i];
+  }
+  for ( int b = 0; b < 3; b++ ) {
+    delete lines[b];
+  }
+}
+
+bool DisplayBus::Boot( host::Time timeout ) {
+  host::Time end = host::Now() + timeout;
+  for ( ;; ) {
+    bool done = master.UsbOutput().find( MASTER_DONE ) != std::string::npos;
+    for ( size_t i = 0; i < slaves.size(); i++ ) {
+      done = done && slaves[i]->UsbOutput().find( SLAVE_DONE ) != std::string::npos;
+    }
+    if ( done ) {
+      break;
+    }
+    if ( host::Now() >= end ) {
+      return false;
+    }
+    host::RunUntil( host::Now() + POLL_PERIOD );
+  }
+  if ( params.linkRate != 0 ) {
+    SetLinkRate( params.linkRate );
+  }
+  return true;
+}
+
+void DisplayBus::SetLinkRate( int rate ) {
+  {
+    host::Device::Probe probe( master );
+    hooks.setLinkRate( rate );
+  }
+  params.linkRate = rate;
+  host::RunUntil( host::Now() + LINK_SWITCH );
+}
+
+int DisplayBus::SendFrame( uint8_t height ) {
+  host::Time now = host::Now();
+  std::vector<uint8_t> frame( 1 + DISPLAY_ROWS * SLAVES_PER_ROW * NUM_MOTORS, height );
+  frame[0] = DATA_CMD;
+  SendUnity( frame, now );
+  sent.push_back( now );
+  heights.push_back( height );
+  for ( size_t i = 0; i < applied.size(); i++ ) {
+    applied[i].push_back( 0 );
+  }
+  return sent.size() - 1;
+}
+
+/****************************************************************************
+ Function
+    RequestStatus
+
+ Parameters
+  None
+
+ Returns
+    The longest sweep of a bus [ns], 0 if no slave replied
+
+ Description
+    Unity's StatusCMD: the master asks the slaves of each bus in turn
+    (GET_STATUS), they reply in their STATUS_SLOT_US slots. Sent
+    between frames, the GET_STATUS bytes count towards the frame 
+    before.
+****************************************************************************/
+host::Time DisplayBus::RequestStatus( void ) {
+  host::Time now = host::Now();
+  SendUnity( std::vector<uint8_t>( 1, STATUS_CMD ), now );
+  int buses = params.config.rs485Buses;
+  host::RunUntil( now + STATUS_REPLY_TIME
+                  + ( params.slaves + buses ) * STATUS_SLOT_US * host::US );
+
+  host::Time longest = 0;
+  for ( int b = 0; b < buses; b++ ) {
+    // the replies on the bus, then the request before them
+    host::Time first = 0, last = 0;
+    for ( int i = 0; i < params.slaves; i++ ) {
+      const std::vector<host::SerialByte> &log = slaves[i]->TxLog( 1 );
+      for ( size_t k = 0; k < log.size(); k++ ) {
+        if ( Bus( i ) == b && log[k].end > now ) {
+          host::Time start = log[k].end - ByteTime();
+          first = ( first == 0 ) ? start : std::min( first, start );
+          last = std::max( last, log[k].end );
+        }
+      }
+    }
+    host::Time request = 0;
+    const std::vector<host::SerialByte> &log = master.TxLog( b + 1 );
+    for ( size_t k = 0; k < log.size(); k++ ) {
+      if ( log[k].end > now && log[k].end <= first ) {
+        request = log[k].end;
+      }
+    }
+    if ( last ) {
+      longest = std::max( longest, last - request );
+    }
+  }
+  return longest;
+}
+
+void DisplayBus::SlaveStatus( int slave, uint8_t *reply ) {
+  host::Device::Probe probe( master );
+  hooks.slaveStatus( slave, reply );
+}
+
+host::Time DisplayBus::Sent( int frame ) const {
+  return sent[frame];
+}
+
+unsigned long DisplayBus::BusBytes( int frame ) const {
+  unsigned long count = 0;
+  for ( int b = 0; b < params.config.rs485Buses; b++ ) {
+    host::Time first, last;
+    count += Window( frame, b, &first, &last );
+  }
+  return count;
+}
+
+host::Time DisplayBus::BusTime( int frame ) const {
+  host::Time longest = 0;
+  for ( int b = 0; b < params.config.rs485Buses; b++ ) {
+    host::Time first, last;
+    if ( Window( frame, b, &first, &last ) ) {
+      longest = std::max( longest, last - first );
+    }
+  }
+  return longest;
+}
+
+host::Time DisplayBus::BusEnd( int frame ) const {
+  host::Time end = 0;
+  for ( int b = 0; b < params.config.rs485Buses; b++ ) {
+    host::Time first, last;
+    if ( Window( frame, b, &first, &last ) ) {
+      end = std::max( end, last );
+    }
+  }
+  return end;
+}
+
+host::Time DisplayBus::Applied( int slave, int frame ) const {
+  return applied[slave][frame];
+}
+
+host::Time DisplayBus::ByteTime( void ) const {
+  // 10 bits at LINK_BAUD(rate), 1, 2 or 3 Mbaud
+  return 10 * host::SEC / ( 1000000ULL * ( params.linkRate + 1 ) );
+}
+
+int DisplayBus::Bus( int slave ) const {
+  int buses = params.config.rs485Buses;
+  return std::min( ( slave / SLAVES_PER_ROW ) / ( DISPLAY_ROWS / buses ), buses - 1 );
+}
+
+unsigned int DisplayBus::RxErrors( int slave ) {
+  host::Device::Probe probe( *slaves[slave] );
+  return Slave( hostSlaveImages[slave] ).rxErrors();
+}
+
+unsigned long DisplayBus::RxOverflows( int slave ) const {
+  return slaves[slave]->ports[1].rxOverflow;
+}
+
+MasterStats DisplayBus::Stats( void ) {
+  MasterStats stats;
+  host::Device::Probe probe( master );
+  hooks.stats( &stats );
+  return stats;
+}
+
+/****************************************************************************
+
+  Private Functions
+
+****************************************************************************/
+
+// A msg from Unity to the master at time at: as it is, or if the
+// config has framedUnityLink, [SEQ] [msg] COBS framed with a CRC.
+// Every msg takes a sequence number, framed or not.
+void DisplayBus::SendUnity( std::vector<uint8_t> msg, host::Time at ) {
+  uint8_t seq = unitySeq++;
+  if ( params.config.framedUnityLink ) {
+    msg.insert( msg.begin(), seq );
+    std::vector<uint8_t> encoded( RS485_ENCODED_SIZE(msg.size()) );
+    encoded.resize( encodeMsg( &msg[0], msg.size(), &encoded[0], encoded.size() ) );
+    msg.swap( encoded );
+  }
+  master.UsbSend( &msg[0], msg.size(), at );
+}
+
+// The master's bytes on a bus that ended after the frame was sent and
+// before the next one: how many, first start and last stop bit
+unsigned long DisplayBus::Window( int frame, int b, host::Time *first, host::Time *last ) const {
+  host::Time from = sent[frame];
+  host::Time to = ( frame + 1 < (int)sent.size() ) ? sent[frame + 1] : host::Now();
+  const std::vector<host::SerialByte> &log = master.TxLog( b + 1 );
+  unsigned long count = 0;
+  for ( size_t i = 0; i < log.size(); i++ ) {
+    if ( log[i].end > from && log[i].end <= to ) {
+      if ( count == 0 ) {
+        *first = log[i].end - ByteTime();
+      }
+      *last = log[i].end;
+      count++;
+    }
+  }
+  return count;
+}
+
+// On the slave's control step: a new pin 0 target is the first frame
+// with its height the slave hasn't had yet. Frames arrive in order,
+// some may never come.
+void DisplayBus::Record( int slave, host::Time now ) {
+  int target = Slave( hostSlaveImages[slave] ).target( 0 );
+  if ( target == lastTarget[slave] ) {
+    return;
+  }
+  lastTarget[slave] = target;
+  int height = lroundf( target * PULSE_TO_MM );
+  for ( int f = nextFrame[slave]; f < (int)sent.size(); f++ ) {
+    if ( heights[f] == height ) {
+      applied[slave][f] = now;
+      nextFrame[slave] = f + 1;
+      return;
+    }
+  }
+}
@@ -0,0 +1,87 @@
+/****************************************************************************
+
+  Header file for DisplayBus
+  The master and its slaves on virtual RS485 lines, for the bus tests
+  and simulations
+
+  Unity's frames go to the master over USB (DataCMD, every pin at one
+  height), framed and numbered if the config has framedUnityLink. A
+  frame is applied on a slave at the control step its pin 0 takes the
+  frame's height as target, so consecutive frames need different
+  heights. Slaves are on the buses the master's default geometry puts
+  them on.
+
+ ****************************************************************************/
+
+#ifndef DISPLAY_BUS_H
+#define DISPLAY_BUS_H
+
+#include <vector>
+#include "HostBoard.h"
+#include "HostSketches.h"
+#include "SlaveBoard.h"
+
+struct DisplayBusParams {
+  int slaves;                 // slave IDs 0 ... slaves-1, at most hostNumSlaveImages
+  int linkRate;               // LINK_BAUD(linkRate) once booted
+  double bitErrorRate;        // on every line
+  bool plants;                // PinPlants on the slave pins, else nothing moves
+  MasterConfig config;        // rs485Buses lines are used
+};
+
+// The master's defaults, 48 slaves, no noise, no plants
+DisplayBusParams DefaultDisplayBus( void );
+
+class DisplayBus
+{
+  public:
+    explicit DisplayBus( const DisplayBusParams &params );
+    ~DisplayBus();
+
+    bool Boot( host::Time timeout );    // run until every setup() is done
+    // SET_BAUD to the slaves now, and run until they have followed
+    void SetLinkRate( int rate );
+
+    // Send a DataCMD with every pin at height [mm] now, returns its number
+    int SendFrame( uint8_t height );
+    // Send a StatusCMD now and run until the master has swept the
+    // slaves: the longest sweep of a bus, from the end of GET_STATUS to
+    // the last reply's stop bit [ns], 0 if no slave replied
+    host::Time RequestStatus( void );
+    void SlaveStatus( int slave, uint8_t *reply );  // its PIN_STATUS msg from the sweep
+
+    // Results of frame f, once the devices have run past it
+    host::Time Sent( int frame ) const;
+    unsigned long BusBytes( int frame ) const;  // master's bytes up to the next frame, all buses
+    host::Time BusTime( int frame ) const;      // first start bit to last stop bit, busiest bus
+    host::Time BusEnd( int frame ) const;       // last stop bit, 0 if nothing was sent
+    host::Time Applied( int slave, int frame ) const;  // when, 0 if never
+
+    host::Time ByteTime( void ) const;  // at the current link rate [ns]
+    int Bus( int slave ) const;
+    unsigned int RxErrors( int slave );
+    unsigned long RxOverflows( int slave ) const;
+    MasterStats Stats( void );
+
+    DisplayBusParams params;
+    host::Device master;
+    const MasterHooks &hooks;
+    std::vector<host::Device *> slaves;
+    std::vector<SlaveBoard *> boards;   // with plants
+    host::Line *lines[3];
+
+  private:
+    void SendUnity( std::vector<uint8_t> msg, host::Time at );
+    unsigned long Window( int frame, int bus, host::Time *first, host::Time *last ) const;
+    void Record( int slave, host::Time now );
+
+    uint8_t unitySeq;                   // of the next msg to the master
+
+    std::vector<host::Time> sent;
+    std::vector<uint8_t> heights;
+    std::vector<std::vector<host::Time> > applied;
+    std::vector<int> lastTarget;
+    std::vector<int> nextFrame;         // of each slave, frames before it are done
+};
+
+#endif
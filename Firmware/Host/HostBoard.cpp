@@ -0,0 +1,1069 @@
+/****************************************************************************
+ Module
+   HostBoard.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   Virtual Teensy 3.2 boards: clocks, interrupts, serial ports and the
+   Arduino core calls of the headers in Arduino/
+
+ Notes
+   The COST_* times are what the calls take on the Teensy at 96 MHz,
+   measured or from the core's cycle counts. Sketch code between two
+   core calls takes no time, so loop rates come out as upper bounds.
+   A UART byte is 10 bits (8N1). The UART FIFOs are not modeled: a
+   byte leaves the TX buffer when it starts on the line.
+   The coroutines switch stacks with _longjmp, which the fortified
+   one refuses to do.
+****************************************************************************/
+
+#undef _FORTIFY_SOURCE
+#include "HostBoard.h"
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "IntervalTimer.h"
+
+#include <algorithm>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <ucontext.h>
+
+/*----------------------------- Module Defines ----------------------------*/
+#define STACK_SIZE          (256 * 1024)
+#define USB_OUTPUT_MAX      (1 << 20)   // keep the last MB a sketch printed
+#define LINE_TRIM           4096        // bytes every tap read before the log is trimmed
+
+// CPU time of the core calls [ns]
+#define COST_TIME           100     // millis(), micros()
+#define COST_DIGITAL        200     // digitalRead(), digitalWrite()
+#define COST_PIN_MODE       500
+#define COST_ANALOG_READ    10000   // one 10-bit conversion with averaging
+#define COST_ANALOG_WRITE   500
+#define COST_IRQ_ON         20      // interrupts(), pending ones run after it
+#define COST_TIMER_ISR      400     // PIT interrupt entry, dispatch and exit
+#define COST_PIN_ISR        800     // port interrupt, finding the pin and its function
+#define COST_SERIAL_CALL    200     // available(), read(), peek()
+#define COST_SERIAL_BYTE    150     // one byte into a TX buffer
+#define COST_SERIAL_RX      300     // UART interrupt share of one received byte
+#define COST_SERIAL_BEGIN   5000
+#define COST_USB_BYTE       50
+#define COST_EEPROM         100
+#define COST_LOOP           500     // main() between two loop() calls, yield()
+
+namespace host {
+
+// A device's coroutine. Only its start needs the ucontext calls; it
+// switches with _setjmp and _longjmp after that, which don't save the
+// signal mask (a system call each time).
+struct Fiber {
+  ucontext_t start;
+  jmp_buf jump;
+};
+
+/*---------------------------- Module Variables ---------------------------*/
+static std::vector<Device *> devices;
+static Device *current = 0;
+static jmp_buf worldJump;
+static Time worldTime = 0;
+static Time limit = 0;          // RunUntil() target
+static Time horizon = 0;        // clock of the device furthest behind, but the current one
+
+/*---------------------------- Module Functions ---------------------------*/
+static Device &Dev( void );
+static Time ByteTime( uint32_t baud );
+
+/****************************************************************************
+
+  Public Functions
+
+****************************************************************************/
+
+Model::~Model() {}
+
+/****************************************************************************
+ Function
+    Device
+
+ Parameters
+  image: the sketch to run, not shared with another device
+  id: value of EEPROM byte 0, the slave ID
+
+ Returns
+    None
+
+ Description
+    Constructor. The sketch starts (constructors, setup()) on the
+    first RunUntil().
+****************************************************************************/
+Device::Device( const SketchImage &image, uint8_t id )
+  : echoUsb(false), keepTx(false), probing(false), irqEnabled(true),
+    inIsr(false), pinsPending(0), usbHead(0), name(image.name), image(image), clock(0),
+    plantTime(0), context(0), stack(0), started(false)
+{
+  memset( pins, 0, sizeof pins );
+  memset( modes, INPUT, sizeof modes );
+  memset( driven, 0, sizeof driven );
+  memset( duty, 0, sizeof duty );
+  memset( analog, 0, sizeof analog );
+  memset( pinIsr, 0, sizeof pinIsr );
+  memset( pinIsrMode, 0, sizeof pinIsrMode );
+  memset( pinPending, 0, sizeof pinPending );
+  memset( timers, 0, sizeof timers );
+  for ( int p = 0; p < NUM_PORTS; p++ ) {
+    Port &port = ports[p];
+    port.begun = false;
+    port.baud = 0;
+    port.txSize = ( p == 1 ) ? 64 : 40;   // Serial1 has the bigger buffers
+    port.rxSize = 64;
+    port.txHead = 0;
+    port.txFreeAt = 0;
+    port.rxHead = 0;
+    port.rxOverflow = 0;
+    port.line = 0;
+    port.tap = -1;
+  }
+  memset( eeprom, 0xFF, sizeof eeprom );
+  eeprom[0] = id;
+  devices.push_back( this );
+}
+
+Device::~Device() {
+  devices.erase( std::find( devices.begin(), devices.end(), this ) );
+  delete (Fiber *)context;
+  delete[] stack;
+}
+
+void Device::Attach( Model *model ) {
+  models.push_back( model );
+}
+
+/****************************************************************************
+ Function
+    Drive
+
+ Parameters
+  pin: input pin
+  level: HIGH or LOW
+  at: when the level changes [ns], not before the step the model is in
+
+ Returns
+    None
+
+ Description
+    Changes an input at a given time within a model step. A change
+    fires the pin's interrupt, if attached, at that time.
+****************************************************************************/
+void Device::Drive( int pin, int level, Time at ) {
+  driven[pin] = true;
+  PinEvent e = { std::max( at, clock ), pin, level ? HIGH : LOW };
+  events.push_back( e );
+  std::push_heap( events.begin(), events.end(), std::greater<PinEvent>() );
+}
+
+void Device::SetAnalog( int pin, int value ) {
+  analog[pin] = value;
+}
+
+int Device::Level( int pin ) const {
+  return pins[pin];
+}
+
+int Device::Duty( int pin ) const {
+  return duty[pin];
+}
+
+void Device::UsbSend( const void *data, size_t length, Time at ) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  for ( size_t i = 0; i < length; i++ ) {
+    usbRx.push_back( std::make_pair( at, bytes[i] ) );
+  }
+}
+
+const std::vector<SerialByte> &Device::TxLog( int port ) const {
+  return ports[port].txLog;
+}
+
+void Device::Connect( int port, Line &line, bool echo ) {
+  ports[port].line = &line;
+  ports[port].tap = line.Connect( this, echo );
+}
+
+Device::Probe::Probe( Device &device )
+  : previous(current), wasProbing(device.probing) {
+  current = &device;
+  device.probing = true;
+}
+
+Device::Probe::~Probe() {
+  current->probing = wasProbing;
+  current = previous;
+}
+
+/****************************************************************************
+ Function
+    Spend
+
+ Parameters
+  ns: CPU time the current code takes
+
+ Returns
+    None
+
+ Description
+    Moves the clock on by ns. Interrupts that come meanwhile run
+    and make it take longer, unless they are off.
+****************************************************************************/
+void Device::Spend( Time ns ) {
+  if ( probing ) {
+    return;
+  }
+  RunTo( clock + ns );
+}
+
+/****************************************************************************
+ Function
+    Sync
+
+ Parameters
+    None
+
+ Returns
+    None
+
+ Description
+    Called before the sketch looks at something another device may
+    send. Waits until every other device got as far as this one, so
+    nothing can still arrive before now.
+****************************************************************************/
+void Device::Sync( void ) {
+  if ( probing ) {
+    return;
+  }
+  while ( clock > horizon ) {
+    ToWorld();
+  }
+}
+
+/****************************************************************************
+ Function
+    Write
+
+ Parameters
+  port: 1-3 for Serial1-3
+  value: byte to send
+
+ Returns
+    None
+
+ Description
+    Queues a byte in the TX buffer, waiting while it is full. The byte
+    goes on the line once the ones before it are out.
+****************************************************************************/
+void Device::Write( int p, uint8_t value ) {
+  Port &port = ports[p];
+  if ( !port.begun ) {
+    return;
+  }
+  Spend( COST_SERIAL_BYTE );
+  while ( port.txHead < port.txStart.size() && port.txStart[port.txHead] <= clock ) {
+    port.txHead++;
+  }
+  if ( port.txStart.size() - port.txHead >= port.txSize ) {
+    // full, wait for the oldest byte to start
+    Spend( port.txStart[port.txHead] - clock );
+    port.txHead++;
+  }
+  if ( port.txHead > 4096 ) {
+    port.txStart.erase( port.txStart.begin(), port.txStart.begin() + port.txHead );
+    port.txHead = 0;
+  }
+  Time start = std::max( clock, port.txFreeAt );
+  port.txFreeAt = start + ByteTime( port.baud );
+  port.txStart.push_back( start );
+  if ( keepTx ) {
+    SerialByte b = { port.txFreeAt, value };
+    port.txLog.push_back( b );
+  }
+  if ( port.line ) {
+    port.line->Send( this, start, port.txFreeAt, port.baud, value );
+  }
+}
+
+/****************************************************************************
+ Function
+    Receive
+
+ Parameters
+  port: 1-3 for Serial1-3
+
+ Returns
+    None
+
+ Description
+    Moves the bytes that came on the port's line by now into its rx
+    buffer, or loses them if it is full. The UART interrupts they took
+    are spent after, so nothing is taken past the time Sync() made
+    safe. Probes don't Sync(), so they take nothing.
+****************************************************************************/
+void Device::Receive( int p ) {
+  Port &port = ports[p];
+  if ( !port.line || !port.begun || probing ) {
+    return;
+  }
+  uint8_t value;
+  unsigned int count = 0;
+  while ( port.line->Receive( port.tap, clock, port.baud, &value ) ) {
+    if ( port.rx.size() - port.rxHead < port.rxSize ) {
+      port.rx.push_back( value );
+    } else {
+      port.rxOverflow++;
+    }
+    count++;
+  }
+  Spend( count * COST_SERIAL_RX );
+}
+
+/****************************************************************************
+
+  Private Functions
+
+****************************************************************************/
+
+// Coroutine of the device: the static constructors of its sketch,
+// setup() and loop() forever
+void Device::Entry( unsigned int lo, unsigned int hi ) {
+  Device *device = (Device *)( ((uintptr_t)hi << 32) | lo );
+  device->Run();
+}
+
+void Device::Run( void ) {
+  for ( void (* const *init)( void ) = image.initBegin; init < image.initEnd; init++ ) {
+    (*init)();
+  }
+  if ( onBoot ) {
+    Probe probe( *this );
+    onBoot( *this );
+  }
+  image.hooks->setup();
+  for ( ;; ) {
+    image.hooks->loop();
+    Spend( COST_LOOP );
+  }
+}
+
+/****************************************************************************
+ Function
+    RunTo
+
+ Parameters
+  target: time the current code is done [ns], without interrupts
+
+ Returns
+    None
+
+ Description
+    Steps the models, applies their pin changes and runs the
+    interrupts in time order until the clock gets to target plus the
+    time the interrupts took. Yields to the other devices once past
+    the RunUntil() time.
+****************************************************************************/
+void Device::RunTo( Time target ) {
+  for ( ;; ) {
+    if ( !models.empty() && plantTime <= clock ) {
+      for ( size_t i = 0; i < models.size(); i++ ) {
+        models[i]->Step( *this, plantTime, PLANT_STEP );
+      }
+      plantTime += PLANT_STEP;
+      continue;
+    }
+    if ( !events.empty() && events.front().at <= clock ) {
+      PinEvent e = events.front();
+      std::pop_heap( events.begin(), events.end(), std::greater<PinEvent>() );
+      events.pop_back();
+      SetLevel( e.pin, e.level );
+      continue;
+    }
+    if ( irqEnabled && !inIsr ) {
+      Time before = clock;
+      if ( DispatchInterrupt() ) {
+        target += clock - before;
+        continue;
+      }
+    }
+    if ( clock >= target ) {
+      return;
+    }
+
+    Time next = target;
+    if ( !models.empty() ) {
+      next = std::min( next, plantTime );
+    }
+    if ( !events.empty() ) {
+      next = std::min( next, events.front().at );
+    }
+    if ( irqEnabled && !inIsr ) {
+      for ( int t = 0; t < NUM_TIMERS; t++ ) {
+        if ( timers[t].running ) {
+          next = std::min( next, timers[t].due );
+        }
+      }
+    }
+    clock = next;
+    Checkpoint();
+  }
+}
+
+void Device::SetLevel( int pin, int level ) {
+  if ( pins[pin] == level ) {
+    return;
+  }
+  pins[pin] = level;
+  int mode = pinIsrMode[pin];
+  if ( pinIsr[pin] && ( mode == CHANGE || (mode == RISING && level)
+                        || (mode == FALLING && !level) ) && !pinPending[pin] ) {
+    pinPending[pin] = true;
+    pinsPending++;
+  }
+}
+
+// Run the first pending interrupt, timers before pins like their
+// IRQ numbers. Returns false if none is pending.
+bool Device::DispatchInterrupt( void ) {
+  for ( int t = 0; t < NUM_TIMERS; t++ ) {
+    Timer &timer = timers[t];
+    if ( timer.running && timer.due <= clock ) {
+      // one pending flag, however late we are
+      do {
+        timer.due += timer.period;
+      } while ( timer.due <= clock );
+      inIsr = true;
+      Spend( COST_TIMER_ISR );
+      timer.function();
+      if ( onTimer ) {
+        probing = true;
+        onTimer( *this, t );
+        probing = false;
+      }
+      inIsr = false;
+      return true;
+    }
+  }
+  for ( int pin = 0; pinsPending > 0 && pin < MAX_PINS; pin++ ) {
+    if ( pinPending[pin] ) {
+      pinPending[pin] = false;
+      pinsPending--;
+      inIsr = true;
+      Spend( COST_PIN_ISR );
+      pinIsr[pin]();
+      inIsr = false;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Past the RunUntil() time: let the world catch up
+void Device::Checkpoint( void ) {
+  if ( clock > limit ) {
+    ToWorld();
+  }
+}
+
+// Back to RunUntil(), which resumes this device where it left off
+void Device::ToWorld( void ) {
+  if ( !_setjmp( ((Fiber *)context)->jump ) ) {
+    _longjmp( worldJump, 1 );
+  }
+}
+
+/****************************************************************************
+
+  Line
+
+****************************************************************************/
+
+Line::Line( uint32_t seed )
+  : bitErrorRate(0), bytes(0), collided(0), noisy(0), first(0),
+    random(seed ? seed : 1) {}
+
+int Line::Connect( const Device *device, bool echo ) {
+  Tap tap = { device, echo, first + log.size() };
+  taps.push_back( tap );
+  return taps.size() - 1;
+}
+
+/****************************************************************************
+ Function
+    Send
+
+ Parameters
+  from: transmitter
+  start, end: start and stop bit [ns]
+  baud: transmitter's rate
+  value: the byte
+
+ Returns
+    None
+
+ Description
+    Puts a byte on the line. It ends after anything a receiver has
+    read, since receivers only read what ended before every device's
+    clock. Bytes of other transmitters it overlaps are garbled, and
+    it is.
+****************************************************************************/
+void Line::Send( const Device *from, Time start, Time end, uint32_t baud, uint8_t value ) {
+  bytes++;
+  if ( bitErrorRate > 0 ) {
+    double byteErrorRate = 1 - pow( 1 - bitErrorRate, 10 );
+    if ( ( Garbage() | (Garbage() << 8) | (Garbage() << 16) ) / 16777216.0 < byteErrorRate ) {
+      value ^= 1 << ( Garbage() & 7 );
+      noisy++;
+    }
+  }
+  size_t i = log.size();
+  while ( i > 0 && log[i - 1].end > end ) {
+    i--;
+  }
+  Byte b = { start, end, from, baud, value };
+  log.insert( log.begin() + i, b );
+  garbled.insert( garbled.begin() + i, false );
+  // sorted by end, so only the bytes at the back can overlap
+  for ( size_t j = log.size(); j > 0 && log[j - 1].end > start; j-- ) {
+    Byte &other = log[j - 1];
+    if ( j - 1 != i && other.from != from && other.start < end ) {
+      if ( !garbled[j - 1] ) {
+        collided++;
+      }
+      if ( !garbled[i] ) {
+        collided++;
+      }
+      garbled[j - 1] = true;
+      garbled[i] = true;
+    }
+  }
+}
+
+// Next byte the tap hears that ended by now, false if none
+bool Line::Receive( int t, Time now, uint32_t baud, uint8_t *value ) {
+  Tap &tap = taps[t];
+  for ( ;; ) {
+    size_t i = tap.next - first;
+    if ( i >= log.size() || log[i].end > now ) {
+      break;
+    }
+    tap.next++;
+    const Byte &b = log[i];
+    if ( b.from == tap.device && !tap.echo ) {
+      continue;
+    }
+    *value = ( garbled[i] || b.baud != baud ) ? Garbage() : b.value;
+    return true;
+  }
+
+  size_t done = first + log.size();
+  for ( size_t k = 0; k < taps.size(); k++ ) {
+    done = std::min( done, taps[k].next );
+  }
+  if ( done - first >= LINE_TRIM ) {
+    log.erase( log.begin(), log.begin() + ( done - first ) );
+    garbled.erase( garbled.begin(), garbled.begin() + ( done - first ) );
+    first = done;
+  }
+  return false;
+}
+
+// xorshift, same garbage for the same seed
+uint8_t Line::Garbage( void ) {
+  random ^= random << 13;
+  random ^= random >> 17;
+  random ^= random << 5;
+  return random >> 24;
+}
+
+Device *Current( void ) {
+  return current;
+}
+
+/****************************************************************************
+ Function
+    RunUntil
+
+ Parameters
+  t: time to run to [ns]
+
+ Returns
+    None
+
+ Description
+    Resumes the device with the earliest clock until every device is
+    past t. A device runs until it is past t, or until it is ahead of
+    another one and about to look at an input.
+****************************************************************************/
+void RunUntil( Time t ) {
+  limit = t;
+  for ( ;; ) {
+    // the earliest device, and the clock of the next earliest
+    Device *next = 0;
+    horizon = t;
+    for ( size_t i = 0; i < devices.size(); i++ ) {
+      Device *d = devices[i];
+      if ( !next || d->clock < next->clock ) {
+        if ( next ) {
+          horizon = std::min( horizon, next->clock );
+        }
+        next = d;
+      } else {
+        horizon = std::min( horizon, d->clock );
+      }
+    }
+    if ( !next || next->clock > t ) {
+      break;
+    }
+
+    bool start = !next->started;
+    if ( start ) {
+      Fiber *fiber = new Fiber;
+      next->stack = new char[STACK_SIZE];
+      getcontext( &fiber->start );
+      fiber->start.uc_stack.ss_sp = next->stack;
+      fiber->start.uc_stack.ss_size = STACK_SIZE;
+      fiber->start.uc_link = 0;
+      uintptr_t p = (uintptr_t)next;
+      makecontext( &fiber->start, (void (*)( void ))Device::Entry, 2,
+                   (unsigned int)p, (unsigned int)(p >> 32) );
+      next->context = fiber;
+      next->started = true;
+    }
+    current = next;
+    if ( !_setjmp( worldJump ) ) {
+      Fiber *fiber = (Fiber *)next->context;
+      if ( start ) {
+        setcontext( &fiber->start );
+      }
+      _longjmp( fiber->jump, 1 );
+    }
+    current = 0;
+  }
+  worldTime = std::max( worldTime, t );
+}
+
+Time Now( void ) {
+  return worldTime;
+}
+
+uint32_t CycleCount( void ) {
+  return (uint32_t)( Dev().Now() * (F_CPU / 1000000) / 1000 );
+}
+
+volatile uint8_t *PinRegister( uint8_t pin ) {
+  return &Dev().pins[pin];
+}
+
+/*----------------------------- Module Functions ---------------------------*/
+
+static Device &Dev( void ) {
+  if ( !current ) {
+    fprintf( stderr, "host: Arduino call outside a device\n" );
+    abort();
+  }
+  return *current;
+}
+
+// Time of one 8N1 byte [ns]
+static Time ByteTime( uint32_t baud ) {
+  return baud ? ( 10 * SEC + baud / 2 ) / baud : 0;
+}
+
+}  // namespace host
+
+/****************************************************************************
+
+  Arduino core
+
+****************************************************************************/
+
+using host::Dev;
+using host::Time;
+
+volatile uint32_t ARM_DEMCR;
+volatile uint32_t ARM_DWT_CTRL;
+
+HardwareSerial Serial( 0 );
+HardwareSerial Serial1( 1 );
+HardwareSerial Serial2( 2 );
+HardwareSerial Serial3( 3 );
+EEPROMClass EEPROM;
+
+uint32_t millis( void ) {
+  Dev().Spend( COST_TIME );
+  return (uint32_t)( Dev().Now() / host::MS );
+}
+
+uint32_t micros( void ) {
+  Dev().Spend( COST_TIME );
+  return (uint32_t)( Dev().Now() / host::US );
+}
+
+void delay( uint32_t ms ) {
+  Dev().Spend( ms * host::MS );
+}
+
+void delayMicroseconds( uint32_t us ) {
+  Dev().Spend( us * host::US );
+}
+
+void yield( void ) {
+  Dev().Spend( COST_LOOP );
+}
+
+void pinMode( uint8_t pin, uint8_t mode ) {
+  host::Device &d = Dev();
+  d.Spend( COST_PIN_MODE );
+  d.modes[pin] = mode;
+  if ( !d.driven[pin] && ( mode == INPUT_PULLUP || mode == INPUT_PULLDOWN ) ) {
+    d.pins[pin] = ( mode == INPUT_PULLUP ) ? HIGH : LOW;
+  }
+}
+
+void digitalWrite( uint8_t pin, uint8_t value ) {
+  host::Device &d = Dev();
+  d.Spend( COST_DIGITAL );
+  if ( d.modes[pin] == OUTPUT ) {
+    d.pins[pin] = value ? HIGH : LOW;
+    d.duty[pin] = value ? 255 : 0;
+  }
+}
+
+int digitalRead( uint8_t pin ) {
+  host::Device &d = Dev();
+  d.Spend( COST_DIGITAL );
+  return d.pins[pin];
+}
+
+int analogRead( uint8_t pin ) {
+  host::Device &d = Dev();
+  d.Spend( COST_ANALOG_READ );
+  return d.analog[pin];
+}
+
+void analogWrite( uint8_t pin, int value ) {
+  host::Device &d = Dev();
+  d.Spend( COST_ANALOG_WRITE );
+  d.duty[pin] = constrain( value, 0, 255 );
+}
+
+void analogWriteResolution( uint32_t bits ) {
+  (void)bits;
+}
+
+void analogReadResolution( unsigned int bits ) {
+  (void)bits;
+}
+
+void attachInterrupt( uint8_t pin, void (*function)(void), int mode ) {
+  host::Device &d = Dev();
+  d.Spend( COST_PIN_MODE );
+  d.pinIsr[pin] = function;
+  d.pinIsrMode[pin] = mode;
+}
+
+void detachInterrupt( uint8_t pin ) {
+  host::Device &d = Dev();
+  d.pinIsr[pin] = 0;
+  if ( d.pinPending[pin] ) {
+    d.pinPending[pin] = false;
+    d.pinsPending--;
+  }
+}
+
+void noInterrupts( void ) {
+  Dev().irqEnabled = false;
+}
+
+void interrupts( void ) {
+  host::Device &d = Dev();
+  d.irqEnabled = true;
+  d.Spend( COST_IRQ_ON );
+}
+
+/*------------------------------ Strings ----------------------------------*/
+
+String::String( int value, unsigned char base ) {
+  char buffer[34];
+  if ( base == DEC ) {
+    snprintf( buffer, sizeof buffer, "%d", value );
+  } else if ( base == HEX ) {
+    snprintf( buffer, sizeof buffer, "%x", value );
+  } else {
+    snprintf( buffer, sizeof buffer, "%o", value );
+  }
+  str = buffer;
+}
+
+/*------------------------------- Print -----------------------------------*/
+
+Print::~Print() {}
+
+size_t Print::write( const uint8_t *buffer, size_t size ) {
+  for ( size_t i = 0; i < size; i++ ) {
+    write( buffer[i] );
+  }
+  return size;
+}
+
+size_t Print::print( double n, int digits ) {
+  char buffer[64];
+  snprintf( buffer, sizeof buffer, "%.*f", digits, n );
+  return write( buffer );
+}
+
+int Print::printf( const char *format, ... ) {
+  char buffer[512];
+  va_list args;
+  va_start( args, format );
+  vsnprintf( buffer, sizeof buffer, format, args );
+  va_end( args );
+  return write( buffer );
+}
+
+size_t Print::printSigned( long n, int base ) {
+  if ( n < 0 && base == DEC ) {
+    return write( (uint8_t)'-' ) + printNumber( -(unsigned long)n, base );
+  }
+  return printNumber( n, base );
+}
+
+size_t Print::printNumber( unsigned long n, int base ) {
+  char buffer[8 * sizeof(long) + 1];
+  char *s = &buffer[sizeof buffer - 1];
+  *s = 0;
+  if ( base < 2 ) {
+    base = DEC;
+  }
+  do {
+    int digit = n % base;
+    *--s = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    n /= base;
+  } while ( n );
+  return write( s );
+}
+
+/*------------------------------- Stream ----------------------------------*/
+
+// Like Stream::readBytes on the Teensy: polls until length bytes came
+// or nothing came for the timeout
+size_t Stream::readBytes( char *buffer, size_t length ) {
+  size_t count = 0;
+  uint32_t start = millis();
+  while ( count < length ) {
+    int c = read();
+    if ( c >= 0 ) {
+      buffer[count++] = (char)c;
+      start = millis();
+    } else if ( millis() - start >= timeout ) {
+      break;
+    } else {
+      yield();
+    }
+  }
+  return count;
+}
+
+/*--------------------------- HardwareSerial ------------------------------*/
+
+void HardwareSerial::begin( uint32_t baud, uint32_t format ) {
+  (void)format;
+  host::Device &d = Dev();
+  if ( port != 0 ) {
+    // what came at the old rate is in the buffer already
+    d.Sync();
+    d.Receive( port );
+  }
+  d.Spend( COST_SERIAL_BEGIN );
+  d.ports[port].begun = true;
+  d.ports[port].baud = baud;
+}
+
+void HardwareSerial::end( void ) {
+  flush();
+  Dev().ports[port].begun = false;
+}
+
+int HardwareSerial::available( void ) {
+  host::Device &d = Dev();
+  d.Sync();
+  if ( port != 0 ) {
+    d.Receive( port );
+  }
+  d.Spend( COST_SERIAL_CALL );
+  if ( port == 0 ) {
+    size_t n = 0;
+    while ( d.usbHead + n < d.usbRx.size() && d.usbRx[d.usbHead + n].first <= d.Now() ) {
+      n++;
+    }
+    return n;
+  }
+  host::Device::Port &p = d.ports[port];
+  return p.rx.size() - p.rxHead;
+}
+
+int HardwareSerial::peek( void ) {
+  host::Device &d = Dev();
+  d.Sync();
+  if ( port != 0 ) {
+    d.Receive( port );
+  }
+  d.Spend( COST_SERIAL_CALL );
+  if ( port == 0 ) {
+    if ( d.usbHead < d.usbRx.size() && d.usbRx[d.usbHead].first <= d.Now() ) {
+      return d.usbRx[d.usbHead].second;
+    }
+    return -1;
+  }
+  host::Device::Port &p = d.ports[port];
+  return ( p.rxHead < p.rx.size() ) ? p.rx[p.rxHead] : -1;
+}
+
+int HardwareSerial::read( void ) {
+  int c = peek();
+  if ( c < 0 ) {
+    return c;
+  }
+  host::Device &d = Dev();
+  if ( port == 0 ) {
+    d.usbHead++;
+  } else {
+    host::Device::Port &p = d.ports[port];
+    if ( ++p.rxHead == p.rx.size() ) {
+      p.rx.clear();
+      p.rxHead = 0;
+    }
+  }
+  return c;
+}
+
+void HardwareSerial::flush( void ) {
+  host::Device &d = Dev();
+  d.Spend( COST_SERIAL_CALL );
+  if ( port != 0 && d.ports[port].txFreeAt > d.Now() ) {
+    d.Spend( d.ports[port].txFreeAt - d.Now() );
+  }
+}
+
+void HardwareSerial::clear( void ) {
+  host::Device &d = Dev();
+  if ( port == 0 ) {
+    while ( d.usbHead < d.usbRx.size() && d.usbRx[d.usbHead].first <= d.Now() ) {
+      d.usbHead++;
+    }
+  } else {
+    d.ports[port].rx.clear();
+    d.ports[port].rxHead = 0;
+  }
+}
+
+size_t HardwareSerial::write( uint8_t b ) {
+  return write( &b, 1 );
+}
+
+size_t HardwareSerial::write( const uint8_t *buffer, size_t size ) {
+  host::Device &d = Dev();
+  if ( port == 0 ) {
+    d.Spend( COST_USB_BYTE * size );
+    std::string &out = d.usbOutput;
+    out.append( (const char *)buffer, size );
+    if ( out.size() > USB_OUTPUT_MAX ) {
+      out.erase( 0, out.size() - USB_OUTPUT_MAX / 2 );
+    }
+    if ( d.echoUsb ) {
+      fwrite( buffer, 1, size, stdout );
+    }
+    return size;
+  }
+  for ( size_t i = 0; i < size; i++ ) {
+    d.Write( port, buffer[i] );
+  }
+  return size;
+}
+
+int HardwareSerial::availableForWrite( void ) {
+  host::Device &d = Dev();
+  d.Spend( COST_SERIAL_CALL );
+  if ( port == 0 ) {
+    return 64;
+  }
+  host::Device::Port &p = d.ports[port];
+  while ( p.txHead < p.txStart.size() && p.txStart[p.txHead] <= d.Now() ) {
+    p.txHead++;
+  }
+  return p.txSize - ( p.txStart.size() - p.txHead );
+}
+
+void HardwareSerial::addMemoryForWrite( void *buffer, size_t length ) {
+  (void)buffer;
+  Dev().ports[port].txSize += length;
+}
+
+void HardwareSerial::addMemoryForRead( void *buffer, size_t length ) {
+  (void)buffer;
+  Dev().ports[port].rxSize += length;
+}
+
+void HardwareSerial::transmitterEnable( uint8_t pin ) {
+  (void)pin;
+}
+
+/*------------------------------- EEPROM ----------------------------------*/
+
+uint8_t EEPROMClass::read( int address ) {
+  host::Device &d = Dev();
+  d.Spend( COST_EEPROM );
+  return d.Eeprom()[address & E2END];
+}
+
+void EEPROMClass::write( int address, uint8_t value ) {
+  host::Device &d = Dev();
+  d.Spend( COST_EEPROM );
+  d.Eeprom()[address & E2END] = value;
+}
+
+/*---------------------------- IntervalTimer ------------------------------*/
+
+bool IntervalTimer::begin( void (*function)(void), unsigned long microseconds ) {
+  host::Device &d = Dev();
+  if ( timer < 0 ) {
+    for ( int t = 0; t < NUM_TIMERS && timer < 0; t++ ) {
+      if ( !d.timers[t].running ) {
+        timer = t;
+      }
+    }
+    if ( timer < 0 ) {
+      return false;
+    }
+  }
+  host::Device::Timer &t = d.timers[timer];
+  t.running = true;
+  t.function = function;
+  t.period = microseconds * host::US;
+  t.due = d.Now() + t.period;
+  return true;
+}
+
+bool IntervalTimer::begin( void (*function)(void), float microseconds ) {
+  return begin( function, (unsigned long)( microseconds + 0.5f ) );
+}
+
+void IntervalTimer::update( unsigned long microseconds ) {
+  if ( timer >= 0 ) {
+    Dev().timers[timer].period = microseconds * host::US;
+  }
+}
+
+void IntervalTimer::end( void ) {
+  if ( timer >= 0 ) {
+    Dev().timers[timer].running = false;
+    timer = -1;
+  }
+}
@@ -0,0 +1,247 @@
+/****************************************************************************
+
+  Header file for HostBoard
+  Teensy boards on a PC: the sketches run on virtual clocks
+
+  Each Device runs one sketch image (see Makefile) in its own
+  coroutine. The Arduino core calls (Arduino/Arduino.h) cost the
+  device the CPU time they take on the Teensy 3.2, which advances its
+  clock; timer and pin interrupts run at their exact times in between.
+  RunUntil() always resumes the device that is furthest behind, and a
+  device only looks at its inputs (serial reads) once every other
+  device has caught up with it, so whatever a device sees was sent
+  before it looked, to the ns.
+  Models (motors, encoders, switches) move with the device they are
+  wired to, in steps of at most PLANT_STEP.
+
+ ****************************************************************************/
+
+#ifndef HOST_BOARD_H
+#define HOST_BOARD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace host {
+
+typedef uint64_t Time;                  // [ns]
+const Time US  = 1000ULL;
+const Time MS  = 1000000ULL;
+const Time SEC = 1000000000ULL;
+
+#define PLANT_STEP      (10 * host::US)  // longest model step
+#define NUM_PORTS       4               // Serial (USB), Serial1-3
+#define NUM_TIMERS      4               // IntervalTimers
+#define EEPROM_SIZE     2048
+#define MAX_PINS        64
+
+class Device;
+
+// What every sketch wrapper (sketches/*.cpp) starts its hooks with
+struct SketchHooks {
+  void (*setup)( void );
+  void (*loop)( void );
+};
+
+// One copy of a sketch, linked under its own symbol prefix
+struct SketchImage {
+  const char *name;
+  void (* const *initBegin)( void );    // its static constructors
+  void (* const *initEnd)( void );
+  const SketchHooks *hooks;             // e.g. a SlaveHooks (HostSketches.h)
+};
+
+// Something wired to the pins of a device, e.g. a motor and encoder
+class Model
+{
+  public:
+    virtual ~Model();
+    // Move from now to now + dt with the device outputs as they are
+    // now. Input changes in the step go through Device::Drive().
+    virtual void Step( Device &device, Time now, Time dt ) = 0;
+};
+
+// A byte on a serial line
+struct SerialByte {
+  Time end;          // [ns] when the stop bit is done
+  uint8_t value;
+};
+
+// A multi-drop RS485 line shared by the serial ports of several
+// devices. Every port on it hears every byte, its own ones only if it
+// was connected with echo (receiver always on). Bytes of two
+// transmitters that overlap collide, and a port at another baud rate
+// than the sender's reads garbage. Noise flips bits at bitErrorRate.
+class Line
+{
+  public:
+    explicit Line( uint32_t seed );
+
+    double bitErrorRate;
+
+    unsigned long bytes;        // sent on the line
+    unsigned long collided;     // of them, garbled by another transmitter
+    unsigned long noisy;        // of them, with a bit flipped by noise
+
+  private:
+    struct Byte {
+      Time start, end;
+      const Device *from;
+      uint32_t baud;
+      uint8_t value;
+    };
+    struct Tap {
+      const Device *device;
+      bool echo;
+      size_t next;              // number of the next byte to look at
+    };
+    int Connect( const Device *device, bool echo );
+    void Send( const Device *from, Time start, Time end, uint32_t baud, uint8_t value );
+    bool Receive( int tap, Time now, uint32_t baud, uint8_t *value );
+    uint8_t Garbage( void );
+
+    std::vector<Byte> log;      // by end time
+    std::vector<bool> garbled;
+    size_t first;               // number of log[0]
+    std::vector<Tap> taps;
+    uint32_t random;
+
+    friend class Device;
+};
+
+class Device
+{
+  public:
+    Device( const SketchImage &image, uint8_t id );   // id goes to EEPROM[0]
+    ~Device();
+
+    const char *Name( void ) const { return name.c_str(); }
+    Time Now( void ) const { return clock; }
+    uint8_t *Eeprom( void ) { return eeprom; }
+
+    // Wiring, before the first RunUntil()
+    void Attach( Model *model );        // not owned
+
+    // Pins
+    void Drive( int pin, int level, Time at );  // input level from at on
+    void SetAnalog( int pin, int value );       // analogRead() value
+    int Level( int pin ) const;
+    int Duty( int pin ) const;          // last analogWrite(), 0/255 for digitalWrite()
+
+    // USB serial: bytes to the sketch from at on, and what it printed
+    void UsbSend( const void *data, size_t length, Time at );
+    const std::string &UsbOutput( void ) const { return usbOutput; }
+    void ClearUsbOutput( void ) { usbOutput.clear(); }
+    bool echoUsb;                       // copy what the sketch prints to stdout
+
+    // Bytes a UART sent, while keepTx is set
+    const std::vector<SerialByte> &TxLog( int port ) const;
+    bool keepTx;
+
+    // Wire a UART (1-3) to a line, before the first RunUntil()
+    void Connect( int port, Line &line, bool echo );
+
+    // Calls into the sketch from the host: sets the current device
+    // and makes the core calls free
+    class Probe
+    {
+      public:
+        explicit Probe( Device &device );
+        ~Probe();
+      private:
+        Device *previous;
+        bool wasProbing;
+    };
+
+    // Move the clock of a device that isn't running, for sketch code
+    // timed under a Probe (bench/)
+    void Advance( Time ns ) { clock += ns; }
+
+    // Host code run on the device's clock
+    std::function<void (Device &)> onBoot;       // after the constructors, before setup()
+    std::function<void (Device &, int)> onTimer; // after each IntervalTimer interrupt
+
+    // Core, for the Arduino calls in HostBoard.cpp
+    struct Timer {
+      bool running;
+      void (*function)( void );
+      Time period, due;
+    };
+    struct Port {
+      bool begun;
+      uint32_t baud;
+      size_t txSize, rxSize;            // buffers [bytes]
+      std::vector<Time> txStart;        // queued bytes not on the line yet
+      size_t txHead;
+      Time txFreeAt;                    // end of the last queued byte
+      std::vector<uint8_t> rx;          // received, not read yet
+      size_t rxHead;
+      unsigned long rxOverflow;         // bytes lost to a full rx buffer
+      std::vector<SerialByte> txLog;
+      Line *line;
+      int tap;
+    };
+    void Spend( Time ns );              // busy for ns, interrupts run meanwhile
+    void Sync( void );                  // about to look at an input
+    void Write( int port, uint8_t value );
+    void Receive( int port );           // take what came on the line, after Sync()
+    bool probing;
+    bool irqEnabled;
+    bool inIsr;
+    uint8_t pins[MAX_PINS];             // levels, PinRegister()
+    uint8_t modes[MAX_PINS];            // pinMode()
+    bool driven[MAX_PINS];              // level set by a model
+    int duty[MAX_PINS];
+    int analog[MAX_PINS];
+    void (*pinIsr[MAX_PINS])( void );
+    int pinIsrMode[MAX_PINS];
+    bool pinPending[MAX_PINS];
+    int pinsPending;                    // of pinPending
+    Timer timers[NUM_TIMERS];
+    Port ports[NUM_PORTS];
+    std::vector<std::pair<Time, uint8_t> > usbRx;
+    size_t usbHead;
+    std::string usbOutput;
+
+  private:
+    struct PinEvent {
+      Time at;
+      int pin, level;
+      bool operator>( const PinEvent &e ) const { return at > e.at; }
+    };
+    static void Entry( unsigned int lo, unsigned int hi );
+    void Run( void );
+    void RunTo( Time target );
+    void SetLevel( int pin, int level );
+    bool DispatchInterrupt( void );
+    void Checkpoint( void );
+    void ToWorld( void );
+
+    std::string name;
+    const SketchImage image;
+    Time clock;                         // [ns]
+    Time plantTime;                     // models are done up to here
+    std::vector<Model *> models;
+    std::vector<PinEvent> events;       // heap, earliest first
+    uint8_t eeprom[EEPROM_SIZE];
+    void *context;
+    char *stack;
+    bool started;
+
+    friend void RunUntil( Time t );
+};
+
+// The device running now, null outside the sketches
+Device *Current( void );
+
+// Run every device up to t [ns]
+void RunUntil( Time t );
+// Latest t RunUntil() got to
+Time Now( void );
+
+}  // namespace host
+
+#endif
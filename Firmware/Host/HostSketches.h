@@ -0,0 +1,105 @@
+/****************************************************************************
+
+  Header file for HostSketches
+  What the host sees of each sketch copy
+
+  The wrappers in sketches/ build a sketch with its hooks: functions
+  that reach into that copy's globals. Call them under a
+  host::Device::Probe of the device running that copy.
+
+ ****************************************************************************/
+
+#ifndef HOST_SKETCHES_H
+#define HOST_SKETCHES_H
+
+#include "HostBoard.h"
+
+// Teensy pins of one ShapePin
+struct SlaveWiring {
+  int motorA, motorB;
+  int encoderA, encoderB;
+  int sw;
+  bool analogSwitch;    // read with analogRead(), no interrupt
+};
+
+struct SlaveHooks {
+  host::SketchHooks sketch;
+  // pins of ShapePin pin on the slave with that ID, no slave needed
+  void (*wiring)( int id, int pin, SlaveWiring *wiring );
+  // queue a pin command for the control step like readMSG() does,
+  // false if the pin's queue is full
+  bool (*move)( int pin, int pulses, unsigned int duration, int mode );
+  bool (*zero)( int pin );
+  bool (*idle)( int pin );
+  void (*setProfile)( int pin, int speed, int accel );  // [mm/s], [mm/s^2]
+  // SET_PARAMS blocks, one for all pins or one per pin, as readMSG()
+  // applies them
+  void (*setParams)( const uint8_t *blocks, unsigned int len );
+  int (*position)( int pin );       // [pulses]
+  int (*target)( int pin );         // [pulses]
+  int (*state)( int pin );          // PinState_t
+  int (*stalls)( int pin );
+  float (*velocity)( int pin );     // [pulses/s]
+  unsigned int (*rxErrors)( void ); // RS485 receive errors
+  void (*setBlockingReceive)( bool on );  // recvMsg() in loop(), as it used to be
+};
+
+// The config globals at the top of Master-Unity.ino
+struct MasterConfig {
+  bool framedUnityLink;
+  bool broadcastPositions;
+  bool sendDeltaPositions;
+  bool adaptiveLinkRate;
+  int positionBits;
+  int rs485Buses;
+};
+
+struct MasterStats {
+  unsigned long bytesSent;          // on the RS485 buses
+  unsigned long msgsSent;
+  unsigned long framesDropped;      // Unity frames replaced before they were sent
+  unsigned long unityFramesLost;    // missing from Unity's sequence (framed link)
+  unsigned long deltaFrames;        // sent as changed pins only
+  unsigned long deltaBytesSaved;    // by them, against the last full frame
+  int frameSeq;                     // last frame committed
+  int linkRate;
+  int numSlaves;
+};
+
+struct MasterHooks {
+  host::SketchHooks sketch;
+  // set it before setup(), e.g. from Device::onBoot
+  void (*getConfig)( MasterConfig *config );
+  void (*setConfig)( const MasterConfig *config );
+  void (*stats)( MasterStats *stats );
+  void (*setLinkRate)( int rate );  // SET_BAUD to the slaves, then LINK_BAUD(rate)
+  void (*setAdaptiveLink)( int mode );  // as a LinkCMD
+  // CheckLink()'s decision from a sweep's errors and msgs: the next
+  // rate, taken as the current one without telling the slaves
+  int (*nextLinkRate)( unsigned long errors, unsigned long msgs );
+  // send a DataCMD frame (displaySize heights [mm]) as loop() does
+  void (*sendPositions)( const uint8_t *heights );
+  // zMap index of a slave's pin in its SET_POS msg (slaveGather)
+  int (*gatherIndex)( int slave, int pin );
+  // slaveStatus[slave] after RequestStatus(): the slave's PIN_STATUS
+  // msg (STATUS_LENGTH bytes), zeros if it didn't reply. The sweep
+  // waits on micros(), so it runs from loop() on a StatusCMD
+  // (DisplayBus::RequestStatus), the clock stands still in a Probe
+  void (*slaveStatus)( int slave, uint8_t *reply );
+};
+
+// The sketch copies linked into this program (images, see Makefile),
+// the master only in programs built with it
+extern const host::SketchImage hostSlaveImages[];
+extern const int hostNumSlaveImages;
+extern const host::SketchImage hostMasterImage;
+
+inline const SlaveHooks &Slave( const host::SketchImage &image ) {
+  return *(const SlaveHooks *)image.hooks;
+}
+
+inline const MasterHooks &Master( const host::SketchImage &image ) {
+  return *(const MasterHooks *)image.hooks;
+}
+
+#endif
@@ -0,0 +1,209 @@
+/****************************************************************************
+ Module
+   PinPlant.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   Motor, leadscrew, encoder and switch of one display pin
+
+ Notes
+   The winding inductance is left out (its time constant is well
+   under a PLANT_STEP), so the current follows the voltage and the
+   PWM is averaged. Encoder edges and the switch are interpolated to
+   their times within a step.
+****************************************************************************/
+
+#include "PinPlant.h"
+#include "Arduino.h"
+#include "ShapeConstants.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define TWO_PI_D        6.283185307179586
+#define ANALOG_SW_HIGH  1023    // analogRead() of a closed analog switch
+
+/****************************************************************************
+
+  Public Functions
+
+****************************************************************************/
+
+PinPlantParams DefaultPinPlant( void ) {
+  PinPlantParams p;
+  p.supply = 12.0f;
+  p.resistance = 10.0f;
+  p.kt = 0.057f;
+  p.inertia = 2e-6f;
+  p.viscous = 1e-5f;
+  p.coulomb = 0.004f;
+  p.stiction = 0.006f;
+  p.load = 2.0f;
+  p.pitch = SCREW_PITCH;
+  p.countsPerRev = PULSES_PER_REV * 4;
+  p.markError = 0.1f;
+  p.switchAt = ZERO_OFFSET;
+  p.bottom = ZERO_OFFSET - 1;
+  p.top = DEFAULT_MAX_TRAVEL + 5;
+  return p;
+}
+
+/****************************************************************************
+ Function
+    PinPlant
+
+ Parameters
+  params: motor, friction, screw and encoder
+  wiring: Teensy pins, see SlaveHooks::wiring
+  height: where the pin starts [mm]
+  seed: for the encoder mark errors
+
+ Returns
+    None
+
+ Description
+    Constructor. Attach it to the slave's Device before it starts.
+****************************************************************************/
+PinPlant::PinPlant( const PinPlantParams &params, const SlaveWiring &wiring,
+                    float height, unsigned int seed )
+  : p(params), wiring(wiring), omega(0), current(0), jammed(false), started(false)
+{
+  uint32_t x = seed * 2654435761u + 1;
+  for ( int i = 0; i < 16; i++ ) {
+    x = x * 1664525u + 1013904223u;
+    markOffset[i] = p.markError * ( (x >> 8) / 8388608.0f - 1.0f );
+  }
+  angle = height / p.pitch * TWO_PI_D;
+  count = CountAt( angle );
+  switchDown = ( height <= p.switchAt );
+}
+
+/****************************************************************************
+ Function
+    Step
+
+ Parameters
+  device: the slave
+  now: start of the step [ns]
+  dt: length of the step [ns]
+
+ Returns
+    None
+
+ Description
+    Integrates the screw over the step with the motor voltage the
+    slave outputs now, and drives the encoder and switch pins at the
+    times they change.
+****************************************************************************/
+void PinPlant::Step( host::Device &device, host::Time now, host::Time dt ) {
+  if ( !started ) {
+    DriveCount( device, count, now );
+    if ( wiring.analogSwitch ) {
+      device.SetAnalog( wiring.sw, switchDown ? ANALOG_SW_HIGH : 0 );
+    } else {
+      device.Drive( wiring.sw, switchDown, now );
+    }
+    started = true;
+  }
+
+  double h = dt * 1e-9;
+  // UP drives lead B, DOWN lead A
+  float volts = ( device.Duty(wiring.motorB) - device.Duty(wiring.motorA) ) / 255.0f * p.supply;
+  current = ( volts - p.kt * omega ) / p.resistance;
+  double torque = p.kt * current - p.load * p.pitch * 1e-3 / TWO_PI_D;
+  double before = angle;
+  if ( jammed ) {
+    omega = 0;
+  } else if ( omega != 0 || fabs(torque) > p.stiction ) {
+    double direction = ( omega != 0 ) ? omega : torque;
+    double friction = ( direction > 0 ? p.coulomb : -p.coulomb ) + p.viscous * omega;
+    double next = omega + ( torque - friction ) / p.inertia * h;
+    if ( omega != 0 && (next > 0) != (omega > 0) ) {
+      next = 0;   // friction stopped it, it sticks until it breaks away again
+    }
+    omega = next;
+  }
+  angle += omega * h;
+
+  double height = angle * p.pitch / TWO_PI_D;
+  if ( height < p.bottom || height > p.top ) {
+    height = ( height < p.bottom ) ? p.bottom : p.top;
+    angle = height / p.pitch * TWO_PI_D;
+    omega = 0;
+  }
+
+  // encoder edges at the angles they are at
+  int target = CountAt( angle );
+  while ( count != target ) {
+    int next = count + ( target > count ? 1 : -1 );
+    double edge = EdgeAngle( target > count ? next : count );
+    double f = ( angle != before ) ? ( edge - before ) / ( angle - before ) : 1;
+    f = constrain( f, 0.0, 1.0 );
+    DriveCount( device, next, now + (host::Time)( f * dt ) );
+    count = next;
+  }
+
+  bool down = ( height <= p.switchAt );
+  if ( down != switchDown ) {
+    double beforeHeight = before * p.pitch / TWO_PI_D;
+    double f = ( height != beforeHeight ) ? ( p.switchAt - beforeHeight ) / ( height - beforeHeight ) : 1;
+    f = constrain( f, 0.0, 1.0 );
+    switchDown = down;
+    if ( wiring.analogSwitch ) {
+      device.SetAnalog( wiring.sw, down ? ANALOG_SW_HIGH : 0 );
+    } else {
+      device.Drive( wiring.sw, down, now + (host::Time)( f * dt ) );
+    }
+  }
+}
+
+float PinPlant::Height( void ) const {
+  return angle * p.pitch / TWO_PI_D;
+}
+
+float PinPlant::Speed( void ) const {
+  return omega * p.pitch / TWO_PI_D;
+}
+
+float PinPlant::Current( void ) const {
+  return current;
+}
+
+bool PinPlant::SwitchDown( void ) const {
+  return switchDown;
+}
+
+void PinPlant::Jam( bool jam ) {
+  jammed = jam;
+}
+
+/****************************************************************************
+
+  Private Functions
+
+****************************************************************************/
+
+// Encoder count at a screw angle, with the mark errors
+int PinPlant::CountAt( double a ) const {
+  double u = a / TWO_PI_D * p.countsPerRev;
+  int k = (int)floor( u );
+  if ( u < k + markOffset[k & 15] ) {
+    k--;
+  } else if ( u >= k + 1 + markOffset[(k + 1) & 15] ) {
+    k++;
+  }
+  return k;
+}
+
+// Angle where the count goes from count-1 to count
+double PinPlant::EdgeAngle( int c ) const {
+  return ( c + markOffset[c & 15] ) / p.countsPerRev * TWO_PI_D;
+}
+
+// Quadrature levels of a count, counting up goes
+// (A,B) = (0,0) (0,1) (1,1) (1,0) like the Encoder library
+void PinPlant::DriveCount( host::Device &device, int c, host::Time at ) {
+  int phase = c & 3;
+  device.Drive( wiring.encoderA, phase == 2 || phase == 3, at );
+  device.Drive( wiring.encoderB, phase == 1 || phase == 2, at );
+}
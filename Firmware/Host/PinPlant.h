@@ -0,0 +1,73 @@
+/****************************************************************************
+
+  Header file for PinPlant
+  One pin of the display: a DC motor turning a leadscrew, its
+  quadrature encoder and its limit switch
+
+  The pin height x [mm] is 0 where the firmware's zero ends up: the
+  switch closes at ZERO_OFFSET and below. Driving a motor lead
+  (analogWrite) puts duty/255 of the supply across the motor, both
+  leads low brake it. Friction is viscous plus Coulomb, with a higher
+  breakaway torque from rest, and a load pushes the pin down. Hard
+  stops end the travel below the switch and above DEFAULT_MAX_TRAVEL.
+
+ ****************************************************************************/
+
+#ifndef PIN_PLANT_H
+#define PIN_PLANT_H
+
+#include "HostBoard.h"
+#include "HostSketches.h"
+
+struct PinPlantParams {
+  float supply;         // [V]
+  float resistance;     // [ohm] winding
+  float kt;             // [N m/A], also the back EMF [V s/rad]
+  float inertia;        // [kg m^2] rotor and screw
+  float viscous;        // [N m s/rad]
+  float coulomb;        // [N m] sliding friction
+  float stiction;       // [N m] breakaway friction
+  float load;           // [N] pushing the pin down
+  float pitch;          // [mm/rev] leadscrew
+  float countsPerRev;   // encoder counts (4 per mark)
+  float markError;      // largest error of an encoder edge [counts]
+  float switchAt;       // [mm] switch closed at and below
+  float bottom, top;    // [mm] hard stops
+};
+
+// A small 12 V motor turning the SCREW_PITCH screw directly, about
+// 90 mm/s at full duty, and a PULSES_PER_REV encoder on the screw
+PinPlantParams DefaultPinPlant( void );
+
+class PinPlant : public host::Model
+{
+  public:
+    PinPlant( const PinPlantParams &params, const SlaveWiring &wiring,
+              float height, unsigned int seed );
+
+    void Step( host::Device &device, host::Time now, host::Time dt );
+
+    float Height( void ) const;         // [mm]
+    float Speed( void ) const;          // [mm/s]
+    float Current( void ) const;        // [A]
+    bool SwitchDown( void ) const;
+    void Jam( bool jammed );            // stop the screw where it is
+
+  private:
+    int CountAt( double angle ) const;
+    double EdgeAngle( int count ) const;
+    void DriveCount( host::Device &device, int count, host::Time at );
+
+    PinPlantParams p;
+    SlaveWiring wiring;
+    double angle;       // [rad] screw, 0 at height 0
+    double omega;       // [rad/s]
+    float current;      // [A]
+    int count;          // encoder count the pins show
+    bool switchDown;
+    bool jammed;
+    bool started;
+    float markOffset[16];   // [counts] edge errors, repeat every 16 counts
+};
+
+#endif
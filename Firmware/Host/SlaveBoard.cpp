@@ -0,0 +1,185 @@
+/****************************************************************************
+ Module
+   SlaveBoard.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   A slave sketch with its pins, see SlaveBoard.h
+
+ Notes
+   Runs all devices (host::RunUntil), not only this one.
+****************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <string>
+#include "SlaveBoard.h"
+#include "ShapePin.h"     // PinState_t
+
+/*----------------------------- Module Defines ----------------------------*/
+#define POLL_PERIOD     (10 * host::MS)     // how often Boot() and ZeroAll() look
+#define SETUP_DONE      "------"            // end of the banner setup() prints
+#define USB_CMD_TIME    (20 * host::MS)     // readSerial() takes it and prints the reply
+
+SlaveBoard::SlaveBoard( const host::SketchImage &image, uint8_t id, float height,
+                        const PinPlantParams &params )
+  : device(image, id), hooks(Slave(image))
+{
+  for ( int i = 0; i < NUM_MOTORS; i++ ) {
+    hooks.wiring( id, i, &wiring[i] );
+    plant[i] = new PinPlant( params, wiring[i], height, id * NUM_MOTORS + i );
+    device.Attach( plant[i] );
+  }
+}
+
+SlaveBoard::~SlaveBoard() {
+  for ( int i = 0; i < NUM_MOTORS; i++ ) {
+    delete plant[i];
+  }
+}
+
+bool SlaveBoard::Boot( host::Time timeout ) {
+  host::Time end = host::Now() + timeout;
+  while ( device.UsbOutput().find(SETUP_DONE) == std::string::npos ) {
+    if ( host::Now() >= end ) {
+      return false;
+    }
+    host::RunUntil( host::Now() + POLL_PERIOD );
+  }
+  return true;
+}
+
+/****************************************************************************
+ Function
+    ZeroAll
+
+ Parameters
+  timeout: longest time to wait [ns]
+
+ Returns
+    true if every pin found its switch and came back up to 0
+
+ Description
+    Zeroing drives a pin down to its switch, sets the encoder to
+    ZERO_OFFSET and moves it to 0.
+****************************************************************************/
+bool SlaveBoard::ZeroAll( host::Time timeout ) {
+  for ( int i = 0; i < NUM_MOTORS; i++ ) {
+    Zero( i );
+  }
+  host::Time end = host::Now() + timeout;
+  bool done = false;
+  while ( !done && host::Now() < end ) {
+    host::RunUntil( host::Now() + POLL_PERIOD );
+    done = true;
+    for ( int i = 0; i < NUM_MOTORS; i++ ) {
+      done = done && State( i ) != WAITING4SWITCH
+                  && fabsf( plant[i]->Height() ) <= DEFAULT_DEADZONE + PULSE_TO_MM
+                  && plant[i]->Speed() == 0;
+    }
+  }
+  return done;
+}
+
+StepResponse SlaveBoard::Step( int pin, float height, host::Time duration ) {
+  host::Time at = host::Now();
+  StepResponse response( plant[pin]->Height(), height, at );
+  PinPlant *p = plant[pin];
+  device.onTimer = [&response, p]( host::Device &d, int ) {
+    response.Add( d.Now(), p->Height() );
+  };
+  Move( pin, height );
+  host::RunUntil( at + duration );
+  device.onTimer = nullptr;
+  return response;
+}
+
+bool SlaveBoard::Move( int pin, float height ) {
+  host::Device::Probe probe( device );
+  return hooks.move( pin, lroundf( height / PULSE_TO_MM ), 0, TRAJ_LINEAR );
+}
+
+bool SlaveBoard::Keyframe( int pin, float height, unsigned int duration, int mode ) {
+  host::Device::Probe probe( device );
+  return hooks.move( pin, lroundf( height / PULSE_TO_MM ), duration, mode );
+}
+
+bool SlaveBoard::Zero( int pin ) {
+  host::Device::Probe probe( device );
+  return hooks.zero( pin );
+}
+
+int SlaveBoard::State( int pin ) {
+  host::Device::Probe probe( device );
+  return hooks.state( pin );
+}
+
+int SlaveBoard::Stalls( int pin ) {
+  host::Device::Probe probe( device );
+  return hooks.stalls( pin );
+}
+
+float SlaveBoard::Position( int pin ) {
+  host::Device::Probe probe( device );
+  return hooks.position( pin ) * PULSE_TO_MM;
+}
+
+float SlaveBoard::Velocity( int pin ) {
+  host::Device::Probe probe( device );
+  return hooks.velocity( pin ) * PULSE_TO_MM;
+}
+
+void SlaveBoard::SetProfile( int pin, int speed, int accel ) {
+  host::Device::Probe probe( device );
+  hooks.setProfile( pin, speed, accel );
+}
+
+void SlaveBoard::SetParams( const uint8_t *blocks, unsigned int len ) {
+  host::Device::Probe probe( device );
+  hooks.setParams( blocks, len );
+}
+
+bool SlaveBoard::Profile( const char *stage, float *min, float *mean, float *max ) {
+  unsigned long count;
+  return SlaveProfile( device, stage, &count, min, mean, max );
+}
+
+void SlaveBoard::ClearProfile( void ) {
+  SlaveClearProfile( device );
+}
+
+/****************************************************************************
+ Function
+    SlaveProfile
+
+ Parameters
+  device: running the slave sketch
+  stage: name in the sketch's profileNames, e.g. "period"
+  count: times the stage ran since the last clear
+  min, mean, max: the stage's times [us]
+
+ Returns
+    true if the stage's row was printed
+
+ Description
+    Sends the serial PRINT_PROFILE command and reads the stage's row
+    from the table profilePrint() writes.
+****************************************************************************/
+bool SlaveProfile( host::Device &device, const char *stage, unsigned long *count,
+                   float *min, float *mean, float *max ) {
+  size_t from = device.UsbOutput().size();
+  device.UsbSend( "7", 1, host::Now() );
+  host::RunUntil( host::Now() + USB_CMD_TIME );
+  std::string row = std::string( "\n" ) + stage + " ";
+  size_t at = device.UsbOutput().find( row, from );
+  return at != std::string::npos
+         && sscanf( device.UsbOutput().c_str() + at + row.size(), "%lu %f %f %f",
+                    count, min, mean, max ) == 4;
+}
+
+void SlaveClearProfile( host::Device &device ) {
+  device.UsbSend( "8", 1, host::Now() );
+  host::RunUntil( host::Now() + USB_CMD_TIME );
+}
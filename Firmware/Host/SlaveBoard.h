@@ -0,0 +1,63 @@
+/****************************************************************************
+
+  Header file for SlaveBoard
+  A slave sketch on a virtual board with a PinPlant on each of its
+  pins, for the tests and simulations
+
+  Heights are the plant's [mm]; the firmware's zero is within a pulse
+  of plant height 0 once a pin has been zeroed.
+
+ ****************************************************************************/
+
+#ifndef SLAVE_BOARD_H
+#define SLAVE_BOARD_H
+
+#include "HostBoard.h"
+#include "HostSketches.h"
+#include "PinPlant.h"
+#include "StepResponse.h"
+#include "ShapeConstants.h"
+
+class SlaveBoard
+{
+  public:
+    // pins start at height [mm], not zeroed
+    SlaveBoard( const host::SketchImage &image, uint8_t id, float height,
+                const PinPlantParams &params );
+    ~SlaveBoard();
+
+    bool Boot( host::Time timeout );            // run until setup() is done
+    bool ZeroAll( host::Time timeout );         // zero the pins, run until they are at 0
+    // move pin to height [mm] now and record it for duration
+    StepResponse Step( int pin, float height, host::Time duration );
+
+    // the pin commands of HostSketches.h, posted now
+    bool Move( int pin, float height );         // [mm]
+    // keyframe to height [mm] over duration [ms], TRAJ_LINEAR or TRAJ_CUBIC
+    bool Keyframe( int pin, float height, unsigned int duration, int mode );
+    bool Zero( int pin );
+    int State( int pin );                       // PinState_t
+    int Stalls( int pin );
+    float Position( int pin );                  // firmware's position [mm]
+    float Velocity( int pin );                  // firmware's measured speed [mm/s]
+    void SetProfile( int pin, int speed, int accel );   // [mm/s], [mm/s^2], 0 for steps
+    void SetParams( const uint8_t *blocks, unsigned int len );  // SET_PARAMS blocks
+
+    // The sketch's profiler over USB, PRINT_PROFILE and CLEAR_PROFILE:
+    // a stage's min/mean/max [us], false if its row didn't come
+    bool Profile( const char *stage, float *min, float *mean, float *max );
+    void ClearProfile( void );
+
+    host::Device device;
+    const SlaveHooks &hooks;
+    PinPlant *plant[NUM_MOTORS];
+    SlaveWiring wiring[NUM_MOTORS];
+};
+
+// The same for any device running the slave sketch, e.g. a DisplayBus
+// slave, with the number of times the stage ran
+bool SlaveProfile( host::Device &device, const char *stage, unsigned long *count,
+                   float *min, float *mean, float *max );
+void SlaveClearProfile( host::Device &device );
+
+#endif
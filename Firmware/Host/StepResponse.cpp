@@ -0,0 +1,102 @@
+/****************************************************************************
+ Module
+   StepResponse.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   Step-response metrics of a pin
+
+ Notes
+   Crossing times are interpolated between samples.
+****************************************************************************/
+
+#include <math.h>
+#include "StepResponse.h"
+#include "ShapeConstants.h"
+
+StepResponse::StepResponse( float start, float target, host::Time at )
+  : start(start), target(target), at(at) {}
+
+void StepResponse::Add( host::Time t, float height ) {
+  Sample s = { t, height };
+  samples.push_back( s );
+}
+
+StepMetrics StepResponse::Metrics( void ) const {
+  float band = 0.02f * fabsf( target - start );
+  if ( band < DEFAULT_DEADZONE + PULSE_TO_MM ) {
+    band = DEFAULT_DEADZONE + PULSE_TO_MM;
+  }
+  return Metrics( band );
+}
+
+/****************************************************************************
+ Function
+    Metrics
+
+ Parameters
+  band: settled within this of the target [mm]
+
+ Returns
+    StepMetrics
+
+ Description
+    Works in the direction of the step, so overshoot is past the target
+    whichever way the pin moved.
+****************************************************************************/
+StepMetrics StepResponse::Metrics( float band ) const {
+  StepMetrics m;
+  m.rise = -1;
+  m.overshoot = 0;
+  m.settling = -1;
+  m.finalError = 0;
+  m.band = band;
+  if ( samples.empty() ) {
+    return m;
+  }
+
+  float step = target - start;
+  float sign = ( step < 0 ) ? -1.0f : 1.0f;
+  float t10 = -1, t90 = -1;
+  float previous = 0;       // progress of the sample before, 0 to 1
+  host::Time previousT = at;
+  for ( size_t i = 0; i < samples.size(); i++ ) {
+    float progress = ( step != 0 ) ? ( samples[i].height - start ) / step : 1;
+    float levels[2] = { 0.1f, 0.9f };
+    float *times[2] = { &t10, &t90 };
+    for ( int k = 0; k < 2; k++ ) {
+      if ( *times[k] < 0 && progress >= levels[k] ) {
+        float f = ( progress != previous ) ? ( levels[k] - previous ) / ( progress - previous ) : 1;
+        *times[k] = Ms( previousT ) + f * ( Ms( samples[i].t ) - Ms( previousT ) );
+      }
+    }
+    float past = sign * ( samples[i].height - target );
+    if ( past > m.overshoot ) {
+      m.overshoot = past;
+    }
+    previous = progress;
+    previousT = samples[i].t;
+  }
+  if ( t90 >= 0 ) {
+    m.rise = t90 - t10;
+  }
+
+  // the last time it was out of the band
+  size_t last = samples.size();
+  while ( last > 0 && fabsf( samples[last - 1].height - target ) <= band ) {
+    last--;
+  }
+  if ( last == 0 ) {
+    m.settling = 0;
+  } else if ( last < samples.size() ) {
+    m.settling = Ms( samples[last].t );
+  }
+  m.finalError = samples.back().height - target;
+  return m;
+}
+
+float StepResponse::Ms( host::Time t ) const {
+  return ( t - at ) / (float)host::MS;
+}
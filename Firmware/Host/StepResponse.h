@@ -0,0 +1,48 @@
+/****************************************************************************
+
+  Header file for StepResponse
+  Rise time, overshoot and settling time of a pin moving to a new
+  target, from samples of its height
+
+  Times are from the step, the command reaching the slave. The
+  default settling band is 2 % of the step, but no tighter than the
+  deadzone plus one pulse the PID stops within.
+
+ ****************************************************************************/
+
+#ifndef STEP_RESPONSE_H
+#define STEP_RESPONSE_H
+
+#include <vector>
+#include "HostBoard.h"
+
+struct StepMetrics {
+  float rise;           // [ms] 10 % to 90 % of the step, -1 if it never got there
+  float overshoot;      // [mm] furthest past the target
+  float settling;       // [ms] until it stays within band, -1 if it doesn't
+  float finalError;     // [mm] last sample to the target
+  float band;           // [mm]
+};
+
+class StepResponse
+{
+  public:
+    StepResponse( float start, float target, host::Time at );
+
+    void Add( host::Time t, float height );    // in time order
+    StepMetrics Metrics( void ) const;
+    StepMetrics Metrics( float band ) const;
+
+  private:
+    struct Sample {
+      host::Time t;
+      float height;
+    };
+    float Ms( host::Time t ) const;
+
+    float start, target;
+    host::Time at;
+    std::vector<Sample> samples;
+};
+
+#endif
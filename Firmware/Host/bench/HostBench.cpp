@@ -0,0 +1,218 @@
+/****************************************************************************
+ Module
+   HostBench.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   Runs the benchmarks of a host bench program, see HostBench.h
+
+ Notes
+   --benchmark_filter=regex, --benchmark_min_time=seconds,
+   --benchmark_format=console|json, --benchmark_out=file (JSON)
+   The iterations grow until a run takes the minimum time, like
+   Google Benchmark; the JSON has the fields its compare.py reads.
+****************************************************************************/
+
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "HostBench.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define MAX_ITERATIONS      ((int64_t)1000000000)
+#define DEFAULT_MIN_TIME    0.5         // [s]
+
+namespace hostbench {
+
+struct Bench {
+  std::string name;
+  BenchFunction function;
+  int arg;
+};
+
+struct Result {
+  std::string name;
+  int64_t iterations;
+  double realTime, cpuTime;             // [ns] per iteration
+  double bytesPerSecond, itemsPerSecond;
+};
+
+static std::vector<Bench> &Benches( void ) {
+  static std::vector<Bench> benches;
+  return benches;
+}
+
+static double Seconds( const timespec &from, const timespec &to ) {
+  return ( to.tv_sec - from.tv_sec ) + ( to.tv_nsec - from.tv_nsec ) * 1e-9;
+}
+
+State::State( int64_t iterations, int range )
+  : realTime(0), cpuTime(0), bytesProcessed(0), itemsProcessed(0),
+    total(iterations), left(iterations), arg(range), started(false) {}
+
+bool State::KeepRunning( void ) {
+  if ( !started ) {
+    started = true;
+    clock_gettime( CLOCK_MONOTONIC, &realStart );
+    clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &cpuStart );
+  }
+  if ( left-- > 0 ) {
+    return true;
+  }
+  timespec realEnd, cpuEnd;
+  clock_gettime( CLOCK_MONOTONIC, &realEnd );
+  clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &cpuEnd );
+  realTime = Seconds( realStart, realEnd );
+  cpuTime = Seconds( cpuStart, cpuEnd );
+  return false;
+}
+
+Registration::Registration( const char *name, BenchFunction function,
+                            std::initializer_list<int> args ) {
+  if ( args.size() == 0 ) {
+    Bench bench = { name, function, 0 };
+    Benches().push_back( bench );
+  }
+  for ( int arg : args ) {
+    Bench bench = { std::string( name ) + "/" + std::to_string( arg ), function, arg };
+    Benches().push_back( bench );
+  }
+}
+
+/****************************************************************************
+
+  Private Functions
+
+****************************************************************************/
+
+// Grow the iterations until a run takes minTime
+static Result Run( const Bench &bench, double minTime ) {
+  int64_t iterations = 1;
+  for ( ;; ) {
+    State state( iterations, bench.arg );
+    bench.function( state );
+    if ( state.realTime >= minTime || iterations >= MAX_ITERATIONS ) {
+      Result result;
+      result.name = bench.name;
+      result.iterations = iterations;
+      result.realTime = state.realTime * 1e9 / iterations;
+      result.cpuTime = state.cpuTime * 1e9 / iterations;
+      result.bytesPerSecond = state.cpuTime > 0 ? state.bytesProcessed / state.cpuTime : 0;
+      result.itemsPerSecond = state.cpuTime > 0 ? state.itemsProcessed / state.cpuTime : 0;
+      return result;
+    }
+    // aim 40% past minTime, at most 10x more at a time
+    double factor = state.realTime > 0 ? 1.4 * minTime / state.realTime : 10;
+    int64_t next = (int64_t)( iterations * std::min( std::max( factor, 1.0 ), 10.0 ) );
+    iterations = std::min( std::max( next, iterations + 1 ), MAX_ITERATIONS );
+  }
+}
+
+static void WriteJson( FILE *file, const char *executable, const std::vector<Result> &results ) {
+  char date[64], host[256] = "";
+  time_t now = time( 0 );
+  strftime( date, sizeof date, "%Y-%m-%dT%H:%M:%S%z", localtime( &now ) );
+  gethostname( host, sizeof host - 1 );
+  fprintf( file, "{\n  \"context\": {\n" );
+  fprintf( file, "    \"date\": \"%s\",\n    \"host_name\": \"%s\",\n", date, host );
+  fprintf( file, "    \"executable\": \"%s\",\n    \"num_cpus\": %ld,\n",
+           executable, sysconf( _SC_NPROCESSORS_ONLN ) );
+  fprintf( file, "    \"library_build_type\": \"release\"\n  },\n  \"benchmarks\": [\n" );
+  for ( size_t i = 0; i < results.size(); i++ ) {
+    const Result &r = results[i];
+    fprintf( file, "    {\n      \"name\": \"%s\",\n      \"run_name\": \"%s\",\n",
+             r.name.c_str(), r.name.c_str() );
+    fprintf( file, "      \"run_type\": \"iteration\",\n      \"repetitions\": 1,\n"
+                   "      \"repetition_index\": 0,\n      \"threads\": 1,\n" );
+    fprintf( file, "      \"iterations\": %lld,\n      \"real_time\": %.6e,\n"
+                   "      \"cpu_time\": %.6e,\n      \"time_unit\": \"ns\"",
+             (long long)r.iterations, r.realTime, r.cpuTime );
+    if ( r.bytesPerSecond > 0 ) {
+      fprintf( file, ",\n      \"bytes_per_second\": %.6e", r.bytesPerSecond );
+    }
+    if ( r.itemsPerSecond > 0 ) {
+      fprintf( file, ",\n      \"items_per_second\": %.6e", r.itemsPerSecond );
+    }
+    fprintf( file, "\n    }%s\n", i + 1 < results.size() ? "," : "" );
+  }
+  fprintf( file, "  ]\n}\n" );
+}
+
+static void PrintResult( FILE *file, const Result &r ) {
+  fprintf( file, "%-40s %12.1f ns %12.1f ns %12lld", r.name.c_str(), r.realTime,
+           r.cpuTime, (long long)r.iterations );
+  if ( r.bytesPerSecond > 0 ) {
+    fprintf( file, "  %.1f MB/s", r.bytesPerSecond / 1e6 );
+  }
+  if ( r.itemsPerSecond > 0 ) {
+    fprintf( file, "  %.3g items/s", r.itemsPerSecond );
+  }
+  fprintf( file, "\n" );
+}
+
+}  // namespace hostbench
+
+int main( int argc, char **argv ) {
+  using namespace hostbench;
+  const char *filter = 0, *out = 0;
+  double minTime = DEFAULT_MIN_TIME;
+  bool json = false;
+  for ( int a = 1; a < argc; a++ ) {
+    if ( !strncmp( argv[a], "--benchmark_filter=", 19 ) ) {
+      filter = argv[a] + 19;
+    } else if ( !strncmp( argv[a], "--benchmark_min_time=", 21 ) ) {
+      minTime = atof( argv[a] + 21 );
+    } else if ( !strcmp( argv[a], "--benchmark_format=json" ) ) {
+      json = true;
+    } else if ( !strcmp( argv[a], "--benchmark_format=console" ) ) {
+      json = false;
+    } else if ( !strncmp( argv[a], "--benchmark_out=", 16 ) ) {
+      out = argv[a] + 16;
+    } else {
+      fprintf( stderr, "usage: %s [--benchmark_filter=regex] [--benchmark_min_time=s]\n"
+                       "       [--benchmark_format=console|json] [--benchmark_out=file]\n",
+               argv[0] );
+      return 2;
+    }
+  }
+  regex_t pattern;
+  if ( filter && regcomp( &pattern, filter, REG_EXTENDED | REG_NOSUB ) != 0 ) {
+    fprintf( stderr, "bad filter: %s\n", filter );
+    return 2;
+  }
+
+  // the table goes to stderr when stdout gets the JSON
+  FILE *console = json ? stderr : stdout;
+  fprintf( console, "%-40s %15s %15s %12s\n", "Benchmark", "Time", "CPU", "Iterations" );
+  std::vector<Result> results;
+  for ( size_t i = 0; i < Benches().size(); i++ ) {
+    const Bench &bench = Benches()[i];
+    if ( filter && regexec( &pattern, bench.name.c_str(), 0, 0, 0 ) != 0 ) {
+      continue;
+    }
+    results.push_back( Run( bench, minTime ) );
+    PrintResult( console, results.back() );
+    fflush( console );
+  }
+
+  if ( json ) {
+    WriteJson( stdout, argv[0], results );
+  }
+  if ( out ) {
+    FILE *file = fopen( out, "w" );
+    if ( !file ) {
+      perror( out );
+      return 1;
+    }
+    WriteJson( file, argv[0], results );
+    fclose( file );
+  }
+  return 0;
+}
@@ -0,0 +1,70 @@
+/****************************************************************************
+
+  Header file for HostBench
+  Micro-benchmarks of the firmware on the PC, one program per
+  bench/bench_*.cpp, in the manner of Google Benchmark
+
+    BENCH( Name ) { setup; while ( state.KeepRunning() ) { ... } }
+    BENCH_ARGS( Name, 8, 63, 300 ) { ... state.range() ... }
+
+  Each benchmark runs until it took --benchmark_min_time seconds.
+  Results go to the console, and as Google Benchmark JSON to stdout
+  (--benchmark_format=json) or to a file (--benchmark_out=file), so
+  tools/bench_compare.py can compare a run with a saved baseline.
+  Times are of the PC, only the ratios between runs mean anything.
+
+ ****************************************************************************/
+
+#ifndef HOST_BENCH_H
+#define HOST_BENCH_H
+
+#include <stdint.h>
+#include <time.h>
+#include <initializer_list>
+
+namespace hostbench {
+
+class State
+{
+  public:
+    State( int64_t iterations, int range );
+
+    // true while there are iterations left, the clock runs from the
+    // first call to the last one
+    bool KeepRunning( void );
+    int range( void ) const { return arg; }
+    int64_t iterations( void ) const { return total; }
+    void SetBytesProcessed( int64_t bytes ) { bytesProcessed = bytes; }
+    void SetItemsProcessed( int64_t items ) { itemsProcessed = items; }
+
+    double realTime, cpuTime;         // [s] of the timed loop
+    int64_t bytesProcessed, itemsProcessed;
+
+  private:
+    int64_t total, left;
+    int arg;
+    bool started;
+    timespec realStart, cpuStart;
+};
+
+typedef void (*BenchFunction)( State &state );
+
+struct Registration {
+  Registration( const char *name, BenchFunction function, std::initializer_list<int> args );
+};
+
+// Keeps the compiler from dropping a result nobody reads
+template <class T> inline void DoNotOptimize( const T &value ) {
+  asm volatile( "" : : "r,m"( value ) : "memory" );
+}
+
+}  // namespace hostbench
+
+#define BENCH_ARGS( name, ... ) \
+  static void name( hostbench::State &state ); \
+  static hostbench::Registration name##Registration( #name, name, { __VA_ARGS__ } ); \
+  static void name( hostbench::State &state )
+
+#define BENCH( name ) BENCH_ARGS( name )
+
+#endif
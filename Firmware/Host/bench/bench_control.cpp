@@ -0,0 +1,75 @@
+/****************************************************************************
+ Module
+   bench_control.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   The slave's control step: PID::Compute() and ShapePin::RunSM() in
+   each PinState_t
+
+ Notes
+   RunSM/n is the PinState_t n: 0 IDLE, 1 WAITING4SWITCH,
+   2 MOVING2TARGET, 3 UP_STATE, 4 DOWN_STATE, 5 DEBUG.
+   The pin is wired as pin 1 of slave 0, on a board that isn't booted
+   and has nothing on its pins; its clock moves on by a control period
+   (a PID sample time for Compute) every iteration.
+****************************************************************************/
+
+#include "HostBench.h"
+#include "HostSketches.h"
+#include "ShapePin.h"
+
+#define PIN             1
+#define CONTROL_PERIOD  (CONTROL_PERIOD_US * host::US)
+#define PID_PERIOD      (2 * host::MS)      // ShapePin's SetSampleTime(2)
+
+static host::Device &Board( void ) {
+  static host::Device *board = new host::Device( hostSlaveImages[0], 0 );
+  return *board;
+}
+
+BENCH( PidCompute ) {
+  host::Device::Probe probe( Board() );
+  PID pid( DEFAULT_KP, DEFAULT_KI, DEFAULT_KD );
+  pid.SetOutputLimits( -DEFAULT_SPEED, DEFAULT_SPEED );
+  pid.SetSampleTime( 2 );
+  int input = 0;
+  while ( state.KeepRunning() ) {
+    Board().Advance( PID_PERIOD );
+    hostbench::DoNotOptimize( pid.Compute( input, 400 ) );
+    input = ( input + 7 ) % 500;
+  }
+  state.SetItemsProcessed( state.iterations() );
+}
+
+BENCH( PidComputeWithRate ) {
+  host::Device::Probe probe( Board() );
+  PID pid( DEFAULT_KP, DEFAULT_KI, DEFAULT_KD );
+  pid.SetOutputLimits( -DEFAULT_SPEED, DEFAULT_SPEED );
+  pid.SetSampleTime( 2 );
+  int input = 0;
+  while ( state.KeepRunning() ) {
+    Board().Advance( PID_PERIOD );
+    hostbench::DoNotOptimize( pid.Compute( input, 400, 3500L * PID_ONE ) );
+    input = ( input + 7 ) % 500;
+  }
+  state.SetItemsProcessed( state.iterations() );
+}
+
+BENCH_ARGS( RunSM, IDLE, WAITING4SWITCH, MOVING2TARGET, UP_STATE, DOWN_STATE, DEBUG ) {
+  host::Device::Probe probe( Board() );
+  SlaveWiring w;
+  Slave( hostSlaveImages[0] ).wiring( 0, PIN, &w );
+  static ShapePin *pin = new ShapePin( PIN, true, w.motorA, w.motorB, w.encoderA, w.encoderB );
+  pin->CommandTargetPulses( 40 * MM_TO_PULSE );
+  PinState_t pinState = (PinState_t)state.range();
+  while ( state.KeepRunning() ) {
+    Board().Advance( CONTROL_PERIOD );
+    pin->SetState( pinState );
+    pin->RunSM();
+  }
+  Board().ClearUsbOutput();
+  state.SetItemsProcessed( state.iterations() );
+}
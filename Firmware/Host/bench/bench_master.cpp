@@ -0,0 +1,154 @@
+/****************************************************************************
+ Module
+   bench_master.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   The master's SendNewPositions(): packing a 12x24 frame and its
+   commit in each of the ways it can send them
+
+ Notes
+   The master boots on its own, then the frames are sent from a Probe,
+   so its serial writes are free and never wait for the bus; what is
+   timed is the packing, CRC and encoding. Frames alternate between
+   two heights, on every pin or on one slave's pins.
+   The per-slave gather is also timed alone: the master's slaveGather
+   table, copied out once, against the branches on the row it replaced.
+****************************************************************************/
+
+#include <string.h>
+#include <string>
+#include "HostBench.h"
+#include "HostSketches.h"
+
+#define DISPLAY_PINS    288     // default 12x24 display
+#define PINS_PER_SLAVE  6
+#define SLAVES          (DISPLAY_PINS / PINS_PER_SLAVE)
+
+static host::Device &MasterBoard( void ) {
+  static host::Device *master = 0;
+  if ( !master ) {
+    master = new host::Device( hostMasterImage, 0 );
+    while ( master->UsbOutput().find( "Initialized shape display Master" ) == std::string::npos ) {
+      host::RunUntil( host::Now() + 100 * host::MS );
+    }
+  }
+  return *master;
+}
+
+// changed: pins that differ between the two frames
+static void Send( hostbench::State &state, const MasterConfig &config, int changed ) {
+  const MasterHooks &hooks = Master( hostMasterImage );
+  host::Device::Probe probe( MasterBoard() );
+  hooks.setConfig( &config );
+  uint8_t frames[2][DISPLAY_PINS];
+  memset( frames, 20, sizeof frames );
+  memset( frames[1], 21, changed );
+  int f = 0;
+  while ( state.KeepRunning() ) {
+    hooks.sendPositions( frames[f] );
+    f = 1 - f;
+  }
+  state.SetItemsProcessed( state.iterations() );
+}
+
+static MasterConfig Config( void ) {
+  MasterConfig config;
+  host::Device::Probe probe( MasterBoard() );
+  Master( hostMasterImage ).getConfig( &config );
+  config.broadcastPositions = true;
+  config.sendDeltaPositions = true;
+  config.positionBits = 0;
+  return config;
+}
+
+BENCH( SendAllPositions ) {
+  MasterConfig config = Config();
+  config.sendDeltaPositions = false;
+  Send( state, config, DISPLAY_PINS );
+}
+
+BENCH( SendChangedEveryPin ) {
+  Send( state, Config(), DISPLAY_PINS );
+}
+
+BENCH( SendChangedOneSlave ) {
+  Send( state, Config(), PINS_PER_SLAVE );
+}
+
+BENCH( SendPositionsPerSlave ) {
+  MasterConfig config = Config();
+  config.broadcastPositions = false;
+  Send( state, config, DISPLAY_PINS );
+}
+
+BENCH_ARGS( SendPackedPositions, 4, 6, 8, 12 ) {
+  MasterConfig config = Config();
+  config.positionBits = state.range();
+  Send( state, config, DISPLAY_PINS );
+}
+
+/*------------------------------- Gather ----------------------------------*/
+
+static uint16_t gather[SLAVES][PINS_PER_SLAVE];
+static int offset[SLAVES];
+static bool flipped[SLAVES];
+static char zMap[DISPLAY_PINS];
+
+static void CopyGather( void ) {
+  const MasterHooks &hooks = Master( hostMasterImage );
+  MasterConfig config = Config();
+  host::Device::Probe probe( MasterBoard() );
+  hooks.setConfig( &config );
+  for ( int s = 0; s < SLAVES; s++ ) {
+    for ( int p = 0; p < PINS_PER_SLAVE; p++ ) {
+      gather[s][p] = hooks.gatherIndex( s, p );
+    }
+    flipped[s] = gather[s][0] > gather[s][1];
+    offset[s] = flipped[s] ? gather[s][PINS_PER_SLAVE - 1] : gather[s][0];
+  }
+  for ( int i = 0; i < DISPLAY_PINS; i++ ) {
+    zMap[i] = i;
+  }
+}
+
+// The 48 SET_POS payloads of a frame, as SendSlavePositions() fills them
+BENCH( GatherFromTable ) {
+  CopyGather();
+  uint8_t msg[PINS_PER_SLAVE];
+  while ( state.KeepRunning() ) {
+    for ( int s = 0; s < SLAVES; s++ ) {
+      const uint16_t *g = gather[s];
+      for ( int j = 0; j < PINS_PER_SLAVE; j++ ) {
+        msg[j] = zMap[g[j]];
+      }
+      hostbench::DoNotOptimize( msg );
+    }
+  }
+  state.SetBytesProcessed( state.iterations() * DISPLAY_PINS );
+}
+
+// The same, with the branch on the row and the index arithmetic the
+// table replaced
+BENCH( GatherWithBranches ) {
+  CopyGather();
+  uint8_t msg[PINS_PER_SLAVE];
+  while ( state.KeepRunning() ) {
+    for ( int s = 0; s < SLAVES; s++ ) {
+      int o = offset[s];
+      if ( !flipped[s] ) {
+        for ( int i = 0, j = 0; i < PINS_PER_SLAVE; i++, j++ ) {
+          msg[i] = zMap[j + o];
+        }
+      } else {
+        for ( int i = 0, j = PINS_PER_SLAVE - 1; i < PINS_PER_SLAVE; i++, j-- ) {
+          msg[i] = zMap[j + o];
+        }
+      }
+      hostbench::DoNotOptimize( msg );
+    }
+  }
+  state.SetBytesProcessed( state.iterations() * DISPLAY_PINS );
+}
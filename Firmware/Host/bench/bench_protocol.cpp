@@ -0,0 +1,201 @@
+/****************************************************************************
+ Module
+   bench_protocol.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   RS485_protocol: the CRCs by table and a bit at a time, sending and encoding a msg, receiving one
+   with recvMsg() and with an RS485Receiver, and the master's parsing
+   of a stream of framed Unity frames
+
+ Notes
+   The library is included, for its static crc8() and crc16(), with
+   the framing the sketches use; bench_protocol_complemented is this
+   file built with the legacy framing, for tools/bench_compare.py.
+   The sizes are a status reply (8), a
+   slave msg (63) and a full 12x24 SET_POS_ALL frame (300).
+   Serial I/O is stubbed: writes go to a buffer, reads come from one.
+****************************************************************************/
+
+#include "HostBench.h"
+#include "HostSketches.h"
+#include "RS485_protocol.cpp"
+
+#define MAX_LENGTH      300
+#define USB_PACKET      64      // bytes the receiver gets per update()
+#define STREAM_FRAMES   16
+#define DATA_CMD        127     // Unity's DataCMD
+#define DISPLAY_PINS    288
+
+static byte data[MAX_LENGTH];
+static byte encoded[RS485_ENCODED_SIZE(MAX_LENGTH)];
+static unsigned int encodedLength;
+static unsigned int readPos;
+static unsigned int written;
+
+static void Write( const byte what ) {
+  encoded[written++ % sizeof encoded] = what;
+}
+
+static int Available( void ) {
+  return encodedLength - readPos;
+}
+
+static int Read( void ) {
+  return readPos < encodedLength ? encoded[readPos++] : -1;
+}
+
+// Payload bytes like a frame's heights, with a few zeros for COBS
+static void Fill( int length ) {
+  for ( int i = 0; i < length; i++ ) {
+    data[i] = ( i % 29 == 5 ) ? 0 : (byte)( i * 37 + 11 );
+  }
+  encodedLength = encodeMsg( data, length, encoded, sizeof encoded );
+}
+
+// recvMsg() reads millis(), so the calls run on a board that isn't booted
+static host::Device &Board( void ) {
+  static host::Device *board = new host::Device( hostSlaveImages[0], 0 );
+  return *board;
+}
+
+BENCH_ARGS( Crc8, 8, 63, 300 ) {
+  Fill( state.range() );
+  while ( state.KeepRunning() ) {
+    hostbench::DoNotOptimize( crc8( data, state.range() ) );
+  }
+  state.SetBytesProcessed( state.iterations() * state.range() );
+}
+
+BENCH_ARGS( Crc16, 63, 300 ) {
+  Fill( state.range() );
+  while ( state.KeepRunning() ) {
+    hostbench::DoNotOptimize( crc16( data, state.range() ) );
+  }
+  state.SetBytesProcessed( state.iterations() * state.range() );
+}
+
+// The CRCs a bit at a time, as the library did before the tables
+static byte BitwiseCrc8( const byte *addr, unsigned int len ) {
+  byte crc = 0;
+  while ( len-- ) {
+    byte inbyte = *addr++;
+    for ( int i = 0; i < 8; i++ ) {
+      byte mix = ( crc ^ inbyte ) & 0x01;
+      crc >>= 1;
+      if ( mix ) {
+        crc ^= 0x8C;
+      }
+      inbyte >>= 1;
+    }
+  }
+  return crc;
+}
+
+static uint16_t BitwiseCrc16( const byte *addr, unsigned int len ) {
+  uint16_t crc = 0xFFFF;
+  while ( len-- ) {
+    crc ^= *addr++ << 8;
+    for ( int i = 0; i < 8; i++ ) {
+      crc = ( crc & 0x8000 ) ? ( crc << 1 ) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+BENCH_ARGS( Crc8Bitwise, 8, 63, 300 ) {
+  Fill( state.range() );
+  while ( state.KeepRunning() ) {
+    hostbench::DoNotOptimize( BitwiseCrc8( data, state.range() ) );
+  }
+  state.SetBytesProcessed( state.iterations() * state.range() );
+}
+
+BENCH_ARGS( Crc16Bitwise, 63, 300 ) {
+  Fill( state.range() );
+  while ( state.KeepRunning() ) {
+    hostbench::DoNotOptimize( BitwiseCrc16( data, state.range() ) );
+  }
+  state.SetBytesProcessed( state.iterations() * state.range() );
+}
+
+BENCH( SendComplemented ) {
+  byte value = 0;
+  while ( state.KeepRunning() ) {
+    sendComplemented( Write, value++ );
+  }
+  state.SetBytesProcessed( state.iterations() );
+}
+
+BENCH_ARGS( SendMsg, 8, 63, 300 ) {
+  Fill( state.range() );
+  while ( state.KeepRunning() ) {
+    sendMsg( Write, data, state.range() );
+  }
+  state.SetBytesProcessed( state.iterations() * state.range() );
+}
+
+BENCH_ARGS( EncodeMsg, 8, 63, 300 ) {
+  Fill( state.range() );
+  byte out[RS485_ENCODED_SIZE(MAX_LENGTH)];
+  while ( state.KeepRunning() ) {
+    hostbench::DoNotOptimize( encodeMsg( data, state.range(), out, sizeof out ) );
+  }
+  state.SetBytesProcessed( state.iterations() * state.range() );
+}
+
+BENCH_ARGS( RecvMsg, 8, 63, 300 ) {
+  Fill( state.range() );
+  host::Device::Probe probe( Board() );
+  byte received[MAX_LENGTH];
+  while ( state.KeepRunning() ) {
+    readPos = 0;
+    hostbench::DoNotOptimize( recvMsg( Available, Read, received, sizeof received ) );
+  }
+  state.SetBytesProcessed( state.iterations() * state.range() );
+}
+
+BENCH_ARGS( ReceiverUpdate, 8, 63, 300 ) {
+  Fill( state.range() );
+  byte received[MAX_LENGTH];
+  RS485Receiver receiver( Available, Read, received, sizeof received );
+  while ( state.KeepRunning() ) {
+    readPos = 0;
+    hostbench::DoNotOptimize( receiver.update() );
+  }
+  state.SetBytesProcessed( state.iterations() * state.range() );
+}
+
+// Back-to-back [SEQ] [DataCMD] [heights] frames of a 12x24 display,
+// a USB packet per update() like the master's ReadUnityFrame()
+BENCH( UnityStream ) {
+  static byte stream[STREAM_FRAMES * RS485_ENCODED_SIZE(2 + DISPLAY_PINS)];
+  unsigned int streamLength = 0;
+  byte frame[2 + DISPLAY_PINS];
+  for ( int f = 0; f < STREAM_FRAMES; f++ ) {
+    frame[0] = f;
+    frame[1] = DATA_CMD;
+    for ( int i = 0; i < DISPLAY_PINS; i++ ) {
+      frame[2 + i] = (byte)( i * 7 + f );
+    }
+    streamLength += encodeMsg( frame, sizeof frame, stream + streamLength,
+                               sizeof stream - streamLength );
+  }
+  byte received[2 + DISPLAY_PINS];
+  RS485Receiver receiver( Available, Read, received, sizeof received );
+  while ( state.KeepRunning() ) {
+    for ( unsigned int at = 0; at < streamLength; at += USB_PACKET ) {
+      unsigned int n = min( (unsigned int)USB_PACKET, streamLength - at );
+      memcpy( encoded, stream + at, n );
+      readPos = 0;
+      encodedLength = n;
+      while ( receiver.update() ) {
+        hostbench::DoNotOptimize( received[0] );
+      }
+    }
+  }
+  state.SetBytesProcessed( state.iterations() * streamLength );
+  state.SetItemsProcessed( state.iterations() * STREAM_FRAMES );
+}
@@ -0,0 +1,173 @@
+/****************************************************************************
+ Module
+   bus.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   The master and 48 slaves on the RS485 buses: bus time of each
+   frame, latency from Unity to the slaves' control steps, the
+   frames and bytes lost to noise and collisions, and a status sweep
+
+ Notes
+   bus [-n slaves] [-r link rate 0-2] [-e bit error rate] [-b buses]
+       [-k position bits] [-x] [-u] [-F] [-f frames/s] [-N frames] [-p]
+   -x sends every pin of every frame (no deltas), -u one SET_POS per
+   slave instead of SET_POS_ALL, -F frames the Unity link (the master
+   sends the newest frame and drops stale ones), -p puts plants on
+   the slave pins. Unity sends at -f without waiting for credits.
+   Every frame puts all pins at a new height, so each one is sent in
+   full and each one changes the slaves' targets.
+   After the frames, Unity asks for the status of every slave.
+****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include "DisplayBus.h"
+
+#define FIRST_HEIGHT    5       // [mm] frame heights go round FIRST_HEIGHT ...
+#define HEIGHTS         40      // ... FIRST_HEIGHT + HEIGHTS - 1
+#define SETTLE          (50 * host::MS)    // run after the last frame
+
+static void Usage( const char *name ) {
+  fprintf( stderr, "usage: %s [-n slaves] [-r link rate 0-2] [-e bit error rate] [-b buses]\n"
+                   "       [-k position bits] [-x] [-u] [-F] [-f frames/s] [-N frames] [-p]\n", name );
+}
+
+int main( int argc, char **argv ) {
+  DisplayBusParams params = DefaultDisplayBus();
+  double rate = 60;
+  int frames = 120;
+  int option;
+  while ( (option = getopt( argc, argv, "n:r:e:b:k:xuFf:N:p" )) != -1 ) {
+    if ( option == 'n' ) {
+      params.slaves = atoi( optarg );
+    } else if ( option == 'r' ) {
+      params.linkRate = atoi( optarg );
+    } else if ( option == 'e' ) {
+      params.bitErrorRate = atof( optarg );
+    } else if ( option == 'b' ) {
+      params.config.rs485Buses = atoi( optarg );
+    } else if ( option == 'k' ) {
+      params.config.positionBits = atoi( optarg );
+    } else if ( option == 'x' ) {
+      params.config.sendDeltaPositions = false;
+    } else if ( option == 'u' ) {
+      params.config.broadcastPositions = false;
+    } else if ( option == 'F' ) {
+      params.config.framedUnityLink = true;
+    } else if ( option == 'f' ) {
+      rate = atof( optarg );
+    } else if ( option == 'N' ) {
+      frames = atoi( optarg );
+    } else if ( option == 'p' ) {
+      params.plants = true;
+    } else {
+      Usage( argv[0] );
+      return 2;
+    }
+  }
+  if ( params.slaves < 1 || params.slaves > hostNumSlaveImages || rate <= 0 || frames < 1 ) {
+    Usage( argv[0] );
+    return 2;
+  }
+
+  DisplayBus bus( params );
+  if ( !bus.Boot( 3 * host::SEC ) ) {
+    printf( "the boards did not boot\n" );
+    return 1;
+  }
+  host::Time period = host::SEC / rate;
+  for ( int f = 0; f < frames; f++ ) {
+    bus.SendFrame( FIRST_HEIGHT + f % HEIGHTS );
+    host::RunUntil( host::Now() + period );
+  }
+  host::RunUntil( host::Now() + SETTLE );
+
+  printf( "%d slaves on %d bus(es) at %d Mbaud, bit error rate %g, %d frames at %.0f/s\n",
+          params.slaves, bus.params.config.rs485Buses, params.linkRate + 1,
+          params.bitErrorRate, frames, rate );
+  printf( "deltas %s, %s, position bits %d, %s Unity link\n",
+          params.config.sendDeltaPositions ? "on" : "off",
+          params.config.broadcastPositions ? "SET_POS_ALL" : "SET_POS per slave",
+          params.config.positionBits, params.config.framedUnityLink ? "framed" : "unframed" );
+
+  // frames on the bus
+  double bytes = 0, busTime = 0, longest = 0;
+  for ( int f = 0; f < frames; f++ ) {
+    bytes += bus.BusBytes( f );
+    busTime += bus.BusTime( f ) / (double)host::US;
+    longest = std::max( longest, bus.BusTime( f ) / (double)host::US );
+  }
+  printf( "per frame: %.0f bytes, bus time %.0f us (longest %.0f us, %.0f%% of the frame period)\n",
+          bytes / frames, busTime / frames, longest, 100 * longest * host::US / period );
+
+  // each slave
+  printf( "slave bus applied  latency ms: mean    max  after bus  rx errors overflows\n" );
+  int lost = 0;
+  for ( int i = 0; i < params.slaves; i++ ) {
+    int count = 0;
+    double sum = 0, most = 0, afterBus = 0;
+    for ( int f = 0; f < frames; f++ ) {
+      host::Time at = bus.Applied( i, f );
+      if ( at ) {
+        double ms = ( at - bus.Sent(f) ) / (double)host::MS;
+        count++;
+        sum += ms;
+        most = std::max( most, ms );
+        afterBus += ( (double)at - bus.BusEnd(f) ) / host::MS;
+      }
+    }
+    lost += frames - count;
+    printf( "%5d %3d %7d %19.2f %6.2f %12.2f %10u %9lu\n", i, bus.Bus(i), count,
+            count ? sum / count : 0, most, count ? afterBus / count : 0,
+            bus.RxErrors(i), bus.RxOverflows(i) );
+  }
+
+  // latency over the run: it grows if frames queue up anywhere
+  printf( "latency ms by quarter of the run (applied frames, all slaves):" );
+  for ( int q = 0; q < 4; q++ ) {
+    int count = 0;
+    double sum = 0, most = 0;
+    for ( int f = q * frames / 4; f < ( q + 1 ) * frames / 4; f++ ) {
+      for ( int i = 0; i < params.slaves; i++ ) {
+        if ( bus.Applied( i, f ) ) {
+          double ms = ( bus.Applied( i, f ) - bus.Sent(f) ) / (double)host::MS;
+          count++;
+          sum += ms;
+          most = std::max( most, ms );
+        }
+      }
+    }
+    printf( "  %.2f (max %.2f)", count ? sum / count : 0, most );
+  }
+  printf( "\n" );
+
+  MasterStats stats = bus.Stats();
+  unsigned long sentBytes = 0, collided = 0, noisy = 0;
+  for ( int b = 0; b < bus.params.config.rs485Buses; b++ ) {
+    sentBytes += bus.lines[b]->bytes;
+    collided += bus.lines[b]->collided;
+    noisy += bus.lines[b]->noisy;
+  }
+  printf( "frames not applied: %d of %d (all slaves), master dropped %lu\n",
+          lost, frames * params.slaves, stats.framesDropped );
+  printf( "line bytes %lu, collided %lu, noisy %lu; master sent %lu msgs\n",
+          sentBytes, collided, noisy, stats.msgsSent );
+  printf( "%lu frames sent as deltas, %lu bytes saved against full frames\n",
+          stats.deltaFrames, stats.deltaBytesSaved );
+
+  host::Time sweep = bus.RequestStatus();
+  int replies = 0;
+  for ( int i = 0; i < params.slaves; i++ ) {
+    uint8_t reply[STATUS_LENGTH];
+    bus.SlaveStatus( i, reply );
+    replies += reply[MSG_ADDR] == MASTER_ID && reply[MSG_DATA] == i;
+  }
+  printf( "status sweep: %d of %d slaves replied, longest bus %.2f ms\n",
+          replies, params.slaves, sweep / (double)host::MS );
+  return 0;
+}
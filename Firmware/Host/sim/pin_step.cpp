@@ -0,0 +1,117 @@
+/****************************************************************************
+ Module
+   pin_step.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   Step responses and stall detection latency of a slave pin on the
+   motor and leadscrew plant, with the motion profile and with the
+   setpoint stepped to the target
+
+ Notes
+   pin_step [-l load N] [-v supply V] [-f friction scale]
+            [-s profile speed mm/s] [-a profile accel mm/s^2]
+   Steps go up from 0 and back, the slave has been zeroed first.
+   The control period is the sketch's PROF_PERIOD stage over the steps.
+****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "SlaveBoard.h"
+#include "ShapePin.h"
+
+#define PIN         1
+#define HOLD        (2 * host::SEC)    // recorded after each step
+
+// the slaves step their setpoints by default (DEFAULT_PROFILE_SPEED 0),
+// the profile to compare them with
+static int profileSpeed = 100;      // [mm/s]
+static int profileAccel = 3000;     // [mm/s^2]
+static const float steps[] = { 1, 2, 5, 10, 20, 40, 55 };   // [mm]
+
+static void PrintStep( float from, float to, const StepMetrics &p, const StepMetrics &s ) {
+  printf( "%6.1f -> %5.1f %8.1f %8.2f %8.1f %8.2f | %8.1f %8.2f %8.1f %8.2f\n", from, to,
+          p.rise, p.overshoot, p.settling, p.finalError,
+          s.rise, s.overshoot, s.settling, s.finalError );
+}
+
+// from and to with the profile, then with step targets
+static void Compare( SlaveBoard &board, float from, float to ) {
+  StepMetrics m[2];
+  for ( int profile = 1; profile >= 0; profile-- ) {
+    board.SetProfile( PIN, profile * profileSpeed, profile * profileAccel );
+    board.Step( PIN, from, HOLD );
+    m[profile] = board.Step( PIN, to, HOLD ).Metrics();
+  }
+  PrintStep( from, to, m[1], m[0] );
+}
+
+int main( int argc, char **argv ) {
+  PinPlantParams params = DefaultPinPlant();
+  int option;
+  while ( (option = getopt( argc, argv, "l:v:f:s:a:" )) != -1 ) {
+    if ( option == 'l' ) {
+      params.load = atof( optarg );
+    } else if ( option == 'v' ) {
+      params.supply = atof( optarg );
+    } else if ( option == 'f' ) {
+      params.coulomb *= atof( optarg );
+      params.stiction *= atof( optarg );
+      params.viscous *= atof( optarg );
+    } else if ( option == 's' ) {
+      profileSpeed = atoi( optarg );
+    } else if ( option == 'a' ) {
+      profileAccel = atoi( optarg );
+    } else {
+      fprintf( stderr, "usage: %s [-l load N] [-v supply V] [-f friction scale]\n"
+                       "       [-s profile speed mm/s] [-a profile accel mm/s^2]\n", argv[0] );
+      return 2;
+    }
+  }
+
+  SlaveBoard board( hostSlaveImages[0], 0, 20, params );
+  if ( !board.Boot( 3 * host::SEC ) || !board.ZeroAll( 5 * host::SEC ) ) {
+    printf( "the pins did not zero\n" );
+    return 1;
+  }
+
+  printf( "load %.1f N, supply %.1f V, profile %d mm/s %d mm/s^2, deadzone %d mm\n",
+          params.load, params.supply, profileSpeed, profileAccel,
+          DEFAULT_DEADZONE );
+  board.ClearProfile();
+  printf( "settling band %.2f mm         profile                |"
+          "            step target\n", board.Step( PIN, 0, HOLD ).Metrics().band );
+  printf( "   step [mm]  rise ms overshoot settle ms error mm |"
+          "  rise ms overshoot settle ms error mm\n" );
+  for ( unsigned int i = 0; i < sizeof steps / sizeof steps[0]; i++ ) {
+    Compare( board, 0, steps[i] );
+    Compare( board, steps[i], 0 );
+  }
+  board.SetProfile( PIN, profileSpeed, profileAccel );
+
+  float min, mean, max;
+  if ( board.Profile( "period", &min, &mean, &max ) ) {
+    printf( "control period %.1f / %.1f / %.1f us (min / mean / max), jitter %.1f us\n",
+            min, mean, max, max - min );
+  }
+
+  // jam the pin on its way up
+  board.Move( PIN, 40 );
+  host::RunUntil( host::Now() + 200 * host::MS );
+  board.plant[PIN]->Jam( true );
+  host::Time jammed = host::Now();
+  int stalls = board.Stalls( PIN );
+  while ( board.Stalls(PIN) == stalls && host::Now() < jammed + 10 * host::SEC ) {
+    host::RunUntil( host::Now() + host::MS );
+  }
+  if ( board.Stalls(PIN) == stalls ) {
+    printf( "stall not detected in 10 s\n" );
+  } else {
+    printf( "stall detected %.0f ms after the jam (STALL_TIME %d ms)\n",
+            ( host::Now() - jammed ) / (float)host::MS, STALL_TIME );
+  }
+  return 0;
+}
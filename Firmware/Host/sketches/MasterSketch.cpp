@@ -0,0 +1,79 @@
+/****************************************************************************
+ Module
+   MasterSketch.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   Master-Unity.ino for the host, with its hooks (HostSketches.h)
+
+ Notes
+   Master-Unity.ino.cpp is made by tools/ino2cpp.py.
+****************************************************************************/
+
+#include "Master-Unity.ino.cpp"
+#include "HostSketches.h"
+
+static void GetConfig( MasterConfig *config ) {
+  config->framedUnityLink = framedUnityLink;
+  config->broadcastPositions = broadcastPositions;
+  config->sendDeltaPositions = sendDeltaPositions;
+  config->adaptiveLinkRate = adaptiveLinkRate;
+  config->positionBits = positionBits;
+  config->rs485Buses = rs485Buses;
+}
+
+static void SetConfig( const MasterConfig *config ) {
+  framedUnityLink = config->framedUnityLink;
+  broadcastPositions = config->broadcastPositions;
+  sendDeltaPositions = config->sendDeltaPositions;
+  adaptiveLinkRate = config->adaptiveLinkRate;
+  positionBits = config->positionBits;
+  rs485Buses = constrain( config->rs485Buses, 1, NUM_BUSES );
+}
+
+static void Stats( MasterStats *stats ) {
+  stats->bytesSent = rs485BytesSent;
+  stats->msgsSent = rs485MsgsSent;
+  stats->framesDropped = framesDropped;
+  stats->unityFramesLost = unityFramesLost;
+  stats->deltaFrames = deltaFrames;
+  stats->deltaBytesSaved = deltaBytesSaved;
+  stats->frameSeq = frameSeq;
+  stats->linkRate = linkRate;
+  stats->numSlaves = numSlaves;
+}
+
+static void LinkRate( int rate ) {
+  SetLinkRate( constrain( rate, 0, NUM_LINK_RATES - 1 ) );
+}
+
+static void AdaptiveLink( int mode ) {
+  SetAdaptiveLink( mode );
+}
+
+static int LinkDecision( unsigned long errors, unsigned long msgs ) {
+  linkRate = NextLinkRate( errors, msgs );
+  return linkRate;
+}
+
+static void SendPositions( const uint8_t *heights ) {
+  memcpy( zMap, heights, displaySize );
+  UpdateFineFromMM();
+  SendNewPositions();
+}
+
+static int GatherIndex( int slave, int pin ) {
+  return slaveGather[slave][pin];
+}
+
+static void SlaveStatus( int slave, uint8_t *reply ) {
+  memcpy( reply, slaveStatus[slave], STATUS_LENGTH );
+}
+
+extern "C" const MasterHooks hostMaster = {
+  { setup, loop },
+  GetConfig, SetConfig, Stats, LinkRate, AdaptiveLink, LinkDecision, SendPositions,
+  GatherIndex, SlaveStatus
+};
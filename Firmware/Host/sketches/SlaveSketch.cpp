@@ -0,0 +1,95 @@
+/****************************************************************************
+ Module
+   SlaveSketch.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   Slave.ino for the host, with its hooks (HostSketches.h)
+
+ Notes
+   Slave.ino.cpp is the sketch with the prototypes the Arduino
+   builder adds, made by tools/ino2cpp.py.
+****************************************************************************/
+
+#include "Slave.ino.cpp"
+#include "HostSketches.h"
+
+static void Wiring( int id, int pin, SlaveWiring *wiring ) {
+  Mapping m( id );
+  wiring->motorA = m.pin_motor[2*pin];
+  wiring->motorB = m.pin_motor[2*pin + 1];
+  wiring->encoderA = m.pin_encoder[2*pin];
+  wiring->encoderB = m.pin_encoder[2*pin + 1];
+  wiring->sw = m.pin_switch[pin];
+  // as in setupSwitches()
+  wiring->analogSwitch = (id % 4 == 3) && ( (pin == 0) || (pin == 4) || (pin == 5) );
+}
+
+static bool Post( int pin, byte type, int pulses, unsigned int duration, byte mode ) {
+  PinCommand command;
+  command.type = type;
+  command.pos = pulses;
+  command.duration = duration;
+  command.mode = mode;
+  return pinCommands[pin].Push( command );
+}
+
+static bool Move( int pin, int pulses, unsigned int duration, int mode ) {
+  return Post( pin, PIN_CMD_MOVE, pulses, duration, mode );
+}
+
+static bool Zero( int pin ) {
+  return Post( pin, PIN_CMD_ZERO, 0, 0, 0 );
+}
+
+static bool Idle( int pin ) {
+  return Post( pin, PIN_CMD_IDLE, 0, 0, 0 );
+}
+
+// as a SET_PARAMS with the pin's other params unchanged, applied on
+// the next control step
+static void SetProfile( int pin, int speed, int accel ) {
+  pinParams.pin[pin].profileSpeed = speed;
+  pinParams.pin[pin].profileAccel = accel;
+  PublishParams();
+}
+
+static void SetParams( const uint8_t *blocks, unsigned int len ) {
+  SetPinParams( blocks, len );
+}
+
+static int Position( int pin ) {
+  return pins[pin].GetPosPulses();
+}
+
+static int Target( int pin ) {
+  return pins[pin].GetTargetPulses();
+}
+
+static int State( int pin ) {
+  return pins[pin].GetState();
+}
+
+static int Stalls( int pin ) {
+  return pins[pin].GetStallCount();
+}
+
+static float Velocity( int pin ) {
+  return pins[pin].GetVelocity() / (float)PID_ONE;
+}
+
+static unsigned int RxErrors( void ) {
+  return rs485Receiver.getErrors();
+}
+
+static void SetBlockingReceive( bool on ) {
+  blockingReceive = on;
+}
+
+extern "C" const SlaveHooks hostSlave = {
+  { setup, loop },
+  Wiring, Move, Zero, Idle, SetProfile, SetParams,
+  Position, Target, State, Stalls, Velocity, RxErrors, SetBlockingReceive
+};
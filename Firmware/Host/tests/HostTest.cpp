@@ -0,0 +1,78 @@
+/****************************************************************************
+ Module
+   HostTest.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   Runs the tests of a host test program, see HostTest.h
+
+ Notes
+   Takes test names as arguments to run only those.
+****************************************************************************/
+
+#include <string.h>
+#include <vector>
+#include "HostTest.h"
+
+namespace hosttest {
+
+struct Test {
+  const char *name;
+  TestFunction function;
+};
+
+static std::vector<Test> &Tests( void ) {
+  static std::vector<Test> tests;
+  return tests;
+}
+
+static int failures = 0;
+
+Registration::Registration( const char *name, TestFunction function ) {
+  Test test = { name, function };
+  Tests().push_back( test );
+}
+
+bool Check( bool ok, const char *expression, const char *file, int line ) {
+  if ( !ok ) {
+    printf( "%s:%d: failed: %s\n", file, line, expression );
+    failures++;
+  }
+  return ok;
+}
+
+bool CheckNear( double a, double b, double tolerance, const char *expression,
+                const char *file, int line ) {
+  bool ok = fabs( a - b ) <= tolerance;
+  if ( !ok ) {
+    printf( "%s:%d: failed: %s (%g vs %g, tolerance %g)\n",
+            file, line, expression, a, b, tolerance );
+    failures++;
+  }
+  return ok;
+}
+
+}  // namespace hosttest
+
+int main( int argc, char **argv ) {
+  using namespace hosttest;
+  int run = 0;
+  for ( size_t i = 0; i < Tests().size(); i++ ) {
+    bool selected = ( argc < 2 );
+    for ( int a = 1; a < argc; a++ ) {
+      selected = selected || !strcmp( argv[a], Tests()[i].name );
+    }
+    if ( !selected ) {
+      continue;
+    }
+    int before = failures;
+    Tests()[i].function();
+    printf( "%-40s %s\n", Tests()[i].name, failures == before ? "ok" : "FAILED" );
+    fflush( stdout );
+    run++;
+  }
+  printf( "%d tests, %d failed checks\n", run, failures );
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,44 @@
+/****************************************************************************
+
+  Header file for HostTest
+  A few macros for the host tests, one program per tests/test_*.cpp
+
+    TEST( Name ) { CHECK( ... ); CHECK_NEAR( a, b, tolerance ); }
+
+  A failed check prints where and goes on with the test; the program
+  fails if any check did.
+
+ ****************************************************************************/
+
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <stdio.h>
+#include <math.h>
+
+namespace hosttest {
+
+typedef void (*TestFunction)( void );
+
+struct Registration {
+  Registration( const char *name, TestFunction function );
+};
+
+bool Check( bool ok, const char *expression, const char *file, int line );
+bool CheckNear( double a, double b, double tolerance, const char *expression,
+                const char *file, int line );
+
+}  // namespace hosttest
+
+#define TEST( name ) \
+  static void name( void ); \
+  static hosttest::Registration name##Registration( #name, name ); \
+  static void name( void )
+
+#define CHECK( condition ) \
+  hosttest::Check( (condition), #condition, __FILE__, __LINE__ )
+
+#define CHECK_NEAR( a, b, tolerance ) \
+  hosttest::CheckNear( (a), (b), (tolerance), #a " ~ " #b, __FILE__, __LINE__ )
+
+#endif
@@ -0,0 +1,236 @@
+/****************************************************************************
+ Module
+   test_bus.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   The master and slaves 0-3 on one RS485 line: frames reach the
+   slaves' control steps, bus time follows the bytes sent, noise is
+   seen as receive errors and lost frames, a status sweep gets every
+   slave's reply, a flood of framed frames keeps its latency, the
+   slaves' loop() rate with the bus busy, and frames at the top link
+   rate
+
+ Notes
+   One DisplayBus for all the tests, the sketch copies can only boot
+   once. sim/bus runs the full display.
+****************************************************************************/
+
+#include "HostTest.h"
+#include "DisplayBus.h"
+
+#define SLAVES          4
+#define FRAME_PERIOD    (16667 * host::US)  // 60 frames/s
+#define CONTROL_PERIOD  (500 * host::US)    // slaves' control step, 2 kHz
+#define DISPLAY_PINS    288                 // the master's default 12x24 display
+#define FLOOD_PERIOD    (1000 * host::US)   // a third of a frame's bus time
+#define FLOOD_FRAMES    60
+#define USB_TIMEOUT     (1100 * host::MS)   // an unframed readBytes() gives up
+#define RATE_FRAMES     60                  // a second of frames for the loop rate
+#define LINK_FRAMES     10                  // at each link rate
+
+static DisplayBus &Bus( void ) {
+  static DisplayBus *bus = 0;
+  if ( !bus ) {
+    DisplayBusParams params = DefaultDisplayBus();
+    params.slaves = SLAVES;
+    bus = new DisplayBus( params );
+    bus->Boot( 3 * host::SEC );
+  }
+  return *bus;
+}
+
+// count frames, heights going round 10 ... 29 mm
+static void SendFrames( int count ) {
+  static int height = 0;
+  for ( int i = 0; i < count; i++ ) {
+    Bus().SendFrame( 10 + height++ % 20 );
+    host::RunUntil( host::Now() + FRAME_PERIOD );
+  }
+}
+
+TEST( FramesReachEverySlave ) {
+  DisplayBus &bus = Bus();
+  CHECK( bus.master.UsbOutput().find("Master - v04") != std::string::npos );
+  SendFrames( 10 );
+  for ( int f = 0; f < 10; f++ ) {
+    for ( int i = 0; i < SLAVES; i++ ) {
+      host::Time at = bus.Applied( i, f );
+      CHECK( at > bus.BusEnd(f) );
+      // the next control step after the commit, and a loop() to read it
+      CHECK( at < bus.BusEnd(f) + CONTROL_PERIOD + 100 * host::US );
+    }
+  }
+  CHECK( bus.Stats().framesDropped == 0 );
+}
+
+TEST( BusTimeIsByteTimes ) {
+  DisplayBus &bus = Bus();
+  // the whole frame is queued at once, so its bytes go back to back
+  for ( int f = 0; f < 10; f++ ) {
+    CHECK( bus.BusBytes(f) > DISPLAY_PINS );
+    CHECK( bus.BusTime(f) == bus.BusBytes(f) * bus.ByteTime() );
+  }
+}
+
+TEST( NoiseLosesFrames ) {
+  DisplayBus &bus = Bus();
+  unsigned int errors = 0;
+  for ( int i = 0; i < SLAVES; i++ ) {
+    errors += bus.RxErrors( i );
+  }
+  CHECK( errors == 0 );
+
+  bus.lines[0]->bitErrorRate = 1e-4;
+  SendFrames( 40 );
+  bus.lines[0]->bitErrorRate = 0;
+  int lost = 0;
+  for ( int f = 10; f < 50; f++ ) {
+    for ( int i = 0; i < SLAVES; i++ ) {
+      lost += ( bus.Applied(i, f) == 0 );
+    }
+  }
+  for ( int i = 0; i < SLAVES; i++ ) {
+    errors += bus.RxErrors( i );
+  }
+  CHECK( bus.lines[0]->noisy > 0 );
+  CHECK( errors > 0 );
+  CHECK( lost > 0 && lost < 40 * SLAVES );
+
+  // clean again
+  SendFrames( 2 );
+  for ( int i = 0; i < SLAVES; i++ ) {
+    CHECK( bus.Applied(i, 51) != 0 );
+  }
+}
+
+// A StatusCMD between frames: every slave replies in its slot, with
+// its own ID, errors and pins, and no two replies overlap
+TEST( StatusSweepReachesEverySlave ) {
+  DisplayBus &bus = Bus();
+  unsigned long collided = bus.lines[0]->collided;
+  host::Time sweep = bus.RequestStatus();
+  printf( "status sweep of %d slaves: %.0f us, %d us of slots\n", SLAVES,
+          sweep / (double)host::US, ( SLAVES + 1 ) * STATUS_SLOT_US );
+  CHECK( sweep > 0 && sweep <= ( SLAVES + 1 ) * STATUS_SLOT_US * host::US );
+  CHECK( bus.lines[0]->collided == collided );
+  for ( int i = 0; i < SLAVES; i++ ) {
+    uint8_t reply[STATUS_LENGTH];
+    bus.SlaveStatus( i, reply );
+    CHECK( reply[MSG_ADDR] == MASTER_ID && reply[MSG_CMD] == PIN_STATUS );
+    CHECK( reply[MSG_DATA] == i );
+    CHECK( ( reply[MSG_DATA + 1] << 8 | reply[MSG_DATA + 2] ) == (int)bus.RxErrors( i ) );
+    host::Device::Probe probe( *bus.slaves[i] );
+    const SlaveHooks &slave = Slave( hostSlaveImages[i] );
+    for ( int p = 0; p < NUM_MOTORS; p++ ) {
+      const uint8_t *pin = &reply[MSG_DATA + 3 + 5 * p];
+      CHECK( (int16_t)( pin[0] << 8 | pin[1] ) == slave.position( p ) );
+      CHECK( ( pin[2] & 0x0F ) == slave.state( p ) );
+      CHECK( pin[3] == slave.stalls( p ) );
+      CHECK( pin[4] == 0 );     // no plants, nothing moves
+    }
+  }
+}
+
+// Unity sends three times faster than the bus goes: the master sends
+// the newest frame, so a frame waits at most one frame on the bus
+TEST( FloodKeepsLatencyBounded ) {
+  DisplayBus &bus = Bus();
+  {
+    host::Device::Probe probe( bus.master );
+    bus.params.config.framedUnityLink = true;
+    bus.hooks.setConfig( &bus.params.config );
+  }
+  host::RunUntil( host::Now() + USB_TIMEOUT );
+  MasterStats before = bus.Stats();
+  int first = bus.SendFrame( 10 );
+  host::RunUntil( host::Now() + FRAME_PERIOD );
+  for ( int f = 1; f < FLOOD_FRAMES; f++ ) {
+    bus.SendFrame( 10 + f % 20 );
+    host::RunUntil( host::Now() + FLOOD_PERIOD );
+  }
+  host::RunUntil( host::Now() + FRAME_PERIOD );
+
+  host::Time frameTime = bus.BusTime( first );
+  int applied = 0;
+  for ( int f = first; f < first + FLOOD_FRAMES; f++ ) {
+    host::Time at = bus.Applied( 0, f );
+    if ( at ) {
+      applied++;
+      CHECK( at - bus.Sent(f) < 2 * frameTime + CONTROL_PERIOD + host::MS );
+    }
+    for ( int i = 1; i < SLAVES; i++ ) {
+      CHECK( ( bus.Applied(i, f) != 0 ) == ( at != 0 ) );
+    }
+  }
+  MasterStats stats = bus.Stats();
+  CHECK( applied > 1 && applied < FLOOD_FRAMES / 2 );
+  CHECK( stats.framesDropped - before.framesDropped == (unsigned long)( FLOOD_FRAMES - applied ) );
+  // the newest frame is always sent
+  CHECK( bus.Applied( 0, first + FLOOD_FRAMES - 1 ) != 0 );
+}
+
+// loop() passes per second of slave 0 and its longest readMSG() [us],
+// over a second of frames
+static double LoopRate( bool blocking, float *readMax ) {
+  DisplayBus &bus = Bus();
+  host::Device &slave = *bus.slaves[0];
+  {
+    host::Device::Probe probe( slave );
+    Slave( hostSlaveImages[0] ).setBlockingReceive( blocking );
+  }
+  SlaveClearProfile( slave );
+  host::Time start = host::Now();
+  SendFrames( RATE_FRAMES );
+  double seconds = ( host::Now() - start ) / (double)host::SEC;
+  unsigned long loops = 0, reads = 0;
+  float min, mean, max;
+  CHECK( SlaveProfile( slave, "loop", &loops, &min, &mean, &max ) );
+  CHECK( SlaveProfile( slave, "readMSG", &reads, &min, &mean, readMax ) );
+  return loops / seconds;
+}
+
+// The receiver only takes the bytes that are there; recvMsg() waited
+// for a whole msg, up to 8 ms when the bus was quiet, so loop() ran a
+// few hundred times a second
+TEST( LoopRateWhileBusBusy ) {
+  float blockingRead = 0, receiverRead = 0;
+  double blocking = LoopRate( true, &blockingRead );
+  double receiver = LoopRate( false, &receiverRead );
+  printf( "loop() at %.0f /s with recvMsg (longest read %.0f us), "
+          "%.0f /s with the receiver (%.0f us)\n",
+          blocking, blockingRead, receiver, receiverRead );
+  CHECK( blocking < 500 );
+  CHECK( receiver > 50 * blocking );
+  CHECK( blockingRead > 3000 );
+  CHECK( receiverRead < 200 );
+}
+
+// SET_BAUD up to LINK_BAUD(2), as Boot() does for a linkRate: frames
+// still reach every slave, in a third of the bus time, then the same
+// back at the base rate
+TEST( FramesReachEverySlaveAtTopLinkRate ) {
+  DisplayBus &bus = Bus();
+  for ( int rate = 2; rate >= 0; rate -= 2 ) {
+    bus.SetLinkRate( rate );
+    CHECK( bus.Stats().linkRate == rate );
+    host::Time byteTime = bus.ByteTime();
+    int first = bus.SendFrame( 30 );
+    host::RunUntil( host::Now() + FRAME_PERIOD );
+    SendFrames( LINK_FRAMES - 1 );
+    printf( "link rate %d: %lu bytes in %.0f us a frame\n", rate,
+            bus.BusBytes( first ), bus.BusTime( first ) / (double)host::US );
+    for ( int f = first; f < first + LINK_FRAMES; f++ ) {
+      CHECK( bus.BusTime(f) >= bus.BusBytes(f) * byteTime );
+      CHECK( bus.BusTime(f) <= bus.BusBytes(f) * ( byteTime + 1 ) );
+      for ( int i = 0; i < SLAVES; i++ ) {
+        host::Time at = bus.Applied( i, f );
+        CHECK( at > bus.BusEnd(f) );
+        CHECK( at < bus.BusEnd(f) + CONTROL_PERIOD + 100 * host::US );
+      }
+    }
+  }
+}
+
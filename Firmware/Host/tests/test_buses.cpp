@@ -0,0 +1,160 @@
+/****************************************************************************
+ Module
+   test_buses.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   The 12x24 display split across RS485 buses: the frame time of full
+   frames against a model of the bytes each bus carries, for 1, 2 and
+   3 buses, and every slave applying every frame on its own bus
+
+ Notes
+   The master sets up its buses once, in setup(), so each bus count
+   is a program of its own: the Makefile builds this file as
+   test_buses with one bus and as test_buses_2 and test_buses_3.
+   Frames are sent in full (no deltas) as SET_POS_ALL with one bus,
+   one SET_POS_RANGE per bus with more, each followed by the commit on
+   every bus. The buses send at the same time, so a frame takes as
+   long as the busiest one.
+****************************************************************************/
+
+#include <string.h>
+#include <algorithm>
+#include "HostTest.h"
+#include "DisplayBus.h"
+#include "ShapeConstants.h"
+#include "RS485_protocol.h"
+
+#ifndef TEST_BUSES
+  #define TEST_BUSES    1
+#endif
+
+#define SLAVES          48
+#define DISPLAY_ROWS    12
+#define DISPLAY_COLUMNS 24
+#define FRAMES          6
+#define FIRST_HEIGHT    10      // [mm] frame f at FIRST_HEIGHT + f, under 30 mm
+#define FRAME_PERIOD    (host::SEC / 60)
+#define SETTLE          (20 * host::MS)     // run after the last frame
+#define MAX_SPLIT_COST  1.12    // of 1/N of the single bus time
+#define MAX_AFTER_BUS   host::MS            // USB, commit and a control step
+
+static DisplayBus &Bus( void ) {
+  static DisplayBus *bus = 0;
+  if ( !bus ) {
+    DisplayBusParams params = DefaultDisplayBus();
+    params.slaves = SLAVES;
+    params.config.rs485Buses = TEST_BUSES;
+    params.config.sendDeltaPositions = false;
+    params.config.broadcastPositions = true;
+    params.config.positionBits = 0;
+    bus = new DisplayBus( params );
+    bus->Boot( 3 * host::SEC );
+  }
+  return *bus;
+}
+
+// Bytes on the wire of a msg of length bytes, with the sketches'
+// framing. The heights sent are never 0, and COBS adds a code byte
+// to every 254 bytes without one.
+static unsigned int WireBytes( unsigned int length ) {
+  uint8_t msg[2 + DISPLAY_ROWS * DISPLAY_COLUMNS + 2];
+  memset( msg, FIRST_HEIGHT, sizeof msg );
+  uint8_t encoded[RS485_ENCODED_SIZE(sizeof msg)];
+  return encodeMsg( msg, length, encoded, sizeof encoded );
+}
+
+// Bytes bus b of buses carries for a full frame: its rows, the rows
+// split evenly with the last bus taking the rest, and the commit
+static unsigned int FrameBytes( int buses, int b ) {
+  int rows = DISPLAY_ROWS / buses;
+  if ( b == buses - 1 ) {
+    rows = DISPLAY_ROWS - ( buses - 1 ) * rows;
+  }
+  int header = buses == 1 ? 2 : 4;        // SET_POS_ALL, SET_POS_RANGE with a start
+  return WireBytes( header + rows * DISPLAY_COLUMNS ) + WireBytes( 3 );
+}
+
+// [ns] first start bit to last stop bit of the busiest bus
+static host::Time FrameTime( int buses ) {
+  unsigned int most = 0;
+  for ( int b = 0; b < buses; b++ ) {
+    most = std::max( most, FrameBytes( buses, b ) );
+  }
+  return most * Bus().ByteTime();
+}
+
+static unsigned int TotalBytes( int buses ) {
+  unsigned int total = 0;
+  for ( int b = 0; b < buses; b++ ) {
+    total += FrameBytes( buses, b );
+  }
+  return total;
+}
+
+static void SendFrames( void ) {
+  static bool sent = false;
+  if ( !sent ) {
+    for ( int f = 0; f < FRAMES; f++ ) {
+      Bus().SendFrame( FIRST_HEIGHT + f );
+      host::RunUntil( host::Now() + FRAME_PERIOD );
+    }
+    host::RunUntil( host::Now() + SETTLE );
+    sent = true;
+  }
+}
+
+// The model for every bus count, the speedup over one bus
+TEST( FrameTimeModel ) {
+  host::Time single = FrameTime( 1 );
+  printf( "buses  bytes  busiest bus  frame time  speedup\n" );
+  for ( int buses = 1; buses <= 3; buses++ ) {
+    host::Time t = FrameTime( buses );
+    printf( "%5d %6u %12u %8.0f us %8.2fx\n", buses, TotalBytes( buses ),
+            (unsigned int)( t / Bus().ByteTime() ), t / (double)host::US, single / (double)t );
+    CHECK( t * buses <= single * MAX_SPLIT_COST );
+  }
+}
+
+// Each frame on the buses, byte for byte as the model has it
+TEST( FrameTimeMatchesModel ) {
+  SendFrames();
+  DisplayBus &bus = Bus();
+  CHECK( bus.params.config.rs485Buses == TEST_BUSES );
+  int matched = 0;
+  for ( int f = 0; f < FRAMES; f++ ) {
+    matched += bus.BusBytes( f ) == TotalBytes( TEST_BUSES )
+               && bus.BusTime( f ) == FrameTime( TEST_BUSES );
+  }
+  printf( "%d bus(es): %lu bytes, %.0f us a frame, model %u bytes, %.0f us\n",
+          TEST_BUSES, bus.BusBytes( 0 ), bus.BusTime( 0 ) / (double)host::US,
+          TotalBytes( TEST_BUSES ), FrameTime( TEST_BUSES ) / (double)host::US );
+  CHECK( matched == FRAMES );
+}
+
+// Every slave, on the bus of its row, applies every frame soon after
+// the busiest bus is done
+TEST( SlavesApplyOnTheirBus ) {
+  SendFrames();
+  DisplayBus &bus = Bus();
+  int rowsPerBus = DISPLAY_ROWS / TEST_BUSES;
+  int wrongBus = 0, missed = 0;
+  host::Time latest = 0;
+  for ( int s = 0; s < SLAVES; s++ ) {
+    int row = s / ( DISPLAY_COLUMNS / NUM_MOTORS );
+    wrongBus += bus.Bus( s ) != std::min( row / rowsPerBus, TEST_BUSES - 1 );
+    for ( int f = 0; f < FRAMES; f++ ) {
+      host::Time at = bus.Applied( s, f );
+      missed += at == 0;
+      if ( at ) {
+        latest = std::max( latest, at - bus.Sent( f ) );
+      }
+    }
+  }
+  printf( "latest apply %.2f ms after Unity sent the frame\n", latest / (double)host::MS );
+  CHECK( wrongBus == 0 );
+  CHECK( missed == 0 );
+  CHECK( latest <= FrameTime( TEST_BUSES ) + MAX_AFTER_BUS );
+}
@@ -0,0 +1,163 @@
+/****************************************************************************
+ Module
+   test_control_isr.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   The handoff between loop() and the control ISR: DoubleBuffer and
+   CommandQueue with the other side running in the middle of a copy,
+   and the control rate of a slave with its pins moving
+
+ Notes
+   Sample copies itself a field at a time and can run the "other
+   side" after any field, the way an interrupt lands between two
+   stores. The control period is the sketch's own PROF_PERIOD stage,
+   the one PRINT_PROFILE shows on a Teensy; here its jitter comes from
+   the modeled interrupt costs, the encoders' pin interrupts and
+   loop()'s noInterrupts() sections.
+****************************************************************************/
+
+#include <functional>
+#include "HostTest.h"
+#include "SlaveBoard.h"
+#include "DoubleBuffer.h"
+#include "CommandQueue.h"
+
+#define FIELDS          4
+#define QUEUE_SIZE      4
+#define SLAVE_ID        0
+#define MAX_JITTER_US   10      // a few pin interrupts in a row
+
+// Runs interrupt() once, after field at of the next copy
+static std::function<void (void)> interrupt;
+static int interruptAt = -1;
+
+struct Sample {
+  int field[FIELDS];
+
+  Sample( int value = 0 ) {
+    for ( int i = 0; i < FIELDS; i++ ) {
+      field[i] = value;
+    }
+  }
+  Sample( const Sample &s ) { *this = s; }
+  Sample &operator=( const Sample &s ) {
+    for ( int i = 0; i < FIELDS; i++ ) {
+      field[i] = s.field[i];
+      if ( interruptAt == i ) {
+        interruptAt = -1;
+        interrupt();
+      }
+    }
+    return *this;
+  }
+  // the value of every field, -1 if the copy was torn
+  int Value( void ) const {
+    for ( int i = 1; i < FIELDS; i++ ) {
+      if ( field[i] != field[0] ) {
+        return -1;
+      }
+    }
+    return field[0];
+  }
+};
+
+// ISR -> loop(): the ISR writes once or twice while Read() copies
+TEST( ReadRetriesWhenWritten ) {
+  for ( int writes = 1; writes <= 2; writes++ ) {
+    for ( int at = 0; at < FIELDS; at++ ) {
+      DoubleBuffer<Sample> buffer;
+      buffer.Write( Sample(1) );
+      interrupt = [&buffer, writes]() {
+        for ( int w = 0; w < writes; w++ ) {
+          buffer.Write( Sample(2 + w) );
+        }
+      };
+      interruptAt = at;
+      Sample value;
+      buffer.Read( value );
+      CHECK( value.Value() == 1 + writes );
+    }
+  }
+}
+
+// loop() -> ISR: Take() in the middle of a Write() gets the last
+// whole value, the new one on the next Take()
+TEST( TakeDuringWrite ) {
+  for ( int at = 0; at < FIELDS; at++ ) {
+    DoubleBuffer<Sample> buffer;
+    buffer.Write( Sample(1) );
+    Sample taken;
+    bool took = false;
+    interrupt = [&buffer, &taken, &took]() { took = buffer.Take( taken ); };
+    interruptAt = at;
+    buffer.Write( Sample(2) );
+    CHECK( took && taken.Value() == 1 );
+    CHECK( buffer.Take( taken ) && taken.Value() == 2 );
+    CHECK( !buffer.Take( taken ) );
+  }
+}
+
+TEST( TakeGetsNewestOnce ) {
+  DoubleBuffer<Sample> buffer;
+  Sample taken;
+  CHECK( !buffer.Take( taken ) );
+  for ( int i = 1; i <= 300; i++ ) {
+    buffer.Write( Sample(i) );
+    if ( i % 3 == 0 ) {
+      CHECK( buffer.Take( taken ) && taken.Value() == i );
+      CHECK( !buffer.Take( taken ) );
+    }
+  }
+}
+
+// loop() pushes while the ISR pops, past the byte indexes wrapping
+TEST( QueueKeepsOrder ) {
+  CommandQueue<Sample, QUEUE_SIZE> queue;
+  Sample popped;
+  int pushed = 0, next = 0;
+  for ( int round = 0; round < 200; round++ ) {
+    interrupt = [&queue, &popped, &next]() {
+      if ( queue.Pop( popped ) ) {
+        CHECK( popped.Value() == next );
+        next++;
+      }
+    };
+    interruptAt = round % FIELDS;
+    while ( queue.Push( Sample(pushed) ) ) {
+      pushed++;
+    }
+    interruptAt = -1;
+    CHECK( pushed - next == QUEUE_SIZE );
+    int drain = 1 + round % QUEUE_SIZE;
+    for ( int i = 0; i < drain; i++ ) {
+      CHECK( queue.Peek( popped ) && popped.Value() == next );
+      CHECK( queue.Pop( popped ) && popped.Value() == next );
+      next++;
+    }
+  }
+  while ( queue.Pop( popped ) ) {
+    CHECK( popped.Value() == next );
+    next++;
+  }
+  CHECK( next == pushed && pushed > 255 );
+}
+
+TEST( ControlRateWithPinsMoving ) {
+  SlaveBoard board( hostSlaveImages[0], SLAVE_ID, 20, DefaultPinPlant() );
+  CHECK( board.Boot( 3 * host::SEC ) );
+  CHECK( board.ZeroAll( 5 * host::SEC ) );
+  board.ClearProfile();
+  for ( int i = 0; i < NUM_MOTORS; i++ ) {
+    board.Move( i, 30 + 4 * i );
+  }
+  host::RunUntil( host::Now() + host::SEC );
+  float min = 0, mean = 0, max = 0;
+  CHECK( board.Profile( "period", &min, &mean, &max ) );
+  printf( "control period %.1f / %.1f / %.1f us (min / mean / max), jitter %.1f us\n",
+          min, mean, max, max - min );
+  CHECK_NEAR( mean, CONTROL_PERIOD_US, 1 );
+  CHECK( max - min < MAX_JITTER_US );
+}
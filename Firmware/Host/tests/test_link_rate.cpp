@@ -0,0 +1,134 @@
+/****************************************************************************
+ Module
+   test_link_rate.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   The master's adaptive bus rate: NextLinkRate() run sweep after
+   sweep against a simulated channel
+
+ Notes
+   The channel loses each msg with a probability that depends on the
+   bus rate, so errors come in random counts like on a noisy bus.
+   Only the decision is tested here; the rate change itself (SET_BAUD
+   and the slaves following) runs in test_bus, and in sim/bus -r.
+****************************************************************************/
+
+#include "HostTest.h"
+#include "HostSketches.h"
+
+#define LINK_GOOD_CHECKS    3       // as in Master-Unity.ino
+#define NUM_LINK_RATES      3
+#define MSGS_PER_CHECK      1000    // msgs heard between two sweeps
+#define CHECKS              500     // about 17 minutes of LINK_CHECK_MS
+
+static host::Device &MasterBoard( void ) {
+  static host::Device *master = new host::Device( hostMasterImage, 0 );
+  return *master;
+}
+
+// Chance of losing a msg at each rate, xorshift for the draws
+struct Channel {
+  double loss[NUM_LINK_RATES];
+  uint32_t random;
+
+  unsigned long Errors( int rate, unsigned long msgs ) {
+    unsigned long errors = 0;
+    for ( unsigned long i = 0; i < msgs; i++ ) {
+      random ^= random << 13;
+      random ^= random >> 17;
+      random ^= random << 5;
+      errors += ( random / 4294967296.0 ) < loss[rate];
+    }
+    return errors;
+  }
+};
+
+// Back at the base rate with the adaptive rate just turned on
+static void Reset( void ) {
+  const MasterHooks &hooks = Master( hostMasterImage );
+  while ( hooks.nextLinkRate( MSGS_PER_CHECK, MSGS_PER_CHECK ) > 0 ) {
+  }
+  hooks.setAdaptiveLink( 1 );
+}
+
+TEST( CleanChannelClimbsToTop ) {
+  host::Device::Probe probe( MasterBoard() );
+  const MasterHooks &hooks = Master( hostMasterImage );
+  Reset();
+  int rate = 0;
+  for ( int check = 1; check <= 3 * LINK_GOOD_CHECKS; check++ ) {
+    rate = hooks.nextLinkRate( 0, MSGS_PER_CHECK );
+    CHECK( rate == check / LINK_GOOD_CHECKS || rate == NUM_LINK_RATES - 1 );
+  }
+  CHECK( rate == NUM_LINK_RATES - 1 );
+}
+
+TEST( FewErrorsHoldTheRate ) {
+  host::Device::Probe probe( MasterBoard() );
+  const MasterHooks &hooks = Master( hostMasterImage );
+  Reset();
+  for ( int check = 0; check < LINK_GOOD_CHECKS; check++ ) {
+    hooks.nextLinkRate( 0, MSGS_PER_CHECK );
+  }
+  // under LINK_FALL_BACK_PERMILLE: no step down, but no step up either
+  for ( int check = 0; check < 10 * LINK_GOOD_CHECKS; check++ ) {
+    CHECK( hooks.nextLinkRate( 5, MSGS_PER_CHECK ) == 1 );
+  }
+}
+
+// The top rate loses 5 % of its msgs: it is tried less and less often,
+// and the rate below, which is clean, is never given up
+TEST( NoisyTopRateBacksOff ) {
+  host::Device::Probe probe( MasterBoard() );
+  const MasterHooks &hooks = Master( hostMasterImage );
+  Reset();
+  Channel channel = { { 0, 0, 0.05 }, 12345 };
+  int rate = 0, tries = 0, atRate[NUM_LINK_RATES] = { 0 };
+  int lastTry = 0, lastGap = 0;
+  for ( int check = 0; check < CHECKS; check++ ) {
+    int next = hooks.nextLinkRate( channel.Errors( rate, MSGS_PER_CHECK ), MSGS_PER_CHECK );
+    if ( next == NUM_LINK_RATES - 1 && rate != next ) {
+      CHECK( check - lastTry > lastGap );
+      lastGap = check - lastTry;
+      lastTry = check;
+      tries++;
+    }
+    CHECK( next >= 1 || check < LINK_GOOD_CHECKS );
+    rate = next;
+    atRate[rate]++;
+  }
+  // the wait doubles from LINK_GOOD_CHECKS after each fall back
+  CHECK( tries >= 2 && tries <= 8 );
+  CHECK( atRate[NUM_LINK_RATES - 1] == tries );
+  CHECK( atRate[1] > 0.9 * CHECKS );
+}
+
+// A burst of noise on every rate drops to the base rate, and the rate
+// comes back once the bus is clean
+TEST( NoiseBurstFallsBackAndRecovers ) {
+  host::Device::Probe probe( MasterBoard() );
+  const MasterHooks &hooks = Master( hostMasterImage );
+  Reset();
+  Channel clean = { { 0, 0, 0 }, 1 };
+  Channel burst = { { 0.1, 0.1, 0.1 }, 777 };
+  int rate = 0;
+  for ( int check = 0; check < 3 * LINK_GOOD_CHECKS; check++ ) {
+    rate = hooks.nextLinkRate( clean.Errors( rate, MSGS_PER_CHECK ), MSGS_PER_CHECK );
+  }
+  CHECK( rate == NUM_LINK_RATES - 1 );
+  for ( int check = 0; check < NUM_LINK_RATES; check++ ) {
+    rate = hooks.nextLinkRate( burst.Errors( rate, MSGS_PER_CHECK ), MSGS_PER_CHECK );
+  }
+  CHECK( rate == 0 );
+  int checks = 0;
+  while ( rate < NUM_LINK_RATES - 1 && checks < CHECKS ) {
+    rate = hooks.nextLinkRate( clean.Errors( rate, MSGS_PER_CHECK ), MSGS_PER_CHECK );
+    checks++;
+  }
+  // each of the fall backs doubled the clean checks needed
+  CHECK( rate == NUM_LINK_RATES - 1 );
+  CHECK( checks == 2 * ( LINK_GOOD_CHECKS << (NUM_LINK_RATES - 1) ) );
+}
@@ -0,0 +1,199 @@
+/****************************************************************************
+ Module
+   test_pid.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   PID::Compute() against a double-precision copy of its algorithm,
+   and the cases the fixed point has to get right: overflow, windup
+   and restarts after a pause
+
+ Notes
+   The library is included and runs on a slave board that isn't
+   booted, whose clock is moved by hand for micros(). Ticks come
+   every control period with some jitter, as ShapePin calls it, with
+   the sample time and tolerance ShapePin sets.
+****************************************************************************/
+
+#include <math.h>
+#include "HostTest.h"
+#include "HostSketches.h"
+#include "ShapeConstants.h"
+#include "PIDLib.cpp"
+
+#define SAMPLE_MS       2                           // ShapePin's SetSampleTime(2)
+#define SAMPLE_US       (SAMPLE_MS * 1000)
+#define TICK_US         CONTROL_PERIOD_US
+#define JITTER_US       20
+#define RUNS            200
+#define STEPS           2000                        // ticks per run
+#define MAX_ERROR       1                           // [PWM steps] fixed vs double
+
+static uint32_t state = 88172645u;
+
+static uint32_t Random( uint32_t n ) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state % n;
+}
+
+static host::Device &Board( void ) {
+  static host::Device *board = new host::Device( hostSlaveImages[0], 0 );
+  return *board;
+}
+
+// PID::Step() in doubles, without the saturating sums
+struct ReferencePid {
+  double kp, ki, kd, outMin, outMax, T, tolerance;
+  double I, D, lastTime;
+  int lastInput, lastOutput;
+
+  ReferencePid( int p, int i, int d, int min, int max, double now )
+    : kp(p), ki(i), kd(d), outMin(min), outMax(max), T(25000), tolerance(0),
+      I(0), D(0), lastTime(now - 25000), lastInput(0), lastOutput(0) {}
+
+  int Compute( int input, int setpoint, double now, double rate, bool haveRate ) {
+    double timeChange = now - lastTime;
+    if ( timeChange + tolerance < T ) {
+      return lastOutput;
+    }
+    double error = setpoint - input;
+    double dt = timeChange;
+    if ( timeChange > PID_MAX_GAP * T ) {
+      lastInput = input;
+      D = 0;
+      dt = 0;
+    }
+    double P = kp * error;
+    I = std::min( outMax, std::max( outMin, I + ki * error * dt / T ) );
+    if ( haveRate ) {
+      D += ( -kd * rate * T / 1e6 - D ) * dt / ( T + dt );
+    } else if ( dt > 0 ) {
+      D += ( -kd * ( input - lastInput ) * T / dt - D ) * dt / ( T + dt );
+    }
+    double sum = P + I + D;
+    int out = (int)std::min( outMax, std::max( outMin, floor( sum + 0.5 ) ) );
+    double excess = out - sum;
+    if ( I != 0 && ( excess > 0 ) != ( I > 0 ) ) {
+      double unwound = I + excess * dt / ( PID_TRACK_SAMPLES * T );
+      I = ( ( unwound > 0 ) != ( I > 0 ) ) ? 0 : unwound;
+    }
+    lastOutput = out;
+    lastInput = input;
+    lastTime = now;
+    return out;
+  }
+};
+
+// Random gains and a pin wandering after a moving setpoint, with an
+// occasional pause longer than PID_MAX_GAP sample times
+static int CompareRun( bool haveRate ) {
+  int kp = Random( 20 ), ki = Random( 20 ), kd = Random( 60 );
+  PID pid( kp, ki, kd );
+  pid.SetOutputLimits( -DEFAULT_SPEED, DEFAULT_SPEED );
+  pid.SetSampleTime( SAMPLE_MS );
+  pid.SetSampleTolerance( TICK_US / 2 );
+  ReferencePid ref( kp, ki, kd, -DEFAULT_SPEED, DEFAULT_SPEED, micros() );
+  ref.T = SAMPLE_US;
+  ref.tolerance = TICK_US / 2;
+
+  int worst = 0;
+  int input = 0, setpoint = 0, velocity = 0;
+  for ( int step = 0; step < STEPS; step++ ) {
+    unsigned long gap = TICK_US + Random( JITTER_US );
+    if ( Random( 500 ) == 0 ) {
+      gap += ( PID_MAX_GAP + 1 ) * SAMPLE_US;
+    }
+    Board().Advance( gap * host::US );
+    if ( Random( 200 ) == 0 ) {
+      setpoint = (int)Random( 4000 ) - 2000;
+    }
+    velocity = constrain( velocity + (int)Random( 5 ) - 2 + ( setpoint > input ) - ( setpoint < input ), -40, 40 );
+    input += velocity / 4;
+    int32_t rate = velocity * 1000L * PID_ONE;      // [Q pulses/s]
+    int out = haveRate ? pid.Compute( input, setpoint, rate ) : pid.Compute( input, setpoint );
+    int expected = ref.Compute( input, setpoint, micros(), rate / (double)PID_ONE, haveRate );
+    worst = std::max( worst, abs( out - expected ) );
+  }
+  return worst;
+}
+
+TEST( MatchesReference ) {
+  host::Device::Probe probe( Board() );
+  int worst = 0;
+  for ( int run = 0; run < RUNS; run++ ) {
+    worst = std::max( worst, CompareRun( false ) );
+  }
+  printf( "position derivative: worst difference %d PWM steps over %d runs\n", worst, RUNS );
+  CHECK( worst <= MAX_ERROR );
+}
+
+TEST( MatchesReferenceWithRate ) {
+  host::Device::Probe probe( Board() );
+  int worst = 0;
+  for ( int run = 0; run < RUNS; run++ ) {
+    worst = std::max( worst, CompareRun( true ) );
+  }
+  printf( "measured rate: worst difference %d PWM steps over %d runs\n", worst, RUNS );
+  CHECK( worst <= MAX_ERROR );
+}
+
+// Kp * error * PID_ONE is past 32 bits, the output still has the sign
+// of the error
+TEST( LargeErrorsSaturate ) {
+  host::Device::Probe probe( Board() );
+  PID pid( DEFAULT_KP, DEFAULT_KI, DEFAULT_KD );
+  pid.SetOutputLimits( -DEFAULT_SPEED, DEFAULT_SPEED );
+  pid.SetSampleTime( SAMPLE_MS );
+  const int errors[] = { 1, 100, 30000, 2000000, -1, -30000, -2000000 };
+  for ( unsigned int i = 0; i < sizeof errors / sizeof errors[0]; i++ ) {
+    Board().Advance( SAMPLE_US * host::US );
+    int out = pid.Compute( 0, errors[i] );
+    CHECK( out == ( errors[i] > 0 ? DEFAULT_SPEED : -DEFAULT_SPEED ) );
+  }
+}
+
+// After a long saturated move the integrator is within the output
+// limits and unwinds, so the pin doesn't overshoot by the windup
+TEST( IntegratorDoesNotWindUp ) {
+  host::Device::Probe probe( Board() );
+  PID pid( 2, 20, 0 );
+  pid.SetOutputLimits( -DEFAULT_SPEED, DEFAULT_SPEED );
+  pid.SetSampleTime( SAMPLE_MS );
+  for ( int i = 0; i < 1000; i++ ) {
+    Board().Advance( SAMPLE_US * host::US );
+    CHECK( pid.Compute( 0, 1000 ) == DEFAULT_SPEED );
+  }
+  // at the target: only the integrator is left, and it is no more
+  // than the limit
+  Board().Advance( SAMPLE_US * host::US );
+  int atTarget = pid.Compute( 1000, 1000 );
+  CHECK( atTarget <= DEFAULT_SPEED && atTarget >= 0 );
+  // past it, the output turns round within a few samples
+  int turned = -1;
+  for ( int i = 0; i < 20 && turned < 0; i++ ) {
+    Board().Advance( SAMPLE_US * host::US );
+    if ( pid.Compute( 1010, 1000 ) < 0 ) {
+      turned = i;
+    }
+  }
+  CHECK( turned >= 0 && turned < 10 );
+}
+
+// Early ticks are skipped, a pause restarts without a derivative kick
+TEST( SampleTimeAndPause ) {
+  host::Device::Probe probe( Board() );
+  PID pid( 1, 0, 50 );
+  pid.SetOutputLimits( -DEFAULT_SPEED, DEFAULT_SPEED );
+  pid.SetSampleTime( SAMPLE_MS );
+  Board().Advance( SAMPLE_US * host::US );
+  int first = pid.Compute( 0, 10 );
+  Board().Advance( ( SAMPLE_US / 2 ) * host::US );
+  CHECK( pid.Compute( 0, 100 ) == first );
+  // the input jumped during a pause: P only
+  Board().Advance( ( PID_MAX_GAP + 1 ) * SAMPLE_US * host::US );
+  CHECK( pid.Compute( 50, 100 ) == 50 );
+}
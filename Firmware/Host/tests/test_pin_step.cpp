@@ -0,0 +1,162 @@
+/****************************************************************************
+ Module
+   test_pin_step.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   Slave pins on the motor and leadscrew plant: zeroing, step
+   responses and stall detection
+
+ Notes
+   Slave ID 3 has both kinds of switch, analog on pins 0, 4 and 5.
+   The limits are loose bounds on the default plant; sim/pin_step
+   prints the numbers.
+****************************************************************************/
+
+#include "HostTest.h"
+#include "SlaveBoard.h"
+#include "ShapePin.h"
+
+#define SLAVE_ID    3
+#define START       20.0f   // [mm] pins at power up, before zeroing
+#define PROFILE_SPEED 60    // [mm/s] turned on with SET_PARAMS
+#define PROFILE_ACCEL 1000  // [mm/s^2]
+#define KEYFRAME_MS   400   // 10 to 30 mm, under the pin's top speed
+#define KEYFRAME_LAG  3     // [mm] behind the keyframe setpoint
+
+static SlaveBoard &Board( void ) {
+  static SlaveBoard *board = 0;
+  if ( !board ) {
+    board = new SlaveBoard( hostSlaveImages[0], SLAVE_ID, START, DefaultPinPlant() );
+    board->Boot( 3 * host::SEC );
+  }
+  return *board;
+}
+
+// A SET_PARAMS block for all pins: the defaults with this profile
+static void SetParams( int speed, int accel ) {
+  uint8_t block[PARAM_BLOCK_SIZE] = {
+    DEFAULT_KP >> 8, DEFAULT_KP & 0xFF, DEFAULT_KI >> 8, DEFAULT_KI & 0xFF,
+    DEFAULT_KD >> 8, DEFAULT_KD & 0xFF, DEFAULT_SPEED, DEFAULT_SPEED,
+    DEFAULT_DEADZONE, 1,
+    (uint8_t)( speed >> 8 ), (uint8_t)speed, (uint8_t)( accel >> 8 ), (uint8_t)accel };
+  Board().SetParams( block, sizeof block );
+}
+
+TEST( BootsAndZeroes ) {
+  SlaveBoard &board = Board();
+  CHECK( board.device.UsbOutput().find("Slave ID: 3") != std::string::npos );
+  CHECK( board.ZeroAll( 3 * host::SEC ) );
+  for ( int i = 0; i < NUM_MOTORS; i++ ) {
+    CHECK_NEAR( board.plant[i]->Height(), 0, DEFAULT_DEADZONE + PULSE_TO_MM );
+    CHECK_NEAR( board.Position(i), board.plant[i]->Height(), 2 * PULSE_TO_MM );
+    CHECK( board.Stalls(i) == 0 );
+  }
+}
+
+// The setpoint steps to the target by default
+TEST( StepUp ) {
+  CHECK( DEFAULT_PROFILE_SPEED == 0 );
+  StepMetrics m = Board().Step( 1, 40, 2 * host::SEC ).Metrics();
+  CHECK( m.rise > 0 );
+  CHECK( m.overshoot < DEFAULT_DEADZONE );
+  CHECK( m.settling > 0 && m.settling < 1000 );
+  CHECK( fabsf(m.finalError) <= m.band );
+}
+
+TEST( StepDown ) {
+  StepMetrics m = Board().Step( 1, 10, 2 * host::SEC ).Metrics();
+  CHECK( m.rise > 0 );
+  CHECK( m.overshoot < DEFAULT_DEADZONE );
+  CHECK( m.settling > 0 && m.settling < 1000 );
+  CHECK( fabsf(m.finalError) <= m.band );
+}
+
+// With the profile from SET_PARAMS: at the profile speed, with a
+// little for the acceleration
+TEST( ProfileFromSetParams ) {
+  SlaveBoard &board = Board();
+  float from = board.plant[1]->Height();
+  float travel = 40 - from;
+  SetParams( PROFILE_SPEED, PROFILE_ACCEL );
+  StepMetrics m = board.Step( 1, 40, 2 * host::SEC ).Metrics();
+  SetParams( 0, PROFILE_ACCEL );
+  float profileTime = 0.8f * travel / PROFILE_SPEED * 1000;
+  CHECK( m.rise > 0.9f * profileTime && m.rise < 1.2f * profileTime );
+  CHECK( m.overshoot < DEFAULT_DEADZONE );
+  CHECK( m.settling > 0 && m.settling < 1.2f * travel / PROFILE_SPEED * 1000 + 100 );
+  CHECK( fabsf(m.finalError) <= m.band );
+}
+
+// Pin 1 along a keyframe from 10 to 30 mm, the height at quarters of
+// it, then after KEYFRAME_MS more
+static void Keyframe( int mode, float heights[5] ) {
+  SlaveBoard &board = Board();
+  board.Step( 1, 10, host::SEC );
+  board.Keyframe( 1, 30, KEYFRAME_MS, mode );
+  host::Time start = host::Now();
+  for ( int q = 1; q <= 4; q++ ) {
+    host::RunUntil( start + q * KEYFRAME_MS / 4 * host::MS );
+    heights[q - 1] = board.plant[1]->Height();
+  }
+  host::RunUntil( start + 2 * KEYFRAME_MS * host::MS );
+  heights[4] = board.plant[1]->Height();
+  printf( "%s: %.2f %.2f %.2f %.2f, then %.2f mm\n", mode == TRAJ_CUBIC ? "cubic" : "linear",
+          heights[0], heights[1], heights[2], heights[3], heights[4] );
+}
+
+// The pin follows the curve a little behind, f(s) of the way at s
+static void CheckKeyframe( int mode, float (*f)( float s ) ) {
+  float h[5];
+  Keyframe( mode, h );
+  for ( int q = 1; q <= 3; q++ ) {
+    float setpoint = 10 + 20 * f( q / 4.0f );
+    CHECK( h[q - 1] < setpoint + PULSE_TO_MM && h[q - 1] > setpoint - KEYFRAME_LAG );
+  }
+  CHECK_NEAR( h[4], 30, DEFAULT_DEADZONE + PULSE_TO_MM );
+}
+
+static float Linear( float s ) {
+  return s;
+}
+
+// from rest to the mean speed
+static float CubicFromRest( float s ) {
+  return 2 * s * s - s * s * s;
+}
+
+TEST( KeyframeLinear ) {
+  CheckKeyframe( TRAJ_LINEAR, Linear );
+}
+
+TEST( KeyframeCubic ) {
+  CheckKeyframe( TRAJ_CUBIC, CubicFromRest );
+}
+
+TEST( StepOnAnalogSwitchPin ) {
+  StepMetrics m = Board().Step( 0, 30, 2 * host::SEC ).Metrics();
+  CHECK( m.settling > 0 && m.settling < 1000 );
+  CHECK( fabsf(m.finalError) <= m.band );
+}
+
+TEST( StallDetectedAfterStallTime ) {
+  SlaveBoard &board = Board();
+  board.Move( 2, 50 );
+  host::RunUntil( host::Now() + 100 * host::MS );
+  board.plant[2]->Jam( true );
+  host::Time jammed = host::Now();
+  int stalls = board.Stalls( 2 );
+  while ( board.Stalls(2) == stalls && host::Now() < jammed + 5 * host::SEC ) {
+    host::RunUntil( host::Now() + host::MS );
+  }
+  float latency = ( host::Now() - jammed ) / (float)host::MS;
+  CHECK( board.Stalls(2) == stalls + 1 );
+  CHECK( board.State(2) == IDLE );
+  // STALL_TIME once its speed reads as stopped, at the latest
+  // ENCODER_STOP_US after the jam; the stepped setpoint is already
+  // STALL_LAG ahead
+  CHECK( latency > STALL_TIME && latency < STALL_TIME + ENCODER_STOP_US / 1000 + 1 );
+  board.plant[2]->Jam( false );
+}
@@ -0,0 +1,315 @@
+/****************************************************************************
+ Module
+   test_positions.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   The master's position msgs against the slaves' unpacking, for
+   every slave of the 12x24 display: each pin's target is checked
+   against the pin the display's wiring puts it on. The bus bytes of
+   frames that change a few pins, sent as deltas and in full, and of
+   bit packed frames at each depth.
+
+ Notes
+   The golden table is the mapping SendNewPositions() used when it
+   sent one SET_POS per slave with the indexes worked out inline:
+   rows of 4 slaves, the odd rows (back of a half-module) with the
+   slaves and their pins in reverse order. It is written out rather
+   than computed, so a change to the master's tables or to the
+   slaves' unpacking can't change both sides of the check.
+   Three frames tell the pins apart: every pin at its row, at its
+   slave's place in the row, then at its own place in the slave. The
+   heights stay under 30 mm, above which the slaves hold pin 5 of every
+   fourth slave at 25 mm.
+****************************************************************************/
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "HostTest.h"
+#include "DisplayBus.h"
+#include "ShapeConstants.h"
+
+#define SLAVES          48
+#define DISPLAY_PINS    288
+#define DISPLAY_COLUMNS 24
+#define BASE_HEIGHT     5       // [mm] the lowest height sent
+#define SETTLE          host::MS        // commit and a control step
+#define BUMP_HEIGHT     20      // [mm] above BASE_HEIGHT
+#define DELTA_FRAMES    60      // two full refreshes
+#define SCATTERED_PINS  12
+#define LOW_HEIGHT      5       // [mm] the two heights of the packed frames,
+#define HIGH_HEIGHT     25      //   apart at every depth
+#define INDEX_BITS      9       // of a display index
+
+// First zMap index of pin 0 of each slave, and the direction of pins 1-5
+static const struct { int first, step; } golden[SLAVES] = {
+  {   0, +1 }, {   6, +1 }, {  12, +1 }, {  18, +1 }, {  47, -1 }, {  41, -1 },
+  {  35, -1 }, {  29, -1 }, {  48, +1 }, {  54, +1 }, {  60, +1 }, {  66, +1 },
+  {  95, -1 }, {  89, -1 }, {  83, -1 }, {  77, -1 }, {  96, +1 }, { 102, +1 },
+  { 108, +1 }, { 114, +1 }, { 143, -1 }, { 137, -1 }, { 131, -1 }, { 125, -1 },
+  { 144, +1 }, { 150, +1 }, { 156, +1 }, { 162, +1 }, { 191, -1 }, { 185, -1 },
+  { 179, -1 }, { 173, -1 }, { 192, +1 }, { 198, +1 }, { 204, +1 }, { 210, +1 },
+  { 239, -1 }, { 233, -1 }, { 227, -1 }, { 221, -1 }, { 240, +1 }, { 246, +1 },
+  { 252, +1 }, { 258, +1 }, { 287, -1 }, { 281, -1 }, { 275, -1 }, { 269, -1 },
+};
+
+static DisplayBus &Bus( void ) {
+  static DisplayBus *bus = 0;
+  if ( !bus ) {
+    DisplayBusParams params = DefaultDisplayBus();
+    params.slaves = SLAVES;
+    bus = new DisplayBus( params );
+    bus->Boot( 3 * host::SEC );
+  }
+  return *bus;
+}
+
+static uint32_t state = 2463534242u;
+
+static uint32_t Random( uint32_t n ) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state % n;
+}
+
+static void SetConfig( bool broadcast, bool delta, int bits = 0 ) {
+  DisplayBus &bus = Bus();
+  host::Device::Probe probe( bus.master );
+  bus.params.config.broadcastPositions = broadcast;
+  bus.params.config.sendDeltaPositions = delta;
+  bus.params.config.positionBits = bits;
+  bus.hooks.setConfig( &bus.params.config );
+}
+
+// Send heights[display index] and let the slaves apply them: run
+// until the bytes are out and the slaves' next control step
+static void SendFrame( const uint8_t *heights ) {
+  DisplayBus &bus = Bus();
+  unsigned long before = bus.Stats().bytesSent;
+  {
+    host::Device::Probe probe( bus.master );
+    bus.hooks.sendPositions( heights );
+  }
+  host::RunUntil( host::Now() + ( bus.Stats().bytesSent - before ) * bus.ByteTime() + SETTLE );
+}
+
+// [mm] target of a pin
+static int Target( int slave, int pin ) {
+  host::Device::Probe probe( *Bus().slaves[slave] );
+  return lroundf( Slave( hostSlaveImages[slave] ).target( pin ) * PULSE_TO_MM );
+}
+
+// Every pin of every slave at the height its golden index was sent
+static bool PinsMatchGolden( const uint8_t *heights ) {
+  bool ok = true;
+  for ( int s = 0; s < SLAVES; s++ ) {
+    for ( int p = 0; p < NUM_MOTORS; p++ ) {
+      int index = golden[s].first + golden[s].step * p;
+      if ( Target( s, p ) != heights[index] ) {
+        printf( "slave %d pin %d: %d mm, zMap[%d] is %d\n",
+                s, p, Target( s, p ), index, heights[index] );
+        ok = false;
+      }
+    }
+  }
+  return ok;
+}
+
+// Row, slave in the row, then pin in the slave, in the mode set
+static bool FramesMatchGolden( void ) {
+  bool ok = true;
+  for ( int frame = 0; frame < 3; frame++ ) {
+    uint8_t heights[DISPLAY_PINS];
+    for ( int i = 0; i < DISPLAY_PINS; i++ ) {
+      int place[] = { i / DISPLAY_COLUMNS, i % DISPLAY_COLUMNS / NUM_MOTORS, i % NUM_MOTORS };
+      heights[i] = BASE_HEIGHT + place[frame];
+    }
+    SendFrame( heights );
+    ok = PinsMatchGolden( heights ) && ok;
+  }
+  return ok;
+}
+
+TEST( GoldenTableCoversDisplay ) {
+  bool seen[DISPLAY_PINS] = { false };
+  int count = 0;
+  for ( int s = 0; s < SLAVES; s++ ) {
+    for ( int p = 0; p < NUM_MOTORS; p++ ) {
+      int index = golden[s].first + golden[s].step * p;
+      count += ( index >= 0 && index < DISPLAY_PINS && !seen[index] );
+      seen[index] = true;
+    }
+  }
+  CHECK( count == DISPLAY_PINS );
+}
+
+// The master's slaveGather, built by SetDisplayGeometry()
+TEST( GatherTableMatchesGolden ) {
+  host::Device::Probe probe( Bus().master );
+  int wrong = 0;
+  for ( int s = 0; s < SLAVES; s++ ) {
+    for ( int p = 0; p < NUM_MOTORS; p++ ) {
+      wrong += Bus().hooks.gatherIndex( s, p ) != golden[s].first + golden[s].step * p;
+    }
+  }
+  CHECK( wrong == 0 );
+}
+
+// One SET_POS_ALL for the frame, each slave takes its own slice
+TEST( BroadcastMatchesGolden ) {
+  CHECK( Bus().Stats().numSlaves == SLAVES );
+  SetConfig( true, false );
+  CHECK( FramesMatchGolden() );
+}
+
+// One SET_POS per slave, gathered by the master
+TEST( PerSlaveMatchesGolden ) {
+  SetConfig( false, false );
+  CHECK( FramesMatchGolden() );
+}
+
+// A finger pressing 3x3 pins, moving a column per frame along row 5
+static void Bump( int frame, uint8_t *heights ) {
+  memset( heights, BASE_HEIGHT, DISPLAY_PINS );
+  int column = frame % DISPLAY_COLUMNS;
+  for ( int row = 4; row <= 6; row++ ) {
+    for ( int c = std::max( 0, column - 1 ); c <= std::min( DISPLAY_COLUMNS - 1, column + 1 ); c++ ) {
+      heights[row * DISPLAY_COLUMNS + c] = BASE_HEIGHT + BUMP_HEIGHT;
+    }
+  }
+}
+
+// A few pins anywhere to new heights
+static void Scatter( int frame, uint8_t *heights ) {
+  if ( frame == 0 ) {
+    memset( heights, BASE_HEIGHT, DISPLAY_PINS );
+  }
+  for ( int i = 0; i < SCATTERED_PINS; i++ ) {
+    heights[Random( DISPLAY_PINS )] = BASE_HEIGHT + Random( BUMP_HEIGHT );
+  }
+}
+
+// Bus bytes of DELTA_FRAMES frames of content, every pin checked
+// after each frame
+static unsigned long FrameBytes( void (*content)( int, uint8_t * ), bool *ok ) {
+  uint8_t heights[DISPLAY_PINS];
+  unsigned long before = Bus().Stats().bytesSent;
+  for ( int f = 0; f < DELTA_FRAMES; f++ ) {
+    content( f, heights );
+    SendFrame( heights );
+    *ok = PinsMatchGolden( heights ) && *ok;
+  }
+  return Bus().Stats().bytesSent - before;
+}
+
+// Deltas (SET_POS_SPARSE or a few SET_POS, a full frame every
+// fullRefreshFrames) against every frame in full. Full frames are all
+// the same size, so the master's count of the bytes its deltas saved
+// is the difference of the two runs.
+static void CompareDeltas( const char *name, void (*content)( int, uint8_t * ),
+                           double minSaving ) {
+  bool ok = true;
+  SetConfig( true, false );
+  state = 1;
+  unsigned long full = FrameBytes( content, &ok );
+  SetConfig( true, true );
+  state = 1;
+  MasterStats before = Bus().Stats();
+  unsigned long delta = FrameBytes( content, &ok );
+  MasterStats after = Bus().Stats();
+  unsigned long deltaFrames = after.deltaFrames - before.deltaFrames;
+  unsigned long saved = after.deltaBytesSaved - before.deltaBytesSaved;
+  double byteTime = Bus().ByteTime() / (double)host::US;
+  printf( "%s: %.1f bytes (%.0f us) a frame in full, %.1f (%.0f us) as deltas, %.1fx\n",
+          name, full / (double)DELTA_FRAMES, full * byteTime / DELTA_FRAMES,
+          delta / (double)DELTA_FRAMES, delta * byteTime / DELTA_FRAMES,
+          full / (double)delta );
+  printf( "%s: %lu delta frames saved %lu bytes\n", name, deltaFrames, saved );
+  CHECK( ok );
+  CHECK( full >= minSaving * delta );
+  CHECK( deltaFrames > 0 && deltaFrames < DELTA_FRAMES );
+  CHECK( saved == full - delta );
+}
+
+TEST( MovingBumpAsDeltas ) {
+  CompareDeltas( "moving bump", Bump, 3 );
+}
+
+TEST( ScatteredPinsAsDeltas ) {
+  CompareDeltas( "scattered pins", Scatter, 2 );
+}
+
+/*----------------------------- Packed frames -----------------------------*/
+
+// The pulses a slave gets for height [mm] at "bits" bits per pin: the
+// master's fine position cut to bits, the slave's scaling to pulses
+static int PackedPulses( int height, int bits ) {
+  long fine = (long)height * POS_FINE_MAX / POSITION_RANGE_MM;
+  unsigned int value = fine >> ( POS_FINE_BITS - bits );
+  unsigned int valueMax = ( 1 << bits ) - 1;
+  return value * POSITION_RANGE_MM * MM_TO_PULSE / valueMax;
+}
+
+// One frame per bit of the display index, each pin low or high by its
+// bit: every pin must have the exact pulses of its golden index
+static bool PackedFramesMatchGolden( int bits ) {
+  bool ok = true;
+  for ( int bit = 0; bit < INDEX_BITS; bit++ ) {
+    uint8_t heights[DISPLAY_PINS];
+    for ( int i = 0; i < DISPLAY_PINS; i++ ) {
+      heights[i] = ( i >> bit ) & 1 ? HIGH_HEIGHT : LOW_HEIGHT;
+    }
+    SendFrame( heights );
+    for ( int s = 0; s < SLAVES; s++ ) {
+      host::Device::Probe probe( *Bus().slaves[s] );
+      for ( int p = 0; p < NUM_MOTORS; p++ ) {
+        int index = golden[s].first + golden[s].step * p;
+        int target = Slave( hostSlaveImages[s] ).target( p );
+        if ( target != PackedPulses( heights[index], bits ) ) {
+          printf( "%d bits, slave %d pin %d: %d pulses, zMap[%d] is %d mm (%d pulses)\n",
+                  bits, s, p, target, index, heights[index],
+                  PackedPulses( heights[index], bits ) );
+          ok = false;
+        }
+      }
+    }
+  }
+  return ok;
+}
+
+// Bytes of one full frame
+static unsigned long FullFrameBytes( void ) {
+  uint8_t heights[DISPLAY_PINS];
+  memset( heights, LOW_HEIGHT, sizeof heights );
+  unsigned long before = Bus().Stats().bytesSent;
+  SendFrame( heights );
+  return Bus().Stats().bytesSent - before;
+}
+
+// SET_POS_PACKED at every depth, and the bus time of a full frame in
+// each of the modes
+TEST( PackedFramesAtEachDepth ) {
+  double byteTime = Bus().ByteTime() / (double)host::US;
+  SetConfig( false, false );
+  unsigned long bytes = FullFrameBytes();
+  printf( "SET_POS per slave:  %4lu bytes, %5.0f us\n", bytes, bytes * byteTime );
+  SetConfig( true, false );
+  bytes = FullFrameBytes();
+  printf( "SET_POS_ALL:        %4lu bytes, %5.0f us\n", bytes, bytes * byteTime );
+  const int depths[] = { 4, 6, 8, 12 };
+  for ( int d = 0; d < 4; d++ ) {
+    int bits = depths[d];
+    SetConfig( true, false, bits );
+    CHECK( PackedFramesMatchGolden( bits ) );
+    bytes = FullFrameBytes();
+    printf( "SET_POS_PACKED %2d: %4lu bytes, %5.0f us\n", bits, bytes, bytes * byteTime );
+    // the pins' bits, the header, the framing and a commit
+    CHECK( bytes >= (unsigned long)DISPLAY_PINS * bits / 8 );
+    CHECK( bytes <= (unsigned long)DISPLAY_PINS * bits / 8 + 20 );
+  }
+  SetConfig( true, true );
+}
@@ -0,0 +1,288 @@
+/****************************************************************************
+ Module
+   test_protocol.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   RS485_protocol's framing: known packets byte for byte, and random
+   msgs sent, read back with recvMsg() and with an RS485Receiver fed
+   the stream in random pieces. The CRC tables against the standard
+   check values and the bit at a time CRCs, and damaged packets.
+
+ Notes
+   The library is included with the framing it is built with, the
+   sketches' by default. The Makefile builds this file a second time
+   as test_protocol_complemented, with the legacy framing.
+   recvMsg() reads millis(), so it runs on a board that isn't booted.
+****************************************************************************/
+
+#include <string.h>
+#include <vector>
+#include "HostTest.h"
+#include "HostSketches.h"
+#include "RS485_protocol.cpp"
+
+#define MAX_LENGTH      300     // a full 12x24 SET_POS_ALL frame
+#define ROUND_TRIPS     3000
+#define MAX_CHUNK       64
+#define GARBAGE         20      // bytes of noise between packets
+#define DAMAGED         20000
+
+#if RS485_FRAMING == RS485_FRAMING_COBS
+  #define FRAMING_NAME  "COBS"
+#else
+  #define FRAMING_NAME  "complemented"
+#endif
+
+static uint32_t state = 2654435769u;
+
+static uint32_t Random( uint32_t n ) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state % n;
+}
+
+// The wire, written by sendMsg() and read by recvMsg() and the receiver
+static std::vector<byte> wire;
+static size_t readPos, end;
+
+static void Write( const byte what ) {
+  wire.push_back( what );
+}
+
+static int Available( void ) {
+  return end - readPos;
+}
+
+static int Read( void ) {
+  return readPos < end ? wire[readPos++] : -1;
+}
+
+static host::Device &Board( void ) {
+  static host::Device *board = new host::Device( hostSlaveImages[0], 0 );
+  return *board;
+}
+
+// Payload with zeros, delimiters and STX/ETX values in it
+static std::vector<byte> RandomMsg( void ) {
+  std::vector<byte> msg( 1 + Random( MAX_LENGTH ) );
+  for ( size_t i = 0; i < msg.size(); i++ ) {
+    int kind = Random( 8 );
+    msg[i] = kind == 0 ? 0 : kind == 1 ? 2 + Random( 2 ) : kind == 2 ? 0xFF : Random( 256 );
+  }
+  return msg;
+}
+
+static bool Sends( const byte *msg, unsigned int length, const byte *golden, size_t goldenLength ) {
+  wire.clear();
+  sendMsg( Write, msg, length );
+  byte encoded[RS485_ENCODED_SIZE(MAX_LENGTH)];
+  unsigned int encodedLength = encodeMsg( msg, length, encoded, sizeof encoded );
+  return wire.size() == goldenLength && !memcmp( &wire[0], golden, goldenLength )
+         && encodedLength == goldenLength && !memcmp( encoded, golden, goldenLength );
+}
+
+// An 8-bit CRC packet with a zero in it, and one of 17 bytes, past
+// RS485_CRC16_LENGTH, with a CRC16. Worked out by hand from the framing
+// described in RS485_protocol.h.
+TEST( GoldenPackets ) {
+  printf( "framing: %s\n", FRAMING_NAME );
+  const byte shortMsg[] = { 0x11, 0x00, 0x22 };         // CRC8 0x7E
+  byte longMsg[17];                                     // CRC16 0xA209
+  for ( int i = 0; i < 17; i++ ) {
+    longMsg[i] = i;
+  }
+#if RS485_FRAMING == RS485_FRAMING_COBS
+  const byte shortWire[] = { 0x00, 0x02, 0x11, 0x03, 0x22, 0x7E, 0x00 };
+  const byte longWire[] = { 0x00, 0x01, 0x13, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                            0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10,
+                            0xA2, 0x09, 0x00 };
+#else
+  const byte shortWire[] = { 0x02, 0x1E, 0x1E, 0x0F, 0x0F, 0x2D, 0x2D, 0x03, 0x78, 0xE1 };
+  const byte longWire[] = { 0x02, 0x0F, 0x0F, 0x0F, 0x1E, 0x0F, 0x2D, 0x0F, 0x3C, 0x0F,
+                            0x4B, 0x0F, 0x5A, 0x0F, 0x69, 0x0F, 0x78, 0x0F, 0x87, 0x0F,
+                            0x96, 0x0F, 0xA5, 0x0F, 0xB4, 0x0F, 0xC3, 0x0F, 0xD2, 0x0F,
+                            0xE1, 0x0F, 0xF0, 0x1E, 0x0F, 0x03, 0xA5, 0x2D, 0x0F, 0x96 };
+#endif
+  CHECK( Sends( shortMsg, sizeof shortMsg, shortWire, sizeof shortWire ) );
+  CHECK( Sends( longMsg, sizeof longMsg, longWire, sizeof longWire ) );
+}
+
+// What the framing costs: COBS one code byte per 254 bytes and the two
+// delimiters, the complemented framing twice the bytes
+TEST( Overhead ) {
+  byte msg[MAX_LENGTH];
+  memset( msg, 0x55, sizeof msg );
+  const int lengths[] = { 8, 63, MAX_LENGTH };
+  for ( int i = 0; i < 3; i++ ) {
+    int length = lengths[i];
+    int crc = length > RS485_CRC16_LENGTH ? 2 : 1;
+    wire.clear();
+    sendMsg( Write, msg, length );
+    printf( "%3d bytes: %3d on the wire\n", length, (int)wire.size() );
+#if RS485_FRAMING == RS485_FRAMING_COBS
+    CHECK( (int)wire.size() == length + crc + 2 + 1 + ( length + crc ) / 254 );
+#else
+    CHECK( (int)wire.size() == 2 * ( length + crc ) + 2 );
+#endif
+    CHECK( (int)wire.size() <= RS485_ENCODED_SIZE(length) );
+  }
+}
+
+// Each msg alone through recvMsg()
+TEST( RecvMsgRoundTrip ) {
+  host::Device::Probe probe( Board() );
+  int failed = 0;
+  for ( int n = 0; n < ROUND_TRIPS; n++ ) {
+    std::vector<byte> msg = RandomMsg();
+    wire.clear();
+    sendMsg( Write, &msg[0], msg.size() );
+    readPos = 0;
+    end = wire.size();
+    byte received[MAX_LENGTH];
+    RS485Status_t status = RS485_TIMEOUT;
+    unsigned int length = recvMsg( Available, Read, received, sizeof received, 10, &status );
+    failed += !( status == RS485_DONE && length == msg.size()
+                 && !memcmp( received, &msg[0], length ) );
+  }
+  CHECK( failed == 0 );
+}
+
+// All of them back to back, with noise between some, read a random
+// piece at a time. The noise is dropped as bad packets, or once in a
+// while passes its CRC and comes out as an extra one.
+TEST( ReceiverRoundTrip ) {
+  std::vector<std::vector<byte> > msgs( ROUND_TRIPS );
+  wire.clear();
+  for ( int n = 0; n < ROUND_TRIPS; n++ ) {
+    if ( n % 10 == 5 ) {
+      for ( int i = 0; i < GARBAGE; i++ ) {
+        wire.push_back( Random( 256 ) );
+      }
+    }
+    msgs[n] = RandomMsg();
+    sendMsg( Write, &msgs[n][0], msgs[n].size() );
+  }
+  byte received[MAX_LENGTH];
+  RS485Receiver receiver( Available, Read, received, sizeof received );
+  readPos = end = 0;
+  int n = 0, extra = 0;
+  while ( end < wire.size() ) {
+    end = std::min( wire.size(), end + 1 + Random( MAX_CHUNK ) );
+    while ( receiver.update() ) {
+      if ( n < ROUND_TRIPS && receiver.getLength() == msgs[n].size()
+           && !memcmp( received, &msgs[n][0], msgs[n].size() ) ) {
+        n++;
+      } else {
+        extra++;
+      }
+    }
+  }
+  printf( "%d msgs, %d noise packets dropped, %d passed as msgs\n",
+          n, receiver.getErrors(), extra );
+  CHECK( n == ROUND_TRIPS );
+  CHECK( receiver.getErrors() > 0 );
+  CHECK( extra <= ROUND_TRIPS / 10 / 32 );
+}
+
+// A msg larger than the buffer is an overflow, the next one still comes
+TEST( OverflowThenNext ) {
+  byte big[MAX_LENGTH], small[] = { 1, 2, 3 };
+  memset( big, 7, sizeof big );
+  wire.clear();
+  sendMsg( Write, big, sizeof big );
+  sendMsg( Write, small, sizeof small );
+  byte received[MAX_LENGTH / 2];
+  RS485Receiver receiver( Available, Read, received, sizeof received );
+  readPos = 0;
+  end = wire.size();
+  CHECK( receiver.update() );
+  CHECK( receiver.getLength() == sizeof small && !memcmp( received, small, sizeof small ) );
+  CHECK( receiver.getErrors( RS485_OVERFLOW ) == 1 );
+}
+
+/*--------------------------------- CRCs ----------------------------------*/
+
+// The CRCs a bit at a time, as the library did before the tables
+static byte BitwiseCrc8( const byte *addr, unsigned int len ) {
+  byte crc = 0;
+  while ( len-- ) {
+    byte inbyte = *addr++;
+    for ( int i = 0; i < 8; i++ ) {
+      byte mix = ( crc ^ inbyte ) & 0x01;
+      crc >>= 1;
+      if ( mix ) {
+        crc ^= 0x8C;
+      }
+      inbyte >>= 1;
+    }
+  }
+  return crc;
+}
+
+static uint16_t BitwiseCrc16( const byte *addr, unsigned int len ) {
+  uint16_t crc = 0xFFFF;
+  while ( len-- ) {
+    crc ^= *addr++ << 8;
+    for ( int i = 0; i < 8; i++ ) {
+      crc = ( crc & 0x8000 ) ? ( crc << 1 ) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+// CRC-8/MAXIM and CRC-16/CCITT-FALSE of "123456789"
+TEST( CrcCheckValues ) {
+  const byte check[] = "123456789";
+  CHECK( crc8( check, 9 ) == 0xA1 );
+  CHECK( crc16( check, 9 ) == 0x29B1 );
+}
+
+TEST( TablesMatchBitwise ) {
+  int failed = 0;
+  for ( int n = 0; n < ROUND_TRIPS; n++ ) {
+    std::vector<byte> msg = RandomMsg();
+    failed += crc8( &msg[0], msg.size() ) != BitwiseCrc8( &msg[0], msg.size() );
+    failed += crc16( &msg[0], msg.size() ) != BitwiseCrc16( &msg[0], msg.size() );
+  }
+  CHECK( failed == 0 );
+}
+
+// Packets with one to three bits flipped on the wire. The framing
+// catches some, the CRC the rest: none may come out as a good packet
+// with a CRC16, about 1 in 256 may with a CRC8.
+TEST( DamagedPacketsDropped ) {
+  int sent[2] = { 0 }, passed[2] = { 0 };
+  byte received[MAX_LENGTH];
+  RS485Receiver receiver( Available, Read, received, sizeof received );
+  for ( int n = 0; n < DAMAGED; n++ ) {
+    // either side of RS485_CRC16_LENGTH
+    std::vector<byte> msg = RandomMsg();
+    if ( n % 2 ) {
+      msg.resize( 1 + Random( RS485_CRC16_LENGTH ) );
+    }
+    int wide = msg.size() > RS485_CRC16_LENGTH;
+    wire.clear();
+    sendMsg( Write, &msg[0], msg.size() );
+    int bits = 1 + Random( 3 );
+    for ( int b = 0; b < bits; b++ ) {
+      size_t at = 1 + Random( wire.size() - 2 );     // not the delimiters
+      wire[at] ^= 1 << Random( 8 );
+    }
+    receiver.reset();
+    readPos = 0;
+    end = wire.size();
+    sent[wide]++;
+    while ( receiver.update() ) {
+      passed[wide] += !( receiver.getLength() == msg.size()
+                         && !memcmp( received, &msg[0], msg.size() ) );
+    }
+  }
+  printf( "damaged packets taken as good: CRC8 %d of %d, CRC16 %d of %d\n",
+          passed[0], sent[0], passed[1], sent[1] );
+  CHECK( passed[0] <= 2 * sent[0] / 256 );
+  CHECK( passed[1] == 0 );
+}
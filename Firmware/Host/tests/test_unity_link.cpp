@@ -0,0 +1,177 @@
+/****************************************************************************
+ Module
+   test_unity_link.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   The framed Unity to master USB link: an RS485Receiver fed a
+   corrupted stream in random pieces, and the master dropping a bad
+   frame and taking the next one without a timeout
+
+ Notes
+   The library is included, with the framing the sketches use (COBS),
+   so the fuzzing runs on the parser alone. The master gets DataCMD
+   frames over USB at 60 Hz, with no slaves on its buses.
+****************************************************************************/
+
+#include <string.h>
+#include <string>
+#include <vector>
+#include "HostTest.h"
+#include "HostSketches.h"
+#include "RS485_protocol.cpp"
+
+#define FUZZ_FRAMES     2000
+#define MAX_LENGTH      300
+#define MAX_CHUNK       64      // a USB packet
+#define DATA_CMD        127     // DataCMD
+#define DISPLAY_PINS    288     // default 12x24 display
+#define FRAME_PERIOD    (host::SEC / 60)
+#define MASTER_FRAMES   40
+#define COMMIT_TIME     (8 * host::MS)  // a 12x24 frame at 1 Mbaud and the commit
+
+static uint32_t state = 2463534242u;
+
+static uint32_t Random( uint32_t n ) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state % n;
+}
+
+// The stream the receiver reads, up to end
+static std::vector<byte> stream;
+static size_t readPos, end;
+
+static int Available( void ) {
+  return end - readPos;
+}
+
+static int Read( void ) {
+  return readPos < end ? stream[readPos++] : -1;
+}
+
+// Frames numbered in their first two bytes, a third of them damaged
+// by a flipped bit, a dropped byte or an inserted one. Every clean
+// frame must come through whole and in order, and nothing else.
+TEST( FuzzedStreamKeepsCleanFrames ) {
+  std::vector<std::vector<byte> > frames( FUZZ_FRAMES );
+  std::vector<bool> damaged( FUZZ_FRAMES );
+  stream.clear();
+  for ( int f = 0; f < FUZZ_FRAMES; f++ ) {
+    std::vector<byte> &frame = frames[f];
+    frame.resize( 2 + Random( MAX_LENGTH - 1 ) );
+    frame[0] = f >> 8;
+    frame[1] = f & 0xFF;
+    for ( size_t i = 2; i < frame.size(); i++ ) {
+      frame[i] = Random( 4 ) ? Random( 256 ) : 0;
+    }
+    byte encoded[RS485_ENCODED_SIZE(MAX_LENGTH)];
+    std::vector<byte> e( encoded, encoded + encodeMsg( &frame[0], frame.size(),
+                                                        encoded, sizeof encoded ) );
+    damaged[f] = Random( 3 ) == 0;
+    if ( damaged[f] ) {
+      size_t at = 1 + Random( e.size() - 2 );     // not the delimiters
+      int kind = Random( 3 );
+      if ( kind == 0 ) {
+        e[at] ^= 1 << Random( 8 );
+      } else if ( kind == 1 ) {
+        e.erase( e.begin() + at );
+      } else {
+        e.insert( e.begin() + at, Random( 256 ) );
+      }
+    }
+    stream.insert( stream.end(), e.begin(), e.end() );
+  }
+
+  byte received[MAX_LENGTH];
+  RS485Receiver receiver( Available, Read, received, sizeof received );
+  readPos = end = 0;
+  int expected = 0, good = 0, wrong = 0;
+  while ( end < stream.size() ) {
+    end = std::min( stream.size(), end + 1 + Random( MAX_CHUNK ) );
+    while ( receiver.update() ) {
+      int f = ( received[0] << 8 ) | received[1];
+      // skipped frames must be damaged ones
+      while ( expected < f && expected < FUZZ_FRAMES ) {
+        CHECK( damaged[expected] );
+        expected++;
+      }
+      if ( f < FUZZ_FRAMES && f == expected
+           && receiver.getLength() == frames[f].size()
+           && !memcmp( received, &frames[f][0], frames[f].size() ) ) {
+        good++;
+      } else {
+        wrong++;
+      }
+      expected = f + 1;
+    }
+  }
+  int clean = 0;
+  for ( int f = 0; f < FUZZ_FRAMES; f++ ) {
+    clean += !damaged[f];
+  }
+  CHECK( wrong == 0 );
+  CHECK( good >= clean );
+  CHECK( (int)receiver.getPackets() == good + wrong );
+  CHECK( receiver.getErrors() > 0 );
+}
+
+/*------------------------------- Master ----------------------------------*/
+
+static host::Device &MasterBoard( void ) {
+  static host::Device *master = 0;
+  if ( !master ) {
+    master = new host::Device( hostMasterImage, 0 );
+    master->onBoot = []( host::Device & ) {
+      MasterConfig config;
+      Master( hostMasterImage ).getConfig( &config );
+      config.framedUnityLink = true;
+      Master( hostMasterImage ).setConfig( &config );
+    };
+    while ( master->UsbOutput().find( "Initialized shape display Master" ) == std::string::npos ) {
+      host::RunUntil( host::Now() + 100 * host::MS );
+    }
+  }
+  return *master;
+}
+
+static MasterStats Stats( void ) {
+  host::Device::Probe probe( MasterBoard() );
+  MasterStats stats;
+  Master( hostMasterImage ).stats( &stats );
+  return stats;
+}
+
+// Every fourth frame has a byte flipped: it is lost and counted, and
+// the frame after it goes to the bus as quickly as any other
+TEST( MasterDropsCorruptFrame ) {
+  host::Device &master = MasterBoard();
+  MasterStats before = Stats();
+  int sent = 0, corrupted = 0;
+  for ( int f = 0; f < MASTER_FRAMES; f++ ) {
+    byte frame[2 + DISPLAY_PINS];
+    frame[0] = f;
+    frame[1] = DATA_CMD;
+    memset( &frame[2], 10 + f % 20, DISPLAY_PINS );
+    byte encoded[RS485_ENCODED_SIZE(sizeof frame)];
+    unsigned int length = encodeMsg( frame, sizeof frame, encoded, sizeof encoded );
+    bool corrupt = ( f % 4 == 2 );
+    if ( corrupt ) {
+      encoded[length / 2] ^= 0x10;
+      corrupted++;
+    }
+    host::Time at = host::Now();
+    master.UsbSend( encoded, length, at );
+    host::RunUntil( at + COMMIT_TIME );
+    MasterStats stats = Stats();
+    CHECK( (byte)( stats.frameSeq - before.frameSeq ) == sent + !corrupt );
+    sent += !corrupt;
+    host::RunUntil( at + FRAME_PERIOD );
+  }
+  MasterStats after = Stats();
+  CHECK( after.unityFramesLost - before.unityFramesLost == (unsigned long)corrupted );
+  CHECK( after.framesDropped == before.framesDropped );
+}
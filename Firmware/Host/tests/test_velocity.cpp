@@ -0,0 +1,93 @@
+/****************************************************************************
+ Module
+   test_velocity.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   The speed the slave measures from its encoder edge times against
+   the plant's true speed, from fast to slow where the edges are far
+   apart
+
+ Notes
+   Linear keyframes move the setpoint at a constant speed and the PID
+   keeps the pin on it. The means of the two speeds over the middle
+   half of the keyframe, sampled every control period, are compared.
+   Below 20 mm/s the pin sticks and slips, and the uneven encoder
+   marks make every longer gap between edges read as slowing down.
+   At 1 mm/s the edges are ENCODER_STOP_US apart.
+****************************************************************************/
+
+#include <math.h>
+#include "HostTest.h"
+#include "SlaveBoard.h"
+#include "ShapePin.h"
+
+#define SLAVE_ID    0
+#define PIN         1
+#define BOTTOM      5.0f    // [mm] keyframes start here
+#define SAMPLE      (host::SEC / CONTROL_RATE_HZ)
+#define FAST_ERROR  0.02f   // of the true speed, from 20 mm/s
+#define SLOW_ERROR  0.15f   // from 2 mm/s, edges 125 ms apart
+
+static SlaveBoard &Board( void ) {
+  static SlaveBoard *board = 0;
+  if ( !board ) {
+    board = new SlaveBoard( hostSlaveImages[0], SLAVE_ID, 20, DefaultPinPlant() );
+    board->Boot( 3 * host::SEC );
+    board->ZeroAll( 5 * host::SEC );
+  }
+  return *board;
+}
+
+// Mean measured and true speed [mm/s] up at speed over travel [mm]
+static void MeasureAt( float speed, float travel, float *measured, float *actual ) {
+  SlaveBoard &board = Board();
+  board.Step( PIN, BOTTOM, host::SEC );
+  unsigned int duration = lroundf( travel / speed * 1000 );   // [ms]
+  board.Keyframe( PIN, BOTTOM + travel, duration, TRAJ_LINEAR );
+  host::Time start = host::Now();
+  host::RunUntil( start + duration * host::MS / 4 );
+  double sumMeasured = 0, sumActual = 0;
+  int n = 0;
+  while ( host::Now() < start + duration * host::MS * 3 / 4 ) {
+    host::RunUntil( host::Now() + SAMPLE );
+    sumMeasured += board.Velocity( PIN );
+    sumActual += board.plant[PIN]->Speed();
+    n++;
+  }
+  *measured = sumMeasured / n;
+  *actual = sumActual / n;
+  host::RunUntil( start + duration * host::MS + 200 * host::MS );
+}
+
+// Within error of the true mean speed at each of speeds [mm/s]
+static void Check( const float *speeds, int count, float error ) {
+  for ( int i = 0; i < count; i++ ) {
+    float measured, actual;
+    float travel = speeds[i] < 5 ? 6 : 40;
+    MeasureAt( speeds[i], travel, &measured, &actual );
+    printf( "%5.1f mm/s: measured %6.2f, true %6.2f mm/s (%+.1f %%)\n", speeds[i],
+            measured, actual, 100 * ( measured - actual ) / actual );
+    CHECK( fabsf( measured - actual ) <= error * actual );
+  }
+}
+
+TEST( FastSpeeds ) {
+  const float speeds[] = { 20, 40, 70 };
+  Check( speeds, 3, FAST_ERROR );
+}
+
+TEST( SlowSpeeds ) {
+  const float speeds[] = { 2, 5, 10 };
+  Check( speeds, 3, SLOW_ERROR );
+}
+
+// Reads as stopped between some edges, but never faster
+TEST( BelowOneEdgePerStopTime ) {
+  float measured, actual;
+  MeasureAt( 1, 6, &measured, &actual );
+  printf( "  1.0 mm/s: measured %6.2f, true %6.2f mm/s\n", measured, actual );
+  CHECK( measured > 0 && measured < actual );
+}
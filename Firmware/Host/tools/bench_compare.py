@@ -0,0 +1,46 @@
+#!/usr/bin/env python3
+#
+# bench_compare.py BASELINE.json NEW.json [THRESHOLD %]
+#
+# Compares two runs of a bench program (--benchmark_out). Prints the
+# CPU time of each benchmark in both and the change, and exits 1 if
+# any got slower by more than the threshold (default 10%).
+
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        return {b['name']: b for b in json.load(f)['benchmarks']
+                if b.get('run_type', 'iteration') == 'iteration'}
+
+
+def main():
+    if len(sys.argv) not in (3, 4):
+        sys.exit('usage: bench_compare.py BASELINE.json NEW.json [THRESHOLD %]')
+    base, new = load(sys.argv[1]), load(sys.argv[2])
+    threshold = float(sys.argv[3]) if len(sys.argv) == 4 else 10.0
+
+    slower = []
+    print('%-40s %12s %12s %8s' % ('Benchmark', 'Base ns', 'New ns', 'Change'))
+    for name in new:
+        if name not in base:
+            print('%-40s %12s %12.1f %8s' % (name, '-', new[name]['cpu_time'], 'new'))
+            continue
+        before, after = base[name]['cpu_time'], new[name]['cpu_time']
+        change = 100.0 * (after - before) / before if before else 0.0
+        print('%-40s %12.1f %12.1f %+7.1f%%' % (name, before, after, change))
+        if change > threshold:
+            slower.append(name)
+    for name in base:
+        if name not in new:
+            print('%-40s %12.1f %12s %8s' % (name, base[name]['cpu_time'], '-', 'gone'))
+
+    if slower:
+        print('slower by more than %g%%: %s' % (threshold, ', '.join(slower)))
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,53 @@
+#!/usr/bin/env python3
+#
+# ino2cpp.py SKETCH.ino OUT.cpp
+#
+# Turns a sketch into C++ like the Arduino builder does: includes
+# Arduino.h and declares every function after the last #include, so
+# the sketch can call functions defined further down.
+
+import re
+import sys
+
+FUNCTION = re.compile(r'^([A-Za-z_][\w:<>\s\*&]*?[\s\*&])([A-Za-z_]\w*)\s*\(([^;{}]*?)\)\s*\{',
+                      re.M)
+NOT_TYPES = ('else', 'return', 'case')
+NOT_FUNCTIONS = ('if', 'for', 'while', 'switch')
+
+
+def strip_comments(text):
+    # blank out comments but keep the line breaks, so offsets still match
+    def blank(m):
+        return re.sub(r'[^\n]', ' ', m.group(0))
+    return re.sub(r'//[^\n]*|/\*.*?\*/', blank, text, flags=re.S)
+
+
+def main():
+    ino, out = sys.argv[1], sys.argv[2]
+    text = open(ino).read()
+    code = strip_comments(text)
+
+    prototypes = []
+    for m in FUNCTION.finditer(code):
+        ret, name, args = m.group(1).strip(), m.group(2), m.group(3)
+        if ret.split()[0] in NOT_TYPES or name in NOT_FUNCTIONS:
+            continue
+        args = ' '.join(args.split())
+        prototypes.append('%s %s(%s);' % (' '.join(ret.split()), name, args))
+
+    includes = [m.end() for m in re.finditer(r'^\s*#include.*$', code, re.M)]
+    split = includes[-1] if includes else 0
+    line = text.count('\n', 0, split) + 1
+
+    with open(out, 'w') as f:
+        f.write('#include "Arduino.h"\n')
+        f.write('#line 1 "%s"\n' % ino)
+        f.write(text[:split])
+        f.write('\n')
+        f.write('\n'.join(prototypes))
+        f.write('\n#line %d "%s"\n' % (line + 1, ino))
+        f.write(text[split + 1:])
+
+
+if __name__ == '__main__':
+    main()
@@ -2,6 +2,7 @@
  * http://www.pjrc.com/teensy/td_libs_Encoder.html
  * Copyright (c) 2011,2013 PJRC.COM, LLC - Paul Stoffregen <paul@pjrc.com>
  *
+ * Version 1.3 - optional edge timestamps for speed estimation (ENCODER_TIMESTAMPS, ARM only)
  * Version 1.2 - fix -2 bug in C-only code
  * Version 1.1 - expand to support boards with up to 60 interrupts
  * Version 1.0 - initial release
@@ -51,6 +52,11 @@
 #define ENCODER_ARGLIST_SIZE 0
 #endif
 
+// Edge timestamps need the C update() below, not the AVR assembly
+#if defined(ENCODER_TIMESTAMPS) && defined(__AVR__)
+#undef ENCODER_TIMESTAMPS
+#endif
+
 
 
 // All the data needed by interrupts is consolidated into this ugly struct
@@ -64,6 +70,14 @@ typedef struct {
 	IO_REG_TYPE            pin2_bitmask;
 	uint8_t                state;
 	int32_t                position;
+#ifdef ENCODER_TIMESTAMPS
+	uint32_t               edge_time;      // micros() at the last count
+	uint32_t               edge_period;    // time of the last count
+	uint32_t               edge_period4;   // time of the last 4 counts
+	uint32_t               edge_phase[4];  // micros() at the last count to position & 3
+	int8_t                 edge_dir;       // direction of the last count
+	uint8_t                edge_run;       // counts in that direction since it changed
+#endif
 } Encoder_internal_state_t;
 
 class Encoder
@@ -84,6 +98,13 @@ public:
 		encoder.pin2_register = PIN_TO_BASEREG(pin2);
 		encoder.pin2_bitmask = PIN_TO_BITMASK(pin2);
 		encoder.position = 0;
+		#ifdef ENCODER_TIMESTAMPS
+		encoder.edge_time = micros();
+		encoder.edge_period = 0;
+		encoder.edge_period4 = 0;
+		encoder.edge_dir = 0;
+		encoder.edge_run = 0;
+		#endif
 		// allow time for a passive R-C filter to charge
 		// through the pullup resistors, before reading
 		// the initial state
@@ -115,8 +136,36 @@ public:
 	inline void write(int32_t p) {
 		noInterrupts();
 		encoder.position = p;
+		#ifdef ENCODER_TIMESTAMPS
+		encoder.edge_run = 0;
+		#endif
+		interrupts();
+	}
+#ifdef ENCODER_TIMESTAMPS
+	// Position with the edge timing: the last count came at edgeTime
+	// [us], the last "counts" counts took "period" [us] in direction
+	// dir. counts is 4 once the encoder kept its direction for 4 counts
+	// (a whole cycle, so uneven marks don't matter), 1 after one count,
+	// 0 right after a direction change.
+	inline int32_t readTiming(uint32_t *edgeTime, uint32_t *period, uint8_t *counts, int8_t *dir) {
+		noInterrupts();
+		int32_t ret = encoder.position;
+		*edgeTime = encoder.edge_time;
+		*dir = encoder.edge_dir;
+		if (encoder.edge_run >= 4) {
+			*period = encoder.edge_period4;
+			*counts = 4;
+		} else if (encoder.edge_run >= 1) {
+			*period = encoder.edge_period;
+			*counts = 1;
+		} else {
+			*period = 0;
+			*counts = 0;
+		}
 		interrupts();
+		return ret;
 	}
+#endif
 #else
 	inline int32_t read() {
 		update(&encoder);
@@ -277,17 +326,38 @@ private:
 		switch (state) {
 			case 1: case 7: case 8: case 14:
 				arg->position++;
+				timestamp(arg, 1);
 				return;
 			case 2: case 4: case 11: case 13:
 				arg->position--;
+				timestamp(arg, -1);
 				return;
 			case 3: case 12:
 				arg->position += 2;
+				timestamp(arg, 1);
 				return;
 			case 6: case 9:
 				arg->position -= 2;
+				timestamp(arg, -1);
 				return;
 		}
+#endif
+	}
+	// record the time of a count in direction dir (+1 or -1)
+	static inline void timestamp(Encoder_internal_state_t *arg, int8_t dir) {
+#ifdef ENCODER_TIMESTAMPS
+		uint32_t now = micros();
+		uint32_t *phase = &arg->edge_phase[arg->position & 3];
+		if (dir != arg->edge_dir) {
+			arg->edge_dir = dir;
+			arg->edge_run = 0;
+		} else if (arg->edge_run < 255) {
+			arg->edge_run++;
+		}
+		arg->edge_period = now - arg->edge_time;
+		arg->edge_period4 = now - *phase;
+		arg->edge_time = now;
+		*phase = now;
 #endif
 	}
 /*
@@ -0,0 +1,139 @@
+/****************************************************************************
+ Module
+   Profiler.cpp
+
+ Revision
+   1.0.0
+
+ Description
+   Per-stage cycle count statistics for the shape display firmware
+
+ Notes
+   Each stage should be recorded from one context only (loop() or 
+   one ISR). Readers copy a stage with interrupts off.
+   Built the same whatever PROFILING the sketch sets, only the 
+   macros in Profiler.h depend on it.
+****************************************************************************/
+
+#include "Profiler.h"
+
+typedef struct {
+  uint32_t count;
+  uint32_t min, max;          // [cycles]
+  uint64_t sum;               // [cycles]
+  uint32_t bins[PROFILE_BINS];
+} ProfileStage_t;
+
+static ProfileStage_t stages[PROFILE_MAX_STAGES];
+static uint32_t lastMark[PROFILE_MAX_STAGES];
+static bool haveMark[PROFILE_MAX_STAGES];
+
+/****************************************************************************
+
+  Public Functions
+
+****************************************************************************/
+
+// Start the DWT cycle counter and zero every stage
+void profileBegin ( void ) {
+  ARM_DEMCR |= ARM_DEMCR_TRCENA;
+  ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+  profileClear();
+}
+
+// Add one time [cycles] to a stage
+void profileRecord ( byte stage, uint32_t cycles ) {
+  if ( stage >= PROFILE_MAX_STAGES ) {
+    return;
+  }
+  ProfileStage_t &s = stages[stage];
+  if ( s.count == 0 || cycles < s.min ) {
+    s.min = cycles;
+  }
+  if ( cycles > s.max ) {
+    s.max = cycles;
+  }
+  s.count++;
+  s.sum += cycles;
+  int bin = 31 - __builtin_clz( cycles | 1 ) - PROFILE_FIRST_BIN;
+  s.bins[ constrain( bin, 0, PROFILE_BINS - 1 ) ]++;
+}
+
+// Record the cycles since the last mark of this stage
+void profileMark ( byte stage ) {
+  if ( stage >= PROFILE_MAX_STAGES ) {
+    return;
+  }
+  uint32_t now = PROFILE_CYCLES();
+  if ( haveMark[stage] ) {
+    profileRecord( stage, now - lastMark[stage] );
+  }
+  lastMark[stage] = now;
+  haveMark[stage] = true;
+}
+
+// Zero every stage
+void profileClear ( void ) {
+  for ( byte stage = 0; stage < PROFILE_MAX_STAGES; stage++ ) {
+    profileClear( stage );
+  }
+}
+
+// Zero one stage
+void profileClear ( byte stage ) {
+  if ( stage >= PROFILE_MAX_STAGES ) {
+    return;
+  }
+  noInterrupts();
+  memset( &stages[stage], 0, sizeof stages[stage] );
+  haveMark[stage] = false;
+  interrupts();
+}
+
+// Write one stage to out (PROFILE_PACKED_SIZE bytes, see Profiler.h)
+// Returns the number of bytes written, 0 for a bad stage.
+unsigned int profilePack ( byte stage, byte numStages, byte * out ) {
+  if ( stage >= PROFILE_MAX_STAGES ) {
+    return 0;
+  }
+  noInterrupts();
+  ProfileStage_t s = stages[stage];
+  interrupts();
+
+  uint32_t values[4] = { s.count, s.min, 
+                         s.count ? (uint32_t)(s.sum / s.count) : 0, s.max };
+  unsigned int len = 0;
+  out[len++] = stage;
+  out[len++] = numStages;
+  for ( int i = 0; i < 4; i++ ) {
+    out[len++] = values[i] >> 24;
+    out[len++] = (values[i] >> 16) & 0xFF;
+    out[len++] = (values[i] >> 8) & 0xFF;
+    out[len++] = values[i] & 0xFF;
+  }
+  for ( int b = 0; b < PROFILE_BINS; b++ ) {
+    uint32_t bin = min( s.bins[b], (uint32_t)0xFFFF );
+    out[len++] = bin >> 8;
+    out[len++] = bin & 0xFF;
+  }
+  return len;
+}
+
+// Print the stages to the USB serial, times in us
+void profilePrint ( const char * const * names, byte numStages ) {
+  const float cyclesPerUs = F_CPU / 1000000.0f;
+  Serial.printf( "stage        count    min us   mean us    max us   histogram (bin 0 < %lu cycles, x2 per bin)\n",
+                 1UL << (PROFILE_FIRST_BIN + 1) );
+  for ( byte stage = 0; stage < numStages && stage < PROFILE_MAX_STAGES; stage++ ) {
+    noInterrupts();
+    ProfileStage_t s = stages[stage];
+    interrupts();
+    float mean = s.count ? (float)s.sum / s.count : 0;
+    Serial.printf( "%-10s %7lu %9.1f %9.1f %9.1f  ", names[stage], (unsigned long)s.count,
+                   s.min / cyclesPerUs, mean / cyclesPerUs, s.max / cyclesPerUs );
+    for ( int b = 0; b < PROFILE_BINS; b++ ) {
+      Serial.printf( " %lu", (unsigned long)s.bins[b] );
+    }
+    Serial.println();
+  }
+}
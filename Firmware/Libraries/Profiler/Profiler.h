@@ -0,0 +1,73 @@
+/****************************************************************************
+
+  Header file for Profiler
+  Per-stage timing with the Cortex-M4 DWT cycle counter
+
+  Each sketch numbers its stages (0 ... PROFILE_MAX_STAGES-1) and 
+  times them with PROFILE_SCOPE(stage) at the top of a function or 
+  block. Every stage keeps the count, min/mean/max and a log2 
+  histogram of its times in cycles. PROFILE_MARK(stage) records the 
+  time between two marks instead, e.g. the period of a timer ISR.
+
+  PROFILING is 0 unless the sketch defines it to 1 before including
+  this header. With PROFILING at 0 the macros compile to nothing and 
+  the stages stay empty; the functions are always built.
+
+ ****************************************************************************/
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#if defined(ARDUINO) && ARDUINO >= 100
+  #include "Arduino.h"
+#else
+  #include "WConstants.h"
+#endif
+
+#ifndef PROFILING
+  #define PROFILING  0
+#endif
+
+#define PROFILE_MAX_STAGES  8     // stages per sketch
+#define PROFILE_BINS        16    // histogram bins
+#define PROFILE_FIRST_BIN   6     // bin 0 counts times under 2^(PROFILE_FIRST_BIN+1) cycles,
+                                  // bin b times of 2^(b+PROFILE_FIRST_BIN) cycles and up
+// Bytes written by profilePack:
+//  [STAGE] [NUM STAGES] [COUNT] [MIN] [MEAN] [MAX] [BIN 0] ... [BIN PROFILE_BINS-1]
+//  count, min, mean and max are 4 bytes (high first) in cycles, 
+//  bins 2 bytes (high first, stop at 0xFFFF)
+#define PROFILE_PACKED_SIZE (2 + 4*4 + 2*PROFILE_BINS)
+
+void profileBegin ( void );
+void profileRecord ( byte stage, uint32_t cycles );
+void profileMark ( byte stage );
+void profileClear ( void );
+void profileClear ( byte stage );
+unsigned int profilePack ( byte stage, byte numStages, byte * out );
+void profilePrint ( const char * const * names, byte numStages );
+
+#define PROFILE_CYCLES()        ARM_DWT_CYCCNT
+
+#if PROFILING
+  #define PROFILE_BEGIN()       profileBegin()
+  #define PROFILE_SCOPE(stage)  ProfileScope profileScope_(stage)
+  #define PROFILE_MARK(stage)   profileMark(stage)
+#else
+  #define PROFILE_BEGIN()
+  #define PROFILE_SCOPE(stage)
+  #define PROFILE_MARK(stage)
+#endif
+
+// Times its own lifetime into a stage
+class ProfileScope
+{
+  public:
+    ProfileScope ( byte stage ) : stage_(stage), start_(PROFILE_CYCLES()) {}
+    ~ProfileScope () { profileRecord( stage_, PROFILE_CYCLES() - start_ ); }
+
+  private:
+    byte stage_;
+    uint32_t start_;
+};
+
+#endif
@@ -6,13 +6,25 @@
  Version: 1.1
 
  Version 1.1 reset the timeout period after getting STX.
+ Version 1.2 allow packets longer than 255 bytes (full-frame broadcasts).
+ Version 1.3 add RS485Receiver, a non-blocking version of recvMsg.
+ Version 1.4 add COBS framing (see RS485_FRAMING in RS485_protocol.h).
+ Version 1.5 table driven CRC8, CRC16-CCITT for long packets (RS485_CRC16_LENGTH).
+ Version 1.6 add encodeMsg to build a packet in a buffer for buffered/DMA sends.
+ Version 1.7 count errors per cause in RS485Receiver, recvMsg can report why it failed.
 
- Can send from 1 to 255 bytes from one node to another with:
+ Can send from 1 to 65535 bytes from one node to another with:
 
  * Packet start indicator (STX)
  * Each data byte is doubled and inverted to check validity
  * Packet end indicator (ETX)
- * Packet CRC (checksum)
+ * Packet CRC (checksum), 8-bit or 16-bit for long packets
+
+ or, with RS485_FRAMING_COBS (the default):
+
+ * 0x00 delimiter before and after the packet
+ * Data and CRC are COBS encoded so they never contain 0x00
+   (one extra byte for every 254 data bytes)
 
 
  To allow flexibility with hardware (eg. Serial, SoftwareSerial, I2C)
@@ -62,26 +74,96 @@ PERMISSION TO DISTRIBUTE
 
 const byte STX = '\2';
 const byte ETX = '\3';
+const byte COBS_DELIM = 0;
+
+// Dallas/Maxim 8-bit CRC (polynomial 0x8C reflected), one entry per byte value
+static const byte crc8_table [256] PROGMEM = {
+  0x00, 0x5E, 0xBC, 0xE2, 0x61, 0x3F, 0xDD, 0x83, 0xC2, 0x9C, 0x7E, 0x20, 0xA3, 0xFD, 0x1F, 0x41,
+  0x9D, 0xC3, 0x21, 0x7F, 0xFC, 0xA2, 0x40, 0x1E, 0x5F, 0x01, 0xE3, 0xBD, 0x3E, 0x60, 0x82, 0xDC,
+  0x23, 0x7D, 0x9F, 0xC1, 0x42, 0x1C, 0xFE, 0xA0, 0xE1, 0xBF, 0x5D, 0x03, 0x80, 0xDE, 0x3C, 0x62,
+  0xBE, 0xE0, 0x02, 0x5C, 0xDF, 0x81, 0x63, 0x3D, 0x7C, 0x22, 0xC0, 0x9E, 0x1D, 0x43, 0xA1, 0xFF,
+  0x46, 0x18, 0xFA, 0xA4, 0x27, 0x79, 0x9B, 0xC5, 0x84, 0xDA, 0x38, 0x66, 0xE5, 0xBB, 0x59, 0x07,
+  0xDB, 0x85, 0x67, 0x39, 0xBA, 0xE4, 0x06, 0x58, 0x19, 0x47, 0xA5, 0xFB, 0x78, 0x26, 0xC4, 0x9A,
+  0x65, 0x3B, 0xD9, 0x87, 0x04, 0x5A, 0xB8, 0xE6, 0xA7, 0xF9, 0x1B, 0x45, 0xC6, 0x98, 0x7A, 0x24,
+  0xF8, 0xA6, 0x44, 0x1A, 0x99, 0xC7, 0x25, 0x7B, 0x3A, 0x64, 0x86, 0xD8, 0x5B, 0x05, 0xE7, 0xB9,
+  0x8C, 0xD2, 0x30, 0x6E, 0xED, 0xB3, 0x51, 0x0F, 0x4E, 0x10, 0xF2, 0xAC, 0x2F, 0x71, 0x93, 0xCD,
+  0x11, 0x4F, 0xAD, 0xF3, 0x70, 0x2E, 0xCC, 0x92, 0xD3, 0x8D, 0x6F, 0x31, 0xB2, 0xEC, 0x0E, 0x50,
+  0xAF, 0xF1, 0x13, 0x4D, 0xCE, 0x90, 0x72, 0x2C, 0x6D, 0x33, 0xD1, 0x8F, 0x0C, 0x52, 0xB0, 0xEE,
+  0x32, 0x6C, 0x8E, 0xD0, 0x53, 0x0D, 0xEF, 0xB1, 0xF0, 0xAE, 0x4C, 0x12, 0x91, 0xCF, 0x2D, 0x73,
+  0xCA, 0x94, 0x76, 0x28, 0xAB, 0xF5, 0x17, 0x49, 0x08, 0x56, 0xB4, 0xEA, 0x69, 0x37, 0xD5, 0x8B,
+  0x57, 0x09, 0xEB, 0xB5, 0x36, 0x68, 0x8A, 0xD4, 0x95, 0xCB, 0x29, 0x77, 0xF4, 0xAA, 0x48, 0x16,
+  0xE9, 0xB7, 0x55, 0x0B, 0x88, 0xD6, 0x34, 0x6A, 0x2B, 0x75, 0x97, 0xC9, 0x4A, 0x14, 0xF6, 0xA8,
+  0x74, 0x2A, 0xC8, 0x96, 0x15, 0x4B, 0xA9, 0xF7, 0xB6, 0xE8, 0x0A, 0x54, 0xD7, 0x89, 0x6B, 0x35
+};
+
+// CRC16-CCITT (polynomial 0x1021, initial value 0xFFFF), one entry per byte value
+static const uint16_t crc16_table [256] PROGMEM = {
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+  0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+  0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+  0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+  0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+  0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+  0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+  0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+  0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+  0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+  0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+  0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+  0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+  0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+  0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+  0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+  0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+  0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+  0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+  0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+  0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+  0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+  0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+  0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+  0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+  0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+  0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+  0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+  0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+  0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+  0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
 
 // calculate 8-bit CRC
-static byte crc8 (const byte *addr, byte len)
+static byte crc8 (const byte *addr, unsigned int len)
 {
   byte crc = 0;
   while (len--)
-    {
-    byte inbyte = *addr++;
-    for (byte i = 8; i; i--)
-      {
-      byte mix = (crc ^ inbyte) & 0x01;
-      crc >>= 1;
-      if (mix)
-        crc ^= 0x8C;
-      inbyte >>= 1;
-      }  // end of for
-    }  // end of while
+    crc = pgm_read_byte (&crc8_table [crc ^ *addr++]);
   return crc;
 }  // end of crc8
 
+// calculate 16-bit CRC
+static uint16_t crc16 (const byte *addr, unsigned int len)
+{
+  uint16_t crc = 0xFFFF;
+  while (len--)
+    crc = (crc << 8) ^ pgm_read_word (&crc16_table [(crc >> 8) ^ *addr++]);
+  return crc;
+}  // end of crc16
+
+// number of CRC bytes sent after "length" data bytes
+static byte crcSize (const unsigned int length)
+{
+  return length > RS485_CRC16_LENGTH ? 2 : 1;
+}  // end of crcSize
+
+// CRC for "length" data bytes, of size crcSize (length)
+static uint16_t calcCrc (const byte *addr, const unsigned int length)
+{
+  if (crcSize (length) == 2)
+    return crc16 (addr, length);
+  return crc8 (addr, length);
+}  // end of calcCrc
+
 // send a byte complemented, repeated
 // only values sent would be (in hex):
 //   0F, 1E, 2D, 3C, 4B, 5A, 69, 78, 87, 96, A5, B4, C3, D2, E1, F0
@@ -99,103 +181,395 @@ byte c;
 
 }  // end of sendComplemented
 
-// send a message of "length" bytes (max 255) to other end
+#if RS485_FRAMING != RS485_FRAMING_COBS
 // put STX at start, ETX at end, and add CRC
-void sendMsg (WriteCallback fSend, const byte * data, const byte length)
+static void sendComplementedMsg (WriteCallback fSend, const byte * data, const unsigned int length)
 {
   fSend (STX);  // STX
-  for (byte i = 0; i < length; i++) {
+  for (unsigned int i = 0; i < length; i++) {
     sendComplemented (fSend, data [i]);
   }
   fSend (ETX);  // ETX
-  sendComplemented (fSend, crc8 (data, length));
+  const uint16_t crc = calcCrc (data, length);
+  if (crcSize (length) == 2)
+    sendComplemented (fSend, crc >> 8);
+  sendComplemented (fSend, crc & 0xFF);
+}  // end of sendComplementedMsg
+#endif
+
+#if RS485_FRAMING == RS485_FRAMING_COBS
+// byte "i" of the data followed by its CRC (high byte first)
+static inline byte cobsByte (const byte * data, const unsigned int length,
+                             const uint16_t crc, const byte crcLen, const unsigned int i)
+{
+  if (i < length)
+    return data [i];
+  if (crcLen == 2 && i == length)
+    return crc >> 8;
+  return crc & 0xFF;
+}  // end of cobsByte
+
+// COBS encode data followed by its CRC, between two 0x00 delimiters
+// each block is a code byte (1 + number of non-zero bytes that follow)
+// then the bytes; a code below 0xFF means a zero came after the block
+static void sendCobsMsg (WriteCallback fSend, const byte * data, const unsigned int length)
+{
+  const uint16_t crc = calcCrc (data, length);
+  const byte crcLen = crcSize (length);
+  const unsigned int total = length + crcLen;  // CRC is sent after the data
+  unsigned int start = 0;
+
+  fSend (COBS_DELIM);
+  while (true)
+    {
+    // find the next zero, at most 254 bytes ahead
+    unsigned int end = start;
+    while (end < total && end - start < 254 && cobsByte (data, length, crc, crcLen, end) != 0)
+      end++;
+
+    byte code = end - start + 1;
+    fSend (code);
+    for (unsigned int i = start; i < end; i++)
+      fSend (cobsByte (data, length, crc, crcLen, i));
+
+    if (end >= total)
+      break;
+    // skip the zero this block stands for (a full block has none)
+    start = (code == 0xFF) ? end : end + 1;
+    }  // end of while blocks left
+  fSend (COBS_DELIM);
+}  // end of sendCobsMsg
+#endif
+
+// send a message of "length" bytes (max 65535) to other end
+void sendMsg (WriteCallback fSend, const byte * data, const unsigned int length)
+{
+#if RS485_FRAMING == RS485_FRAMING_COBS
+  sendCobsMsg (fSend, data, length);
+#else
+  sendComplementedMsg (fSend, data, length);
+#endif
 }  // end of sendMsg
 
+// output buffer used by encodeMsg
+static byte * encode_buf;
+static unsigned int encode_size;
+static unsigned int encode_pos;
+
+// WriteCallback that appends to the encodeMsg buffer
+static void encodeWrite (const byte what)
+{
+  if (encode_pos < encode_size)
+    encode_buf [encode_pos] = what;
+  encode_pos++;  // keep counting so overflow can be detected
+}  // end of encodeWrite
+
+// encode a whole message (framing and CRC) into "out" so it can be
+// handed to the serial port in one write; returns the encoded length,
+// or 0 if it doesn't fit in "size" bytes
+unsigned int encodeMsg (const byte * data, const unsigned int length,
+                        byte * out, const unsigned int size)
+{
+  encode_buf = out;
+  encode_size = size;
+  encode_pos = 0;
+  sendMsg (encodeWrite, data, length);
+  if (encode_pos > size)
+    return 0;  // overflow
+  return encode_pos;
+}  // end of encodeMsg
+
+RS485Receiver::RS485Receiver (AvailableCallback fAvailable,
+                              ReadCallback fRead,
+                              byte * data,
+                              const unsigned int length)
+  : fAvailable_ (fAvailable), fRead_ (fRead), data_ (data), length_ (length),
+    packets_ (0), bad_chars_ (0), bad_crcs_ (0), overflows_ (0)
+{
+  reset ();
+}  // end of RS485Receiver::RS485Receiver
+
+unsigned int RS485Receiver::getErrors (RS485Status_t cause) const
+{
+  switch (cause)
+    {
+    case RS485_BAD_CHAR:  return bad_chars_;
+    case RS485_BAD_CRC:   return bad_crcs_;
+    case RS485_OVERFLOW:  return overflows_;
+    default:              return 0;
+    }  // end of switch
+}  // end of RS485Receiver::getErrors
+
+void RS485Receiver::clearCounts ()
+{
+  packets_ = 0;
+  bad_chars_ = 0;
+  bad_crcs_ = 0;
+  overflows_ = 0;
+}  // end of RS485Receiver::clearCounts
+
+// forget any partial packet, wait for the next STX
+void RS485Receiver::reset ()
+{
+  have_stx_ = false;
+  have_etx_ = false;
+  input_pos_ = 0;
+  first_nibble_ = true;
+  current_byte_ = 0;
+  crc_ = 0;
+  crc_pos_ = 0;
+  cobs_code_ = 0;
+  cobs_left_ = 0;
+  pending_count_ = 0;
+}  // end of RS485Receiver::reset
+
+// feed one byte through the packet state machine
+RS485Status_t RS485Receiver::process (byte inByte)
+{
+#if RS485_FRAMING == RS485_FRAMING_COBS
+  return processCobs (inByte);
+#else
+  return processComplemented (inByte);
+#endif
+}  // end of RS485Receiver::process
+
+// STX / complemented nibbles / ETX / CRC framing
+RS485Status_t RS485Receiver::processComplemented (byte inByte)
+{
+  switch (inByte)
+    {
+
+    case STX:   // start of text
+      have_stx_ = true;
+      have_etx_ = false;
+      input_pos_ = 0;
+      first_nibble_ = true;
+      return RS485_STARTED;
+
+    case ETX:   // end of text
+      have_etx_ = true;
+      crc_ = 0;
+      crc_pos_ = 0;
+      return RS485_WAITING;
+
+    default:
+      // wait until packet officially starts
+      if (!have_stx_)
+        return RS485_WAITING;
+
+      // check byte is in valid form (4 bits followed by 4 bits complemented)
+      if ((inByte >> 4) != ((inByte & 0x0F) ^ 0x0F) )
+        {
+        reset ();
+        return RS485_BAD_CHAR;  // bad character
+        }
+
+      // convert back
+      inByte >>= 4;
+
+      // high-order nibble?
+      if (first_nibble_)
+        {
+        current_byte_ = inByte;
+        first_nibble_ = false;
+        return RS485_WAITING;
+        }  // end of first nibble
+
+      // low-order nibble
+      current_byte_ <<= 4;
+      current_byte_ |= inByte;
+      first_nibble_ = true;
+
+      // if we have the ETX this must be the CRC (one or two bytes)
+      if (have_etx_)
+        {
+        crc_ = (crc_ << 8) | current_byte_;
+        if (++crc_pos_ < crcSize (input_pos_))
+          return RS485_WAITING;
+        have_stx_ = false;  // next byte has to be a new STX
+        if (calcCrc (data_, input_pos_) != crc_)
+          return RS485_BAD_CRC;  // bad crc
+        return RS485_DONE;  // data_ holds input_pos_ bytes
+        }  // end if have ETX already
+
+      // keep adding if not full
+      if (input_pos_ < length_)
+        data_ [input_pos_++] = current_byte_;
+      else
+        {
+        reset ();
+        return RS485_OVERFLOW;  // overflow
+        }
+      return RS485_WAITING;
+
+    }  // end of switch
+}  // end of RS485Receiver::processComplemented
+
+// store a decoded COBS byte; the newest two bytes are held back in
+// pending_ since the packet ends with a one or two byte CRC
+bool RS485Receiver::pushCobs (byte decoded)
+{
+  if (pending_count_ == 2)
+    {
+    if (input_pos_ >= length_)
+      return false;  // overflow
+    data_ [input_pos_++] = pending_ [0];
+    pending_ [0] = pending_ [1];
+    pending_count_ = 1;
+    }
+  pending_ [pending_count_++] = decoded;
+  return true;
+}  // end of RS485Receiver::pushCobs
+
+// the delimiter after a packet: split off the CRC and check it
+RS485Status_t RS485Receiver::finishCobs ()
+{
+  const unsigned int total = input_pos_ + pending_count_;
+  const byte crcLen = (total >= 2 && crcSize (total - 2) == 2) ? 2 : 1;
+
+  // the data length has to call for this CRC size
+  if (pending_count_ < crcLen || crcSize (total - crcLen) != crcLen)
+    return RS485_BAD_CRC;
+
+  uint16_t crc;
+  if (crcLen == 2)
+    crc = ((uint16_t) pending_ [0] << 8) | pending_ [1];
+  else
+    {
+    if (pending_count_ == 2)
+      {
+      if (input_pos_ >= length_)
+        return RS485_OVERFLOW;  // overflow
+      data_ [input_pos_++] = pending_ [0];
+      }
+    crc = pending_ [pending_count_ - 1];
+    }
+
+  if (calcCrc (data_, input_pos_) != crc)
+    return RS485_BAD_CRC;  // bad crc
+  return RS485_DONE;  // data_ holds input_pos_ bytes
+}  // end of RS485Receiver::finishCobs
+
+// 0x00 delimited COBS framing, CRC as the last decoded byte(s)
+RS485Status_t RS485Receiver::processCobs (byte inByte)
+{
+  if (inByte == COBS_DELIM)
+    {
+    // a delimiter always starts the next packet
+    bool truncated = have_stx_ && cobs_left_ != 0;
+    bool empty = !have_stx_ || pending_count_ == 0;
+    RS485Status_t status = RS485_STARTED;
+    if (truncated)
+      status = RS485_BAD_CHAR;  // block shorter than its code
+    else if (!empty)
+      status = finishCobs ();
+    unsigned int received = input_pos_;
+    reset ();
+    have_stx_ = true;
+    if (status == RS485_DONE)
+      input_pos_ = received;
+    return status;  // empty packets (back to back delimiters) just restart
+    }  // end of delimiter
+
+  // wait until packet officially starts
+  if (!have_stx_)
+    return RS485_WAITING;
+
+  if (cobs_left_ == 0)
+    {
+    // code byte; the previous block ended with a zero unless it was full
+    if (cobs_code_ != 0 && cobs_code_ != 0xFF && !pushCobs (0))
+      {
+      reset ();
+      return RS485_OVERFLOW;  // overflow
+      }
+    cobs_code_ = inByte;
+    cobs_left_ = inByte - 1;
+    return RS485_WAITING;
+    }  // end of code byte
+
+  cobs_left_--;
+  if (!pushCobs (inByte))
+    {
+    reset ();
+    return RS485_OVERFLOW;  // overflow
+    }
+  return RS485_WAITING;
+}  // end of RS485Receiver::processCobs
+
+// consume the bytes already received, without waiting for more
+// returns true as soon as a complete packet is in the buffer; any
+// bytes after it are left for the next call
+bool RS485Receiver::update ()
+{
+  while (fAvailable_ () > 0)
+    {
+    switch (process (fRead_ ()))
+      {
+      case RS485_DONE:
+        packets_++;
+        return true;
+
+      case RS485_BAD_CHAR:
+        bad_chars_++;
+        break;
+
+      case RS485_BAD_CRC:
+        bad_crcs_++;
+        break;
+
+      case RS485_OVERFLOW:
+        overflows_++;
+        break;
+
+      default:
+        break;
+      }  // end of switch
+    }  // end of while bytes available
+  return false;
+}  // end of RS485Receiver::update
+
 // receive a message, maximum "length" bytes, timeout after "timeout" milliseconds
 // if nothing received, or an error (eg. bad CRC, bad data) return 0
 // otherwise, returns length of received data
-byte recvMsg (AvailableCallback fAvailable,   // return available count
+// if "result" is given it is set to RS485_DONE or to the cause of the failure
+unsigned int recvMsg (AvailableCallback fAvailable,   // return available count
               ReadCallback fRead,             // read one byte
               byte * data,                    // buffer to receive into
-              const byte length,              // maximum buffer size
-              unsigned long timeout)          // milliseconds before timing out
+              const unsigned int length,      // maximum buffer size
+              unsigned long timeout,          // milliseconds before timing out
+              RS485Status_t * result)         // why it returned, may be NULL
   {
 
   unsigned long start_time = millis ();
 
-  bool have_stx = false;
-
-  // variables below are set when we get an STX
-  bool have_etx;
-  byte input_pos;
-  bool first_nibble;
-  byte current_byte;
+  RS485Receiver receiver (fAvailable, fRead, data, length);
 
   while (millis () - start_time < timeout)
     {
     if (fAvailable () > 0)
       {
-      byte inByte = fRead ();
-
-      switch (inByte)
+      RS485Status_t status = receiver.process (fRead ());
+      switch (status)
         {
-
-        case STX:   // start of text
-          have_stx = true;
-          have_etx = false;
-          input_pos = 0;
-          first_nibble = true;
+        case RS485_STARTED:
           start_time = millis ();  // reset timeout period
           break;
 
-        case ETX:   // end of text
-          have_etx = true;
+        case RS485_WAITING:
           break;
 
         default:
-          // wait until packet officially starts
-          if (!have_stx)
-            break;
-
-          // check byte is in valid form (4 bits followed by 4 bits complemented)
-          if ((inByte >> 4) != ((inByte & 0x0F) ^ 0x0F) )
-            return 0;  // bad character
-
-          // convert back
-          inByte >>= 4;
-
-          // high-order nibble?
-          if (first_nibble)
-            {
-            current_byte = inByte;
-            first_nibble = false;
-            break;
-            }  // end of first nibble
-
-          // low-order nibble
-          current_byte <<= 4;
-          current_byte |= inByte;
-          first_nibble = true;
-
-          // if we have the ETX this must be the CRC
-          if (have_etx)
-            {
-            if (crc8 (data, input_pos) != current_byte)
-              return 0;  // bad crc
-            return input_pos;  // return received length
-            }  // end if have ETX already
-
-          // keep adding if not full
-          if (input_pos < length)
-            data [input_pos++] = current_byte;
-          else
-            return 0;  // overflow
-          break;
-
+          if (result)
+            *result = status;
+          if (status == RS485_DONE)
+            return receiver.getLength ();  // return received length
+          return 0;  // bad character, bad crc or overflow
         }  // end of switch
       }  // end of incoming data
     } // end of while not timed out
 
+  if (result)
+    *result = RS485_TIMEOUT;
   return 0;  // timeout
 } // end of recvMsg
-
@@ -1,15 +1,109 @@
+#ifndef RS485_PROTOCOL_H
+#define RS485_PROTOCOL_H
+
 #if defined(ARDUINO) && ARDUINO >= 100
   #include "Arduino.h"
 #else
   #include "WConstants.h"
 #endif
 
+// Framing used on the wire, must be the same on master and slaves
+//  RS485_FRAMING_COMPLEMENTED: STX, each byte sent as two nibble+complement
+//                              bytes, ETX, CRC (about 2x the payload)
+//  RS485_FRAMING_COBS:         0x00, COBS encoded payload + CRC, 0x00
+//                              (1 extra byte per 254 payload bytes)
+#define RS485_FRAMING_COMPLEMENTED  0
+#define RS485_FRAMING_COBS          1
+#ifndef RS485_FRAMING
+  #define RS485_FRAMING  RS485_FRAMING_COBS
+#endif
+
+// Packets with more than RS485_CRC16_LENGTH data bytes (e.g. full-frame
+// broadcasts) carry a CRC16-CCITT, shorter ones keep the 8-bit CRC
+#ifndef RS485_CRC16_LENGTH
+  #define RS485_CRC16_LENGTH  16
+#endif
+
+// Worst case encoded size of a "length" byte message, for sizing encodeMsg buffers
+#define RS485_ENCODED_SIZE(length)  (2*(length) + 6)
+
 typedef void (*WriteCallback)  (const byte what);    // send a byte to serial port
 typedef int  (*AvailableCallback)  ();    // return number of bytes available
 typedef int  (*ReadCallback)  ();    // read a byte from serial port
 
 void sendMsg (WriteCallback fSend, 
-              const byte * data, const byte length);
-byte recvMsg (AvailableCallback fAvailable, ReadCallback fRead, 
-              byte * data, const byte length, 
-              unsigned long timeout = 10);
\ No newline at end of file
+              const byte * data, const unsigned int length);
+unsigned int encodeMsg (const byte * data, const unsigned int length,
+              byte * out, const unsigned int size);
+// result of feeding one byte to an RS485Receiver
+typedef enum { RS485_WAITING,     // nothing useful yet, keep feeding
+               RS485_STARTED,     // got STX (or delimiter), new packet begins
+               RS485_DONE,        // complete packet with good CRC
+               RS485_BAD_CHAR,    // byte not in complemented form / bad COBS block
+               RS485_BAD_CRC,     // CRC mismatch
+               RS485_OVERFLOW,    // packet larger than the buffer
+               RS485_TIMEOUT      // recvMsg only: no complete packet in time
+             } RS485Status_t;
+
+unsigned int recvMsg (AvailableCallback fAvailable, ReadCallback fRead, 
+              byte * data, const unsigned int length, 
+              unsigned long timeout = 10, RS485Status_t * result = NULL);
+
+// Resumable receiver. Keeps the STX/nibble/CRC state between calls
+// so the caller never has to wait for a whole packet to arrive.
+class RS485Receiver
+  {
+  public:
+    RS485Receiver (AvailableCallback fAvailable, ReadCallback fRead,
+                   byte * data, const unsigned int length);
+
+    // read whatever bytes are available, return true once a packet is complete
+    bool update ();
+    // feed a single byte to the parser
+    RS485Status_t process (byte inByte);
+    // drop any partial packet
+    void reset ();
+
+    const byte * getData () const { return data_; }
+    unsigned int getLength () const { return input_pos_; }
+    // packets dropped by update() (bad character, bad CRC or overflow)
+    unsigned int getErrors () const { return bad_chars_ + bad_crcs_ + overflows_; }
+    // packets dropped by update() for one cause (RS485_BAD_CHAR, RS485_BAD_CRC
+    // or RS485_OVERFLOW)
+    unsigned int getErrors (RS485Status_t cause) const;
+    // good packets returned by update()
+    unsigned int getPackets () const { return packets_; }
+    // zero the packet and error counts
+    void clearCounts ();
+
+  private:
+    RS485Status_t processComplemented (byte inByte);
+    RS485Status_t processCobs (byte inByte);
+    bool pushCobs (byte decoded);
+    RS485Status_t finishCobs ();
+
+    AvailableCallback fAvailable_;
+    ReadCallback fRead_;
+    byte * data_;
+    unsigned int length_;
+    unsigned int packets_;
+    unsigned int bad_chars_;
+    unsigned int bad_crcs_;
+    unsigned int overflows_;
+
+    bool have_stx_;
+    bool have_etx_;
+    unsigned int input_pos_;
+    bool first_nibble_;
+    byte current_byte_;
+    uint16_t crc_;        // CRC bytes received after ETX
+    byte crc_pos_;
+
+    // COBS state
+    byte cobs_code_;      // code byte of the current block
+    byte cobs_left_;      // data bytes left in the current block
+    byte pending_ [2];    // last decoded bytes, the CRC once the packet ends
+    byte pending_count_;
+  };  // end of class RS485Receiver
+
+#endif
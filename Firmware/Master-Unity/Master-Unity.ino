@@ -14,6 +14,63 @@
       Byte  0 : command byte (data, zero, stop, etc...)
       Byte 1-n: any data bytes
 
+    With framedUnityLink (off by default, for hosts that frame their
+    msgs), every msg (both ways) is framed like the RS485 msgs 
+    (0x00, COBS encoded msg + CRC, 0x00):
+      Byte  0 : frame sequence number
+      Byte  1 : command byte
+      Byte 2-n: any data bytes
+    A corrupt frame is dropped on its own, the next one is read normally.
+    Position frames go to a back buffer while the bus is busy; only the 
+    newest one is sent. Once a frame is on the bus the master replies
+      [SEQ] [AckCMD] [CREDITS] [DROPPED HIGH] [DROPPED LOW] [QUEUE DEPTH]
+    CREDITS is the number of position frames used up (sent or dropped) 
+    since the last ack. Unity keeps at most UNITY_CREDITS frames in flight.
+    QUEUE DEPTH is the most frames that waited for the bus at once since 
+    the last ack, 1 while the bus keeps up with Unity.
+
+    With rs485Buses > 1 the display is split into contiguous blocks of
+    rows, one per RS485 bus (Serial1, Serial2, Serial3). Each bus only 
+    gets the positions of its own rows (SET_POS_RANGE, SET_POS_PACKED_RANGE
+    or its part of a SET_POS_SPARSE) and all buses send at the same time,
+    so a full frame takes about 1/rs485Buses of the single bus time.
+
+    A TrajCMD (framed link only) is a keyframe: each pin moves to its
+    height over DURATION ms, interpolated on the slaves at their loop rate
+      [TrajCMD] [MODE] [DURATION HIGH] [DURATION LOW] [zMap 0 ... displaySize-1]
+    MODE is TRAJ_LINEAR or TRAJ_CUBIC. A keyframe stream a few times 
+    slower than the frame rate gives the same smooth motion.
+
+    Reply to a StatusCMD from Unity:
+      Byte  0 : StatusCMD
+      Byte 1-n: STATUS_LENGTH bytes per slave (PIN_STATUS msg as 
+                sent by the slave, all zeros if it didn't answer)
+
+    The display geometry is set at startup from EEPROM and can be 
+    changed with a GeometryCMD:
+      [GeometryCMD] [ROWS] [PINS PER ROW] [LAYOUT]
+    Pins per row must be a multiple of PINS_PER_MCU and the display at 
+    most MAX_SLAVES slaves. Slave n drives pins n*PINS_PER_MCU ... of 
+    row n/(pins per row/PINS_PER_MCU), every other row flipped with 
+    LAYOUT_SERPENTINE. The new geometry is stored in EEPROM, sent to 
+    the slaves and echoed back to Unity (framed link only).
+
+    A LinkCMD turns the adaptive bus rate on (MODE 1) or off (MODE 0):
+      [LinkCMD] [MODE]
+    When on, the master polls the slaves every LINK_CHECK_MS and steps 
+    the bus rate up (1, 2, 3 Mbaud) while the errors they report stay at
+    zero, and back down when they go over LINK_FALL_BACK_PERMILLE. On the
+    framed link the reply is
+      [SEQ] [LinkCMD] [RATE] [BAD CHAR H/L] [BAD CRC H/L] [OVERFLOW H/L] [MISSED H/L]
+    with the master's receive errors and the status replies missed.
+
+    A ProfileCMD returns the profiled stages (see Profiler.h) of the 
+    master (ID = MASTER_ID) or of one slave, and zeros them if CLEAR is 1:
+      [ProfileCMD] [ID] [CLEAR]
+    Reply (SEQ on the framed link only):
+      [SEQ] [ProfileCMD] [ID] [NUM STAGES] [profilePack() block] ...
+    A slave that doesn't answer gives 0 stages.
+
  Author
     Alexa Siu <afsiu@stanford.edu>
   
@@ -25,23 +82,70 @@
 bool debug = false;         // true if want minimal print statements
 bool debugData = false;     // true if want to print the data Teensy receives from unity
 bool sendRS485msg = true;   // true if connected to RS485
+bool broadcastPositions = true; // true to send the full frame in one SET_POS_ALL msg
+bool sendDeltaPositions = true; // true to only send pins that changed since the last frame
+int positionBits = 0;           // 0 to send 1 byte (mm) per pin, else bits per pin (4, 6, 8 
+                                // or 12) of a SET_POS_PACKED frame
+bool framedUnityLink = false;   // true if Unity msgs are framed with sequence number and CRC
+#define NUM_BUSES 3             // RS485 buses on the Teensy (Serial1, Serial2, Serial3)
+int rs485Buses = 1;             // RS485 buses in use (1-NUM_BUSES)
+bool adaptiveLinkRate = false;  // true to step the bus rate up while the error rate is low
+byte busRows[NUM_BUSES] = {0, 0, 0}; // rows on each bus (first rows on bus 0), all 0s to split evenly
 bool ledOnSerialReceive = true;
 bool ledOnRS485send = !ledOnSerialReceive;
 unsigned long receivedMsgStartTime;
 
-/// IMPORTANT to update these otherwise arrays will
-//            random register values
+#define PINS_PER_MCU 6
+#define MAX_SLAVES   64   // slave IDs 0 ... 63, below MASTER_ID
+
+// Slave layouts
+#define LAYOUT_ROWS       0   // every row in the same pin order
+#define LAYOUT_SERPENTINE 1   // odd rows flipped (back of half-module)
+
 // Set the physical display parameters
-const int displaySizeX = 12;                        // number of rows
-const int displaySizeZ = 24;                        // pins per row
-const int displaySize = displaySizeX*displaySizeZ;  // display size
-char zMap[displaySize];         // buffer to store data sent from Unity
+// Buffers are sized for the largest display, the geometry in use
+// is set by SetDisplayGeometry()
+const int maxDisplaySize = MAX_SLAVES*PINS_PER_MCU; // largest display size
+int displaySizeX = 12;                        // number of rows
+int displaySizeZ = 24;                        // pins per row
+int displaySize = displaySizeX*displaySizeZ;  // display size
+byte displayLayout = LAYOUT_SERPENTINE;       // slave layout
+int numSlaves = displaySize/PINS_PER_MCU;     // slaves in the display
+int slaveOffset[MAX_SLAVES];                  // first zMap index of each slave
+byte slaveBus[MAX_SLAVES];                    // RS485 bus of each slave
+int busFirstSlave[NUM_BUSES + 1];             // slaves busFirstSlave[b] ... busFirstSlave[b+1]-1 are on bus b
+int busStart[NUM_BUSES + 1];                  // zMap indices busStart[b] ... busStart[b+1]-1 are on bus b
+uint16_t slaveGather[MAX_SLAVES][PINS_PER_MCU]; // zMap index of each pin of a slave's SET_POS msg
+int EEPROMGeometry = 1;                       // [ROWS] [PINS PER ROW] [LAYOUT]
+char zMap[maxDisplaySize];         // buffer to store data sent from Unity
+char lastZMap[maxDisplaySize];     // last frame sent to the display
+uint16_t zMapFine[maxDisplaySize]; // same frame as a fraction of POSITION_RANGE_MM (0-POS_FINE_MAX)
+byte fineData[2*maxDisplaySize];   // buffer to store fine data sent from Unity
+const int fullRefreshFrames = 30;     // resend the full frame every N frames in case msgs were lost
+int framesSinceRefresh = fullRefreshFrames; // frames sent as deltas since the last full frame
+unsigned long rs485BytesSent = 0;     // bytes written to the RS485 bus
+unsigned long rs485MsgsSent = 0;      // msgs written to the RS485 bus
+unsigned long fullFrameBytes = 0;     // bus bytes of the last full frame
+unsigned long deltaFrames = 0;        // frames sent as changed pins only
+unsigned long deltaBytesSaved = 0;    // bus bytes they saved against the last full frame
+byte frameSeq = 0;                    // sequence number of the last frame committed
+unsigned int trajDuration = 0;        // [ms] keyframe duration of the frame, 0 for a plain frame
+byte trajMode = 0;                    // TRAJ_LINEAR or TRAJ_CUBIC
 int numRcvd;                    // keep count of how many bytes are received
 const int setupSize = 4;              // size of setup command sent from Unity
 char setupData[setupSize];      // buffer for storing setup command from Unity
-#define PINS_PER_MCU 6
+const int paramsSize = 1 + 6*14;      // size of params command sent from Unity (ID + PARAM_BLOCK_SIZE per pin)
+char paramsData[paramsSize];    // buffer for storing params command from Unity
+const int geometrySize = 3;           // size of geometry command sent from Unity
+
+// Fine positions: POS_FINE_BITS bits over the full pin travel
+#define POSITION_RANGE_MM 60
+#define POS_FINE_BITS     12
+#define POS_FINE_MAX      ((1 << POS_FINE_BITS) - 1)
 
 #include "RS485_protocol.h"  // library with error-checking protocol
+#define PROFILING 1          // 0 to compile the stage timing out
+#include "Profiler.h"        // per-stage cycle counts
 #include <EEPROM.h>
 
 // This board's address
@@ -49,16 +153,18 @@ int EEPROMAddress = 0;
 byte myID = 0;
 
 // SM states
-typedef enum { SENDING, FORWARDING_SETUP, WAITING_2_RECEIVE, WAITING_4_CMD } MasterState_t;
+typedef enum { SENDING, FORWARDING_SETUP, FORWARDING_PARAMS, WAITING_2_RECEIVE, 
+               WAITING_2_RECEIVE_FINE, WAITING_4_CMD } MasterState_t;
 MasterState_t currentState = WAITING_4_CMD;
 
 // RS485 variables
-#define RS485Serial Serial1 
-#define SSerialRX        0     // Serial Receive pin
-#define SSerialTX        1     // Serial Transmit pin
-#define SSerialTxControl 2     // RS485 Transmit control
+// Bus 0: Serial1 (RX 0, TX 1), bus 1: Serial2 (RX 9, TX 10), 
+// bus 2: Serial3 (RX 7, TX 8)
+HardwareSerial *rs485Bus[NUM_BUSES] = { &Serial1, &Serial2, &Serial3 };
+const int busTxControl[NUM_BUSES] = { 2, 3, 4 };  // RS485 Transmit control
 #define RS485Transmit    HIGH
 #define RS485Receive     LOW
+int rxBus = 0;                        // bus read by fAvailable and fRead
 
 // Msg definitions
 #define MAX_MSG_SIZE 63
@@ -71,6 +177,15 @@ MasterState_t currentState = WAITING_4_CMD;
 #define ZeroCMD   126
 #define StopCMD   125
 #define SetupCMD  124
+#define StatusCMD 123
+#define DataFineCMD 122   // 2 bytes per pin (high first), 0-POS_FINE_MAX over the full travel
+#define ParamsCMD 121     // slave ID (or UNIVERSAL_SLAVE_ID) + one SET_PARAMS block per pin
+#define GeometryCMD 119   // rows, pins per row and slave layout of the display
+#define LinkCMD   118     // adaptive bus rate on/off
+#define TrajCMD   117     // keyframe: mode, duration and one byte per pin
+#define ProfileCMD 116    // profiled stages of the master or of one slave
+#define AckCMD    120     // reply to a position frame, returns credits to Unity
+#define UNITY_CREDITS 2   // position frames Unity may have in flight
 
 // Msg types for hardware slave
 #define MSG_ADDR 0  // bit 0 is the slave ID
@@ -88,6 +203,104 @@ MasterState_t currentState = WAITING_4_CMD;
 #define SET_KI            247   // set Ki gain
 #define SET_KD            246   // set Kd gain
 #define DISABLE_PIN       245   // disable pin
+#define SET_MAX_TRAVEL    244   // set max travel
+#define SET_POS_ALL       243   // set pin positions of the full display
+#define SET_POS_SPARSE    242   // set positions of a list of display pins
+#define GET_STATUS        241   // ask a range of slaves for their status
+#define PIN_STATUS        240   // status reply from a slave
+#define COMMIT_POS        239   // apply the staged positions of a frame
+#define SET_POS_PACKED    238   // set pin positions of the full display, bit packed
+#define SET_PARAMS        237   // set gains, speeds, deadzone and enable of the pins
+#define SET_GEOMETRY      236   // set rows, pins per row and slave layout of the display
+#define SET_POS_RANGE     235   // set pin positions of part of the display
+#define SET_POS_PACKED_RANGE 234   // set pin positions of part of the display, bit packed
+#define SET_BAUD          233   // set the bus rate to LINK_BAUD(rate)
+#define SET_TRAJ_ALL      232   // keyframe for part of the display, pins interpolate to it
+#define GET_PROFILE       231   // ask one slave for one profiled stage
+#define PROFILE_DATA      230   // profile reply from a slave
+
+// Keyframe interpolation (SET_TRAJ_ALL), must match the slaves
+#define TRAJ_LINEAR       0     // constant speed from the current setpoint
+#define TRAJ_CUBIC        1     // cubic Hermite, keeps the setpoint speed continuous
+
+// SET_PARAMS block, one for all pins or one per pin
+//  [KP HIGH] [KP LOW] [KI HIGH] [KI LOW] [KD HIGH] [KD LOW]
+//  [MAX SPEED] [MIN SPEED] [DEADZONE mm] [ENABLED]
+//  [PROFILE SPEED HIGH] [PROFILE SPEED LOW] [PROFILE ACCEL HIGH] [PROFILE ACCEL LOW]
+#define PARAM_BLOCK_SIZE  14
+
+// Largest msg sent to the slaves (a 12-bit SET_POS_PACKED frame)
+#define MAX_FRAME_SIZE    (MSG_DATA + 1 + (maxDisplaySize*POS_FINE_BITS + 7)/8)
+
+// Status replies
+#define MASTER_ID         65    // address of the slave replies
+#define STATUS_LENGTH     (MSG_DATA + 3 + 5*PINS_PER_MCU)  // PIN_STATUS msg size
+#define STATUS_SLOT_US    520   // reply slot per slave: 40 bus bytes + turnaround
+
+// Profile replies, must match the slaves
+#define PROFILE_LENGTH    (MSG_DATA + 1 + PROFILE_PACKED_SIZE)  // PROFILE_DATA msg size
+#define PROFILE_REPLY_US  5000  // time a slave gets to answer a GET_PROFILE
+
+// Bus rate, must match the slaves. Slaves that hear nothing from the 
+// master for LINK_TIMEOUT_MS fall back to LINK_BAUD(0)
+#define NUM_LINK_RATES    3
+#define LINK_BAUD(rate)   (1000000UL*((rate) + 1))  // 1, 2 or 3 Mbaud
+#define LINK_TIMEOUT_MS   6000
+#define LINK_CHECK_MS     2000  // time between error checks (a status sweep)
+#define LINK_FALL_BACK_PERMILLE 10  // errors per 1000 msgs that make us step down
+#define LINK_GOOD_CHECKS  3     // clean checks in a row before stepping up
+
+// Per msg bus overhead (delimiters, COBS code, CRC) used to pick 
+// the cheapest way to send a frame
+#define MSG_OVERHEAD 4
+
+// RS485_protocol callbacks (bottom of the file), used by the receivers
+// below before the IDE's generated prototypes
+int fUsbAvailable ();
+int fUsbRead ();
+int fAvailable ();
+int fRead ();
+
+// Framed msgs from Unity
+byte unityBuffer[2 + 2*maxDisplaySize];  // [SEQ] [CMD] + largest data (DataFineCMD)
+RS485Receiver unityReceiver( fUsbAvailable, fUsbRead, unityBuffer, sizeof unityBuffer );
+byte unitySeq = 0;                    // sequence number of the last frame from Unity
+bool haveUnitySeq = false;            // false until the first frame from Unity
+unsigned long unityFramesLost = 0;    // frames missing from the sequence
+
+// Back buffer: newest position frame from Unity, waiting for the bus
+byte pendingFrame[2*maxDisplaySize];  // data of a DataCMD or DataFineCMD
+byte pendingCmd = 0;                  // DataCMD, DataFineCMD or 0 if none pending
+byte pendingSeq = 0;                  // sequence number of the pending frame
+byte pendingCredits = 0;              // frames received since the last ack
+byte queueDepth = 0;                  // frames received since one last went to the bus
+byte maxQueueDepth = 0;               // most frames waiting at once since the last ack
+unsigned long framesDropped = 0;      // stale frames replaced before being sent
+
+// Adaptive bus rate
+byte linkRate = 0;                    // LINK_BAUD(linkRate) in use
+byte linkGoodChecks = 0;              // clean checks in a row
+byte linkNeededChecks = LINK_GOOD_CHECKS; // clean checks needed to step up, doubles after a fall back
+unsigned long lastLinkCheck = 0;      // [ms]
+unsigned long lastLinkMsgs = 0;       // rs485MsgsSent at the last check
+unsigned int lastSlaveErrors[MAX_SLAVES];     // receive errors reported by each slave
+bool slaveAnswered[MAX_SLAVES];       // true if the slave answered the last check
+unsigned int slavesMissed = 0;        // status replies we didn't get
+
+// Status table, one PIN_STATUS msg per slave
+byte slaveStatus[MAX_SLAVES][STATUS_LENGTH];
+byte rs485Buffer[MAX_MSG_SIZE];
+byte rs485TxMemory[NUM_BUSES][2*RS485_ENCODED_SIZE(MAX_FRAME_SIZE)];  // room for two full frames per bus
+unsigned int rs485TxCapacity[NUM_BUSES];  // availableForWrite() of an empty TX buffer
+RS485Receiver rs485Receiver( fAvailable, fRead, rs485Buffer, MAX_MSG_SIZE );
+
+// Profiled stages, read with a ProfileCMD
+#define PROF_LOOP       0   // whole loop()
+#define PROF_UNITY_RX   1   // ReadUnityFrame() (framed link)
+#define PROF_SEND       2   // SendNewPositions()
+#define PROF_STATUS     3   // RequestStatus()
+#define PROF_LINK       4   // CheckLink()
+#define PROF_NUM_STAGES 5
 
 // LED for debugging
 #define ledPin 13
@@ -97,6 +310,8 @@ void setup() {
 
   // Assign ID
   myID = EEPROM.read(EEPROMAddress);
+
+  PROFILE_BEGIN();
   
   // Start the built-in serial port, probably to Serial Monitor
   Serial.begin(115200);
@@ -106,12 +321,22 @@ void setup() {
   digitalWrite(  ledPin, HIGH );
 
   // RS485 setup
-  pinMode(SSerialTxControl, OUTPUT);
-  digitalWrite(SSerialTxControl, RS485Receive);  // Init Transceiver
-  // Start the software serial port, to another device
-  RS485Serial.begin(1000000); // set the data rate 
+  for ( int bus = 0; bus < rs485Buses; bus++ ) {
+    pinMode(busTxControl[bus], OUTPUT);
+    digitalWrite(busTxControl[bus], RS485Receive);  // Init Transceiver
+    // Start the software serial port, to another device
+    rs485Bus[bus]->begin(LINK_BAUD(0)); // set the data rate 
+    // Bigger TX buffer so a whole frame is queued and sent by the 
+    // UART interrupt while we go back to reading from Unity
+    rs485Bus[bus]->addMemoryForWrite(rs485TxMemory[bus], sizeof rs485TxMemory[bus]);
+    rs485TxCapacity[bus] = rs485Bus[bus]->availableForWrite();
+    rs485Bus[bus]->transmitterEnable(busTxControl[bus]);
+  }
   delay(1000);
   
+  // Display geometry from EEPROM, defaults if it was never set
+  LoadDisplayGeometry();
+
   // Unity setup
   // Initialize the buffer with 0s
   for ( int  i = 0; i < displaySize; i++ ) {
@@ -123,12 +348,7 @@ void setup() {
 }
 
 void loop() {
-// Latency measurement
-//  unsigned long lastTime = micros();
-//  SendNewPositions();
-//  Serial.printf("Time to send all pin position: %i micros \n", (micros() - lastTime));
-//  Serial.println();
-
+  PROFILE_SCOPE(PROF_LOOP);
   
   switch ( currentState ) {
 
@@ -140,10 +360,19 @@ void loop() {
     // in this state the master will wait for a cmd from Unity
     // Current commands include:
     //  - DataCMD to update the pin positions
+    //  - DataFineCMD to update the pin positions with sub-mm resolution
     //  - SetupCMD to forward setup parameters
+    //  - ParamsCMD to forward all the pin parameters of a slave
     //  - ZeroCMD to reset the display back to all zeros
     //  - StopCMD to stop and reset the display 
     case WAITING_4_CMD:
+      if ( adaptiveLinkRate ) {
+        CheckLink();
+      }
+      if ( framedUnityLink ) {
+        ReadUnityFrame();
+        break;
+      }
       numRcvd = 0;
       char cmd[1];
       // Read the bytes from serial
@@ -161,11 +390,23 @@ void loop() {
           }
           currentState = WAITING_2_RECEIVE;
           break;
+        } else if (  ( (int)cmd[0] )  == DataFineCMD ) {
+          if (debug) {
+            receivedMsgStartTime = micros();
+            Serial.println( F("Teensy: Received a fine data cmd.") );
+          }
+          currentState = WAITING_2_RECEIVE_FINE;
+          break;
         } else if (  ( (int)cmd[0] ) == SetupCMD ) {
           if ( debug ) {
             Serial.println( F("Teensy:  Received a setup cmd.") );
           }
           currentState = FORWARDING_SETUP;
+        } else if (  ( (int)cmd[0] ) == ParamsCMD ) {
+          if ( debug ) {
+            Serial.println( F("Teensy:  Received a params cmd.") );
+          }
+          currentState = FORWARDING_PARAMS;
         } else if (  ( (int)cmd[0] ) == ZeroCMD ) {
           if ( debug ) {
             Serial.println( F("Teensy:  Received a zeroing cmd.") );
@@ -176,6 +417,27 @@ void loop() {
             Serial.println( F("Teensy: Received a stop cmd.") );
           }
           StopDisplay();
+        } else if (  ( (int)cmd[0] )  == StatusCMD ) {
+          if ( debug ) {
+            Serial.println( F("Teensy: Received a status cmd.") );
+          }
+          RequestStatus( 0, numSlaves );
+          SendStatus();
+        } else if (  ( (int)cmd[0] )  == GeometryCMD ) {
+          char geometry[geometrySize];
+          if ( Serial.readBytes( geometry, geometrySize ) == geometrySize ) {
+            SetDisplayGeometry( geometry[0], geometry[1], geometry[2] );
+          }
+        } else if (  ( (int)cmd[0] )  == LinkCMD ) {
+          char mode[1];
+          if ( Serial.readBytes( mode, 1 ) == 1 ) {
+            SetAdaptiveLink( mode[0] );
+          }
+        } else if (  ( (int)cmd[0] )  == ProfileCMD ) {
+          char request[2];
+          if ( Serial.readBytes( request, 2 ) == 2 ) {
+            SendProfile( request[0], request[1] );
+          }
         } 
       } //endif
       //Serial.flush();  // clear the buffer
@@ -213,6 +475,22 @@ void loop() {
       }
     break;
     
+    // wait for params commmand from unity, forward the message when received
+    case FORWARDING_PARAMS:
+      numRcvd = Serial.readBytes( paramsData, paramsSize );
+      if ( numRcvd == paramsSize ) {
+        if ( debug ) {
+          Serial.printf( F("Teensy: received params for Slave %i.\n"), (int)paramsData[0] );
+        }
+        SetParams( paramsData[0], (const byte*)&paramsData[1], PINS_PER_MCU );
+      } else if ( numRcvd > 0 ) {
+        if ( debug ) {
+          Serial.printf( F("Teensy: received %i bytes; but expecting %i\n"), numRcvd, paramsSize );
+        } 
+      }
+      currentState = WAITING_4_CMD;
+    break;
+
     // in this state, the master will wait for pin display data from unity
     case WAITING_2_RECEIVE:
       numRcvd = 0;
@@ -232,6 +510,7 @@ void loop() {
           Serial.printf( F("Teensy: received %i floats.\n"), numRcvd );
           Serial.printf( F("Teensy: Time to receive was %i micros. \n"), micros()-receivedMsgStartTime );
         }
+        UpdateFineFromMM();
         // change states to send to the display
         currentState = SENDING;
       } else {
@@ -244,6 +523,30 @@ void loop() {
       }
     break; // break WAITING_2_RECEIVE
 
+    // in this state, the master will wait for fine pin display data from unity
+    case WAITING_2_RECEIVE_FINE:
+      numRcvd = 0;
+      // Read the bytes from serial, 2 per pin
+      if ( ledOnSerialReceive ) {
+        digitalWrite( ledPin, HIGH );   
+      }
+      numRcvd = Serial.readBytes( (char*)fineData, 2*displaySize );
+      if ( ledOnSerialReceive ) {
+        digitalWrite( ledPin, LOW );
+      }
+      if ( numRcvd == 2*displaySize ) {
+        UpdateFromFineData();
+        currentState = SENDING;
+      } else {
+        if ( numRcvd > 0 ) {
+           if ( debug ) {
+            Serial.printf( F("Teensy: received %i bytes; but expecting %i\n"), numRcvd, 2*displaySize );
+            } 
+        }
+        currentState = WAITING_4_CMD;
+      }
+    break; // break WAITING_2_RECEIVE_FINE
+
     // in this state, the master will send data to the shape display
     case SENDING:
       
@@ -254,6 +557,9 @@ void loop() {
       if (sendRS485msg) {
         SendNewPositions();
       }
+      if ( framedUnityLink ) {
+        SendFrameAck( pendingSeq );
+      }
       if (ledOnRS485send) {
         digitalWrite( ledPin, LOW );
       }
@@ -291,54 +597,610 @@ void loop() {
   
 } // end loop
 
+// Read all frames waiting from Unity without blocking. Position frames
+// replace the pending one (latest wins), which goes out once the RS485 
+// buses have sent the previous frame.
+void ReadUnityFrame( void ) {
+  PROFILE_SCOPE(PROF_UNITY_RX);
+  while ( unityReceiver.update() ) {
+    HandleUnityFrame();
+  }
+
+  if ( pendingCmd != 0 && BusesReady() ) {
+    trajDuration = 0;
+    if ( pendingCmd == DataCMD ) {
+      memcpy( zMap, pendingFrame, displaySize );
+      UpdateFineFromMM();
+    } else if ( pendingCmd == TrajCMD ) {
+      trajMode = pendingFrame[0];
+      trajDuration = (pendingFrame[1] << 8) | pendingFrame[2];
+      memcpy( zMap, &pendingFrame[3], displaySize );
+      UpdateFineFromMM();
+    } else {
+      memcpy( fineData, pendingFrame, 2*displaySize );
+      UpdateFromFineData();
+    }
+    pendingCmd = 0;
+    queueDepth = 0;
+    currentState = SENDING;
+  }
+}
+
+// True if every bus has sent all but the last commit, so the next 
+// frame is the only one queued. The TX buffers have room for two 
+// frames, a frame queued behind another would wait a whole frame time 
+// instead of in the back buffer where a newer one can replace it.
+bool BusesReady( void ) {
+  for ( int bus = 0; bus < rs485Buses; bus++ ) {
+    unsigned int queued = rs485TxCapacity[bus] - rs485Bus[bus]->availableForWrite();
+    if ( queued > RS485_ENCODED_SIZE(3) ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Act on the frame in unityBuffer. Frames with a bad CRC or the 
+// wrong size are dropped.
+void HandleUnityFrame( void ) {
+  unsigned int len = unityReceiver.getLength();
+  if ( len < 2 ) {
+    return;
+  }
+  if ( ledOnSerialReceive ) {
+    digitalWrite( ledPin, HIGH ); 
+  }
+
+  // count the frames we never got, Unity's sequence can start anywhere
+  byte seq = unityBuffer[0];
+  if ( haveUnitySeq ) {
+    unityFramesLost += (byte)(seq - unitySeq - 1);
+  }
+  unitySeq = seq;
+  haveUnitySeq = true;
+
+  byte cmd = unityBuffer[1];
+  byte *data = &unityBuffer[2];
+  unsigned int dataLen = len - 2;
+
+  if ( (cmd == DataCMD && (int)dataLen == displaySize) ||
+       (cmd == DataFineCMD && (int)dataLen == 2*displaySize) ||
+       (cmd == TrajCMD && (int)dataLen == 3 + displaySize) ) {
+    if ( pendingCmd != 0 ) {
+      framesDropped++;
+    }
+    memcpy( pendingFrame, data, dataLen );
+    pendingCmd = cmd;
+    pendingSeq = seq;
+    pendingCredits++;
+    if ( queueDepth < 255 ) {
+      queueDepth++;
+    }
+    maxQueueDepth = max( maxQueueDepth, queueDepth );
+  } else if ( cmd == SetupCMD && dataLen == setupSize ) {
+    sendMsg( data, setupSize );
+  } else if ( cmd == ParamsCMD && dataLen == paramsSize ) {
+    SetParams( data[0], &data[1], PINS_PER_MCU );
+  } else if ( cmd == ZeroCMD || cmd == StopCMD ) {
+    // a frame queued before the cmd would move the pins again
+    if ( pendingCmd != 0 ) {
+      framesDropped++;
+      pendingCmd = 0;
+      queueDepth = 0;
+      SendFrameAck( pendingSeq );
+    }
+    if ( cmd == ZeroCMD ) {
+      ZeroDisplay();
+    } else {
+      StopDisplay();
+    }
+  } else if ( cmd == StatusCMD ) {
+    RequestStatus( 0, numSlaves );
+    SendStatus();
+  } else if ( cmd == GeometryCMD && dataLen == geometrySize ) {
+    SetDisplayGeometry( data[0], data[1], data[2] );
+    byte reply[2 + geometrySize] = { seq, GeometryCMD, 
+                                     (byte)displaySizeX, (byte)displaySizeZ, displayLayout };
+    sendMsg( fUsbWrite, reply, sizeof reply );
+  } else if ( cmd == LinkCMD && dataLen == 1 ) {
+    SetAdaptiveLink( data[0] );
+    unsigned int counts[4] = { rs485Receiver.getErrors(RS485_BAD_CHAR), rs485Receiver.getErrors(RS485_BAD_CRC),
+                               rs485Receiver.getErrors(RS485_OVERFLOW), slavesMissed };
+    byte reply[3 + 2*4] = { seq, LinkCMD, linkRate };
+    for ( int i = 0; i < 4; i++ ) {
+      reply[3 + 2*i] = counts[i] >> 8;
+      reply[4 + 2*i] = counts[i] & 0xFF;
+    }
+    sendMsg( fUsbWrite, reply, sizeof reply );
+  } else if ( cmd == ProfileCMD && dataLen == 2 ) {
+    SendProfile( data[0], data[1] );
+  } else if ( debug ) {
+    Serial.printf( F("Teensy: bad frame, cmd %i with %i bytes\n"), cmd, dataLen );
+  }
+
+  if ( ledOnSerialReceive ) {
+    digitalWrite( ledPin, LOW );
+  }
+}
+
+// Return the credits of the position frames used since the last ack
+//    PACKET STRUCTURE
+//    [SEQ]  [AckCMD]  [CREDITS]  [DROPPED HIGH]  [DROPPED LOW]  [QUEUE DEPTH]
+void SendFrameAck( byte seq ) {
+  byte msg[6];
+  msg[0] = seq;
+  msg[1] = AckCMD;
+  msg[2] = pendingCredits;
+  msg[3] = (framesDropped >> 8) & 0xFF;
+  msg[4] = framesDropped & 0xFF;
+  msg[5] = maxQueueDepth;
+  sendMsg( fUsbWrite, msg, sizeof msg );
+  pendingCredits = 0;
+  maxQueueDepth = queueDepth;
+}
+
+// Turn the adaptive bus rate on (mode 1) or off (mode 0, back to the base rate)
+void SetAdaptiveLink( byte mode ) {
+  adaptiveLinkRate = ( mode != 0 );
+  linkGoodChecks = 0;
+  linkNeededChecks = LINK_GOOD_CHECKS;
+  if ( !adaptiveLinkRate && linkRate != 0 ) {
+    SetLinkRate( 0 );
+  }
+}
+
+// Every LINK_CHECK_MS, poll the slaves for the receive errors they saw 
+// and move the bus rate up or down
+void CheckLink( void ) {
+  if ( millis() - lastLinkCheck < LINK_CHECK_MS ) {
+    return;
+  }
+  PROFILE_SCOPE(PROF_LINK);
+  lastLinkCheck = millis();
+
+  unsigned int masterErrors = rs485Receiver.getErrors();
+  RequestStatus( 0, numSlaves );
+  unsigned long errors = rs485Receiver.getErrors() - masterErrors;
+  int replies = 0;
+  for (int SlaveID = 0; SlaveID < numSlaves; SlaveID++) {
+    const byte *reply = slaveStatus[SlaveID];
+    if ( reply[MSG_ADDR] != MASTER_ID ) {
+      // a missing reply counts as a lost msg, unless the slave 
+      // never answered (not fitted)
+      if ( slaveAnswered[SlaveID] ) {
+        errors++;
+        slavesMissed++;
+      }
+      slaveAnswered[SlaveID] = false;
+      continue;
+    }
+    slaveAnswered[SlaveID] = true;
+    unsigned int slaveErrors = (reply[MSG_DATA + 1] << 8) | reply[MSG_DATA + 2];
+    errors += (uint16_t)(slaveErrors - lastSlaveErrors[SlaveID]);
+    lastSlaveErrors[SlaveID] = slaveErrors;
+    replies++;
+  }
+  // every slave hears every msg, plus one reply each
+  unsigned long msgs = (rs485MsgsSent - lastLinkMsgs)*numSlaves + numSlaves;
+
+  byte rate;
+  if ( replies == 0 ) {
+    // nobody hears us, they go back to the base rate after LINK_TIMEOUT_MS
+    rate = 0;
+  } else {
+    rate = NextLinkRate( errors, msgs );
+  }
+  if ( rate != linkRate ) {
+    SetLinkRate( rate );
+  }
+  lastLinkMsgs = rs485MsgsSent;
+}
+
+// Pick the bus rate for the next period from the errors seen in "msgs"
+// msgs. Only touches the link counters (no bus access), so it can be 
+// run against a simulated channel.
+byte NextLinkRate( unsigned long errors, unsigned long msgs ) {
+  if ( errors*1000 > LINK_FALL_BACK_PERMILLE*msgs ) {
+    // too many errors: step down and wait longer before trying again
+    linkGoodChecks = 0;
+    if ( linkRate > 0 ) {
+      linkNeededChecks = min( 2*linkNeededChecks, 255 );
+      return linkRate - 1;
+    }
+    return 0;
+  }
+  if ( errors > 0 ) {
+    linkGoodChecks = 0;
+    return linkRate;
+  }
+  linkGoodChecks = min( linkGoodChecks + 1, 255 );
+  if ( linkGoodChecks >= linkNeededChecks && linkRate < NUM_LINK_RATES - 1 ) {
+    linkGoodChecks = 0;
+    return linkRate + 1;
+  }
+  return linkRate;
+}
+
+// Tell the slaves to change the bus rate and follow them
+//    PACKET STRUCTURE
+//    [UNIVERSAL_SLAVE_ID]  [SET_BAUD]  [RATE]
+void SetLinkRate( byte rate ) {
+  static byte msg[3] = {
+    UNIVERSAL_SLAVE_ID, SET_BAUD, 0
+  };
+  msg[2] = rate;
+  sendMsg(msg, 3);
+  for ( int bus = 0; bus < rs485Buses; bus++ ) {
+    rs485Bus[bus]->flush();
+    rs485Bus[bus]->begin(LINK_BAUD(rate));
+    rs485Bus[bus]->transmitterEnable(busTxControl[bus]);
+  }
+  rs485Receiver.reset();
+  linkRate = rate;
+  // give the slaves time to switch
+  delay(2);
+  if ( debug ) {
+    Serial.printf( F("Teensy: bus rate %lu baud\n"), LINK_BAUD(rate) );
+  }
+}
+
+// Read the display geometry from EEPROM and send it to the slaves.
+// Keeps the default 12x24 display if EEPROM holds no valid geometry.
+void LoadDisplayGeometry( void ) {
+  if ( !SetDisplayGeometry( EEPROM.read(EEPROMGeometry), EEPROM.read(EEPROMGeometry + 1), 
+                            EEPROM.read(EEPROMGeometry + 2) ) ) {
+    SetDisplayGeometry( displaySizeX, displaySizeZ, displayLayout );
+  }
+}
+
+// Use a new display geometry: build the slave mapping tables, store 
+// the geometry in EEPROM and send it to the slaves. 
+// Returns false (and keeps the old geometry) if it doesn't fit.
+bool SetDisplayGeometry( int rows, int pinsPerRow, int layout ) {
+  if ( rows < 1 || pinsPerRow < PINS_PER_MCU || pinsPerRow % PINS_PER_MCU != 0
+       || rows*pinsPerRow > maxDisplaySize || layout > LAYOUT_SERPENTINE ) {
+    if ( debug ) {
+      Serial.printf( F("Teensy: bad geometry %i x %i, layout %i\n"), rows, pinsPerRow, layout );
+    }
+    return false;
+  }
+  displaySizeX = rows;
+  displaySizeZ = pinsPerRow;
+  displaySize = rows*pinsPerRow;
+  displayLayout = layout;
+  numSlaves = displaySize/PINS_PER_MCU;
+
+  int slavesPerRow = pinsPerRow/PINS_PER_MCU;
+  for (int SlaveID = 0; SlaveID < numSlaves; SlaveID++) {
+    int row = SlaveID/slavesPerRow;
+    int column = SlaveID%slavesPerRow;
+    bool flipped = ( layout == LAYOUT_SERPENTINE && row%2 == 1 );
+    if ( flipped ) {
+      column = slavesPerRow - 1 - column;
+    }
+    slaveOffset[SlaveID] = row*pinsPerRow + column*PINS_PER_MCU;
+    slaveBus[SlaveID] = rs485Buses - 1;
+    for (int bus = 0, lastRow = 0; bus < rs485Buses - 1; bus++) {
+      lastRow += ( busRows[0] + busRows[1] + busRows[2] > 0 ) ? busRows[bus] : rows/rs485Buses;
+      if ( row < lastRow ) {
+        slaveBus[SlaveID] = bus;
+        break;
+      }
+    }
+    // pin j of the slave, in reverse order on flipped rows
+    for (int j = 0; j < PINS_PER_MCU; j++) {
+      slaveGather[SlaveID][j] = slaveOffset[SlaveID] + ( flipped ? PINS_PER_MCU - 1 - j : j );
+    }
+  }
+
+  // rows (and slaves) of a bus are contiguous
+  for (int bus = 0, SlaveID = 0; bus <= rs485Buses; bus++) {
+    while ( SlaveID < numSlaves && slaveBus[SlaveID] < bus ) {
+      SlaveID++;
+    }
+    busFirstSlave[bus] = SlaveID;
+    busStart[bus] = ( SlaveID/slavesPerRow )*pinsPerRow;
+  }
+
+  EEPROM.update( EEPROMGeometry, rows );
+  EEPROM.update( EEPROMGeometry + 1, pinsPerRow );
+  EEPROM.update( EEPROMGeometry + 2, layout );
+
+  // old frames don't match the new layout
+  memset( zMap, 0, sizeof zMap );
+  memset( lastZMap, 0, sizeof lastZMap );
+  memset( zMapFine, 0, sizeof zMapFine );
+  pendingCmd = 0;
+  queueDepth = 0;
+  framesSinceRefresh = fullRefreshFrames;
+
+  static byte msg[5] = {
+    UNIVERSAL_SLAVE_ID, SET_GEOMETRY, 0, 0, 0
+  };
+  msg[2] = rows;
+  msg[3] = pinsPerRow;
+  msg[4] = layout;
+  sendMsg(msg, 5);
+  return true;
+}
+
+// Keep a fine copy of the zMap for SET_POS_PACKED
+void UpdateFineFromMM( void ) {
+  for ( int i = 0; i < displaySize; i++ ) {
+    zMapFine[i] = (long)constrain(zMap[i], 0, POSITION_RANGE_MM) * POS_FINE_MAX / POSITION_RANGE_MM;
+  }
+}
+
+// Decode fine data sent from Unity (2 bytes per pin, high first)
+void UpdateFromFineData( void ) {
+  for ( int i = 0; i < displaySize; i++ ) {
+    zMapFine[i] = min( (fineData[2*i] << 8) | fineData[2*i + 1], POS_FINE_MAX );
+    // rounded to mm for the byte per pin msgs
+    zMap[i] = ((long)zMapFine[i] * POSITION_RANGE_MM + POS_FINE_MAX/2) / POS_FINE_MAX;
+  }
+}
+
 // Decode position data for full display sent from Unity and send 
 // to hardware display through RS485
 void SendNewPositions( void ) {
-  // NOTE:  8 add currently added to slave IDs since hardware is actually MCU 8-15
-  //        To apply same values to all rows, remove rowOffset variable 
+  PROFILE_SCOPE(PROF_SEND);
+  unsigned long startBytes = rs485BytesSent;
+  bool fullFrame = false;
+  bool delta = false;
 
-  static byte msg[] = {0,0,0,0,0,0,0,0};
-  int MCUoffset = 0;
-  int rowNum = 0;
-  int rowOffset = 0;
-  
-  // iterate through slave mcu ids
-  for (int SlaveID = 0; SlaveID < displaySizeX*4; SlaveID++) {
-      
-    // Grab row offset
-    rowNum = floor(SlaveID/4);
-    rowOffset = rowNum*displaySizeZ;
- 
-    // Even Row (front of half-module)
-    if (SlaveID%8 < 4) {
-      MCUoffset = (SlaveID%4)*PINS_PER_MCU;
-      msg[0] = SlaveID;
-      msg[1] = SET_POS;
-      //Serial.printf("MCU: %i, ", SlaveID);
-      for (int i = 2, j = 0; i < 9; i++, j++ ) {
-        msg[i] = zMap[j+MCUoffset+rowOffset];
-        //Serial.printf("%i, ", msg[i]);
+  if ( trajDuration > 0 ) {
+    SendTrajectoryPositions();
+    fullFrame = true;
+  } else if ( positionBits > 0 ) {
+    SendPackedPositions( positionBits );
+    fullFrame = true;
+  } else if ( !broadcastPositions ) {
+    SendPositionsPerSlave();
+  } else if ( !sendDeltaPositions || framesSinceRefresh >= fullRefreshFrames ) {
+    SendAllPositions();
+    fullFrame = true;
+  } else {
+    fullFrame = SendChangedPositions();
+    delta = !fullFrame;
+  }
+
+  // slaves only stage positions, apply the frame on all of them at once
+  if ( rs485BytesSent != startBytes ) {
+    CommitPositions();
+  }
+
+  // remember what the display was sent
+  for ( int i = 0; i < displaySize; i++ ) {
+    lastZMap[i] = zMap[i];
+  }
+
+  unsigned long frameBytes = rs485BytesSent - startBytes;
+  if ( fullFrame ) {
+    framesSinceRefresh = 0;
+    fullFrameBytes = frameBytes;
+  } else {
+    framesSinceRefresh++;
+  }
+  if ( delta ) {
+    deltaFrames++;
+    if ( fullFrameBytes > frameBytes ) {
+      deltaBytesSaved += fullFrameBytes - frameBytes;
+    }
+  }
+}
+
+// Tell all slaves to apply the positions staged for the next frame.
+// With several buses each one commits once its own positions are out.
+//    PACKET STRUCTURE
+//    [UNIVERSAL_SLAVE_ID]  [COMMIT_POS]  [FRAME SEQ]
+void CommitPositions( void ) {
+  static byte msg[3] = {
+    UNIVERSAL_SLAVE_ID, COMMIT_POS, 0
+  };
+  frameSeq++;
+  msg[2] = frameSeq;
+  sendMsg(msg, 3);
+}
+
+// Send the frame as a keyframe: the slaves move each pin to its height 
+// over trajDuration ms. Each bus gets the rows of its own slaves.
+//    PACKET STRUCTURE
+//    [UNIVERSAL_SLAVE_ID]  [SET_TRAJ_ALL]  [MODE]  [DURATION HIGH]  [DURATION LOW]
+//    [START HIGH]  [START LOW]  [zMap START ...]
+void SendTrajectoryPositions( void ) {
+  static byte msg[MSG_DATA + 5 + maxDisplaySize];
+  for ( int bus = 0; bus < rs485Buses; bus++ ) {
+    int start = busStart[bus];
+    int end = busStart[bus + 1];
+    if ( end <= start ) {
+      continue;
+    }
+    msg[MSG_ADDR] = UNIVERSAL_SLAVE_ID;
+    msg[MSG_CMD] = SET_TRAJ_ALL;
+    msg[MSG_DATA] = trajMode;
+    msg[MSG_DATA + 1] = trajDuration >> 8;
+    msg[MSG_DATA + 2] = trajDuration & 0xFF;
+    msg[MSG_DATA + 3] = start >> 8;
+    msg[MSG_DATA + 4] = start & 0xFF;
+    memcpy( &msg[MSG_DATA + 5], &zMap[start], end - start );
+    sendBusMsg(bus, msg, MSG_DATA + 5 + end - start);
+  }
+}
+
+// Send the full display with "bits" bits per pin, taken from the top 
+// of zMapFine. Each slave unpacks its own 6 pins straight to pulses.
+//    PACKET STRUCTURE
+//    [UNIVERSAL_SLAVE_ID]  [SET_POS_PACKED]  [BITS]  [pin 0 ... displaySize-1, MSB first]
+// Payload is displaySize*bits/8 bytes: 144 (4-bit), 216 (6-bit),
+// 288 (8-bit) or 432 (12-bit)
+// With several buses each one gets the pins of its own rows
+//    [UNIVERSAL_SLAVE_ID]  [SET_POS_PACKED_RANGE]  [BITS]  [START HIGH]  [START LOW]  [pin START ..., MSB first]
+void SendPackedPositions( int bits ) {
+  static byte msg[MAX_FRAME_SIZE + 2];
+  for ( int bus = 0; bus < rs485Buses; bus++ ) {
+    int start = busStart[bus];
+    int end = busStart[bus + 1];
+    int header = MSG_DATA + 1;
+    msg[MSG_ADDR] = UNIVERSAL_SLAVE_ID;
+    msg[MSG_CMD] = SET_POS_PACKED;
+    msg[MSG_DATA] = bits;
+    if ( rs485Buses > 1 ) {
+      msg[MSG_CMD] = SET_POS_PACKED_RANGE;
+      msg[header++] = start >> 8;
+      msg[header++] = start & 0xFF;
+    }
+    if ( end <= start ) {
+      continue;
+    }
+    int len = header + ((end - start)*bits + 7)/8;
+    memset( &msg[header], 0, len - header );
+
+    byte *packed = &msg[header];
+    unsigned long bitPos = 0;
+    for ( int i = start; i < end; i++ ) {
+      unsigned int value = zMapFine[i] >> (POS_FINE_BITS - bits);
+      for ( int b = bits - 1; b >= 0; b--, bitPos++ ) {
+        if ( value & (1 << b) ) {
+          packed[bitPos >> 3] |= 0x80 >> (bitPos & 7);
+        }
       }
-            //Serial.printf(", rn: %i, ro: %i \n", rowNum, rowOffset);
-      sendMsg(msg, 8);
     }
-    
-    // Odd Row (back of half-module, flipped pin order)
-    else {
-      MCUoffset = abs((SlaveID%4)-3)*PINS_PER_MCU;
-      msg[0] = SlaveID;
-      msg[1] = SET_POS;
-      //Serial.printf("MCU: %i, ", SlaveID);
-      for (int i = 2, j = 5; i < 9; i++, j-- ) {
-        msg[i] = zMap[j+MCUoffset+rowOffset];
-        //Serial.printf("%i, ", msg[i]);
+    sendBusMsg(bus, msg, len);
+  }
+}
+
+// Send only the pins that changed since the last frame, picking 
+// whichever costs the fewest bus bytes:
+//  - a SET_POS msg for each slave with a changed pin
+//  - one SET_POS_SPARSE msg with the changed pins
+//  - the full frame
+// Returns true if the full frame was sent
+bool SendChangedPositions( void ) {
+  int changedPins = 0;
+  int changedSlaves = 0;
+  static bool slaveChanged[MAX_SLAVES];
+
+  for (int SlaveID = 0; SlaveID < numSlaves; SlaveID++) {
+    int offset = SlaveDisplayOffset(SlaveID);
+    slaveChanged[SlaveID] = false;
+    for (int j = 0; j < PINS_PER_MCU; j++) {
+      if ( zMap[offset + j] != lastZMap[offset + j] ) {
+        slaveChanged[SlaveID] = true;
+        changedPins++;
       }
-            //Serial.printf(", rn: %i, ro: %i \n", rowNum, rowOffset);
-      sendMsg(msg, 8);
     }
-    
+    if ( slaveChanged[SlaveID] ) {
+      changedSlaves++;
+    }
+  }
+
+  int perSlaveCost = changedSlaves*(MSG_LENGTH + MSG_OVERHEAD);
+  int sparseCost = MSG_DATA + 3*changedPins + MSG_OVERHEAD;
+  int fullCost = MSG_DATA + displaySize + MSG_OVERHEAD;
+
+  if ( changedPins == 0 ) {
+    // nothing to send
+  } else if ( fullCost <= perSlaveCost && fullCost <= sparseCost ) {
+    SendAllPositions();
+    return true;
+  } else if ( perSlaveCost <= sparseCost ) {
+    for (int SlaveID = 0; SlaveID < numSlaves; SlaveID++) {
+      if ( slaveChanged[SlaveID] ) {
+        SendSlavePositions(SlaveID);
+      }
+    }
+  } else {
+    SendSparsePositions();
+  }
+  return false;
+}
+
+// Send the pins that changed since the last frame as (display index, height) 
+// entries in a broadcast msg. Each slave applies the entries for its own pins.
+//    PACKET STRUCTURE
+//    [UNIVERSAL_SLAVE_ID]  [SET_POS_SPARSE]  [INDEX HIGH]  [INDEX LOW]  [HEIGHT] ...
+// With several buses each one gets the entries of its own rows.
+void SendSparsePositions( void ) {
+  static byte msg[MSG_DATA + maxDisplaySize];
+  for ( int bus = 0; bus < rs485Buses; bus++ ) {
+    int start = busStart[bus];
+    int end = busStart[bus + 1];
+    int len = MSG_DATA;
+    msg[MSG_ADDR] = UNIVERSAL_SLAVE_ID;
+    msg[MSG_CMD] = SET_POS_SPARSE;
+    for ( int i = start; i < end && len + 3 <= MSG_DATA + displaySize; i++ ) {
+      if ( zMap[i] != lastZMap[i] ) {
+        msg[len++] = i >> 8;
+        msg[len++] = i & 0xFF;
+        msg[len++] = zMap[i];
+      }
+    }
+    if ( len > MSG_DATA ) {
+      sendBusMsg(bus, msg, len);
+    }
   }
-  
+}
+
+// First zMap index of a slave's 6 pins 
+int SlaveDisplayOffset( int SlaveID ) {
+  return slaveOffset[SlaveID];
+}
+
+// Send the full display in a single broadcast msg. The zMap is sent 
+// as received from Unity; each slave picks out its own 6 pins.
+//    PACKET STRUCTURE
+//    [UNIVERSAL_SLAVE_ID]  [SET_POS_ALL]  [zMap 0 ... displaySize-1]
+// With several buses each one gets the rows of its own slaves
+//    [UNIVERSAL_SLAVE_ID]  [SET_POS_RANGE]  [START HIGH]  [START LOW]  [zMap START ...]
+void SendAllPositions( void ) {
+  static byte msg[MSG_DATA + 2 + maxDisplaySize];
+  if ( rs485Buses == 1 ) {
+    msg[MSG_ADDR] = UNIVERSAL_SLAVE_ID;
+    msg[MSG_CMD] = SET_POS_ALL;
+    for ( int i = 0; i < displaySize; i++ ) {
+      msg[MSG_DATA + i] = zMap[i];
+    }
+    sendMsg(msg, MSG_DATA + displaySize);
+    return;
+  }
+
+  for ( int bus = 0; bus < rs485Buses; bus++ ) {
+    int start = busStart[bus];
+    int end = busStart[bus + 1];
+    if ( end <= start ) {
+      continue;
+    }
+    msg[MSG_ADDR] = UNIVERSAL_SLAVE_ID;
+    msg[MSG_CMD] = SET_POS_RANGE;
+    msg[MSG_DATA] = start >> 8;
+    msg[MSG_DATA + 1] = start & 0xFF;
+    memcpy( &msg[MSG_DATA + 2], &zMap[start], end - start );
+    sendBusMsg(bus, msg, MSG_DATA + 2 + end - start);
+  }
+}
+
+// Send one SET_POS msg per slave
+void SendPositionsPerSlave( void ) {
+  // iterate through slave mcu ids
+  for (int SlaveID = 0; SlaveID < numSlaves; SlaveID++) {
+    SendSlavePositions(SlaveID);
+  }
+}
+
+// Send a SET_POS msg with the 6 pins of one slave, gathered from 
+// the zMap with the table built by SetDisplayGeometry()
+//    PACKET STRUCTURE
+//    [ID]  [SET_POS]  [PIN 0] ... [PIN 5]
+void SendSlavePositions( int SlaveID ) {
+  static byte msg[MSG_LENGTH];
+  const uint16_t *gather = slaveGather[SlaveID];
+
+  msg[MSG_ADDR] = SlaveID;
+  msg[MSG_CMD] = SET_POS;
+  for (int j = 0; j < PINS_PER_MCU; j++) {
+    msg[MSG_DATA + j] = zMap[gather[j]];
+  }
+  sendBusMsg(slaveBus[SlaveID], msg, MSG_LENGTH);
 }
 
 // Send a zeroing command to the hardware display
@@ -348,6 +1210,8 @@ void ZeroDisplay ( void ) {
   };
   // Send the message
   sendMsg(msg, 2);
+  // pins no longer match the last frame, resend it in full
+  framesSinceRefresh = fullRefreshFrames;
 }
 
 // Send a stop command to the hardware display
@@ -357,6 +1221,155 @@ void StopDisplay ( void ) {
   };
   // Send the message
   sendMsg(msg, 2);
+  // pins no longer match the last frame, resend it in full
+  framesSinceRefresh = fullRefreshFrames;
+}
+
+// Ask slaves firstID ... firstID+count-1 for their status. Each slave 
+// replies in its own STATUS_SLOT_US slot after the request, so the sweep
+// takes count*STATUS_SLOT_US (about 25 ms for a 12x24 display).
+//    PACKET STRUCTURE
+//    [UNIVERSAL_SLAVE_ID]  [GET_STATUS]  [FIRST ID]  [COUNT]
+// With several buses, the slaves of each bus are asked in turn.
+void RequestStatus ( int firstID, int count ) {
+  PROFILE_SCOPE(PROF_STATUS);
+  static byte msg[4] = {
+    UNIVERSAL_SLAVE_ID, GET_STATUS, 0, 0
+  };
+
+  // forget the old replies
+  for (int SlaveID = firstID; SlaveID < firstID + count; SlaveID++) {
+    memset( slaveStatus[SlaveID], 0, STATUS_LENGTH );
+  }
+
+  for ( int bus = 0; bus < rs485Buses; bus++ ) {
+    int busFirst = max( firstID, busFirstSlave[bus] );
+    int busCount = min( firstID + count, busFirstSlave[bus + 1] ) - busFirst;
+    if ( busCount <= 0 ) {
+      continue;
+    }
+    msg[2] = busFirst;
+    msg[3] = busCount;
+
+    sendBusMsg(bus, msg, 4);
+    // slots start once the request is out on the bus
+    rs485Bus[bus]->flush();
+    rxBus = bus;
+    rs485Receiver.reset();
+
+    unsigned long startTime = micros();
+    unsigned long sweepTime = (unsigned long)(busCount + 1) * STATUS_SLOT_US;
+    while ( micros() - startTime < sweepTime ) {
+      if ( rs485Receiver.update() ) {
+        const byte *reply = rs485Receiver.getData();
+        int SlaveID = reply[MSG_DATA];
+        if ( rs485Receiver.getLength() == STATUS_LENGTH
+             && reply[MSG_ADDR] == MASTER_ID && reply[MSG_CMD] == PIN_STATUS
+             && SlaveID >= busFirst && SlaveID < busFirst + busCount ) {
+          memcpy( slaveStatus[SlaveID], reply, STATUS_LENGTH );
+        }
+      }
+    }
+  }
+  rxBus = 0;
+  rs485Receiver.reset();
+}
+
+// Send the status table to Unity
+void SendStatus ( void ) {
+  if ( framedUnityLink ) {
+    static byte reply[2 + sizeof slaveStatus];
+    reply[0] = unitySeq;
+    reply[1] = StatusCMD;
+    memcpy( &reply[2], slaveStatus, numSlaves*STATUS_LENGTH );
+    sendMsg( fUsbWrite, reply, 2 + numSlaves*STATUS_LENGTH );
+    return;
+  }
+  Serial.write( (byte)StatusCMD );
+  Serial.write( (const byte*)slaveStatus, numSlaves*STATUS_LENGTH );
+}
+
+// Send the profiled stages of the master (ID MASTER_ID) or of one 
+// slave to Unity, zeroing them after if clear is set
+//    PACKET STRUCTURE
+//    [SEQ]  [ProfileCMD]  [ID]  [NUM STAGES]  [profilePack() block] ...
+//    (no SEQ on the unframed link)
+void SendProfile ( byte ID, byte clear ) {
+  static byte reply[4 + PROFILE_MAX_STAGES*PROFILE_PACKED_SIZE];
+  int len = 4;
+  if ( ID == MASTER_ID ) {
+    for ( byte stage = 0; stage < PROF_NUM_STAGES; stage++ ) {
+      len += profilePack( stage, PROF_NUM_STAGES, &reply[len] );
+      if ( clear ) {
+        profileClear( stage );
+      }
+    }
+  } else if ( ID < numSlaves ) {
+    // the first reply tells how many stages the slave has
+    byte numStages = 1;
+    for ( byte stage = 0; stage < numStages && stage < PROFILE_MAX_STAGES; stage++ ) {
+      if ( !RequestProfile( ID, stage, clear, &reply[len] ) ) {
+        break;
+      }
+      numStages = reply[len + 1];
+      len += PROFILE_PACKED_SIZE;
+    }
+  }
+  reply[0] = unitySeq;
+  reply[1] = ProfileCMD;
+  reply[2] = ID;
+  reply[3] = (len - 4) / PROFILE_PACKED_SIZE;
+  if ( framedUnityLink ) {
+    sendMsg( fUsbWrite, reply, len );
+    return;
+  }
+  Serial.write( &reply[1], len - 1 );
+}
+
+// Ask one slave for one profiled stage and wait up to PROFILE_REPLY_US
+// for it. Copies the profilePack() block to out and returns true if 
+// the slave answered.
+//    PACKET STRUCTURE
+//    [ID]  [GET_PROFILE]  [STAGE]  [CLEAR]
+bool RequestProfile ( byte ID, byte stage, byte clear, byte *out ) {
+  byte msg[4] = { ID, GET_PROFILE, stage, clear };
+  int bus = slaveBus[ID];
+  bool answered = false;
+
+  sendBusMsg(bus, msg, 4);
+  rs485Bus[bus]->flush();
+  rxBus = bus;
+  rs485Receiver.reset();
+
+  unsigned long startTime = micros();
+  while ( !answered && micros() - startTime < PROFILE_REPLY_US ) {
+    if ( rs485Receiver.update() ) {
+      const byte *reply = rs485Receiver.getData();
+      if ( rs485Receiver.getLength() == PROFILE_LENGTH
+           && reply[MSG_ADDR] == MASTER_ID && reply[MSG_CMD] == PROFILE_DATA
+           && reply[MSG_DATA] == ID && reply[MSG_DATA + 1] == stage ) {
+        memcpy( out, &reply[MSG_DATA + 1], PROFILE_PACKED_SIZE );
+        answered = true;
+      }
+    }
+  }
+  rxBus = 0;
+  rs485Receiver.reset();
+  return answered;
+}
+
+// Send all the pin parameters of a slave (or of every slave with 
+// UNIVERSAL_SLAVE_ID) in one msg. numBlocks is 1 to use the same 
+// block for every pin, or PINS_PER_MCU for one block per pin.
+//    PACKET STRUCTURE
+//    [ID]  [SET_PARAMS]  [PARAM BLOCK] ...
+void SetParams ( byte ID, const byte *blocks, int numBlocks ) {
+  static byte msg[MSG_DATA + PARAM_BLOCK_SIZE*PINS_PER_MCU];
+  int len = MSG_DATA + PARAM_BLOCK_SIZE*numBlocks;
+  msg[MSG_ADDR] = ID;
+  msg[MSG_CMD] = SET_PARAMS;
+  memcpy( &msg[MSG_DATA], blocks, PARAM_BLOCK_SIZE*numBlocks );
+  sendMsg(msg, len);
 }
 
 // Send a command to set max speed
@@ -434,20 +1447,23 @@ void toggleLED  ( void ) {
  *  receiveMsg
  *  
  *  Description
- *    Receives RS485 message and saves it to 
- *    the passed in byte array buffer
+ *    Feeds the bytes waiting in the RS485 serial 
+ *    buffer to the receiver and returns right away.
+ *    A complete msg is left in rs485Buffer
  *  
  *  Parameters
- *    Byte array where the received msg will 
- *    be stored
+ *    None
  *    
  *  Returns
- *    0 if it was nothing, otherwise returns 
+ *    0 if no complete msg yet, otherwise returns 
  *    length of msg received
  *    
 */
-byte receiveMsg(byte *msgBuffer) {
-  return recvMsg (fAvailable, fRead, msgBuffer, sizeof msgBuffer);
+unsigned int receiveMsg( void ) {
+  if ( rs485Receiver.update() ) {
+    return rs485Receiver.getLength();
+  }
+  return 0;
 }
 
 
@@ -466,17 +1482,14 @@ byte receiveMsg(byte *msgBuffer) {
  *    
 */
 void sendMsg( byte* msg ) {
-  // Enable the transmit pin
-  RS485Serial.transmitterEnable(SSerialTxControl);
-  // Send the message
-  sendMsg (fWrite, msg, MSG_LENGTH);  
+  sendMsg( msg, MSG_LENGTH );
 }
 
 /* 
  *  sendMsg
  *  
  *  Description
- *    Sends RS485 message from Master
+ *    Sends RS485 message from Master on every bus
  *    
  *  Parameters 
  *    Message to send as a byte array 
@@ -487,10 +1500,36 @@ void sendMsg( byte* msg ) {
  *    
 */
 void sendMsg( byte* msg, int len ) {
-  // Enable the transmit pin
-  RS485Serial.transmitterEnable(SSerialTxControl);
+  for ( int bus = 0; bus < rs485Buses; bus++ ) {
+    sendBusMsg( bus, msg, len );
+  }
+}
+
+/* 
+ *  sendBusMsg
+ *  
+ *  Description
+ *    Sends RS485 message from Master on one bus. 
+ *    The whole packet is encoded first and queued 
+ *    in the serial TX buffer, so this only waits 
+ *    if the buffer is full
+ *    
+ *  Parameters 
+ *    Bus to send on (0 ... rs485Buses-1)
+ *    Message to send as a byte array 
+ *    Length of the message to send
+ *    
+ *  Returns
+ *    None
+ *    
+*/
+void sendBusMsg( int bus, byte* msg, int len ) {
+  static byte encoded[RS485_ENCODED_SIZE(MAX_FRAME_SIZE + 2)];
+  unsigned int encodedLen = encodeMsg( msg, len, encoded, sizeof encoded );
   // Send the message
-  sendMsg (fWrite, msg, len);  
+  rs485Bus[bus]->write( encoded, encodedLen );
+  rs485BytesSent += encodedLen;
+  rs485MsgsSent++;
 }
 
 /* 
@@ -523,7 +1562,7 @@ void printByteArray(byte arr[], int len) {
  * 
 */
 void fWrite (const byte msg) {
-  RS485Serial.write (msg);  
+  rs485Bus[rxBus]->write (msg);  
 }
 
 /*
@@ -534,7 +1573,7 @@ void fWrite (const byte msg) {
  * 
 */
 int fAvailable () {
-  return RS485Serial.available();
+  return rs485Bus[rxBus]->available();
 }
 
 /*
@@ -545,6 +1584,24 @@ int fAvailable () {
  * 
 */
 int fRead () {
-  return RS485Serial.read();
+  return rs485Bus[rxBus]->read();
+}
+
+/*
+ * fUsbWrite, fUsbAvailable, fUsbRead
+ * 
+ * Callback functions used by RS485_protocol
+ * for framed msgs over the USB serial to Unity
+ * 
+*/
+void fUsbWrite (const byte msg) {
+  Serial.write (msg);
+}
+
+int fUsbAvailable () {
+  return Serial.available();
 }
 
+int fUsbRead () {
+  return Serial.read();
+}
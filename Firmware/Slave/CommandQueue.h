@@ -0,0 +1,68 @@
+/****************************************************************************
+
+  Header file for CommandQueue
+  Lock-free FIFO of commands from loop() to an ISR
+
+  Unlike a DoubleBuffer, no command is lost: a ZERO or IDLE followed
+  by a MOVE before the ISR runs is still seen in order.
+  - loop() calls Push(), which fails while the queue is full.
+  - The ISR calls Peek() and Pop(). The ISR can't be interrupted
+    by loop().
+  Each side only writes its own index, and a slot is filled before
+  tail publishes it.
+
+ ****************************************************************************/
+
+#ifndef COMMAND_QUEUE_H
+#define COMMAND_QUEUE_H
+
+#include "Arduino.h"
+#include "DoubleBuffer.h"    // COMPILER_BARRIER
+
+// N must be a power of 2, at most 128
+template <class T, byte N>
+class CommandQueue
+{
+  public:
+    CommandQueue() : head(0), tail(0) {}
+
+    // Add a command, returns false if the queue is full
+    bool Push( const T &value ) {
+      byte t = tail;
+      if ( (byte)(t - head) >= N ) {
+        return false;
+      }
+      slot[t & (N - 1)] = value;
+      COMPILER_BARRIER();
+      tail = t + 1;
+      return true;
+    }
+
+    // Copy the oldest command without removing it,
+    // returns false if the queue is empty
+    bool Peek( T &value ) {
+      byte h = head;
+      if ( h == tail ) {
+        return false;
+      }
+      value = slot[h & (N - 1)];
+      return true;
+    }
+
+    // Remove the oldest command, returns false if the queue is empty
+    bool Pop( T &value ) {
+      if ( !Peek(value) ) {
+        return false;
+      }
+      COMPILER_BARRIER();
+      head = head + 1;
+      return true;
+    }
+
+  private:
+    T slot[N];
+    volatile byte head;  // next slot to pop, only the ISR writes it
+    volatile byte tail;  // next slot to push, only loop() writes it
+};
+
+#endif
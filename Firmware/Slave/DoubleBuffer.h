@@ -0,0 +1,68 @@
+/****************************************************************************
+
+  Header file for DoubleBuffer
+  Lock-free handoff of a value between loop() and an ISR
+
+  The writer fills the slot that is not published and then publishes
+  it by bumping the sequence number, so a reader never sees a half
+  written value:
+  - loop() -> ISR: loop() calls Write(), the ISR calls Take() to get
+    each new value once. The ISR can't be interrupted by loop().
+  - ISR -> loop(): the ISR calls Write(), loop() calls Read() which
+    copies again if the ISR published while it was copying.
+  A newer value replaces one that was not taken yet.
+
+ ****************************************************************************/
+
+#ifndef DOUBLE_BUFFER_H
+#define DOUBLE_BUFFER_H
+
+#include "Arduino.h"
+
+// keep the compiler from moving memory accesses across this point
+#define COMPILER_BARRIER() __asm__ volatile ("" ::: "memory")
+
+template <class T>
+class DoubleBuffer
+{
+  public:
+    DoubleBuffer() : seq(0), taken(0) {}
+
+    // Publish a new value, the reader must not interrupt this
+    // unless it only uses Read()
+    void Write( const T &value ) {
+      slot[(seq + 1) & 1] = value;
+      COMPILER_BARRIER();
+      seq = seq + 1;
+    }
+
+    // Get the latest value if it is new, from a context that
+    // Write() can't interrupt. Returns false if nothing new.
+    bool Take( T &value ) {
+      byte s = seq;
+      if ( s == taken ) {
+        return false;
+      }
+      value = slot[s & 1];
+      taken = s;
+      return true;
+    }
+
+    // Copy the latest value, retrying if Write() interrupted us
+    void Read( T &value ) {
+      byte s;
+      do {
+        s = seq;
+        COMPILER_BARRIER();
+        value = slot[s & 1];
+        COMPILER_BARRIER();
+      } while ( s != seq );
+    }
+
+  private:
+    T slot[2];
+    volatile byte seq;   // slot (seq & 1) holds the latest value
+    byte taken;          // seq of the last value taken
+};
+
+#endif
@@ -31,41 +31,61 @@ PID::PID ( int Kp, int Ki, int Kd ) {
 
   SetOutputLimits(0, 255);
 
-  SampleTime = 25;
+  SampleTime = 25000;
+  SampleTolerance = 0;
 
   SetTunings(Kp, Ki, Kd);
   
   lastOutput = 0;
+  lastInput = 0;
+  ITerm = 0;
+  DTerm = 0;
   
-  lastTime = millis() - SampleTime;
+  lastTime = micros() - SampleTime;
   
 }
 
+/****************************************************************************
+ Function
+    Compute
+
+ Parameters
+  myInput: measured position [pulses]
+  mySetpoint: wanted position [pulses]
+
+ Returns
+    Motor output within the output limits
+
+ Description
+    Runs once per SampleTime, timed in us. The gains are per 
+    SampleTime and get scaled to the real time since the last run, 
+    so a late cycle integrates more and differentiates less. 
+    The terms are Q(PID_Q) fixed point with saturating sums.
+    The derivative uses the change of myInput since the last run.
+****************************************************************************/
 int PID::Compute( int myInput, int mySetpoint ) {
-  unsigned long now = millis();
-  unsigned long timeChange = (now - lastTime);
-  
-  if (timeChange >= SampleTime)
-  {
-    /*Compute all the working error variables*/
-    int input = myInput;
-    int error = mySetpoint - input;
-    // error windup
-    ITerm += (ki * error);
-    ITerm = clamp(ITerm, outMax, outMin);
-    int dInput = (input - lastInput);
-
-    /*Compute PID Output*/
-    int out = kp * error + ITerm - kd * dInput;
-    out = clamp(out, outMax, outMin);
-
-    /*Remember some variables for next time*/
-    lastOutput = out;
-    lastInput = input;
-    lastTime = now;
-    return out;
-  }
-  return lastOutput;
+  return Step( myInput, mySetpoint, 0, false );
+}
+
+/****************************************************************************
+ Function
+    Compute
+
+ Parameters
+  myInput: measured position [pulses]
+  mySetpoint: wanted position [pulses]
+  inputRate: measured speed [pulses/s] in Q(PID_Q) fixed point
+
+ Returns
+    Motor output within the output limits
+
+ Description
+    Same as Compute above, with the derivative from a measured 
+    speed instead of the position change, which is mostly encoder 
+    quantization at low speed.
+****************************************************************************/
+int PID::Compute( int myInput, int mySetpoint, int32_t inputRate ) {
+  return Step( myInput, mySetpoint, inputRate, true );
 }
 
 void PID::SetOutputLimits(int Min, int Max) {
@@ -77,30 +97,118 @@ void PID::SetTunings(int Kp, int Ki, int Kd) {
   if (Kp < 0 || Ki < 0 || Kd < 0) {
     return;
   }
+  // Ki and Kd are per SampleTime, Compute scales them to the real dt
   kp = Kp;
   ki = Ki;
   kd = Kd;
-//    double SampleTimeInSec = ((double)SampleTime)/1000;
-//    kp = Kp;
-//    ki = Ki * SampleTimeInSec;
-//    kd = Kd / SampleTimeInSec;
 }
 
 void PID::SetSampleTime(int NewSampleTime) {
   if ( NewSampleTime > 0) {
-//        double ratio  = (double) NewSampleTime / (double)SampleTime;
-//        ki *= ratio;
-//        kd /= ratio;
-    SampleTime = (unsigned long)NewSampleTime;
+    SampleTime = (unsigned long)NewSampleTime * 1000UL;
   }
 }
 
+/****************************************************************************
+ Function
+    SetSampleTolerance
+
+ Parameters
+  us: how much earlier than SampleTime a run may come [us]
+
+ Returns
+    None
+
+ Description
+    When Compute is called from fixed ticks that divide SampleTime,
+    a tick that comes a few us early would otherwise wait for the 
+    next one. Half a tick runs the loop on every Nth tick.
+****************************************************************************/
+void PID::SetSampleTolerance(unsigned long us) {
+  SampleTolerance = us;
+}
+
 /****************************************************************************
 
   Private Functions
 
 ****************************************************************************/
 
+/****************************************************************************
+ Function
+    Step
+
+ Parameters
+  myInput: measured position [pulses]
+  mySetpoint: wanted position [pulses]
+  inputRate: measured speed [pulses/s] in Q(PID_Q), if haveRate
+  haveRate: true to differentiate inputRate instead of myInput
+
+ Returns
+    Motor output within the output limits
+
+ Description
+    The loop behind both Compute overloads.
+****************************************************************************/
+int PID::Step( int myInput, int mySetpoint, int32_t inputRate, bool haveRate ) {
+  unsigned long now = micros();
+  unsigned long timeChange = (now - lastTime);
+  
+  if (timeChange + SampleTolerance < SampleTime) {
+    return lastOutput;
+  }
+
+  /*Compute all the working error variables*/
+  int input = myInput;
+  int32_t error = (int32_t)mySetpoint - input;
+  int64_t dt = timeChange;
+  int64_t T = SampleTime;
+  if (timeChange > PID_MAX_GAP * SampleTime) {
+    // first run after a pause, nothing to integrate or differentiate
+    lastInput = input;
+    DTerm = 0;
+    dt = 0;
+  }
+
+  int32_t PTerm = saturate( (int64_t)kp * error * PID_ONE );
+  // integral, kept within the output limits
+  ITerm = saturate( ITerm + (int64_t)ki * error * PID_ONE * dt / T );
+  if (ITerm > outMax * PID_ONE) {
+    ITerm = outMax * PID_ONE;
+  }
+  else if (ITerm < outMin * PID_ONE) {
+    ITerm = outMin * PID_ONE;
+  }
+  // derivative on measurement, low-pass filtered over one SampleTime
+  if (haveRate) {
+    // input change over one SampleTime at the measured speed
+    int64_t dInput = (int64_t)kd * inputRate * T / 1000000;
+    DTerm = saturate( DTerm + (-dInput - DTerm) * dt / (T + dt) );
+  } else if (dt > 0) {
+    int64_t dInput = (int64_t)kd * (input - lastInput) * PID_ONE * T / dt;
+    DTerm = saturate( DTerm + (-dInput - DTerm) * dt / (T + dt) );
+  }
+
+  /*Compute PID Output*/
+  int32_t sum = saturate( (int64_t)PTerm + ITerm + DTerm );
+  int out = clamp( (int)(((int64_t)sum + PID_ONE / 2) >> PID_Q), outMax, outMin );
+
+  /*Back-calculation anti-windup: while the output saturates, unwind 
+    the integrator towards zero over PID_TRACK_SAMPLES sample times*/
+  int64_t excess = (int64_t)out * PID_ONE - sum;
+  if ( ITerm != 0 && (excess > 0) != (ITerm > 0) ) {
+    int32_t unwound = saturate( ITerm + excess * dt / (PID_TRACK_SAMPLES * T) );
+    ITerm = ( (unwound > 0) != (ITerm > 0) ) ? 0 : unwound;
+  }
+
+  /*Remember some variables for next time*/
+  lastOutput = out;
+  lastInput = input;
+  lastTime = now;
+  return out;
+}
+
+
 int PID::clamp( int val, int max, int min ) {
   if (val > max) {
     val = max;
@@ -111,3 +219,12 @@ int PID::clamp( int val, int max, int min ) {
   return val;
 }
 
+int32_t PID::saturate( int64_t val ) {
+  if (val > INT32_MAX) {
+    return INT32_MAX;
+  }
+  else if (val < INT32_MIN) {
+    return INT32_MIN;
+  }
+  return (int32_t)val;
+}
@@ -9,27 +9,41 @@
 
 #include "Arduino.h"
 
+// Internal terms are fixed point with PID_Q fraction bits
+#define PID_Q             8
+#define PID_ONE           (1L << PID_Q)
+// Integrator tracking time for the anti-windup, in sample times
+#define PID_TRACK_SAMPLES 4
+// Gaps longer than this many sample times restart the loop (no I, no D)
+#define PID_MAX_GAP       8
+
 class PID {
 
   public:
     PID ( int Kp, int Ki, int Kd ) ;
     int Compute( int myInput, int mySetpoint );
+    int Compute( int myInput, int mySetpoint, int32_t inputRate ); // rate [Q pulses/s]
     void SetOutputLimits( int Min, int Max );
-    void SetTunings( int Kp, int Ki, int Kd );
-    void SetSampleTime( int NewSampleTime );
+    void SetTunings( int Kp, int Ki, int Kd ); // gains per sample time
+    void SetSampleTime( int NewSampleTime );   // in ms
+    void SetSampleTolerance( unsigned long us ); // early runs allowed [us]
 
   private:
     int kp;
     int kd;
     int ki;
 
-    unsigned long lastTime;
-    int ITerm, lastInput, lastOutput;
+    unsigned long lastTime;          // [us]
+    int32_t ITerm, DTerm;            // [Q]
+    int lastInput, lastOutput;
 
-    unsigned long SampleTime;
+    unsigned long SampleTime;        // [us]
+    unsigned long SampleTolerance;   // [us] how early a run may come
     int outMin, outMax;
 
+    int Step( int myInput, int mySetpoint, int32_t inputRate, bool haveRate );
     int clamp( int val, int max, int min );
+    int32_t saturate( int64_t val );
 
 };
 #endif
@@ -22,6 +22,8 @@
 // optimmize encoder readings
 #define ENCODER_USE_INTERRUPTS
 #define ENCODER_OPTIMIZE_INTERRUPTS    
+#define ENCODER_TIMESTAMPS      // time the encoder edges for the pin speed
+#define ENCODER_STOP_US 250000  // no edge for this long [us] reads as stopped
 
 //------------RS485 Definitions & Variables-----------------
 #define RS485Serial Serial1    // Using hardware serial for Teensy
@@ -32,7 +34,7 @@
 // is always receiving
 #define RS485Transmit    HIGH
 #define RS485Receive     LOW
-#define MAX_MSG_SIZE 8   // Max buffer size
+#define MAX_MSG_SIZE (MSG_DATA + 3 + (MAX_DISPLAY_SIZE*POS_FINE_BITS + 7)/8)   // Max buffer size (12-bit SET_POS_PACKED_RANGE)
 #define MSG_LENGTH 8
 #define MASTER_ID 65                  // Master Teensy ID
 #define UNIVERSAL_SLAVE_ID 255        // Universal ID
@@ -54,6 +56,61 @@
 #define SET_KD				    246   // set Kd gain
 #define DISABLE_PIN       245   // disable pin
 #define SET_MAX_TRAVEL    244   // disable pin
+#define SET_POS_ALL       243   // set pin positions of the full display
+#define SET_POS_SPARSE    242   // set positions of a list of display pins
+#define GET_STATUS        241   // master asks a range of slaves for their status
+#define PIN_STATUS        240   // status reply to the master
+#define COMMIT_POS        239   // apply the staged positions of a frame
+#define SET_POS_PACKED    238   // set pin positions of the full display, bit packed
+#define SET_PARAMS        237   // set gains, speeds, deadzone and enable of the pins
+#define SET_GEOMETRY      236   // set rows, pins per row and slave layout of the display
+#define SET_POS_RANGE     235   // set pin positions of part of the display (rows of one bus)
+#define SET_POS_PACKED_RANGE 234   // set pin positions of part of the display, bit packed
+#define SET_BAUD          233   // set the bus rate to LINK_BAUD(rate)
+#define SET_TRAJ_ALL      232   // keyframe for part of the display, pins interpolate to it
+#define GET_PROFILE       231   // master asks one slave for one profiled stage
+#define PROFILE_DATA      230   // profile reply to the master
+
+// SET_PARAMS block, one for all pins or one per pin, must match the master
+//  [KP HIGH] [KP LOW] [KI HIGH] [KI LOW] [KD HIGH] [KD LOW]
+//  [MAX SPEED] [MIN SPEED] [DEADZONE mm] [ENABLED]
+//  [PROFILE SPEED HIGH] [PROFILE SPEED LOW] [PROFILE ACCEL HIGH] [PROFILE ACCEL LOW]
+#define PARAM_BLOCK_SIZE  14
+
+// Fine positions: POS_FINE_BITS bits over the full pin travel, must match the master
+#define POSITION_RANGE_MM DEFAULT_MAX_TRAVEL
+#define POS_FINE_BITS     12
+#define POS_FINE_MAX      ((1 << POS_FINE_BITS) - 1)
+
+// Status replies, must match the master
+#define STATUS_LENGTH     (MSG_DATA + 3 + 5*NUM_MOTORS)  // PIN_STATUS msg size
+#define STATUS_SLOT_US    520   // reply slot per slave: 40 bus bytes + turnaround
+#define STATUS_SWITCH     0x10  // pin status flags, low nibble is PinState_t
+#define STATUS_DISABLED   0x20
+
+// Profile replies, must match the master
+//  [MASTER_ID] [PROFILE_DATA] [ID] [profilePack() block]
+#define PROFILE_LENGTH    (MSG_DATA + 1 + PROFILE_PACKED_SIZE)
+
+// Keyframe interpolation (SET_TRAJ_ALL), must match the master
+#define TRAJ_LINEAR       0     // constant speed from the current setpoint
+#define TRAJ_CUBIC        1     // cubic Hermite, keeps the setpoint speed continuous
+
+// Bus rate, must match the master. Slaves that hear nothing from the 
+// master for LINK_TIMEOUT_MS fall back to LINK_BAUD(0)
+#define NUM_LINK_RATES    3
+#define LINK_BAUD(rate)   (1000000UL*((rate) + 1))  // 1, 2 or 3 Mbaud
+#define LINK_TIMEOUT_MS   6000
+
+// Display layout, must match the master. DISPLAY_SIZE_X/Z are the 
+// defaults until the master sends a SET_GEOMETRY
+#define DISPLAY_SIZE_X  12                              // number of rows
+#define DISPLAY_SIZE_Z  24                              // pins per row
+#define DISPLAY_SIZE    (DISPLAY_SIZE_X*DISPLAY_SIZE_Z) // display size
+#define MAX_SLAVES      64                              // slave IDs 0 ... 63
+#define MAX_DISPLAY_SIZE (MAX_SLAVES*NUM_MOTORS)        // largest display size
+#define LAYOUT_ROWS       0   // every row in the same pin order
+#define LAYOUT_SERPENTINE 1   // odd rows flipped (back of half-module)
 
 //----------Translation Definitions & Variables-----------
 #define UP                 1
@@ -61,6 +118,10 @@
 #define DEBOUNCE_DELAY     1
 #define SWITCH_THRESH      700  // HIGH threshold for analog switches 
 #define DEFAULT_SPEED      250
+#define DEFAULT_KP         1500
+#define DEFAULT_KI         5
+#define DEFAULT_KD         200
+#define DEFAULT_DEADZONE   1    // [mm]
 #define DEFAULT_MAX_TRAVEL 60
 
 // Rotary to linear conversion variables
@@ -73,13 +134,29 @@
 #define ZERO_OFFSET     -10  // switch position [mm]
 #define ZERO_POS        0
 
+// Control loop, run from a timer interrupt at a fixed rate
+#define CONTROL_RATE_HZ 2000        // pin control steps per second (1000-4000), 0 to run them from loop()
+#if CONTROL_RATE_HZ
+  #define CONTROL_PERIOD_US (1000000UL / CONTROL_RATE_HZ)
+#endif
+
+// Motion profile
+#define DEFAULT_PROFILE_SPEED 0     // max setpoint speed [mm/s], 0 for step targets
+#define DEFAULT_PROFILE_ACCEL 1000  // max setpoint acceleration [mm/s^2]
+#define PROFILE_MAX_DT_US 10000     // longest profile step [us], e.g. after a pause
+#define PROFILE_Q       8           // fraction bits of the profile and keyframe setpoints
+#define PROFILE_ONE     (1L << PROFILE_Q)
+
 // Stall-check variables
 #define STALL_TIME      2000 // stall time threshold in ms
+#define STALL_LAG       3    // distance behind the setpoint that counts as stuck [mm]
+#define STALL_SPEED     1    // slowest speed that still counts as moving [mm/s]
 #define MAX_ZERO_TIME   6000 // max time for zeroing in ms   
 
 // Conversion Factors - Multiply to convert e.g. 8 mm * MM_TO_PULSE = X pulses 
 #define PULSE_TO_MM     ((1.0f/ ( PULSES_PER_REV / SCREW_PITCH )) * (1 / 4.0f)) // [mm/pulse]
 #define MM_TO_PULSE     1/PULSE_TO_MM  //[pulse/mm]
+#define MM_TO_PULSE_Q   ((long)((MM_TO_PULSE) * PROFILE_ONE + 0.5f))  // [pulse/mm << PROFILE_Q]
 
 // Threshold for special case switch connected to analog pin
 #define ANALOG_SW_THRESH 950
@@ -31,6 +31,14 @@
 /*----------------------------- Module Defines ----------------------------*/
 #define ENCODER_OPTIMIZE_INTERRUPTS
 #define ENCODER_USE_INTERRUPTS
+#define US_TO_Q32   4295        // 2^32 / 1000000: [us] to [s << 32]
+#define TRAJ_ONE    (1L << 16)  // end of a keyframe in TrajectorySetpoint
+// Fixed point speeds in pulses/s << PID_Q, and the stall distances
+#define EDGE_RATE         ( 1000000UL * PID_ONE )   // one pulse per us
+#define STALL_VELOCITY    ( (int32_t)( STALL_SPEED * (MM_TO_PULSE) * PID_ONE ) )
+#define PULSE_TO_MM_Q     ( (int32_t)( (PULSE_TO_MM) * PID_ONE + 0.5f ) )  // [mm/pulse << PID_Q]
+#define STALL_LAG_PULSES  ( (int)( STALL_LAG * (MM_TO_PULSE) + 0.5f ) )
+#define PROGRESS_PULSES   ( (int)( 3 * (MM_TO_PULSE) + 0.5f ) )
 
 /****************************************************************************
 
@@ -72,13 +80,17 @@ ShapePin::ShapePin ( int id, bool enabled, int motorA, int motorB,
 
   /* Control variables */
   targetPos = 0;
+  setpoint = 0;
   pid_output = 0;
+  pinVelocity = 0;
+  profileEnabled = false;
   // Values that work 
-  Kp = 1500; //60;  //60 //60;
-  Kd = 200;  //40;  //30 //35;
-  Ki = 5;    //2;   //3 //25;
-  SetDeadzone( 1 ); //[mm]
+  Kp = DEFAULT_KP; //60;  //60 //60;
+  Kd = DEFAULT_KD; //40;  //30 //35;
+  Ki = DEFAULT_KI; //2;   //3 //25;
+  SetDeadzone( DEFAULT_DEADZONE ); //[mm]
   SetMaxTravel( DEFAULT_MAX_TRAVEL ); 
+  SetProfile( DEFAULT_PROFILE_SPEED, DEFAULT_PROFILE_ACCEL );
   
   // set pins as output/input
   pinMode( motorApin, OUTPUT );
@@ -95,15 +107,30 @@ ShapePin::ShapePin ( int id, bool enabled, int motorA, int motorB,
   motorPID->SetOutputLimits(-DEFAULT_SPEED, DEFAULT_SPEED);
   // sampleTime = speed * res = 75mm/s * 1/0.25mm = 60Hz --> 1/60=0.0167 --> 3.3 ms
   motorPID->SetSampleTime(2);
+#if CONTROL_RATE_HZ
+  // run on every Nth control tick even when the timer is a bit early
+  motorPID->SetSampleTolerance(CONTROL_PERIOD_US / 2);
+#endif
 
   // start initially IDLE
   currentPinState = IDLE;
 
+  /* Keyframe interpolation */
+  trajActive = false;
+
+  /* Motion profile */
+  profilePos = 0;
+  profileVel = 0;
+  profileTime = micros();
+
   /* Stall check variables */
   isTraveling = true;
   travelStartTime = millis(); // [ms]
   lastTargetPos = 0.0;        // [pulses]
   travelStartPosition = 0.0;  // [pulses]
+  progressTime = millis();    // [ms]
+  progressPos = 0;            // [pulses]
+  stallCount = 0;
 }
 
 /****************************************************************************
@@ -123,6 +150,8 @@ ShapePin::ShapePin ( int id, bool enabled, int motorA, int motorB,
      A. Siu, 05/18/17, 5:00
 ****************************************************************************/
 void ShapePin::RunSM( void ) {
+  // measure the pin speed for the PID and the stall check
+  UpdateVelocity();
  
   switch (currentPinState) {
     case IDLE:
@@ -138,6 +167,10 @@ void ShapePin::RunSM( void ) {
     case MOVING2TARGET:
       // Check switch
       CheckSwitch();
+      // move the setpoint along the keyframe
+      UpdateTrajectory();
+      // move the setpoint towards the target within the speed limits
+      UpdateProfile();
       // run PID to move pin
       RunControlLoop();
       // Check if the pin has been stalled
@@ -220,17 +253,106 @@ void ShapePin::CommandTargetPos ( int newPos ) {
   if ( newPos > maxTravel) {
     newPos = maxTravel;
   }
-  targetPos = newPos * MM_TO_PULSE;
+  CommandTargetPulses( newPos * MM_TO_PULSE );
+}
+
+/****************************************************************************
+ Function
+  CommandTargetPulses
+
+ Parameters
+  newPos: the new pin position to go to [pulses]
+
+ Returns
+    None
+
+ Description
+  Sets a new position for the pin and changes pin state to move.
+  Used for targets finer than 1 mm. A pin that is already moving 
+  keeps its profile speed and heads for the new target from there.
+****************************************************************************/
+void ShapePin::CommandTargetPulses ( int newPos ) {
+  // cap the max travel
+  if ( newPos > maxTravelPulses ) {
+    newPos = maxTravelPulses;
+  }
+  targetPos = newPos;
+  trajActive = false;
+  if ( currentPinState != MOVING2TARGET ) {
+    // start the profile from rest where the pin is
+    ResetProfile();
+    travelStartTime = millis();
+    travelStartPosition = GetPosPulses();
+  }
   // keep track of time to check if stalled
   isTraveling = true;
-  travelStartTime = millis();
-  travelStartPosition = GetPosPulses();
   lastTargetPos = targetPos;
   
   // change states to moving
   currentPinState = MOVING2TARGET;
 }
 
+/****************************************************************************
+ Function
+  CommandTrajectory
+
+ Parameters
+  newPos: the keyframe position [pulses]
+  duration: time to get there [ms], 0 to jump like CommandTargetPulses
+  mode: TRAJ_LINEAR or TRAJ_CUBIC
+
+ Returns
+    None
+
+ Description
+  Moves the setpoint from where it is now to newPos over duration. 
+  RunSM interpolates the setpoint every cycle, so keyframes sent at 
+  a low rate still give a smooth motion. A new keyframe starts from 
+  the current setpoint (and its speed with TRAJ_CUBIC).
+****************************************************************************/
+void ShapePin::CommandTrajectory ( int newPos, unsigned int duration, byte mode ) {
+  // cap the max travel
+  if ( newPos > maxTravelPulses ) {
+    newPos = maxTravelPulses;
+  }
+  if ( duration == 0 ) {
+    CommandTargetPulses( newPos );
+    return;
+  }
+
+  unsigned long now = micros();
+  int32_t startPos;
+  int32_t startVel = 0;
+  if ( trajActive && currentPinState == MOVING2TARGET ) {
+    startPos = TrajectorySetpoint( now, &startVel );
+  } else if ( currentPinState == MOVING2TARGET && profileEnabled ) {
+    // start from where the profile has brought the setpoint, not from
+    // the target it is still heading to
+    startPos = profilePos;
+    startVel = profileVel;
+  } else if ( currentPinState == MOVING2TARGET ) {
+    startPos = targetPos * PROFILE_ONE;
+  } else {
+    startPos = GetPosPulses() * PROFILE_ONE;
+  }
+
+  CommandTargetPulses( ( startPos + PROFILE_ONE / 2 ) >> PROFILE_Q );
+  trajActive = true;
+  trajMode = mode;
+  trajStartPos = startPos;
+  trajEndPos = newPos * PROFILE_ONE;
+  trajStartTime = now;
+  trajDuration = duration * 1000UL;
+  // the divides TrajectorySetpoint needs, done once per keyframe
+  trajShift = 0;
+  while ( ( trajDuration >> trajShift ) > 0xFFFF ) {
+    trajShift++;
+  }
+  trajVelScale = ( 1000000ULL << 16 ) / trajDuration;
+  trajStartTangent = ( mode == TRAJ_CUBIC ) ? 
+                     (int64_t)startVel * trajDuration / 1000000 : 0;
+}
+
 /****************************************************************************
  Function
    Idle
@@ -249,6 +371,7 @@ void ShapePin::CommandTargetPos ( int newPos ) {
 ****************************************************************************/
 void ShapePin::Idle ( void ) {
   Stop();
+  trajActive = false;
   currentPinState = IDLE;
 }
 
@@ -273,6 +396,23 @@ void ShapePin::DisableShapePin( void ) {
   Idle();
 }
 
+/****************************************************************************
+ Function
+  EnableShapePin
+
+ Parameters
+  None
+
+ Returns
+    None
+
+ Description
+  Enable a disabled pin. It stays IDLE until commanded.
+****************************************************************************/
+void ShapePin::EnableShapePin( void ) {
+  pinEnabled = true;
+}
+
 /****************************************************************************
  Function
    SwitchISR
@@ -354,6 +494,7 @@ bool ShapePin::GetSwitchDown( void ) {
 ****************************************************************************/
 void ShapePin::SetKp ( int newkp ) {
   Kp = newkp;
+  motorPID->SetTunings(Kp, Ki, Kd);
 }
 
 /****************************************************************************
@@ -374,6 +515,7 @@ void ShapePin::SetKp ( int newkp ) {
 ****************************************************************************/
 void ShapePin::SetKi ( int newki ) {
   Ki = newki;
+  motorPID->SetTunings(Kp, Ki, Kd);
 }
 
 /****************************************************************************
@@ -394,6 +536,27 @@ void ShapePin::SetKi ( int newki ) {
 ****************************************************************************/
 void ShapePin::SetKd ( int newkd ) {
   Kd = newkd;
+  motorPID->SetTunings(Kp, Ki, Kd);
+}
+
+/****************************************************************************
+ Function
+  SetTunings
+
+ Parameters
+  newkp, newki, newkd: the new PID gains
+
+ Returns
+    None
+
+ Description
+  Sets all PID gains at once
+****************************************************************************/
+void ShapePin::SetTunings ( int newkp, int newki, int newkd ) {
+  Kp = newkp;
+  Ki = newki;
+  Kd = newkd;
+  motorPID->SetTunings(Kp, Ki, Kd);
 }
 
 /****************************************************************************
@@ -496,6 +659,36 @@ void ShapePin::SetDeadzone_Pulses ( int pulses ) {
 ****************************************************************************/
 void ShapePin::SetMaxTravel ( int maxMM ) {
   maxTravel = maxMM;
+  maxTravelPulses = maxMM * MM_TO_PULSE;
+}
+
+/****************************************************************************
+ Function
+   SetProfile
+
+ Parameters
+  speed: max setpoint speed [mm/s], 0 to step the setpoint to the target
+  accel: max setpoint acceleration [mm/s^2]
+
+ Returns
+    None
+
+ Description
+  Sets the limits of the motion profile. The PID follows a setpoint 
+  that ramps up to speed and brakes in time for the target instead 
+  of jumping to it, so the pin does not saturate and overshoot.
+  Turned on mid-move, the profile starts at rest from the setpoint.
+****************************************************************************/
+void ShapePin::SetProfile ( int speed, int accel ) {
+  bool enabled = ( speed > 0 && accel > 0 );
+  if ( enabled && !profileEnabled ) {
+    profilePos = setpoint * PROFILE_ONE;
+    profileVel = 0;
+    profileTime = micros();
+  }
+  profileEnabled = enabled;
+  profileMaxVel = speed * MM_TO_PULSE_Q;
+  profileMaxAccel = accel * MM_TO_PULSE_Q;
 }
 
 /****************************************************************************
@@ -538,6 +731,60 @@ int ShapePin::GetPosPulses ( void ) {
   return encoder->read();
 }
 
+/****************************************************************************
+ Function
+   GetTargetPulses
+
+ Parameters
+  None
+
+ Returns
+    The target position in pulses
+
+ Description
+  Returns where the pin is heading, the end of a keyframe once it is 
+  done
+****************************************************************************/
+int ShapePin::GetTargetPulses ( void ) {
+  return trajActive ? trajEndPos >> PROFILE_Q : targetPos;
+}
+
+/****************************************************************************
+ Function
+   GetVelocity
+
+ Parameters
+  None
+
+ Returns
+    The pin speed in pulses/s << PID_Q, positive going up
+
+ Description
+  Returns the speed measured by the last RunSM
+****************************************************************************/
+int32_t ShapePin::GetVelocity ( void ) {
+  return pinVelocity;
+}
+
+/****************************************************************************
+ Function
+   GetSpeedMM
+
+ Parameters
+  None
+
+ Returns
+    The pin speed in mm/s, rounded, positive going up
+
+ Description
+  GetVelocity for the status replies, in integers
+****************************************************************************/
+int ShapePin::GetSpeedMM ( void ) {
+  int32_t speed = ( (int64_t)abs(pinVelocity) * PULSE_TO_MM_Q + PID_ONE * PID_ONE / 2 ) 
+                  >> ( 2 * PID_Q );
+  return ( pinVelocity < 0 ) ? -speed : speed;
+}
+
 /****************************************************************************
  Function
   GetState
@@ -585,6 +832,40 @@ String ShapePin::PrintState( void ) {
   return "";
 }
 
+/****************************************************************************
+ Function
+   GetEnabled
+
+ Parameters
+    None
+
+ Returns
+    True if the pin is enabled, false if it was disabled
+
+ Description
+  Returns whether the pin is in use
+****************************************************************************/
+bool ShapePin::GetEnabled( void ) {
+  return pinEnabled;
+}
+
+/****************************************************************************
+ Function
+   GetStallCount
+
+ Parameters
+    None
+
+ Returns
+    Number of times the pin stalled since power up (wraps at 255)
+
+ Description
+  Used for reporting stalls back to the master
+****************************************************************************/
+byte ShapePin::GetStallCount( void ) {
+  return stallCount;
+}
+
 /****************************************************************************
  
   Private Functions
@@ -611,20 +892,208 @@ String ShapePin::PrintState( void ) {
 void ShapePin::RunControlLoop ( void ) {
   // update the current position
   int currPos = GetPosPulses(); //[pulses * 4]
-  // stop motor if we're in the dead zone
-  if ( (currPos < (targetPos + deadzone)) && (currPos > (targetPos - deadzone)) ) {
+  // stop motor once the setpoint arrived and we're in the dead zone
+  if ( (setpoint == targetPos) && 
+       (currPos < (targetPos + deadzone)) && (currPos > (targetPos - deadzone)) ) {
     Stop();
   } else { // compute PID term and control pin
     // calculate PID term (output)
-    pid_output = motorPID->Compute(currPos, targetPos);
+#ifdef ENCODER_TIMESTAMPS
+    pid_output = motorPID->Compute(currPos, setpoint, pinVelocity);
+#else
+    pid_output = motorPID->Compute(currPos, setpoint);
+#endif
     // set dir and speed to move the pin
     int speed = abs(pid_output);
-    int dir = speed / pid_output;
+    int dir = ( pid_output < 0 ) ? DOWN : UP;
     Move( dir, speed );
   } // End if deadzone
   currentPinState = MOVING2TARGET;
 }
 
+/****************************************************************************
+ Function
+   UpdateProfile
+
+ Parameters
+  None
+
+ Returns
+    None
+
+ Description
+    Moves the setpoint one step towards targetPos: it speeds up at 
+    profileMaxAccel to profileMaxVel and brakes just in time to stop 
+    on the target. The speed carries over when the target changes.
+    All in fixed point, the Teensy 3.2 has no FPU.
+****************************************************************************/
+void ShapePin::UpdateProfile ( void ) {
+  unsigned long now = micros();
+  uint32_t dt = now - profileTime; //[us]
+  profileTime = now;
+  if ( !profileEnabled || trajActive ) {
+    setpoint = targetPos;
+    return;
+  }
+  if ( dt > PROFILE_MAX_DT_US ) {
+    dt = PROFILE_MAX_DT_US;
+  }
+  int64_t dtQ32 = (int64_t)dt * US_TO_Q32; //[s << 32]
+
+  int32_t error = targetPos * PROFILE_ONE - profilePos;
+  int32_t step = ( profileMaxAccel * dtQ32 + (1LL << 31) ) >> 32;
+  // fastest speed from which we can still stop on the target
+  int32_t vel = profileMaxVel;
+  uint64_t velSquared = 2 * (uint64_t)profileMaxAccel * abs(error);
+  if ( velSquared < (uint64_t)profileMaxVel * profileMaxVel ) {
+    vel = ISqrt( velSquared );
+  }
+  if ( error < 0 ) {
+    vel = -vel;
+  }
+  profileVel += constrain( vel - profileVel, -step, step );
+  profilePos += ( profileVel * dtQ32 + (1LL << 31) ) >> 32;
+
+  // arrived once we reach the target slowly enough to stop there
+  int32_t left = targetPos * PROFILE_ONE - profilePos;
+  if ( ( error == 0 || (left < 0) != (error < 0) || left == 0 ) 
+       && abs(profileVel) <= 2 * step ) {
+    profilePos = targetPos * PROFILE_ONE;
+    profileVel = 0;
+  }
+  setpoint = ( profilePos + PROFILE_ONE / 2 ) >> PROFILE_Q;
+}
+
+/****************************************************************************
+ Function
+   ISqrt
+
+ Parameters
+  val: the number to take the root of
+
+ Returns
+    floor(sqrt(val))
+
+ Description
+    Integer square root, one result bit per pass.
+****************************************************************************/
+uint32_t ShapePin::ISqrt ( uint64_t val ) {
+  uint64_t root = 0;
+  uint64_t bit = 1ULL << 62;
+  while ( bit > val ) {
+    bit >>= 2;
+  }
+  while ( bit != 0 ) {
+    if ( val >= root + bit ) {
+      val -= root + bit;
+      root = ( root >> 1 ) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return (uint32_t)root;
+}
+
+/****************************************************************************
+ Function
+   ResetProfile
+
+ Parameters
+  None
+
+ Returns
+    None
+
+ Description
+    Starts the profile at rest from the current pin position.
+****************************************************************************/
+void ShapePin::ResetProfile ( void ) {
+  int currPos = GetPosPulses();
+  profilePos = currPos * PROFILE_ONE;
+  profileVel = 0;
+  profileTime = micros();
+  setpoint = profileEnabled ? currPos : targetPos;
+  progressTime = millis();
+  progressPos = currPos;
+}
+
+/****************************************************************************
+ Function
+   UpdateTrajectory
+
+ Parameters
+  None
+
+ Returns
+    None
+
+ Description
+    Moves targetPos along the current keyframe. Ends the keyframe 
+    (targetPos = end position) once its duration is over.
+****************************************************************************/
+void ShapePin::UpdateTrajectory ( void ) {
+  if ( !trajActive ) {
+    return;
+  }
+  unsigned long now = micros();
+  if ( now - trajStartTime >= trajDuration ) {
+    targetPos = trajEndPos >> PROFILE_Q;
+    trajActive = false;
+    return;
+  }
+  int32_t velocity;
+  int32_t pos = TrajectorySetpoint( now, &velocity );
+  targetPos = ( pos + PROFILE_ONE / 2 ) >> PROFILE_Q;
+  // the keyframe shapes the setpoint, the profile just follows along
+  profilePos = pos;
+  profileVel = velocity;
+}
+
+/****************************************************************************
+ Function
+   TrajectorySetpoint
+
+ Parameters
+  now: time [us]
+  velocity: set to the setpoint speed [pulses/s << PROFILE_Q]
+
+ Returns
+    Setpoint of the current keyframe at time now [pulses << PROFILE_Q]
+
+ Description
+    Linear: constant speed from start to end.
+    Cubic: Hermite curve from the start position and speed to the 
+    end position and the keyframe's mean speed, so the next keyframe
+    joins smoothly. Fixed point with s from 0 to TRAJ_ONE.
+****************************************************************************/
+int32_t ShapePin::TrajectorySetpoint ( unsigned long now, int32_t *velocity ) {
+  uint32_t elapsed = now - trajStartTime;
+  if ( elapsed > trajDuration ) {
+    elapsed = trajDuration;
+  }
+  // elapsed / trajDuration in a 32-bit divide
+  int32_t s = ( ( elapsed >> trajShift ) << 16 ) / ( trajDuration >> trajShift );
+  int32_t move = trajEndPos - trajStartPos;
+  if ( trajMode != TRAJ_CUBIC ) {
+    *velocity = ( (int64_t)move * trajVelScale ) >> 16;
+    return trajStartPos + (int32_t)( ( (int64_t)s * move ) >> 16 );
+  }
+  int32_t s2 = ( (int64_t)s * s ) >> 16;
+  int32_t s3 = ( (int64_t)s2 * s ) >> 16;
+  // h00 = 1 - h01 and the end tangent is the move
+  int32_t h10 = s3 - 2*s2 + s;
+  int32_t h01 = -2*s3 + 3*s2;
+  int32_t h11 = s3 - s2;
+  // derivative of the curve over s, then over the duration
+  int64_t slope = ( (int64_t)(6*s - 6*s2) * move 
+                    + (int64_t)(3*s2 - 4*s + TRAJ_ONE) * trajStartTangent
+                    + (int64_t)(3*s2 - 2*s) * move ) >> 16;
+  *velocity = ( slope * trajVelScale ) >> 16;
+  return trajStartPos + (int32_t)( ( (int64_t)h10 * trajStartTangent 
+                                     + (int64_t)(h01 + h11) * move ) >> 16 );
+}
+
 /****************************************************************************
  Function
    RunControlLoopWithoutMoving
@@ -685,6 +1154,49 @@ void ShapePin::Move ( int direction, int speed ) {
   }
 }
 
+/****************************************************************************
+ Function
+  UpdateVelocity
+
+ Parameters
+  None
+
+ Returns
+    None
+
+ Description
+    Measures the pin speed from the time between encoder edges, 
+    which is much finer than counting pulses per control step at 
+    low speed. The time of the last 4 edges is used once the pin 
+    kept its direction that long, so uneven encoder marks cancel 
+    out. Between edges the speed can be at most one pulse over the 
+    time since the last one, so a slowing pin reads slower right 
+    away, and no edge for ENCODER_STOP_US reads as stopped. One 
+    32-bit divide, no floats in the ISR.
+****************************************************************************/
+void ShapePin::UpdateVelocity ( void ) {
+#ifdef ENCODER_TIMESTAMPS
+  uint32_t edgeTime, period;
+  uint8_t counts;
+  int8_t dir;
+  encoder->readTiming( &edgeTime, &period, &counts, &dir );
+  uint32_t sinceEdge = micros() - edgeTime;
+
+  if ( counts == 0 || period == 0 || sinceEdge > ENCODER_STOP_US ) {
+    pinVelocity = 0;
+    return;
+  }
+  // no edge yet when the next one was due: the pin is slowing down
+  uint32_t speed;
+  if ( sinceEdge > period / counts ) {
+    speed = EDGE_RATE / sinceEdge;
+  } else {
+    speed = counts * EDGE_RATE / period;
+  }
+  pinVelocity = dir * (int32_t)speed;
+#endif
+}
+
 /****************************************************************************
  Function
   CheckIfStalled
@@ -696,21 +1208,32 @@ void ShapePin::Move ( int direction, int speed ) {
     True if the pin was stalled, false otherwise
 
  Description
+    The pin is stalled if it has been trying to move for STALL_TIME 
+    while neither keeping up with the setpoint, moving at STALL_SPEED
+    nor moving 3 mm.
+    New targets do not restart the clock.
 
  Author
      A. Siu, 05/18/17, 5:00
 ****************************************************************************/
 bool ShapePin::CheckIfStalled ( void ) {
-    // if motor should be traveling
-  if ( isTraveling ) {
-      if ( ((millis()-travelStartTime) > STALL_TIME) 
-        && ( (abs(GetPosPulses()-travelStartPosition) < 3*MM_TO_PULSE) && ( abs(pid_output) > 0) ) ) {
-        // if we've been traveling for some seconds and (we haven't moved and we've been trying to) 
-        // turn off motor until system reset
-        Idle();
-        Serial.printf("stalled %d", pinID);
-        return true;
-      }
+  int currPos = GetPosPulses();
+  unsigned long now = millis();
+  if ( !isTraveling || pid_output == 0
+       || abs(currPos - setpoint) < STALL_LAG_PULSES
+       || abs(pinVelocity) >= STALL_VELOCITY
+       || abs(currPos - progressPos) >= PROGRESS_PULSES ) {
+    // the pin is on track or making progress
+    progressTime = now;
+    progressPos = currPos;
+    return false;
+  }
+  if ( (now - progressTime) > STALL_TIME ) {
+    // if we've been trying to move for some seconds and haven't
+    // turn off motor until system reset
+    Idle();
+    stallCount++;
+    return true;
   }
   return false;
 }
@@ -737,6 +1260,7 @@ bool ShapePin::CheckIfStalledZeroing ( void ) {
         // if we've been traveling for some seconds and ( we haven't moved and we've been trying to) 
         // turn off motor until system reset
         Idle();
+        stallCount++;
         return true;
       }
   }
@@ -754,13 +1278,20 @@ bool ShapePin::CheckIfStalledZeroing ( void ) {
     None
 
  Description
-   Checks if switch status has changed
+   Checks if switch status has changed. The switch stays down for a
+   while after the pin turns around, so a pin already heading up off
+   it only has its position held at the zero offset; stopping it
+   would restart the profile from rest every step and never let it go.
 
  Author
      A. Siu, 05/18/17, 5:00
 ****************************************************************************/
 void ShapePin::CheckSwitch ( void ) {
   if ( switchDown ) {
+    if ( currentPinState == MOVING2TARGET && targetPos > GetPosPulses() ) {
+      encoder->write( ZERO_OFFSET * MM_TO_PULSE );
+      return;
+    }
     Stop(); // stop motors
     SetMaxSpeed(DEFAULT_SPEED);
     SetMinSpeed(DEFAULT_SPEED);
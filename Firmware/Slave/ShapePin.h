@@ -37,8 +37,14 @@ class ShapePin
     void Zero( void );					        // * zero the pin to recalibrate
     void CommandTargetPos(int newPos);  // * set a new target pos for the pin
                                         //   in units of mm
+    void CommandTargetPulses(int newPos); // * same as CommandTargetPos but in
+                                          //   pulses, for sub-mm targets
+    void CommandTrajectory(int newPos,    // * move the setpoint to newPos [pulses]
+                           unsigned int duration, // over duration [ms], TRAJ_LINEAR
+                           byte mode);            //   or TRAJ_CUBIC
     void Idle ( void );					        // * set the pin in idle state
     void DisableShapePin( void );       // * disable the pin so it is no longer used
+    void EnableShapePin( void );        // * re-enable a disabled pin (stays IDLE)
     void SwitchISR ( bool );            // * should be called by the switch ISR with the updated
                                         //   switch state
     
@@ -48,24 +54,38 @@ class ShapePin
     void SetKp ( int newkp );
     void SetKi ( int newi );
     void SetKd ( int newkd );
+    void SetTunings ( int newkp, int newki, int newkd ); // all gains at once
     void SetMaxSpeed ( int speed ); // duty cycle (0-255)
     void SetMinSpeed ( int speed ); // duty cycle (0-255)
     void SetDeadzone ( int mm );    // in mm 
     void SetDeadzone_Pulses ( int pulses );  // in pulses (aka ticks*4)
     void SetMaxTravel ( int mm );   // in mm (0-60)
+    void SetProfile ( int speed, int accel ); // setpoint limits in mm/s and mm/s^2,
+                                              //   speed 0 for step targets
 
     // Display Functions
     int GetPosMM( void );
     int GetPosPulses( void );
+    int GetTargetPulses( void );    // where the pin is heading [pulses]
+    int32_t GetVelocity( void );    // measured pin speed [pulses/s << PID_Q]
+    int GetSpeedMM( void );         // the same in mm/s
     bool GetSwitchDown( void );
     PinState_t GetState( void );
     String PrintState( void );
+    bool GetEnabled( void );
+    byte GetStallCount( void );     // number of stalls since power up
 
     bool debugFlag = false;
 
   private:
     /*---------------------------- Module Functions ---------------------------*/
     void RunControlLoop ( void );
+    void UpdateTrajectory ( void );
+    int32_t TrajectorySetpoint ( unsigned long now, int32_t *velocity );
+    void UpdateProfile ( void );
+    uint32_t ISqrt ( uint64_t val );
+    void UpdateVelocity ( void );
+    void ResetProfile ( void );
     void RunControlLoopWithoutMoving ( void );
     void Move ( int direction, int speed );
     bool CheckIfStalled ( void );
@@ -86,16 +106,40 @@ class ShapePin
 
     /* Control variables */
     bool isTraveling;
-    int targetPos;   //[pulses]
-    double deadzone; //[pulses]
+    int targetPos;   //[pulses] where the pin should end up
+    int setpoint;    //[pulses] where the PID drives the pin this cycle
+    int deadzone;    //[pulses]
     int pid_output;          
+    int32_t pinVelocity; //[pulses/s << PID_Q] measured from the encoder edge times
     int Kp, Kd, Ki;         
     int maxTravel;   //[mm] max travel distance e.g. 60 mm
+    int maxTravelPulses; //[pulses] the same
+
+    /* Keyframe interpolation, fixed point with PROFILE_Q fraction bits */
+    bool trajActive;                // true while the setpoint is moving
+    byte trajMode;                  // TRAJ_LINEAR or TRAJ_CUBIC
+    int32_t trajStartPos, trajEndPos; // [pulses]
+    int32_t trajStartTangent;       // [pulses] start speed times the duration
+    unsigned long trajStartTime;    // [us]
+    unsigned long trajDuration;     // [us]
+    byte trajShift;                 // trajDuration >> trajShift fits 16 bits
+    uint32_t trajVelScale;          // [1/s << 16] 1 / trajDuration
+
+    /* Motion profile, fixed point with PROFILE_Q fraction bits */
+    bool profileEnabled;            // false to step setpoint = targetPos
+    int32_t profileMaxVel;          // [pulses/s]
+    int32_t profileMaxAccel;        // [pulses/s^2]
+    int32_t profilePos;             // [pulses]
+    int32_t profileVel;             // [pulses/s]
+    unsigned long profileTime;      // [us] last profile step
 
     /* Stall check variables */
     unsigned long travelStartTime; // [ms]
     int lastTargetPos;             // [pulses]
     int travelStartPosition;       // [pulses]
+    unsigned long progressTime;    // [ms] last time the pin kept up or moved
+    int progressPos;               // [pulses] position at progressTime
+    byte stallCount;               // stalls since power up
 
     /* Switch */
     int loweringSpeed = 200;     
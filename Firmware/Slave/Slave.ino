@@ -21,12 +21,22 @@
 #include "ShapeConstants.h"
 #include "Teensy-pin.h"      // Teensy pin definitions
 #include "RS485_protocol.h"  // library with error-checking protocol
+#include "DoubleBuffer.h"    // lock-free handoff between loop() and the control ISR
+#include "CommandQueue.h"    // lock-free command FIFO from loop() to the control ISR
+#define PROFILING 1          // 0 to compile the stage timing out
+#include "Profiler.h"        // per-stage cycle counts
 #include <EEPROM.h>
+#include <IntervalTimer.h>
 
 //-----------EEPROM Definitions & Variables-----------------//
 int EEPROMAddress = 0;
 byte myID = EEPROM.read(EEPROMAddress);       // Slave address
 Mapping mapping(myID);                        // Map pins based on Slave ID
+int EEPROMGeometry = 1;                       // [ROWS] [PINS PER ROW] [LAYOUT]
+
+// Where our pins are in the display, set by SetDisplayGeometry()
+int displayOffset;                            // first display (zMap) index of our pins
+bool displayFlipped;                          // true if our pins are in reverse order
 
 // Switch ISR
 volatile bool switchStatus[6] = {false, false, false, false, false, false};
@@ -36,6 +46,35 @@ GenericSwitchISR switchISR[6] = { &Switch0_ISR, &Switch1_ISR, &Switch2_ISR,
                                   &Switch3_ISR, &Switch4_ISR, &Switch5_ISR
                                 };                          
 
+//----------RS485 receiver -----------//
+// RS485_protocol callbacks (bottom of the file), used by the receiver
+// below before the IDE's generated prototypes
+int fAvailable ();
+int fRead ();
+
+byte msgReceived[MAX_MSG_SIZE];               // RS485 msg buffer
+RS485Receiver rs485Receiver( fAvailable, fRead, msgReceived, MAX_MSG_SIZE );
+bool blockingReceive = false;                 // true to wait up to 8 ms for a msg with
+                                              // recvMsg, as loop() used to (for comparing)
+
+// Positions are staged until the master commits the frame, so every
+// pin of the display starts moving at the same time
+int stagedPos[NUM_MOTORS];                    // [pulses]
+unsigned int stagedDuration[NUM_MOTORS];      // [ms] keyframe duration, 0 to jump
+byte stagedMode[NUM_MOTORS];                  // TRAJ_LINEAR or TRAJ_CUBIC
+bool stagedPin[NUM_MOTORS] = {false, false, false, false, false, false};
+byte lastCommitSeq = 0;                       // sequence number of the last frame applied
+bool haveCommitSeq = false;                   // false until the first commit
+
+// Bus rate, set by the master with SET_BAUD
+byte linkRate = 0;                            // LINK_BAUD(linkRate)
+unsigned long lastMsgTime = 0;                // [ms] last good msg on the bus
+
+// Status reply, sent in our slot after a GET_STATUS
+bool statusPending = false;
+unsigned long statusRequestTime;              // [us]
+unsigned long statusDelay;                    // [us] start of our slot
+
 //----------ShapePins -----------//
 ShapePin pins[NUM_MOTORS] = {
   ShapePin ( 0, true, mapping.pin_motor[0], mapping.pin_motor[1],
@@ -52,6 +91,65 @@ ShapePin pins[NUM_MOTORS] = {
   mapping.pin_encoder[10], mapping.pin_encoder[11] )
 };
 
+//----------Control loop -----------//
+// The pins run in a timer ISR (CONTROL_RATE_HZ). loop() only talks
+// to them through these buffers.
+#define PIN_CMD_MOVE  0   // go to pos [pulses] over duration [ms], 0 to jump
+#define PIN_CMD_IDLE  1   // stop the pin
+#define PIN_CMD_ZERO  2   // re-zero the pin
+#define PIN_CMD_QUEUE 8   // commands waiting per pin (power of 2)
+
+typedef struct {
+  byte type;              // PIN_CMD_*
+  int pos;                // [pulses]
+  unsigned int duration;  // [ms]
+  byte mode;              // TRAJ_LINEAR or TRAJ_CUBIC
+} PinCommand;
+
+typedef struct {
+  int kp, ki, kd;
+  byte maxSpeed, minSpeed;   // duty cycle (0-255)
+  byte deadzone;             // [mm]
+  byte maxTravel;            // [mm]
+  bool enabled;
+  int profileSpeed;          // [mm/s], 0 for step targets
+  int profileAccel;          // [mm/s^2]
+} PinParams;
+
+typedef struct {
+  PinParams pin[NUM_MOTORS];
+} SlaveParams;            // published together so a SET_PARAMS lands on one step
+
+typedef struct {
+  int pos;                // [pulses]
+  byte flags;             // PinState_t | STATUS_SWITCH | STATUS_DISABLED
+  byte stallCount;
+  int8_t speed;           // [mm/s]
+} PinStatus;
+
+CommandQueue<PinCommand, PIN_CMD_QUEUE> pinCommands[NUM_MOTORS];  // loop() -> ISR, per pin
+DoubleBuffer<SlaveParams> paramsBuffer;                // loop() -> ISR, all pins
+DoubleBuffer<PinStatus> pinStatus[NUM_MOTORS];         // ISR -> loop(), per pin
+SlaveParams pinParams;                        // loop()'s copy of the parameters
+
+#if CONTROL_RATE_HZ
+IntervalTimer controlTimer;
+#endif
+
+//----------Profiling -----------//
+// Stages timed with PROFILE_SCOPE, read with GET_PROFILE or the 
+// serial PRINT_PROFILE command
+#define PROF_LOOP       0   // whole loop()
+#define PROF_READ_MSG   1   // readMSG()
+#define PROF_SWITCHES   2   // updateAnalogSwitches()
+#define PROF_STATUS     3   // sendStatus()
+#define PROF_CONTROL    4   // ControlStep(), in the timer ISR
+#define PROF_PERIOD     5   // time between control steps (jitter)
+#define PROF_NUM_STAGES 6
+const char * const profileNames[PROF_NUM_STAGES] = {
+  "loop", "readMSG", "switches", "status", "control", "period"
+};
+
 // Serial commands
 const int bytes2Read = 5;
 char inputArr[bytes2Read];  // store user input here     
@@ -68,16 +166,23 @@ const int singlePinSpeed = 255;
 #define MOVE_ALL_PINS   4
 #define STOP_ALL_PINS   5
 #define ZERO_ALL_PINS   6
+#define PRINT_PROFILE   7
+#define CLEAR_PROFILE   8
 
 void setup() {
   Serial.begin(115200);  
   Serial.setTimeout(2);
   delay(1000);
+  PROFILE_BEGIN();
   setupRS485();
+  LoadDisplayGeometry();
 
   // setup switches and interrupt
   setupSwitches();
 
+  // start running the pins
+  setupControlLoop();
+
   Serial.println("Shape Display Firmware v04: Slave");
   Serial.printf( "Slave ID: %d\n", myID);
   #if PULSES_3
@@ -91,14 +196,29 @@ void setup() {
 }
 
 void loop() {
+  PROFILE_SCOPE(PROF_LOOP);
+
   // read any messages from RS485
   readMSG();
 
+  // serial commands from the Serial Monitor
+  if ( Serial.available() > 0 ) {
+    readSerial();
+  }
+
   // analog switches need to be polled
   updateAnalogSwitches();
 
+#if !CONTROL_RATE_HZ
   // run the pins state machine
-  RunPinsSM();
+  ControlStep();
+#endif
+
+  // back to the base rate if the master can't reach us
+  checkLinkTimeout();
+
+  // reply to a status request once our slot comes
+  sendStatus();
 
 } //end loop
 
@@ -115,6 +235,8 @@ void loop() {
 //  - Move all pins: 4
 //  - Stop all pins: 5
 //  - Zero all pins: 6
+//  - Print the profiled stages: 7
+//  - Clear the profiled stages: 8
 void readSerial() {
   
     // read user input
@@ -144,13 +266,13 @@ void readSerial() {
           if ( pinNum >= 0 && pinNum < NUM_MOTORS ) {
             if (target == 1) {
               targetPos = 20;
-              pins[pinNum].CommandTargetPos(targetPos);
+              CommandPinPulses(pinNum, targetPos * MM_TO_PULSE);
             } else if (target == 2) {
               targetPos = 35;
-              pins[pinNum].CommandTargetPos(targetPos);
+              CommandPinPulses(pinNum, targetPos * MM_TO_PULSE);
             } else if (target == 3) {
               targetPos = 50;
-              pins[pinNum].CommandTargetPos(targetPos);
+              CommandPinPulses(pinNum, targetPos * MM_TO_PULSE);
             } 
             Serial.printf("pin %d, target %d\n", pinNum, targetPos);
           } else {
@@ -162,7 +284,7 @@ void readSerial() {
           token = strtok(NULL, delim);
           pinNum = atoi( token );
           if ( pinNum >= 0 && pinNum < NUM_MOTORS ) {
-            pins[pinNum].Idle();
+            PostPinCommand(pinNum, PIN_CMD_IDLE, 0, 0, TRAJ_LINEAR);
             Serial.printf("stop pin %d\n", pinNum);
           } else {
             Serial.printf("stop cmd for invalid pin num %d. Pin num should be between 0-5\n", pinNum);
@@ -172,7 +294,7 @@ void readSerial() {
           token = strtok(NULL, delim);
           pinNum = atoi( token );
           if ( pinNum >= 0 && pinNum < NUM_MOTORS ) {
-            pins[pinNum].Zero();
+            PostPinCommand(pinNum, PIN_CMD_ZERO, 0, 0, TRAJ_LINEAR);
             Serial.printf("zero pin %d\n", pinNum);
           } else {
             Serial.printf("zero cmd for invalid pin num %d. Pin num should be between 0-5\n", pinNum);
@@ -201,6 +323,13 @@ void readSerial() {
           ZeroPins();
           Serial.printf("zeroing all pins\n");
         break;
+        case PRINT_PROFILE:
+          profilePrint( profileNames, PROF_NUM_STAGES );
+        break;
+        case CLEAR_PROFILE:
+          profileClear();
+          Serial.printf("cleared profile\n");
+        break;
       }
       Serial.println("");
       Serial.flush();
@@ -208,35 +337,134 @@ void readSerial() {
   
 }
 
-// Command all pins
+// Command all pins [mm]
 void CommandPins ( int newPos ) {
   for (int i = 0; i < NUM_MOTORS; i++) {
-    pins[i].CommandTargetPos( newPos );
+    CommandPinPulses( i, newPos * MM_TO_PULSE );
   }
 }
 
 // Zero all pins
 void ZeroPins ( void ) {
   for (int i = 0; i < NUM_MOTORS; i++) {
-    pins[i].Zero();
+    PostPinCommand( i, PIN_CMD_ZERO, 0, 0, TRAJ_LINEAR );
   }
 }
 
 // Stop all pins
 void StopPins ( void ) {
   for (int i = 0; i < NUM_MOTORS; i++) {
-    pins[i].Idle();
+    PostPinCommand( i, PIN_CMD_IDLE, 0, 0, TRAJ_LINEAR );
+  }
+}
+
+//----------------------Control Loop Functions-----------------------
+// Start the pins with the default parameters and run them from 
+// the timer at CONTROL_RATE_HZ (or from loop() if it is 0)
+void setupControlLoop( void ) {
+  for (int i = 0; i < NUM_MOTORS; i++) {
+    pinParams.pin[i].kp = DEFAULT_KP;
+    pinParams.pin[i].ki = DEFAULT_KI;
+    pinParams.pin[i].kd = DEFAULT_KD;
+    pinParams.pin[i].maxSpeed = DEFAULT_SPEED;
+    pinParams.pin[i].minSpeed = DEFAULT_SPEED;
+    pinParams.pin[i].deadzone = DEFAULT_DEADZONE;
+    pinParams.pin[i].maxTravel = DEFAULT_MAX_TRAVEL;
+    pinParams.pin[i].enabled = true;
+    pinParams.pin[i].profileSpeed = DEFAULT_PROFILE_SPEED;
+    pinParams.pin[i].profileAccel = DEFAULT_PROFILE_ACCEL;
   }
+  PublishParams();
+  ControlStep();
+#if CONTROL_RATE_HZ
+  controlTimer.begin( ControlISR, CONTROL_PERIOD_US );
+#endif
 }
 
-// Run state machine for all pins
-void RunPinsSM ( void ) {
-  // run each pin's state machine
+#if CONTROL_RATE_HZ
+// Timer ISR, runs the pins. The spread of the PROF_PERIOD times
+// is the jitter of the control rate.
+void ControlISR( void ) {
+  PROFILE_MARK(PROF_PERIOD);
+  ControlStep();
+}
+#endif
+
+// One control step: apply what loop() sent, run each pin's state 
+// machine and publish the pin status for loop()
+void ControlStep( void ) {
+  PROFILE_SCOPE(PROF_CONTROL);
+  static SlaveParams params;
+  PinCommand command, next;
+  PinStatus status;
+  bool newParams = paramsBuffer.Take( params );
   for (int i = 0; i < NUM_MOTORS; i++) {
+    if ( newParams ) {
+      pins[i].SetTunings( params.pin[i].kp, params.pin[i].ki, params.pin[i].kd );
+      pins[i].SetMaxSpeed( params.pin[i].maxSpeed );
+      pins[i].SetMinSpeed( params.pin[i].minSpeed );
+      pins[i].SetDeadzone( params.pin[i].deadzone );
+      pins[i].SetMaxTravel( params.pin[i].maxTravel );
+      pins[i].SetProfile( params.pin[i].profileSpeed, params.pin[i].profileAccel );
+      if ( params.pin[i].enabled ) {
+        pins[i].EnableShapePin();
+      } else if ( pins[i].GetEnabled() ) {
+        pins[i].DisableShapePin();
+      }
+    }
+    // one command per step so a ZERO or IDLE gets a step of its own,
+    // but of back-to-back moves only the newest matters
+    if ( pinCommands[i].Pop(command) ) {
+      while ( command.type == PIN_CMD_MOVE && pinCommands[i].Peek(next) 
+              && next.type == PIN_CMD_MOVE ) {
+        pinCommands[i].Pop(command);
+      }
+      if ( command.type == PIN_CMD_IDLE ) {
+        pins[i].Idle();
+      } else if ( command.type == PIN_CMD_ZERO ) {
+        pins[i].Zero();
+      } else {
+        pins[i].CommandTrajectory( command.pos, command.duration, command.mode );
+      }
+    }
+
     pins[i].RunSM();
+
+    status.pos = pins[i].GetPosPulses();
+    status.flags = pins[i].GetState();
+    if ( pins[i].GetSwitchDown() ) {
+      status.flags |= STATUS_SWITCH;
+    }
+    if ( !pins[i].GetEnabled() ) {
+      status.flags |= STATUS_DISABLED;
+    }
+    status.stallCount = pins[i].GetStallCount();
+    status.speed = constrain( pins[i].GetSpeedMM(), -127, 127 );
+    pinStatus[i].Write( status );
   }
 }
 
+// Queue a command for one pin. If the pin's queue is full, wait 
+// for the control step to take one.
+void PostPinCommand( int pinNum, byte type, int pulses, unsigned int duration, byte mode ) {
+  PinCommand command;
+  command.type = type;
+  command.pos = pulses;
+  command.duration = duration;
+  command.mode = mode;
+  while ( !pinCommands[pinNum].Push( command ) ) {
+#if !CONTROL_RATE_HZ
+    ControlStep();
+#endif
+  }
+}
+
+// Send loop()'s copy of every pin's parameters to the control step,
+// which applies them all on the same step
+void PublishParams( void ) {
+  paramsBuffer.Write( pinParams );
+}
+
 //----------------------Switch Functions-----------------------
 void setupSwitches () {
   for (int i = 0; i < NUM_MOTORS; i++) {
@@ -264,6 +492,7 @@ void setupSwitches () {
 
 // For analog switches, need to manually call 'ISR function'
 void updateAnalogSwitches() {
+  PROFILE_SCOPE(PROF_SWITCHES);
   for (int i = 0; i < NUM_MOTORS; i++) {
     // If we're using an MCU with analog switches (MCU_ID is 0)
     if ((myID % 4 == 3) && ( (i == 0) || ((i == 4) || (i == 5)) ) ) {
@@ -277,19 +506,39 @@ void updateAnalogSwitches() {
 void setupRS485( void ) {
   pinMode(SSerialTxControl, OUTPUT);
   digitalWrite(SSerialTxControl, RS485Receive);  // Init Transceiver
-  RS485Serial.begin(1000000);
+  RS485Serial.begin(LINK_BAUD(0));
+}
+
+// Change the bus rate, once our last reply is out
+void SetLinkRate( byte rate ) {
+  RS485Serial.flush();
+  RS485Serial.begin(LINK_BAUD(rate));
+  rs485Receiver.reset();
+  linkRate = rate;
+  lastMsgTime = millis();
+}
+
+// Fall back to the base rate if no good msg came for LINK_TIMEOUT_MS,
+// the master does the same when we stop answering
+void checkLinkTimeout( void ) {
+  if ( linkRate != 0 && millis() - lastMsgTime > LINK_TIMEOUT_MS ) {
+    SetLinkRate( 0 );
+  }
 }
 
 // read messages sent through RS485
 void readMSG() {
-  byte msgReceived[MAX_MSG_SIZE]; // Create a buffer
-  byte receivedMsgLen = receiveMsg(msgReceived);
+  PROFILE_SCOPE(PROF_READ_MSG);
+  // only handles bytes that already arrived, never waits for the rest of a msg
+  unsigned int receivedMsgLen = receiveMsg();
 
   // declare variabless outside switch so compiler is happy
   int pinNum, newKp, newKi, newKd, newSpeed; 
   
   // Length of msg (length > 0 for real msg)
   if ( receivedMsgLen ) {
+    // any good msg means the bus rate works
+    lastMsgTime = millis();
     // Then parse the msg
     // First check if it's a msg for this device
     if ( (msgReceived[MSG_ADDR] != myID) && (msgReceived[MSG_ADDR] != UNIVERSAL_SLAVE_ID) ) {
@@ -297,7 +546,7 @@ void readMSG() {
       return; //return
 
       // Check it's a valid command
-    } else if ( msgReceived[MSG_CMD] < 245 ) {
+    } else if ( msgReceived[MSG_CMD] < GET_PROFILE ) {
       //Serial.println("Not a valid command.");
       return;
 
@@ -310,11 +559,106 @@ void readMSG() {
 
         case SET_POS:   // Set new setpoints
           //Serial.println("Set positions.");
-          for (int i = 0; i < NUM_MOTORS; i++) {
-            pins[i].CommandTargetPos( int( msgReceived[MSG_DATA + i] ) );
-            if ( i == 5 && myID%8 == 3 && msgReceived[MSG_DATA + i] > 30 ) {
-              pins[i].CommandTargetPos( 25 );
-            }
+          SetPinPositions( &msgReceived[MSG_DATA] );
+          break;
+
+        case SET_POS_ALL:   // Set new setpoints from the full display
+          // PACKET STRUCTURE
+          // [ID]  [CMD]  [zMap 0 ... DISPLAY_SIZE-1]
+          SetPinPositionsFromDisplay( &msgReceived[MSG_DATA], receivedMsgLen - MSG_DATA, 0 );
+          break;
+
+        case SET_POS_RANGE:   // Set new setpoints from the rows of our bus
+          // PACKET STRUCTURE
+          // [ID]  [CMD]  [START HIGH]  [START LOW]  [zMap START ...]
+          if ( receivedMsgLen > MSG_DATA + 2 ) {
+            SetPinPositionsFromDisplay( &msgReceived[MSG_DATA + 2], receivedMsgLen - MSG_DATA - 2,
+                                        (msgReceived[MSG_DATA] << 8) | msgReceived[MSG_DATA + 1] );
+          }
+          break;
+
+        case SET_POS_SPARSE:   // Set new setpoints for the pins that changed
+          // PACKET STRUCTURE
+          // [ID]  [CMD]  [INDEX HIGH]  [INDEX LOW]  [HEIGHT] ...
+          SetPinPositionsSparse( &msgReceived[MSG_DATA], receivedMsgLen - MSG_DATA );
+          break;
+
+        case SET_POS_PACKED:   // Set new setpoints from the bit packed full display
+          // PACKET STRUCTURE
+          // [ID]  [CMD]  [BITS]  [pin 0 ... DISPLAY_SIZE-1, MSB first]
+          if ( receivedMsgLen > MSG_DATA + 1 ) {
+            SetPinPositionsPacked( msgReceived[MSG_DATA], &msgReceived[MSG_DATA + 1], 
+                                   receivedMsgLen - MSG_DATA - 1, 0 );
+          }
+          break;
+
+        case SET_POS_PACKED_RANGE:   // Set new setpoints from the bit packed rows of our bus
+          // PACKET STRUCTURE
+          // [ID]  [CMD]  [BITS]  [START HIGH]  [START LOW]  [pin START ..., MSB first]
+          if ( receivedMsgLen > MSG_DATA + 3 ) {
+            SetPinPositionsPacked( msgReceived[MSG_DATA], &msgReceived[MSG_DATA + 3], receivedMsgLen - MSG_DATA - 3,
+                                   (msgReceived[MSG_DATA + 1] << 8) | msgReceived[MSG_DATA + 2] );
+          }
+          break;
+
+        case SET_TRAJ_ALL:   // Set keyframes for the rows of our bus
+          // PACKET STRUCTURE
+          // [ID]  [CMD]  [MODE]  [DURATION HIGH]  [DURATION LOW]  [START HIGH]  [START LOW]  [zMap START ...]
+          if ( receivedMsgLen > MSG_DATA + 5 ) {
+            SetPinTrajectoriesFromDisplay( &msgReceived[MSG_DATA], receivedMsgLen - MSG_DATA );
+          }
+          break;
+
+        case COMMIT_POS:  // Apply the staged positions
+          // PACKET STRUCTURE
+          // [ID]  [CMD]  [FRAME SEQ]
+          CommitPinPositions( msgReceived[MSG_DATA] );
+          break;
+
+        case GET_STATUS:  // Reply with our status in our slot
+          // PACKET STRUCTURE
+          // [ID]  [CMD]  [FIRST ID]  [COUNT]
+          if ( myID >= msgReceived[MSG_DATA] && myID < msgReceived[MSG_DATA] + msgReceived[MSG_DATA + 1] ) {
+            statusPending = true;
+            statusRequestTime = micros();
+            statusDelay = (unsigned long)(myID - msgReceived[MSG_DATA]) * STATUS_SLOT_US;
+          }
+          break;
+
+        case SET_PARAMS:  // Set all the pin parameters
+          // PACKET STRUCTURE
+          // [ID]  [CMD]  [PARAM BLOCK] (all pins)
+          // [ID]  [CMD]  [PARAM BLOCK PIN 0] ... [PARAM BLOCK PIN 5]
+          SetPinParams( &msgReceived[MSG_DATA], receivedMsgLen - MSG_DATA );
+          break;
+
+        case SET_GEOMETRY:  // Set the display geometry
+          // PACKET STRUCTURE
+          // [ID]  [CMD]  [ROWS]  [PINS PER ROW]  [LAYOUT]
+          // The master sends it when it boots and restarts its frame
+          // sequence, and staged positions are in the old layout
+          ClearStagedPositions();
+          if ( receivedMsgLen == MSG_DATA + 3 &&
+               SetDisplayGeometry( msgReceived[MSG_DATA], msgReceived[MSG_DATA + 1], msgReceived[MSG_DATA + 2] ) ) {
+            EEPROM.update( EEPROMGeometry, msgReceived[MSG_DATA] );
+            EEPROM.update( EEPROMGeometry + 1, msgReceived[MSG_DATA + 1] );
+            EEPROM.update( EEPROMGeometry + 2, msgReceived[MSG_DATA + 2] );
+          }
+          break;
+
+        case GET_PROFILE:  // Reply with one profiled stage
+          // PACKET STRUCTURE
+          // [ID]  [CMD]  [STAGE]  [CLEAR]
+          if ( msgReceived[MSG_ADDR] == myID && receivedMsgLen == MSG_DATA + 2 ) {
+            sendProfile( msgReceived[MSG_DATA], msgReceived[MSG_DATA + 1] );
+          }
+          break;
+
+        case SET_BAUD:  // Change the bus rate
+          // PACKET STRUCTURE
+          // [ID]  [CMD]  [RATE]
+          if ( msgReceived[MSG_DATA] < NUM_LINK_RATES ) {
+            SetLinkRate( msgReceived[MSG_DATA] );
           }
           break;
 
@@ -324,8 +668,12 @@ void readMSG() {
           // [ID]  [CMD]  [PIN#]  [KP]
 
           pinNum = int(msgReceived[MSG_DATA]);
+          if ( pinNum >= NUM_MOTORS ) {
+            break;
+          }
           newKp = int(msgReceived[MSG_DATA + 1]);		
-          pins[pinNum].SetKp(newKp); 
+          pinParams.pin[pinNum].kp = newKp;
+          PublishParams();
           break;
 
         case SET_KI:  // Set PID gains
@@ -333,8 +681,12 @@ void readMSG() {
           // [ID]  [CMD]  [PIN#]  [KI]
 
           pinNum = int(msgReceived[MSG_DATA]);
+          if ( pinNum >= NUM_MOTORS ) {
+            break;
+          }
           newKi = int(msgReceived[MSG_DATA + 1]);
-          pins[pinNum].SetKi(newKi); 
+          pinParams.pin[pinNum].ki = newKi;
+          PublishParams();
           break;
 
         case SET_KD:  // Set PID gains
@@ -342,24 +694,36 @@ void readMSG() {
           // [ID]  [CMD]  [PIN#]  [KD]
 
           pinNum = int(msgReceived[MSG_DATA]);
+          if ( pinNum >= NUM_MOTORS ) {
+            break;
+          }
           newKd = int(msgReceived[MSG_DATA + 1]);
-          pins[pinNum].SetKd(newKd); 
+          pinParams.pin[pinNum].kd = newKd;
+          PublishParams();
           break;
 
         case SET_MAXSPEED:
           //  PACKET STRUCTURE
           // [ID]  [CMD]  [PIN#]  [SPEED]
           pinNum = int(msgReceived[MSG_DATA]);
+          if ( pinNum >= NUM_MOTORS ) {
+            break;
+          }
           newSpeed = int(msgReceived[MSG_DATA + 1]);
-          pins[pinNum].SetMaxSpeed(newSpeed); 
+          pinParams.pin[pinNum].maxSpeed = newSpeed;
+          PublishParams();
           break;
 
         case SET_MINSPEED:
           //  PACKET STRUCTURE
           // [ID]  [CMD]  [PIN#]  [SPEED]
           pinNum = int(msgReceived[MSG_DATA]);
+          if ( pinNum >= NUM_MOTORS ) {
+            break;
+          }
           newSpeed = int(msgReceived[MSG_DATA + 1]);
-          pins[pinNum].SetMinSpeed(newSpeed); 
+          pinParams.pin[pinNum].minSpeed = newSpeed;
+          PublishParams();
           break;
 
         case DISABLE_PIN: 
@@ -367,29 +731,37 @@ void readMSG() {
           // [ID]  [CMD]  [PIN#]  [GARBAGE]
 
           pinNum = int(msgReceived[MSG_DATA]);
-          pins[pinNum].DisableShapePin(); 
+          if ( pinNum >= NUM_MOTORS ) {
+            break;
+          }
+          pinParams.pin[pinNum].enabled = false;
+          PublishParams();
           break;
 
         case ZERO_MOTORS:   // Re-zero motors
 //          Serial.println("Zeroing motors.");
+          ClearStagedPositions();
           ZeroPins();
           break;
 
         case STOP_MOTORS:   // Stop all motors
           //Serial.println("Stopping motors.");
+          ClearStagedPositions();
           StopPins();
           break;
 
         case SET_DEADZONE:
           for (int i = 0; i < NUM_MOTORS; i++) {
-            pins[i].SetDeadzone( int(msgReceived[MSG_DATA]) );
+            pinParams.pin[i].deadzone = msgReceived[MSG_DATA];
           }
+          PublishParams();
           break;
 
         case SET_MAX_TRAVEL:
           for (int i = 0; i < NUM_MOTORS; i++) {
-            pins[i].SetMaxTravel( int(msgReceived[MSG_DATA]) );
+            pinParams.pin[i].maxTravel = msgReceived[MSG_DATA];
           }
+          PublishParams();
         break;
 
       } //end switch
@@ -397,45 +769,308 @@ void readMSG() {
   } //endif msg received
 }
 
+// Apply SET_PARAMS blocks, either one block for all pins or one 
+// block per pin. Every pin is updated before the next control step.
+void SetPinParams( const byte *blocks, unsigned int len ) {
+  bool perPin;
+  if ( len == PARAM_BLOCK_SIZE ) {
+    perPin = false;
+  } else if ( len == PARAM_BLOCK_SIZE*NUM_MOTORS ) {
+    perPin = true;
+  } else {
+    return;
+  }
+  for (int i = 0; i < NUM_MOTORS; i++) {
+    const byte *block = perPin ? &blocks[i*PARAM_BLOCK_SIZE] : blocks;
+    pinParams.pin[i].kp = (block[0] << 8) | block[1];
+    pinParams.pin[i].ki = (block[2] << 8) | block[3];
+    pinParams.pin[i].kd = (block[4] << 8) | block[5];
+    pinParams.pin[i].maxSpeed = block[6];
+    pinParams.pin[i].minSpeed = block[7];
+    pinParams.pin[i].deadzone = block[8];
+    pinParams.pin[i].enabled = ( block[9] != 0 );
+    pinParams.pin[i].profileSpeed = (block[10] << 8) | block[11];
+    pinParams.pin[i].profileAccel = (block[12] << 8) | block[13];
+  }
+  PublishParams();
+}
+
+// Stage the 6 pins with positions in this slave's pin order
+void SetPinPositions( const byte *positions ) {
+  for (int i = 0; i < NUM_MOTORS; i++) {
+    StagePinPosition( i, positions[i] );
+  }
+}
+
+// Stage a new position [mm] for one pin, applied on the next commit
+void StagePinPosition( int pinNum, byte position ) {
+  StagePinPulses( pinNum, position * MM_TO_PULSE );
+}
+
+// Stage a new position [pulses] for one pin, applied on the next commit
+void StagePinPulses( int pinNum, int pulses ) {
+  stagedPos[pinNum] = pulses;
+  stagedDuration[pinNum] = 0;
+  stagedPin[pinNum] = true;
+}
+
+// Stage a keyframe for one pin: go to "pulses" over "duration" [ms]
+void StagePinTrajectory( int pinNum, int pulses, unsigned int duration, byte mode ) {
+  StagePinPulses( pinNum, pulses );
+  stagedDuration[pinNum] = duration;
+  stagedMode[pinNum] = mode;
+}
+
+// Apply the staged positions of frame "seq". Frames older than the
+// last one applied (out of order or repeated) are dropped.
+void CommitPinPositions( byte seq ) {
+  if ( haveCommitSeq && (int8_t)(seq - lastCommitSeq) <= 0 ) {
+    return;
+  }
+  lastCommitSeq = seq;
+  haveCommitSeq = true;
+  for (int i = 0; i < NUM_MOTORS; i++) {
+    if ( stagedPin[i] ) {
+      CommandPinTrajectory( i, stagedPos[i], stagedDuration[i], stagedMode[i] );
+      stagedPin[i] = false;
+    }
+  }
+}
+
+// Drop staged positions and wait for the master's next sequence
+void ClearStagedPositions( void ) {
+  for (int i = 0; i < NUM_MOTORS; i++) {
+    stagedPin[i] = false;
+  }
+  haveCommitSeq = false;
+}
+
+// Command one pin [pulses]
+void CommandPinPulses( int pinNum, int pulses ) {
+  CommandPinTrajectory( pinNum, pulses, 0, TRAJ_LINEAR );
+}
+
+// Command one pin to "pulses" over "duration" [ms], 0 to jump
+void CommandPinTrajectory( int pinNum, int pulses, unsigned int duration, byte mode ) {
+  if ( pinNum == 5 && myID%8 == 3 && pulses > 30 * MM_TO_PULSE ) {
+    pulses = 25 * MM_TO_PULSE;
+  }
+  PostPinCommand( pinNum, PIN_CMD_MOVE, pulses, duration, mode );
+}
+
+// Read the display geometry from EEPROM, use the default 12x24
+// display if it was never set
+void LoadDisplayGeometry( void ) {
+  if ( !SetDisplayGeometry( EEPROM.read(EEPROMGeometry), EEPROM.read(EEPROMGeometry + 1), 
+                            EEPROM.read(EEPROMGeometry + 2) ) ) {
+    SetDisplayGeometry( DISPLAY_SIZE_X, DISPLAY_SIZE_Z, LAYOUT_SERPENTINE );
+  }
+}
+
+// Work out where our pins are in a display of "rows" rows of 
+// "pinsPerRow" pins (same mapping the master uses).
+// Returns false (and keeps the old geometry) if it doesn't fit.
+bool SetDisplayGeometry( int rows, int pinsPerRow, int layout ) {
+  if ( rows < 1 || pinsPerRow < NUM_MOTORS || pinsPerRow % NUM_MOTORS != 0
+       || rows*pinsPerRow > MAX_DISPLAY_SIZE || layout > LAYOUT_SERPENTINE ) {
+    return false;
+  }
+  int slavesPerRow = pinsPerRow/NUM_MOTORS;
+  int row = myID/slavesPerRow;
+  int column = myID%slavesPerRow;
+  // Odd Row (back of half-module, flipped pin order)
+  displayFlipped = ( layout == LAYOUT_SERPENTINE && row%2 == 1 );
+  if ( displayFlipped ) {
+    column = slavesPerRow - 1 - column;
+  }
+  displayOffset = row*pinsPerRow + column*NUM_MOTORS;
+  return true;
+}
+
+// First display (zMap) index of this slave's pins; the 6 pins
+// are contiguous in the display
+int DisplayOffset( void ) {
+  return displayOffset;
+}
+
+// Pin number of a display (zMap) index, -1 if not one of our pins
+int DisplayIndexToPin( int index ) {
+  int offset = DisplayOffset();
+  if ( index < offset || index >= offset + NUM_MOTORS ) {
+    return -1;
+  }
+  // Even Row (front of half-module)
+  if ( !displayFlipped ) {
+    return index - offset;
+  }
+  // Odd Row (back of half-module, flipped pin order)
+  return NUM_MOTORS - 1 - (index - offset);
+}
+
+// Pick this slave's pins out of the display, zMap holds display 
+// indices start ... start+len-1 (0 ... for the full display)
+void SetPinPositionsFromDisplay( const byte *zMap, unsigned int len, int start ) {
+  int offset = DisplayOffset() - start;
+
+  // ignore frames that don't cover our pins
+  if ( offset < 0 || offset + NUM_MOTORS > (int)len ) {
+    return;
+  }
+  for (int index = offset; index < offset + NUM_MOTORS; index++) {
+    StagePinPosition( DisplayIndexToPin(index + start), zMap[index] );
+  }
+}
+
+// Pick this slave's keyframes out of a SET_TRAJ_ALL msg:
+// [MODE] [DURATION HIGH] [DURATION LOW] [START HIGH] [START LOW] [zMap START ...]
+void SetPinTrajectoriesFromDisplay( const byte *data, unsigned int len ) {
+  byte mode = data[0];
+  unsigned int duration = (data[1] << 8) | data[2];
+  int start = (data[3] << 8) | data[4];
+  const byte *zMap = &data[5];
+  int offset = DisplayOffset() - start;
+
+  // ignore frames that don't cover our pins
+  if ( offset < 0 || offset + NUM_MOTORS > (int)(len - 5) ) {
+    return;
+  }
+  for (int index = offset; index < offset + NUM_MOTORS; index++) {
+    StagePinTrajectory( DisplayIndexToPin(index + start), zMap[index] * MM_TO_PULSE, duration, mode );
+  }
+}
+
+// Unpack our pins from a bit packed display, "bits" per pin scaled
+// over POSITION_RANGE_MM, and stage them in pulses. packed holds 
+// display indices start ... (0 ... for the full display)
+void SetPinPositionsPacked( int bits, const byte *packed, unsigned int len, int start ) {
+  int offset = DisplayOffset() - start;
+
+  // ignore bad depths and frames that don't cover our pins
+  if ( offset < 0 || bits < 1 || bits > POS_FINE_BITS 
+       || (unsigned long)(offset + NUM_MOTORS) * bits > (unsigned long)len * 8 ) {
+    return;
+  }
+  unsigned int valueMax = (1 << bits) - 1;
+  for (int index = offset; index < offset + NUM_MOTORS; index++) {
+    unsigned long bitPos = (unsigned long)index * bits;
+    unsigned int value = 0;
+    for (int b = 0; b < bits; b++, bitPos++) {
+      value = (value << 1) | ((packed[bitPos >> 3] >> (7 - (bitPos & 7))) & 1);
+    }
+    StagePinPulses( DisplayIndexToPin(index + start), value * POSITION_RANGE_MM * MM_TO_PULSE / valueMax );
+  }
+}
+
+// Apply the (display index, height) entries that are for our pins
+void SetPinPositionsSparse( const byte *entries, unsigned int len ) {
+  for (unsigned int i = 0; i + 2 < len; i += 3) {
+    int pinNum = DisplayIndexToPin( (entries[i] << 8) | entries[i + 1] );
+    if ( pinNum >= 0 ) {
+      StagePinPosition( pinNum, entries[i + 2] );
+    }
+  }
+}
+
+// Send our status to the master once our reply slot starts
+//    PACKET STRUCTURE
+//    [MASTER_ID]  [PIN_STATUS]  [ID]  [RX ERRORS HIGH]  [RX ERRORS LOW]
+//    then for each pin:
+//    [POS HIGH]  [POS LOW]  [STATE | FLAGS]  [STALL COUNT]  [SPEED]
+//    position is in pulses, state is PinState_t with STATUS_SWITCH 
+//    and STATUS_DISABLED flags, speed is signed in mm/s
+void sendStatus() {
+  if ( !statusPending || (micros() - statusRequestTime) < statusDelay ) {
+    return;
+  }
+  PROFILE_SCOPE(PROF_STATUS);
+  statusPending = false;
+
+  byte msg[STATUS_LENGTH];
+  unsigned int errors = rs485Receiver.getErrors();
+  int len = 0;
+  msg[len++] = MASTER_ID;
+  msg[len++] = PIN_STATUS;
+  msg[len++] = myID;
+  msg[len++] = errors >> 8;
+  msg[len++] = errors & 0xFF;
+  for (int i = 0; i < NUM_MOTORS; i++) {
+    PinStatus status;
+    pinStatus[i].Read( status );
+    msg[len++] = (status.pos >> 8) & 0xFF;
+    msg[len++] = status.pos & 0xFF;
+    msg[len++] = status.flags;
+    msg[len++] = status.stallCount;
+    msg[len++] = (byte)status.speed;
+  }
+  sendMsg( msg, len );
+}
+
+// Send one profiled stage to the master (asked for this slave only,
+// so we reply right away), zero it after if clear is set
+//    PACKET STRUCTURE
+//    [MASTER_ID]  [PROFILE_DATA]  [ID]  [profilePack() block]
+void sendProfile( byte stage, byte clear ) {
+  byte msg[PROFILE_LENGTH];
+  msg[MSG_ADDR] = MASTER_ID;
+  msg[MSG_CMD] = PROFILE_DATA;
+  msg[MSG_DATA] = myID;
+  if ( profilePack( stage, PROF_NUM_STAGES, &msg[MSG_DATA + 1] ) == 0 ) {
+    return;
+  }
+  if ( clear ) {
+    profileClear( stage );
+  }
+  sendMsg( msg, PROFILE_LENGTH );
+}
+
 /*
     receiveMsg
 
     Description
-      Receives RS485 message and saves it to
-      the passed in byte array buffer
+      Feeds the bytes waiting in the RS485 serial
+      buffer to the receiver and returns right away
+      (with blockingReceive, waits for a whole msg).
+      A complete msg is left in msgReceived
 
     Parameters
-      Byte array where the received msg will
-      be stored
+      None
 
     Returns
-      0 if it was nothing, otherwise returns
+      0 if no complete msg yet, otherwise returns
       length of msg received
 
 */
-byte receiveMsg(byte *msgBuffer) {
-  //  return recvMsg (fAvailable, fRead, msgBuffer, sizeof msgBuffer);
-  return recvMsg (fAvailable, fRead, msgBuffer, MSG_LENGTH, 8);
+unsigned int receiveMsg( void ) {
+  if ( blockingReceive ) {
+    return recvMsg (fAvailable, fRead, msgReceived, MAX_MSG_SIZE, 8);
+  }
+  if ( rs485Receiver.update() ) {
+    return rs485Receiver.getLength();
+  }
+  return 0;
 }
 
 /*
     sendMsg
 
     Description
-      Sends RS485 message from Master
+      Sends RS485 message to the Master
 
     Parameters
       Message to send as a byte array
+      Length of the message to send
 
     Returns
       None
 
 */
-void sendMsg( byte* msg ) {
+void sendMsg( byte* msg, int len ) {
+  static byte encoded[RS485_ENCODED_SIZE(STATUS_LENGTH > PROFILE_LENGTH ? STATUS_LENGTH : PROFILE_LENGTH)];
+  unsigned int encodedLen = encodeMsg( msg, len, encoded, sizeof encoded );
   // Enable the transmit pin
   RS485Serial.transmitterEnable(SSerialTxControl);
-  // Send the message
-  sendMsg (fWrite, msg, sizeof msg);
+  // Queue the whole message, sent by the UART interrupt
+  RS485Serial.write( encoded, encodedLen );
 }
 
 /*